@@ -0,0 +1,92 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#define HIST_DEFAULT_CAP 4096
+
+
+static void usage() {
+    fprintf(stderr,
+            "Usage: bench load [options]   drive a running server\n"
+            "       bench micro [name...]  run in-process microbenchmarks\n"
+            "\n"
+            "load options:\n"
+            "  -h <host>      server host (default 127.0.0.1)\n"
+            "  -p <port>      server port (default 6379)\n"
+            "  -s <socket>    server Unix socket, overrides -h and -p\n"
+            "  -c <clients>   concurrent connections (default 50)\n"
+            "  -n <requests>  requests per test (default 100000)\n"
+            "  -P <depth>     pipeline depth (default 1)\n"
+            "  -r <keyspace>  number of distinct keys (default 10000)\n"
+            "  -d <bytes>     value size of SET / LPUSH (default 3)\n"
+            "  -t <tests>     comma list run one by one, ping is also known "
+            "(default set,get,incr,lpush,zadd)\n"
+            "  -m <mix>       single weighted mix test, e.g. get:80,set:20\n"
+            "  -T <seconds>   abort a test when no reply arrives for this long "
+            "(default 10)\n");
+}
+
+int main(int argc, char** argv) {
+    setbuf(stdout, NULL);
+
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    if (strcmp(argv[1], "load") == 0) {
+        return load_main(argc - 1, argv + 1);
+    }
+    if (strcmp(argv[1], "micro") == 0) {
+        return micro_main(argc - 1, argv + 1);
+    }
+
+    usage();
+    return 1;
+}
+
+int32_t hist_add(struct latency_hist_t* h, uint32_t us) {
+    if (h->count == h->cap) {
+        uint64_t cap = h->cap == 0 ? HIST_DEFAULT_CAP : h->cap * 2;
+        uint32_t* try = realloc(h->samples_us, cap * sizeof(uint32_t));
+        if (try == NULL) {
+            return -1;
+        }
+        h->samples_us = try;
+        h->cap = cap;
+    }
+    h->samples_us[h->count++] = us;
+    return 0;
+}
+
+static int cmp_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+void hist_report(struct latency_hist_t* h) {
+    if (h->count == 0) {
+        printf("  latency: no samples\n");
+        return;
+    }
+
+    qsort(h->samples_us, h->count, sizeof(uint32_t), cmp_u32);
+
+    static const double pcts[] = { 50.0, 90.0, 99.0, 99.9 };
+    printf("  latency (ms):");
+    for (uint32_t i = 0; i < sizeof pcts / sizeof pcts[0]; i++) {
+        uint64_t idx = (uint64_t) (pcts[i] / 100.0 * (h->count - 1));
+        printf(" p%g=%.3f", pcts[i], h->samples_us[idx] / 1000.0);
+    }
+    printf(" max=%.3f\n", h->samples_us[h->count - 1] / 1000.0);
+}
+
+void hist_free(struct latency_hist_t* h) {
+    free(h->samples_us);
+    h->samples_us = NULL;
+    h->count = h->cap = 0;
+}
@@ -0,0 +1,36 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+
+struct latency_hist_t {
+    uint64_t  count;
+    uint64_t  cap;
+    uint32_t* samples_us;
+};
+
+
+static inline uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int32_t hist_add(struct latency_hist_t*, uint32_t);
+
+void hist_report(struct latency_hist_t*);
+
+void hist_free(struct latency_hist_t*);
+
+/**
+ * Entry points of the sub commands. argv[0] is the sub command name.
+ *
+ * `bench load`:  drive a running server over TCP
+ * `bench micro`: in-process hot path microbenchmarks
+ * */
+int32_t load_main(int32_t, char**);
+int32_t micro_main(int32_t, char**);
+
+#endif // !BENCH_H
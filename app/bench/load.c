@@ -0,0 +1,531 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../event_loop.h"
+#include "bench.h"
+
+#define LOAD_MAX_CMDS  8
+#define LOAD_RBUF_SIZE (64 * 1024)
+
+
+typedef int32_t (*format_cmd_t)(char*, uint32_t, uint64_t, const char*,
+        uint32_t);
+
+struct load_cmd_t {
+    const char*  name;
+    format_cmd_t format;
+    uint32_t     weight;
+};
+
+struct load_opts_t {
+    const char* host;
+    const char* port;
+    const char* socket;   // Unix socket path, overrides host and port
+    uint32_t    clients;
+    uint64_t    requests;
+    uint32_t    pipeline;
+    uint32_t    keyspace;
+    uint32_t    value_size;
+    const char* tests;
+    const char* mix;
+    uint32_t    timeout_s;
+};
+
+struct load_run_t {
+    struct load_opts_t*   opts;
+    struct load_cmd_t     cmds[LOAD_MAX_CMDS];
+    uint32_t              ncmds;
+    uint32_t              total_weight;
+    uint64_t              issued;
+    uint64_t              completed;
+    uint64_t              errors;
+    uint64_t              rng;
+    uint64_t              last_progress_ns;
+    char*                 value;
+    struct latency_hist_t hist;
+    struct event_loop_t*  el;
+};
+
+struct load_client_t {
+    int32_t            fd;
+    uint32_t           pending;     // replies outstanding for current batch
+    uint32_t           batch_size;
+    uint64_t           batch_start_ns;
+    char*              wbuf;
+    uint32_t           wcap;
+    char*              rbuf;
+    uint32_t           rlen;
+    uint32_t           rcap;
+    struct load_run_t* run;
+};
+
+
+static int32_t format_ping(char* buf, uint32_t cap, uint64_t key,
+        const char* value, uint32_t vlen) {
+    return snprintf(buf, cap, "*1\r\n$4\r\nPING\r\n");
+}
+
+static int32_t format_get(char* buf, uint32_t cap, uint64_t key,
+        const char* value, uint32_t vlen) {
+    return snprintf(buf, cap, "*2\r\n$3\r\nGET\r\n$16\r\nkey:%012lu\r\n",
+            (unsigned long) key);
+}
+
+static int32_t format_set(char* buf, uint32_t cap, uint64_t key,
+        const char* value, uint32_t vlen) {
+    return snprintf(buf, cap, "*3\r\n$3\r\nSET\r\n$16\r\nkey:%012lu\r\n"
+            "$%u\r\n%s\r\n", (unsigned long) key, vlen, value);
+}
+
+static int32_t format_incr(char* buf, uint32_t cap, uint64_t key,
+        const char* value, uint32_t vlen) {
+    return snprintf(buf, cap, "*2\r\n$4\r\nINCR\r\n$20\r\ncounter:%012lu\r\n",
+            (unsigned long) key);
+}
+
+static int32_t format_lpush(char* buf, uint32_t cap, uint64_t key,
+        const char* value, uint32_t vlen) {
+    return snprintf(buf, cap, "*3\r\n$5\r\nLPUSH\r\n$19\r\nmylist:%012lu\r\n"
+            "$%u\r\n%s\r\n", (unsigned long) key, vlen, value);
+}
+
+static int32_t format_zadd(char* buf, uint32_t cap, uint64_t key,
+        const char* value, uint32_t vlen) {
+    return snprintf(buf, cap, "*4\r\n$4\r\nZADD\r\n$6\r\nmyzset\r\n"
+            "$%u\r\n%u\r\n$19\r\nmember:%012lu\r\n",
+            snprintf(NULL, 0, "%u", (uint32_t) key), (uint32_t) key,
+            (unsigned long) key);
+}
+
+static const struct load_cmd_t known_cmds[] = {
+    { "ping",  format_ping,  1 },
+    { "get",   format_get,   1 },
+    { "set",   format_set,   1 },
+    { "incr",  format_incr,  1 },
+    { "lpush", format_lpush, 1 },
+    { "zadd",  format_zadd,  1 },
+};
+
+static const struct load_cmd_t* find_cmd(const char* name, uint32_t len) {
+    for (uint32_t i = 0; i < sizeof known_cmds / sizeof known_cmds[0]; i++) {
+        if (strlen(known_cmds[i].name) == len &&
+                strncasecmp(known_cmds[i].name, name, len) == 0) {
+            return &known_cmds[i];
+        }
+    }
+    return NULL;
+}
+
+static uint64_t next_rand(struct load_run_t* run) {
+    run->rng ^= run->rng << 13;
+    run->rng ^= run->rng >> 7;
+    run->rng ^= run->rng << 17;
+    return run->rng;
+}
+
+/**
+ * Return bytes consumed by one complete RESP reply starting at `buf`, 0 when
+ * the reply is incomplete, -1 on protocol error.
+ * */
+static int64_t parse_reply(const char* buf, uint64_t len, int32_t* is_err) {
+    if (len < 3) return 0;
+
+    const char* crlf = memchr(buf, '\r', len);
+    if (crlf == NULL || (uint64_t) (crlf - buf) + 2 > len) return 0;
+
+    uint64_t line = crlf - buf + 2;
+    int64_t n = 0;
+
+    switch (buf[0]) {
+    case '-':
+        *is_err = 1;
+        /* fallthrough */
+    case '+':
+    case ':':
+        return line;
+    case '$':
+        n = strtoll(buf + 1, NULL, 10);
+        if (n < 0) return line;
+        if (line + n + 2 > len) return 0;
+        return line + n + 2;
+    case '*': {
+        n = strtoll(buf + 1, NULL, 10);
+        uint64_t off = line;
+        for (int64_t i = 0; i < n; i++) {
+            int64_t sub = parse_reply(buf + off, len - off, is_err);
+            if (sub <= 0) return sub;
+            off += sub;
+        }
+        return off;
+    }
+    default:
+        return -1;
+    }
+}
+
+static int32_t write_all(int32_t fd, const char* buf, uint32_t len) {
+    ssize_t nwritten = 0;
+    while (len > 0) {
+        if ((nwritten = write(fd, buf, len)) == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return -1;
+        }
+        buf += nwritten;
+        len -= nwritten;
+    }
+    return 0;
+}
+
+static const struct load_cmd_t* pick_cmd(struct load_run_t* run) {
+    if (run->ncmds == 1) return &run->cmds[0];
+
+    uint32_t w = next_rand(run) % run->total_weight;
+    for (uint32_t i = 0; i < run->ncmds; i++) {
+        if (w < run->cmds[i].weight) return &run->cmds[i];
+        w -= run->cmds[i].weight;
+    }
+    return &run->cmds[run->ncmds - 1];
+}
+
+/** Send the next pipeline of commands. Return 0 when nothing is left */
+static int32_t issue_batch(struct load_client_t* c) {
+    struct load_run_t* run = c->run;
+    struct load_opts_t* opts = run->opts;
+
+    uint64_t left = opts->requests - run->issued;
+    if (left == 0) return 0;
+
+    uint32_t batch = left < opts->pipeline ? left : opts->pipeline;
+    uint32_t wlen = 0;
+    for (uint32_t i = 0; i < batch; i++) {
+        const struct load_cmd_t* cmd = pick_cmd(run);
+        wlen += cmd->format(c->wbuf + wlen, c->wcap - wlen,
+                next_rand(run) % opts->keyspace, run->value, opts->value_size);
+    }
+
+    c->batch_size = c->pending = batch;
+    c->batch_start_ns = now_ns();
+    run->issued += batch;
+
+    if (write_all(c->fd, c->wbuf, wlen) == -1) {
+        fprintf(stderr, "client %d write error: %s\n", c->fd, strerror(errno));
+        run->el->stop = 1;
+        return -1;
+    }
+
+    return batch;
+}
+
+static void load_read_handle(struct event_loop_t* el, int32_t fd, void* data) {
+    struct load_client_t* c = data;
+    struct load_run_t* run = c->run;
+
+    if (c->rlen == c->rcap) {
+        char* try = realloc(c->rbuf, c->rcap * 2);
+        if (try == NULL) {
+            fprintf(stderr, "client %d: reply buffer realloc error\n", fd);
+            el->stop = 1;
+            return;
+        }
+        c->rbuf = try;
+        c->rcap *= 2;
+    }
+
+    ssize_t nread = read(fd, c->rbuf + c->rlen, c->rcap - c->rlen);
+    if (nread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (nread <= 0) {
+        fprintf(stderr, "client %d: connection lost (%s)\n", fd,
+                nread == 0 ? "EOF" : strerror(errno));
+        el->stop = 1;
+        return;
+    }
+    c->rlen += nread;
+
+    uint32_t off = 0;
+    int64_t consumed = 0;
+    int32_t is_err = 0;
+    while (c->pending > 0 &&
+            (consumed = parse_reply(c->rbuf + off, c->rlen - off, &is_err)) > 0) {
+        off += consumed;
+        c->pending--;
+        run->completed++;
+        run->errors += is_err;
+        is_err = 0;
+    }
+    if (consumed == -1) {
+        fprintf(stderr, "client %d: protocol error\n", fd);
+        el->stop = 1;
+        return;
+    }
+
+    memmove(c->rbuf, c->rbuf + off, c->rlen - off);
+    c->rlen -= off;
+
+    if (off > 0) {
+        run->last_progress_ns = now_ns();
+    }
+
+    if (c->pending > 0) return;
+
+    uint32_t us = (run->last_progress_ns - c->batch_start_ns) / 1000;
+    for (uint32_t i = 0; i < c->batch_size; i++) {
+        hist_add(&run->hist, us);
+    }
+
+    if (run->completed == run->opts->requests) {
+        el->stop = 1;
+        return;
+    }
+
+    issue_batch(c);
+}
+
+static int32_t connect_unix(const char* path) {
+    struct sockaddr_un sa = { 0 };
+    int32_t fd = -1;
+
+    if (strlen(path) >= sizeof sa.sun_path) {
+        fprintf(stderr, "socket path %s is too long\n", path);
+        return -1;
+    }
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+            connect(fd, (struct sockaddr*) &sa, sizeof sa) == -1) {
+        fprintf(stderr, "connect %s error: %s\n", path, strerror(errno));
+        if (fd != -1) close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+static int32_t connect_client(struct load_opts_t* opts) {
+    if (opts->socket != NULL) return connect_unix(opts->socket);
+
+    struct addrinfo hints = { 0 };
+    struct addrinfo* res = NULL;
+    int32_t fd = -1;
+    int32_t rcode = -1;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ((rcode = getaddrinfo(opts->host, opts->port, &hints, &res)) != 0) {
+        fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(rcode));
+        return -1;
+    }
+
+    for (struct addrinfo* ai = res; ai; ai = ai->ai_next) {
+        if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol))
+                == -1) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd == -1) {
+        fprintf(stderr, "connect %s:%s error: %s\n", opts->host, opts->port,
+                strerror(errno));
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+/** Parse "get,set" or "get:80,set:20" into run->cmds */
+static int32_t parse_cmd_list(struct load_run_t* run, const char* list) {
+    const char* p = list;
+    run->ncmds = 0;
+    run->total_weight = 0;
+
+    while (*p) {
+        uint32_t len = strcspn(p, ":,");
+        const struct load_cmd_t* cmd = find_cmd(p, len);
+        if (cmd == NULL || run->ncmds == LOAD_MAX_CMDS) {
+            fprintf(stderr, "unknown or too many commands in '%s'\n", list);
+            return -1;
+        }
+
+        run->cmds[run->ncmds] = *cmd;
+        p += len;
+        if (*p == ':') {
+            run->cmds[run->ncmds].weight = strtoul(p + 1, (char**) &p, 10);
+        }
+        run->total_weight += run->cmds[run->ncmds].weight;
+        run->ncmds++;
+
+        if (*p == ',') p++;
+    }
+
+    return run->total_weight > 0 ? 0 : -1;
+}
+
+static int32_t run_test(struct load_opts_t* opts, const char* label,
+        const char* cmd_list, char* value) {
+    struct load_run_t run = { 0 };
+    struct load_client_t* clients = NULL;
+    int32_t rval = 1;
+
+    run.opts = opts;
+    run.rng = 0x9E3779B97F4A7C15ULL;
+    run.value = value;
+
+    if (parse_cmd_list(&run, cmd_list) == -1) return 1;
+
+    /** Pre-size so the loop never resizes while clients are registered */
+    if ((run.el = create_event_loop(opts->clients + 64, EL_BACKEND_EPOLL))
+            == NULL) {
+        return 1;
+    }
+
+    if ((clients = calloc(opts->clients, sizeof(struct load_client_t)))
+            == NULL) {
+        goto cleanup;
+    }
+
+    uint32_t wcap = opts->pipeline * (opts->value_size + 128);
+    for (uint32_t i = 0; i < opts->clients; i++) {
+        struct load_client_t* c = &clients[i];
+        c->run = &run;
+        c->wcap = wcap;
+        c->rcap = LOAD_RBUF_SIZE;
+        if ((c->fd = connect_client(opts)) == -1 ||
+                (c->wbuf = malloc(wcap)) == NULL ||
+                (c->rbuf = malloc(LOAD_RBUF_SIZE)) == NULL ||
+                register_event(run.el, c->fd, E_READABLE, load_read_handle, c)
+                != OK) {
+            goto cleanup;
+        }
+    }
+
+    uint64_t start = now_ns();
+    run.last_progress_ns = start;
+    for (uint32_t i = 0; i < opts->clients; i++) {
+        if (issue_batch(&clients[i]) == -1) goto cleanup;
+    }
+
+    while (!run.el->stop) {
+        if (process_events(run.el) < 0) goto cleanup;
+
+        if (now_ns() - run.last_progress_ns > opts->timeout_s * 1000000000ULL) {
+            fprintf(stderr, "%s: no reply for %us, aborting "
+                    "(%lu/%lu completed)\n", label, opts->timeout_s,
+                    (unsigned long) run.completed,
+                    (unsigned long) opts->requests);
+            break;
+        }
+    }
+
+    double elapsed = (now_ns() - start) / 1e9;
+    printf("====== %s ======\n", label);
+    printf("  %lu requests completed in %.2f seconds, %u clients, "
+            "pipeline %u, %u byte values\n", (unsigned long) run.completed,
+            elapsed, opts->clients, opts->pipeline, opts->value_size);
+    printf("  throughput: %.2f requests per second\n", run.completed / elapsed);
+    if (run.errors > 0) {
+        printf("  error replies: %lu\n", (unsigned long) run.errors);
+    }
+    hist_report(&run.hist);
+
+    rval = run.completed == opts->requests ? 0 : 1;
+
+cleanup:
+    if (clients != NULL) {
+        for (uint32_t i = 0; i < opts->clients; i++) {
+            if (clients[i].fd > 0) close(clients[i].fd);
+            free(clients[i].wbuf);
+            free(clients[i].rbuf);
+        }
+        free(clients);
+    }
+    hist_free(&run.hist);
+    free_event_loop(run.el);
+
+    return rval;
+}
+
+int32_t load_main(int32_t argc, char** argv) {
+    struct load_opts_t opts = {
+        .host       = "127.0.0.1",
+        .port       = "6379",
+        .socket     = NULL,
+        .clients    = 50,
+        .requests   = 100000,
+        .pipeline   = 1,
+        .keyspace   = 10000,
+        .value_size = 3,
+        .tests      = "set,get,incr,lpush,zadd",
+        .mix        = NULL,
+        .timeout_s  = 10,
+    };
+
+    int32_t opt = -1;
+    while ((opt = getopt(argc, argv, "h:p:s:c:n:P:r:d:t:m:T:")) != -1) {
+        switch (opt) {
+        case 'h': opts.host = optarg; break;
+        case 'p': opts.port = optarg; break;
+        case 's': opts.socket = optarg; break;
+        case 'c': opts.clients = strtoul(optarg, NULL, 10); break;
+        case 'n': opts.requests = strtoull(optarg, NULL, 10); break;
+        case 'P': opts.pipeline = strtoul(optarg, NULL, 10); break;
+        case 'r': opts.keyspace = strtoul(optarg, NULL, 10); break;
+        case 'd': opts.value_size = strtoul(optarg, NULL, 10); break;
+        case 't': opts.tests = optarg; break;
+        case 'm': opts.mix = optarg; break;
+        case 'T': opts.timeout_s = strtoul(optarg, NULL, 10); break;
+        default:
+            return 1;
+        }
+    }
+
+    if (opts.clients == 0 || opts.pipeline == 0 || opts.keyspace == 0 ||
+            opts.requests == 0) {
+        fprintf(stderr, "-c, -P, -r and -n must be positive\n");
+        return 1;
+    }
+
+    char* value = malloc(opts.value_size + 1);
+    if (value == NULL) return 1;
+    memset(value, 'x', opts.value_size);
+    value[opts.value_size] = '\0';
+
+    int32_t rval = 0;
+    if (opts.mix != NULL) {
+        rval = run_test(&opts, opts.mix, opts.mix, value);
+    } else {
+        char* tests = strdup(opts.tests);
+        char* save = NULL;
+        for (char* t = strtok_r(tests, ",", &save); t != NULL;
+                t = strtok_r(NULL, ",", &save)) {
+            rval |= run_test(&opts, t, t, value);
+        }
+        free(tests);
+    }
+
+    free(value);
+
+    return rval;
+}
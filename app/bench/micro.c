@@ -0,0 +1,939 @@
+#include <arpa/inet.h>
+#include <malloc.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../bitops.h"
+#include "../config.h"
+#include "../dict.h"
+#include "../event_loop.h"
+#include "../hll.h"
+#include "../object.h"
+#include "../resp.h"
+#include "../stream.h"
+#include "../thread_pool.h"
+#include "bench.h"
+
+#define MICRO_PIPES        128
+#define MICRO_LOOP_ITERS   2000
+#define MICRO_REGISTER_OPS 1000000
+#define MICRO_POOL_JOBS    200000
+#define MICRO_GROW_FDS     512
+#define MICRO_GROW_ROUNDS  200
+#define MICRO_ECHO_CONNS   64
+#define MICRO_ECHO_ROUNDS  200000
+#define MICRO_ECHO_MSG     32
+#define MICRO_CRLF_BUF     (64 * 1024)
+#define MICRO_CRLF_ROUNDS  20000
+#define MICRO_PARSE_CMDS   4096
+#define MICRO_PARSE_ROUNDS 200
+#define MICRO_DICT_KEYS    1000000
+#define MICRO_OBJ_KEYS     1000000
+#define MICRO_POPCNT_BUF   (256 * 1024)
+#define MICRO_POPCNT_ROUNDS 10000
+#define MICRO_BITOP_SRCS   4
+#define MICRO_BITOP_BUF    (16 * 1024 * 1024)
+#define MICRO_BITOP_ROUNDS 20
+#define MICRO_BITOP_TILE   (16 * 1024) // as BITOP_TILE_BYTES
+#define MICRO_HLL_KEYS     64
+#define MICRO_HLL_ROUNDS   2000
+#define MICRO_STREAM_ENTRIES 1000000
+
+
+typedef void (*micro_fn_t)();
+
+struct micro_bench_t {
+    const char* name;
+    const char* desc;
+    micro_fn_t  fn;
+};
+
+
+static void report(const char* name, uint64_t ops, uint64_t elapsed_ns) {
+    printf("%-24s %10lu ops %10.1f ns/op %10.3f Mops/s\n", name,
+            (unsigned long) ops, (double) elapsed_ns / ops,
+            ops * 1e3 / elapsed_ns);
+}
+
+/** Re-arms its own pipe so every registered fd fires on every iteration */
+static void pipe_echo_handle(struct event_loop_t* el, int32_t fd, void* data) {
+    char c;
+    int32_t wfd = (int32_t) (intptr_t) data;
+    if (read(fd, &c, 1) == 1) {
+        write(wfd, &c, 1);
+    }
+}
+
+static void bench_event_loop_dispatch() {
+    int32_t pipes[MICRO_PIPES][2];
+    struct event_loop_t* el = create_event_loop(MICRO_PIPES * 2 + 64, EL_BACKEND_POLL);
+    if (el == NULL) return;
+
+    for (uint32_t i = 0; i < MICRO_PIPES; i++) {
+        if (pipe(pipes[i]) == -1) {
+            perror("pipe");
+            return;
+        }
+        register_event(el, pipes[i][0], E_READABLE, pipe_echo_handle,
+                (void*) (intptr_t) pipes[i][1]);
+        write(pipes[i][1], "x", 1);
+    }
+
+    uint64_t events = 0;
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < MICRO_LOOP_ITERS; i++) {
+        int32_t n = process_events(el);
+        if (n < 0) break;
+        events += n;
+    }
+    report("event_loop.dispatch", events, now_ns() - start);
+
+    for (uint32_t i = 0; i < MICRO_PIPES; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+    free_event_loop(el);
+}
+
+static void bench_event_loop_register() {
+    int32_t churn[2];
+    struct event_loop_t* el = create_event_loop(DEFAULT_FDS_CAP, EL_BACKEND_POLL);
+    if (el == NULL) return;
+
+    if (pipe(churn) == -1) {
+        perror("pipe");
+        return;
+    }
+
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < MICRO_REGISTER_OPS; i++) {
+        register_event(el, churn[0], E_READABLE, pipe_echo_handle, NULL);
+        unregister_event(el, churn[0], E_READABLE);
+    }
+    report("event_loop.register", MICRO_REGISTER_OPS * 2ULL, now_ns() - start);
+
+    close(churn[0]);
+    close(churn[1]);
+    free_event_loop(el);
+}
+
+/** Register a storm of fds into a tiny loop so the fd table keeps growing */
+static void bench_event_loop_grow() {
+    int32_t fds[MICRO_GROW_FDS];
+    int32_t p[2];
+    if (pipe(p) == -1) {
+        perror("pipe");
+        return;
+    }
+
+    uint32_t nfds = 0;
+    for (; nfds < MICRO_GROW_FDS; nfds++) {
+        if ((fds[nfds] = dup(p[0])) == -1) break;
+    }
+
+    uint64_t start = now_ns();
+    for (uint32_t r = 0; r < MICRO_GROW_ROUNDS; r++) {
+        struct event_loop_t* el = create_event_loop(4, EL_BACKEND_POLL);
+        if (el == NULL) break;
+        for (uint32_t i = 0; i < nfds; i++) {
+            register_event(el, fds[i], E_READABLE, pipe_echo_handle, NULL);
+        }
+        if (el->nfds != nfds) {
+            printf("event_loop.grow: lost registrations (%u of %u)\n",
+                    el->nfds, nfds);
+        }
+        free_event_loop(el);
+    }
+    report("event_loop.grow", (uint64_t) nfds * MICRO_GROW_ROUNDS,
+            now_ns() - start);
+
+    for (uint32_t i = 0; i < nfds; i++) {
+        close(fds[i]);
+    }
+    close(p[0]);
+    close(p[1]);
+}
+
+/** One echoed message per server side connection is in flight at a time */
+struct echo_conn_t {
+    char buf[MICRO_ECHO_MSG];
+};
+
+struct echo_client_t {
+    uint16_t         port;
+    _Atomic uint32_t done;
+    uint64_t         rounds;
+};
+
+static void echo_sent_handle(struct event_loop_t* el, int32_t fd, ssize_t res,
+        void* data) {
+}
+
+static void echo_recv_handle(struct event_loop_t* el, int32_t fd,
+        const char* buf, ssize_t n, void* data) {
+    struct echo_conn_t* conn = data;
+    if (n <= 0) {
+        unregister_event(el, fd, E_RECV);
+        close(fd);
+        free(conn);
+        return;
+    }
+
+    if (n > MICRO_ECHO_MSG) n = MICRO_ECHO_MSG;
+    memcpy(conn->buf, buf, n);
+    struct iovec iov = { .iov_base = conn->buf, .iov_len = n };
+    el_send(el, fd, &iov, 1, echo_sent_handle, conn);
+}
+
+static void echo_accept_handle(struct event_loop_t* el, int32_t lfd,
+        int32_t fd, void* data) {
+    if (fd < 0) return;
+
+    int32_t one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    struct echo_conn_t* conn = calloc(1, sizeof(struct echo_conn_t));
+    if (conn == NULL || register_reader(el, fd, echo_recv_handle, conn)
+            != OK) {
+        free(conn);
+        close(fd);
+    }
+}
+
+/** Keep every connection busy with a ping-pong until `rounds` complete */
+static void* echo_client_main(void* arg) {
+    struct echo_client_t* ec = arg;
+    struct pollfd pfds[MICRO_ECHO_CONNS];
+    uint32_t got[MICRO_ECHO_CONNS] = { 0 };
+    char msg[MICRO_ECHO_MSG];
+    char buf[MICRO_ECHO_MSG];
+    uint32_t nconns = 0;
+    uint64_t sent = 0;
+    uint64_t completed = 0;
+
+    memset(msg, 'x', sizeof msg);
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(ec->port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (; nconns < MICRO_ECHO_CONNS; nconns++) {
+        int32_t fd = socket(AF_INET, SOCK_STREAM, 0);
+        int32_t one = 1;
+        if (fd == -1 || connect(fd, (struct sockaddr*) &addr, sizeof addr)
+                == -1) {
+            perror("echo connect");
+            if (fd != -1) close(fd);
+            break;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+        pfds[nconns].fd = fd;
+        pfds[nconns].events = POLLIN;
+    }
+
+    for (uint32_t i = 0; i < nconns && sent < ec->rounds; i++, sent++) {
+        write(pfds[i].fd, msg, sizeof msg);
+    }
+
+    while (nconns > 0 && completed < ec->rounds) {
+        if (poll(pfds, nconns, 1000) <= 0) break;
+        for (uint32_t i = 0; i < nconns; i++) {
+            if (!(pfds[i].revents & POLLIN)) continue;
+            ssize_t n = read(pfds[i].fd, buf, sizeof buf - got[i]);
+            if (n <= 0) goto done;
+            if ((got[i] += n) < MICRO_ECHO_MSG) continue;
+
+            got[i] = 0;
+            completed++;
+            if (sent < ec->rounds) {
+                write(pfds[i].fd, msg, sizeof msg);
+                sent++;
+            }
+        }
+    }
+
+done:
+    ec->rounds = completed;
+    for (uint32_t i = 0; i < nconns; i++) {
+        close(pfds[i].fd);
+    }
+    atomic_store(&ec->done, 1);
+    return NULL;
+}
+
+/**
+ * Loopback echo server on the given backend, driven by a client thread.
+ * Reports round trips and the system calls the loop issued for each one.
+ * */
+static void bench_event_loop_echo(const char* name, int32_t backend) {
+    struct event_loop_t* el = create_event_loop(MICRO_ECHO_CONNS * 2 + 64,
+            backend);
+    if (el == NULL) return;
+
+    int32_t lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    struct sockaddr_in addr = { 0 };
+    socklen_t addr_len = sizeof addr;
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (lfd == -1 || bind(lfd, (struct sockaddr*) &addr, sizeof addr) == -1 ||
+            listen(lfd, MICRO_ECHO_CONNS) == -1 ||
+            getsockname(lfd, (struct sockaddr*) &addr, &addr_len) == -1 ||
+            register_acceptor(el, lfd, echo_accept_handle, NULL) != OK) {
+        perror("echo listen");
+        if (lfd != -1) close(lfd);
+        free_event_loop(el);
+        return;
+    }
+
+    struct echo_client_t ec = { 0 };
+    ec.port = ntohs(addr.sin_port);
+    ec.rounds = MICRO_ECHO_ROUNDS;
+
+    pthread_t tid;
+    uint64_t syscalls = el->stat_syscalls;
+    uint64_t start = now_ns();
+    if (pthread_create(&tid, NULL, echo_client_main, &ec) != 0) {
+        perror("pthread_create");
+        close(lfd);
+        free_event_loop(el);
+        return;
+    }
+
+    while (!atomic_load(&ec.done)) {
+        if (process_events(el) < 0) break;
+    }
+    uint64_t elapsed = now_ns() - start;
+    syscalls = el->stat_syscalls - syscalls;
+    pthread_join(tid, NULL);
+
+    if (ec.rounds > 0) {
+        report(name, ec.rounds, elapsed);
+        printf("%-24s %10.2f syscalls/op%s%s\n", "",
+                (double) syscalls / ec.rounds,
+                el->backend == NULL ? "" : " on ", el->backend->name);
+    }
+
+    /** Reap the EOFs of the closed client sockets */
+    for (uint32_t i = 0; i < 64 && el->nfds > 1; i++) {
+        if (process_events(el) < 0) break;
+    }
+
+    close(lfd);
+    free_event_loop(el);
+}
+
+static void bench_event_loop_echo_poll() {
+    bench_event_loop_echo("event_loop.echo.poll", EL_BACKEND_POLL);
+}
+
+static void bench_event_loop_echo_epoll() {
+    bench_event_loop_echo("event_loop.echo.epoll", EL_BACKEND_EPOLL);
+}
+
+static void bench_event_loop_echo_io_uring() {
+    bench_event_loop_echo("event_loop.echo.io_uring", EL_BACKEND_IO_URING);
+}
+
+/** Report the kernel it could not select instead of silently timing another */
+static int32_t select_resp_kernel(const char* name, int32_t kernel) {
+    if (resp_set_kernel(kernel) == -1) {
+        printf("%-24s not supported by this CPU\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+/** Long lines: the cost is the scan itself, one find per buffer */
+static void bench_resp_crlf(const char* name, int32_t kernel) {
+    if (select_resp_kernel(name, kernel) == -1) return;
+
+    char* buf = malloc(MICRO_CRLF_BUF);
+    if (buf == NULL) return;
+    for (uint32_t i = 0; i < MICRO_CRLF_BUF; i++) {
+        buf[i] = 'a' + i % 26;
+    }
+    /** Lone '\r's on the way make the kernels verify the '\n' */
+    for (uint32_t i = 4096; i < MICRO_CRLF_BUF; i += 4096) {
+        buf[i] = '\r';
+    }
+    memcpy(buf + MICRO_CRLF_BUF - 2, "\r\n", 2);
+
+    uint64_t found = 0;
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < MICRO_CRLF_ROUNDS; i++) {
+        /** Keep the compiler from hoisting the scan out of the loop */
+        __asm__ volatile("" : : "r"(buf) : "memory");
+        found += resp_find_crlf(buf, MICRO_CRLF_BUF) != NULL;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    report(name, found, elapsed);
+    printf("%-24s %10.2f GB/s\n", "",
+            (double) MICRO_CRLF_BUF * MICRO_CRLF_ROUNDS / elapsed);
+    free(buf);
+    resp_init();
+}
+
+static void bench_resp_crlf_scalar() {
+    bench_resp_crlf("resp.crlf.scalar", RESP_KERNEL_SCALAR);
+}
+
+static void bench_resp_crlf_sse2() {
+    bench_resp_crlf("resp.crlf.sse2", RESP_KERNEL_SSE2);
+}
+
+static void bench_resp_crlf_avx2() {
+    bench_resp_crlf("resp.crlf.avx2", RESP_KERNEL_AVX2);
+}
+
+/** A pipelined SET workload with 64 byte values, framed request by request */
+static void bench_resp_parse(const char* name, int32_t kernel) {
+    if (select_resp_kernel(name, kernel) == -1) return;
+
+    size_t cap = (size_t) MICRO_PARSE_CMDS * 128;
+    char* buf = malloc(cap);
+    if (buf == NULL) return;
+
+    char value[65];
+    memset(value, 'v', 64);
+    value[64] = '\0';
+
+    size_t len = 0;
+    for (uint32_t i = 0; i < MICRO_PARSE_CMDS; i++) {
+        len += snprintf(buf + len, cap - len, "*3\r\n$3\r\nSET\r\n"
+                "$16\r\nkey:%012u\r\n$64\r\n%s\r\n", i, value);
+    }
+
+    struct resp_request_t req = { 0 };
+    const char* err = NULL;
+    uint64_t ops = 0;
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < MICRO_PARSE_ROUNDS; i++) {
+        size_t pos = 0;
+        while (pos < len) {
+            int64_t n = resp_parse_request(&req, buf + pos, len - pos, &err);
+            if (n <= 0) break;
+            pos += n;
+            ops++;
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    report(name, ops, elapsed);
+    printf("%-24s %10.2f GB/s\n", "",
+            (double) len * MICRO_PARSE_ROUNDS / elapsed);
+    resp_free_request(&req);
+    free(buf);
+    resp_init();
+}
+
+static void bench_resp_parse_scalar() {
+    bench_resp_parse("resp.parse.scalar", RESP_KERNEL_SCALAR);
+}
+
+static void bench_resp_parse_sse2() {
+    bench_resp_parse("resp.parse.sse2", RESP_KERNEL_SSE2);
+}
+
+static void bench_resp_parse_avx2() {
+    bench_resp_parse("resp.parse.avx2", RESP_KERNEL_AVX2);
+}
+
+static int32_t select_bitops_kernel(const char* name, int32_t kernel) {
+    if (bitops_set_kernel(kernel) == -1) {
+        printf("%-24s not supported by this CPU\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+static void fill_random(unsigned char* buf, size_t len, uint64_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        buf[i] = seed >> 56;
+    }
+}
+
+/** A bitmap that fits L2, so the kernel and not memory is measured */
+static void bench_bitops_popcount(const char* name, int32_t kernel) {
+    unsigned char* buf = malloc(MICRO_POPCNT_BUF);
+    if (buf == NULL) return;
+    fill_random(buf, MICRO_POPCNT_BUF, 1);
+
+    bitops_set_kernel(BITOPS_KERNEL_SCALAR);
+    uint64_t expected = bitops_popcount(buf, MICRO_POPCNT_BUF);
+    if (select_bitops_kernel(name, kernel) == -1) {
+        free(buf);
+        bitops_init();
+        return;
+    }
+
+    uint64_t bits = 0;
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < MICRO_POPCNT_ROUNDS; i++) {
+        __asm__ volatile("" : : "r"(buf) : "memory");
+        bits += bitops_popcount(buf, MICRO_POPCNT_BUF);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    report(name, MICRO_POPCNT_ROUNDS, elapsed);
+    printf("%-24s %10.2f GB/s%s\n", "",
+            (double) MICRO_POPCNT_BUF * MICRO_POPCNT_ROUNDS / elapsed,
+            bits == expected * MICRO_POPCNT_ROUNDS ? "" : "  MISMATCH");
+    free(buf);
+    bitops_init();
+}
+
+static void bench_bitops_popcount_scalar() {
+    bench_bitops_popcount("bitops.popcount.scalar", BITOPS_KERNEL_SCALAR);
+}
+
+static void bench_bitops_popcount_sse() {
+    bench_bitops_popcount("bitops.popcount.sse", BITOPS_KERNEL_SSE);
+}
+
+static void bench_bitops_popcount_avx2() {
+    bench_bitops_popcount("bitops.popcount.avx2", BITOPS_KERNEL_AVX2);
+}
+
+/**
+ * BITOP AND over 16 MB bitmaps, tiled like bitop_process(): every source
+ * is applied to a destination tile before the next one. GB/s counts the
+ * source bytes read.
+ * */
+static void bench_bitops_and(const char* name, int32_t kernel) {
+    unsigned char* srcs[MICRO_BITOP_SRCS];
+    unsigned char* dst = malloc(MICRO_BITOP_BUF);
+    int32_t n = 0;
+
+    for (; n < MICRO_BITOP_SRCS; n++) {
+        if ((srcs[n] = malloc(MICRO_BITOP_BUF)) == NULL) break;
+        fill_random(srcs[n], MICRO_BITOP_BUF, n + 1);
+    }
+    if (dst == NULL || n < MICRO_BITOP_SRCS ||
+            select_bitops_kernel(name, kernel) == -1) {
+        goto out;
+    }
+
+    uint64_t start = now_ns();
+    for (uint32_t r = 0; r < MICRO_BITOP_ROUNDS; r++) {
+        for (size_t off = 0; off < MICRO_BITOP_BUF; off += MICRO_BITOP_TILE) {
+            memcpy(dst + off, srcs[0] + off, MICRO_BITOP_TILE);
+            for (int32_t i = 1; i < MICRO_BITOP_SRCS; i++) {
+                bitops_binop(BITOP_AND, dst + off, srcs[i] + off,
+                        MICRO_BITOP_TILE);
+            }
+        }
+        __asm__ volatile("" : : "r"(dst) : "memory");
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    report(name, MICRO_BITOP_ROUNDS, elapsed);
+    printf("%-24s %10.2f GB/s\n", "", (double) MICRO_BITOP_BUF *
+            MICRO_BITOP_SRCS * MICRO_BITOP_ROUNDS / elapsed);
+out:
+    for (int32_t i = 0; i < n; i++) free(srcs[i]);
+    free(dst);
+    bitops_init();
+}
+
+static void bench_bitops_and_scalar() {
+    bench_bitops_and("bitops.and.scalar", BITOPS_KERNEL_SCALAR);
+}
+
+static void bench_bitops_and_sse() {
+    bench_bitops_and("bitops.and.sse", BITOPS_KERNEL_SSE);
+}
+
+static void bench_bitops_and_avx2() {
+    bench_bitops_and("bitops.and.avx2", BITOPS_KERNEL_AVX2);
+}
+
+/** Dense HyperLogLogs of 100k random elements each */
+static struct robj_t** make_hlls() {
+    struct robj_t** hlls = calloc(MICRO_HLL_KEYS, sizeof(struct robj_t*));
+    if (hlls == NULL) return NULL;
+
+    for (uint32_t i = 0; i < MICRO_HLL_KEYS; i++) {
+        if ((hlls[i] = create_hll_object()) == NULL) return hlls;
+        for (uint32_t j = 0; j < 100000; j++) {
+            char ele[32];
+            int32_t n = snprintf(ele, sizeof ele, "user:%u:%u", i, j);
+            hll_add(hlls[i], ele, n);
+        }
+    }
+    return hlls;
+}
+
+/** PFCOUNT of 64 keys: max-merge the registers, then histogram + estimate */
+static void bench_hll_count(const char* name, int32_t kernel) {
+    struct robj_t** hlls = make_hlls();
+    uint8_t* regs = malloc(HLL_REGISTERS);
+    uint8_t* expected = calloc(1, HLL_REGISTERS);
+    if (hlls == NULL || regs == NULL || expected == NULL) goto out;
+    for (uint32_t i = 0; i < MICRO_HLL_KEYS; i++) {
+        if (hlls[i] == NULL) goto out;
+    }
+
+    hll_set_kernel(HLL_KERNEL_SCALAR);
+    for (uint32_t i = 0; i < MICRO_HLL_KEYS; i++) {
+        struct rstr_t* str = hlls[i]->ptr;
+        hll_merge(expected, str->buf, str->len);
+    }
+    if (hll_set_kernel(kernel) == -1) {
+        printf("%-24s not supported by this CPU\n", name);
+        goto out;
+    }
+
+    uint64_t card = 0;
+    uint64_t start = now_ns();
+    for (uint32_t r = 0; r < MICRO_HLL_ROUNDS; r++) {
+        memset(regs, 0, HLL_REGISTERS);
+        for (uint32_t i = 0; i < MICRO_HLL_KEYS; i++) {
+            struct rstr_t* str = hlls[i]->ptr;
+            hll_merge(regs, str->buf, str->len);
+        }
+        card += hll_count_registers(regs);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    report(name, MICRO_HLL_ROUNDS, elapsed);
+    printf("%-24s %10.2f GB/s  %lu%s\n", "", (double) HLL_DENSE_BYTES *
+            MICRO_HLL_KEYS * MICRO_HLL_ROUNDS / elapsed,
+            (unsigned long) (card / MICRO_HLL_ROUNDS),
+            memcmp(regs, expected, HLL_REGISTERS) == 0 ? "" : "  MISMATCH");
+out:
+    for (uint32_t i = 0; hlls != NULL && i < MICRO_HLL_KEYS; i++) {
+        if (hlls[i] != NULL) decr_ref_count(hlls[i]);
+    }
+    free(hlls);
+    free(regs);
+    free(expected);
+    hll_init();
+}
+
+static void bench_hll_count_scalar() {
+    bench_hll_count("hll.count.scalar", HLL_KERNEL_SCALAR);
+}
+
+static void bench_hll_count_ssse3() {
+    bench_hll_count("hll.count.ssse3", HLL_KERNEL_SSSE3);
+}
+
+static void bench_hll_count_avx2() {
+    bench_hll_count("hll.count.avx2", HLL_KERNEL_AVX2);
+}
+
+/** Keys shaped like the load generator's, "key:%012u" */
+static char* make_dict_keys() {
+    char* keys = malloc((size_t) MICRO_DICT_KEYS * 16);
+    if (keys == NULL) return NULL;
+
+    char tmp[32];
+    for (uint32_t i = 0; i < MICRO_DICT_KEYS; i++) {
+        snprintf(tmp, sizeof tmp, "key:%012u", i);
+        memcpy(keys + (size_t) i * 16, tmp, 16);
+    }
+    return keys;
+}
+
+/** Includes every incremental rehash from 4 buckets up */
+static void bench_dict_add() {
+    char* keys = make_dict_keys();
+    struct dict_t* d = create_dict(NULL);
+    if (keys == NULL || d == NULL) return;
+
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < MICRO_DICT_KEYS; i++) {
+        dict_add(d, keys + (size_t) i * 16, 16, NULL);
+    }
+    report("dict.add", MICRO_DICT_KEYS, now_ns() - start);
+
+    free_dict(d);
+    free(keys);
+}
+
+static void bench_dict_find() {
+    char* keys = make_dict_keys();
+    struct dict_t* d = create_dict(NULL);
+    if (keys == NULL || d == NULL) return;
+
+    for (uint32_t i = 0; i < MICRO_DICT_KEYS; i++) {
+        dict_add(d, keys + (size_t) i * 16, 16, NULL);
+    }
+
+    uint64_t found = 0;
+    uint32_t idx = 0;
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < MICRO_DICT_KEYS; i++) {
+        /** Stride through the keys to defeat the prefetcher */
+        idx = (idx + 7919) % MICRO_DICT_KEYS;
+        found += dict_find(d, keys + (size_t) idx * 16, 16) != NULL;
+    }
+    report("dict.find", found, now_ns() - start);
+
+    free_dict(d);
+    free(keys);
+}
+
+/** Value of key i for each workload of bench_object_memory() */
+static size_t format_value(char* buf, uint32_t kind, uint32_t i) {
+    switch (kind) {
+    case 0:  return sprintf(buf, "value:%06u", i);
+    case 1:  return sprintf(buf, "%u", i % OBJ_SHARED_INTEGERS);
+    case 2:  return sprintf(buf, "%u", 1000000000u + i);
+    default: return sprintf(buf, "%-64u", i);
+    }
+}
+
+/**
+ * Heap bytes per key of a keyspace (dict entry, key, bucket and value)
+ * with every value left RAW versus the compact encodings SET picks.
+ * */
+static void bench_object_memory() {
+    static const char* const kinds[] = {
+        "12 byte strings", "integers < 10000", "large integers",
+        "64 byte strings"
+    };
+    char key[32], value[80];
+
+    object_init();
+    for (uint32_t kind = 0; kind < 4; kind++) {
+        double per_key[2];
+        const char* encoding = NULL;
+
+        for (int32_t compact = 0; compact <= 1; compact++) {
+            size_t before = mallinfo2().uordblks;
+            struct dict_t* d = create_dict(decr_ref_count_void);
+            if (d == NULL) return;
+
+            for (uint32_t i = 0; i < MICRO_OBJ_KEYS; i++) {
+                size_t klen = sprintf(key, "key:%012u", i);
+                size_t vlen = format_value(value, kind, i);
+                struct robj_t* o = compact
+                    ? try_object_encoding(create_string_object(value, vlen))
+                    : create_raw_string_object(value, vlen);
+                dict_add(d, key, klen, o);
+                if (i == 0) encoding = obj_encoding_name(o->encoding);
+            }
+
+            per_key[compact] = (double) (mallinfo2().uordblks - before) /
+                MICRO_OBJ_KEYS;
+            free_dict(d);
+        }
+
+        printf("object.memory  %-18s raw %6.1f B/key  %-6s %6.1f B/key\n",
+                kinds[kind], per_key[0], encoding, per_key[1]);
+    }
+}
+
+/**
+ * XADD of sensor readings with the same fields, one entry per block
+ * versus packed blocks at the default limits
+ * */
+static void bench_stream_append() {
+    static const uint32_t entries_per_block[] = { 1, 0 };
+    char value[32];
+    struct resp_arg_t argv[4] = {
+        { "sensor", 6, 0 }, { "temp-01", 7, 0 }, { "value", 5, 0 },
+        { value, 0, 0 },
+    };
+
+    for (uint32_t k = 0; k < 2; k++) {
+        config.stream_node_max_bytes = DEFAULT_STREAM_NODE_MAX_BYTES;
+        config.stream_node_max_entries = entries_per_block[k] != 0 ?
+            entries_per_block[k] : DEFAULT_STREAM_NODE_MAX_ENTRIES;
+
+        struct stream_t* s = create_stream();
+        if (s == NULL) return;
+
+        uint64_t start = now_ns();
+        for (uint32_t i = 0; i < MICRO_STREAM_ENTRIES; i++) {
+            struct stream_id_t id = { 1700000000000ull + i / 4, i % 4 };
+            argv[3].len = snprintf(value, sizeof value, "%u", 20 + i % 17);
+            stream_append(s, &id, argv, 2);
+        }
+        uint64_t elapsed = now_ns() - start;
+
+        char name[32];
+        snprintf(name, sizeof name, "stream.append.%u",
+                config.stream_node_max_entries);
+        report(name, MICRO_STREAM_ENTRIES, elapsed);
+        printf("%-24s %10.1f B/entry\n", "",
+                (double) stream_memory_usage(s, 0) / MICRO_STREAM_ENTRIES);
+        free_stream(s);
+    }
+    config.stream_node_max_bytes = DEFAULT_STREAM_NODE_MAX_BYTES;
+    config.stream_node_max_entries = DEFAULT_STREAM_NODE_MAX_ENTRIES;
+}
+
+/** XRANGE - + walk, decoding every field */
+static void bench_stream_range() {
+    char value[32];
+    struct resp_arg_t argv[2] = { { "value", 5, 0 }, { value, 0, 0 } };
+
+    config.stream_node_max_bytes = DEFAULT_STREAM_NODE_MAX_BYTES;
+    config.stream_node_max_entries = DEFAULT_STREAM_NODE_MAX_ENTRIES;
+    struct stream_t* s = create_stream();
+    if (s == NULL) return;
+    for (uint32_t i = 0; i < MICRO_STREAM_ENTRIES; i++) {
+        struct stream_id_t id = { 1700000000000ull + i, 0 };
+        argv[1].len = snprintf(value, sizeof value, "%u", i);
+        stream_append(s, &id, argv, 1);
+    }
+
+    struct stream_id_t first = { 0, 0 };
+    struct stream_id_t last = { UINT64_MAX, UINT64_MAX };
+    for (int32_t rev = 0; rev <= 1; rev++) {
+        struct stream_iter_t it;
+        struct stream_id_t id;
+        int64_t nfields;
+        uint64_t n = 0;
+        size_t bytes = 0;
+
+        uint64_t start = now_ns();
+        stream_iter_start(&it, s, &first, &last, rev);
+        while (stream_iter_next(&it, &id, &nfields)) {
+            for (int64_t f = 0; f < nfields; f++) {
+                const char* field;
+                const char* v;
+                size_t flen, vlen;
+                stream_iter_field(&it, &field, &flen, &v, &vlen);
+                bytes += flen + vlen;
+            }
+            n++;
+        }
+        stream_iter_stop(&it);
+        __asm__ volatile("" : : "r"(bytes) : "memory");
+        report(rev ? "stream.range.rev" : "stream.range", n,
+                now_ns() - start);
+    }
+    free_stream(s);
+}
+
+static _Atomic uint64_t pool_done = 0;
+
+static void pool_noop_handle(int32_t _) {
+    atomic_fetch_add_explicit(&pool_done, 1, memory_order_relaxed);
+}
+
+static void bench_thread_pool_queue() {
+    struct thread_pool_t* tp = create_thread_pool();
+    if (tp == NULL) return;
+
+    atomic_store(&pool_done, 0);
+
+    uint64_t failed = 0;
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < MICRO_POOL_JOBS; i++) {
+        if (enqueue_thread_work(tp, pool_noop_handle, 0) != 1) {
+            failed++;
+        }
+    }
+    uint64_t enqueued = MICRO_POOL_JOBS - failed;
+    while (atomic_load(&pool_done) < enqueued) {
+        usleep(100);
+    }
+    report("thread_pool.queue", enqueued, now_ns() - start);
+    if (failed > 0) {
+        printf("%-24s %10lu enqueue failures\n", "", (unsigned long) failed);
+    }
+
+    /** Workers are detached and never joined, the pool is left running */
+}
+
+static const struct micro_bench_t micro_benches[] = {
+    { "event_loop.dispatch", "poll + dispatch with every fd ready",
+        bench_event_loop_dispatch },
+    { "event_loop.register", "register / unregister one fd",
+        bench_event_loop_register },
+    { "event_loop.grow",     "register fds into a loop created with 4 slots",
+        bench_event_loop_grow },
+    { "event_loop.echo.poll", "loopback echo, 64 connections, poll backend",
+        bench_event_loop_echo_poll },
+    { "event_loop.echo.epoll", "loopback echo, 64 connections, epoll backend",
+        bench_event_loop_echo_epoll },
+    { "event_loop.echo.io_uring",
+        "loopback echo, 64 connections, io_uring backend",
+        bench_event_loop_echo_io_uring },
+    { "resp.crlf.scalar",    "CRLF search over 64 KB lines, scalar",
+        bench_resp_crlf_scalar },
+    { "resp.crlf.sse2",      "CRLF search over 64 KB lines, SSE2",
+        bench_resp_crlf_sse2 },
+    { "resp.crlf.avx2",      "CRLF search over 64 KB lines, AVX2",
+        bench_resp_crlf_avx2 },
+    { "resp.parse.scalar",   "frame pipelined SET requests, scalar",
+        bench_resp_parse_scalar },
+    { "resp.parse.sse2",     "frame pipelined SET requests, SSE2",
+        bench_resp_parse_sse2 },
+    { "resp.parse.avx2",     "frame pipelined SET requests, AVX2",
+        bench_resp_parse_avx2 },
+    { "bitops.popcount.scalar", "popcount of a 256 KB bitmap, 64 bit SWAR",
+        bench_bitops_popcount_scalar },
+    { "bitops.popcount.sse", "popcount of a 256 KB bitmap, POPCNT",
+        bench_bitops_popcount_sse },
+    { "bitops.popcount.avx2", "popcount of a 256 KB bitmap, AVX2 nibble LUT",
+        bench_bitops_popcount_avx2 },
+    { "bitops.and.scalar",   "tiled AND of 4 x 16 MB bitmaps, 64 bit words",
+        bench_bitops_and_scalar },
+    { "bitops.and.sse",      "tiled AND of 4 x 16 MB bitmaps, SSE2",
+        bench_bitops_and_sse },
+    { "bitops.and.avx2",     "tiled AND of 4 x 16 MB bitmaps, AVX2",
+        bench_bitops_and_avx2 },
+    { "hll.count.scalar",    "PFCOUNT of 64 dense HyperLogLogs, scalar",
+        bench_hll_count_scalar },
+    { "hll.count.ssse3",     "PFCOUNT of 64 dense HyperLogLogs, SSSE3",
+        bench_hll_count_ssse3 },
+    { "hll.count.avx2",      "PFCOUNT of 64 dense HyperLogLogs, AVX2",
+        bench_hll_count_avx2 },
+    { "dict.add",            "insert 1M keys into an empty dict",
+        bench_dict_add },
+    { "dict.find",           "random lookups in a 1M key dict",
+        bench_dict_find },
+    { "object.memory",       "bytes per key, raw strings vs compact "
+        "encodings", bench_object_memory },
+    { "stream.append",       "XADD 1M entries, 1 per block vs packed blocks",
+        bench_stream_append },
+    { "stream.range",        "iterate a 1M entry stream both ways",
+        bench_stream_range },
+    { "thread_pool.queue",   "enqueue to completion of no-op jobs",
+        bench_thread_pool_queue },
+};
+
+int32_t micro_main(int32_t argc, char** argv) {
+    uint32_t n = sizeof micro_benches / sizeof micro_benches[0];
+    uint32_t ran = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        int32_t selected = argc <= 1;
+        for (int32_t j = 1; j < argc && !selected; j++) {
+            selected = strncmp(micro_benches[i].name, argv[j], strlen(argv[j]))
+                == 0;
+        }
+        if (!selected) continue;
+
+        micro_benches[i].fn();
+        ran++;
+    }
+
+    if (ran == 0) {
+        fprintf(stderr, "no microbenchmark matches. available:\n");
+        for (uint32_t i = 0; i < n; i++) {
+            fprintf(stderr, "  %-24s %s\n", micro_benches[i].name,
+                    micro_benches[i].desc);
+        }
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,327 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITOPS_X86 1
+#endif
+
+#include "bitops.h"
+
+/** Keep the compiler from turning the reference kernels into SSE2 */
+#define NO_VECTORIZE __attribute__((optimize("no-tree-vectorize")))
+
+
+static inline uint64_t load64(const unsigned char* p) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    return w;
+}
+
+static inline void store64(unsigned char* p, uint64_t w) {
+    memcpy(p, &w, 8);
+}
+
+/** Bit index of the first `bit` in a byte that contains one */
+static inline int64_t first_bit_in_byte(unsigned char byte, int32_t bit) {
+    uint32_t b = bit ? byte : (unsigned char) ~byte;
+    return __builtin_clz(b) - 24;
+}
+
+static int64_t bitpos_bytes(const unsigned char* p, size_t len, int32_t bit,
+        size_t base) {
+    unsigned char skip = bit ? 0 : 0xff;
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] != skip) {
+            return (int64_t) (base + i) * 8 + first_bit_in_byte(p[i], bit);
+        }
+    }
+    return -1;
+}
+
+/** ------------------------------ Scalar --------------------------------- */
+
+static inline uint64_t popcount64_swar(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+}
+
+NO_VECTORIZE
+static uint64_t popcount_scalar(const unsigned char* p, size_t len) {
+    uint64_t n = 0;
+    for (; len >= 8; p += 8, len -= 8) {
+        n += popcount64_swar(load64(p));
+    }
+    for (; len > 0; p++, len--) {
+        n += popcount64_swar(*p);
+    }
+    return n;
+}
+
+NO_VECTORIZE
+static int64_t bitpos_scalar(const unsigned char* p, size_t len,
+        int32_t bit) {
+    uint64_t skip = bit ? 0 : UINT64_MAX;
+    size_t i = 0;
+    while (i + 8 <= len && load64(p + i) == skip) i += 8;
+    return bitpos_bytes(p + i, len - i, bit, i);
+}
+
+NO_VECTORIZE
+static void binop_scalar(int32_t op, unsigned char* dst,
+        const unsigned char* src, size_t len) {
+    size_t i = 0;
+    switch (op) {
+    case BITOP_AND:
+        for (; i + 8 <= len; i += 8) {
+            store64(dst + i, load64(dst + i) & load64(src + i));
+        }
+        for (; i < len; i++) dst[i] &= src[i];
+        break;
+    case BITOP_OR:
+        for (; i + 8 <= len; i += 8) {
+            store64(dst + i, load64(dst + i) | load64(src + i));
+        }
+        for (; i < len; i++) dst[i] |= src[i];
+        break;
+    case BITOP_XOR:
+        for (; i + 8 <= len; i += 8) {
+            store64(dst + i, load64(dst + i) ^ load64(src + i));
+        }
+        for (; i < len; i++) dst[i] ^= src[i];
+        break;
+    case BITOP_NOT:
+        for (; i + 8 <= len; i += 8) {
+            store64(dst + i, ~load64(src + i));
+        }
+        for (; i < len; i++) dst[i] = ~src[i];
+        break;
+    }
+}
+
+#ifdef BITOPS_X86
+
+/** ------------------------------ SSE ------------------------------------ */
+
+__attribute__((target("popcnt")))
+static uint64_t popcount_popcnt(const unsigned char* p, size_t len) {
+    uint64_t a = 0, b = 0, c = 0, d = 0;
+
+    /** Four independent chains hide the 3 cycle latency of POPCNT */
+    for (; len >= 32; p += 32, len -= 32) {
+        a += __builtin_popcountll(load64(p));
+        b += __builtin_popcountll(load64(p + 8));
+        c += __builtin_popcountll(load64(p + 16));
+        d += __builtin_popcountll(load64(p + 24));
+    }
+    for (; len >= 8; p += 8, len -= 8) {
+        a += __builtin_popcountll(load64(p));
+    }
+    for (; len > 0; p++, len--) {
+        a += __builtin_popcount(*p);
+    }
+    return a + b + c + d;
+}
+
+__attribute__((target("sse2")))
+static int64_t bitpos_sse2(const unsigned char* p, size_t len, int32_t bit) {
+    const __m128i skip = _mm_set1_epi8(bit ? 0 : -1);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+        uint32_t m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, skip));
+        if (m != 0xffff) {
+            i += __builtin_ctz(~m);
+            return (int64_t) i * 8 + first_bit_in_byte(p[i], bit);
+        }
+    }
+    return bitpos_bytes(p + i, len - i, bit, i);
+}
+
+__attribute__((target("sse2")))
+static void binop_sse2(int32_t op, unsigned char* dst,
+        const unsigned char* src, size_t len) {
+    size_t i = 0;
+
+#define BINOP_SSE2_LOOP(expr)                                               \
+    for (; i + 16 <= len; i += 16) {                                        \
+        __m128i d = _mm_loadu_si128((const __m128i*) (dst + i));            \
+        __m128i s = _mm_loadu_si128((const __m128i*) (src + i));            \
+        (void) d;                                                           \
+        _mm_storeu_si128((__m128i*) (dst + i), expr);                       \
+    }
+
+    switch (op) {
+    case BITOP_AND: BINOP_SSE2_LOOP(_mm_and_si128(d, s)); break;
+    case BITOP_OR:  BINOP_SSE2_LOOP(_mm_or_si128(d, s)); break;
+    case BITOP_XOR: BINOP_SSE2_LOOP(_mm_xor_si128(d, s)); break;
+    case BITOP_NOT:
+        BINOP_SSE2_LOOP(_mm_xor_si128(s, _mm_set1_epi8(-1)));
+        break;
+    }
+#undef BINOP_SSE2_LOOP
+
+    binop_scalar(op, dst + i, src + i, len - i);
+}
+
+/** ------------------------------ AVX2 ----------------------------------- */
+
+/**
+ * Nibble lookup popcount (Mula): PSHUFB counts the bits of each nibble,
+ * byte counters are folded into 64 bit lanes by PSADBW every 31 blocks,
+ * before they can overflow.
+ * */
+__attribute__((target("avx2")))
+static uint64_t popcount_avx2(const unsigned char* p, size_t len) {
+    const __m256i lookup = _mm256_setr_epi8(
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+
+    while (len >= 32) {
+        __m256i local = _mm256_setzero_si256();
+        for (int32_t k = 0; k < 31 && len >= 32; k++, p += 32, len -= 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) p);
+            __m256i lo = _mm256_and_si256(v, low_mask);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+            local = _mm256_add_epi8(local, _mm256_add_epi8(
+                        _mm256_shuffle_epi8(lookup, lo),
+                        _mm256_shuffle_epi8(lookup, hi)));
+        }
+        acc = _mm256_add_epi64(acc,
+                _mm256_sad_epu8(local, _mm256_setzero_si256()));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+        popcount_popcnt(p, len);
+}
+
+__attribute__((target("avx2")))
+static int64_t bitpos_avx2(const unsigned char* p, size_t len, int32_t bit) {
+    const __m256i skip = _mm256_set1_epi8(bit ? 0 : -1);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+        uint32_t m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, skip));
+        if (m != UINT32_MAX) {
+            i += __builtin_ctz(~m);
+            return (int64_t) i * 8 + first_bit_in_byte(p[i], bit);
+        }
+    }
+    return bitpos_bytes(p + i, len - i, bit, i);
+}
+
+__attribute__((target("avx2")))
+static void binop_avx2(int32_t op, unsigned char* dst,
+        const unsigned char* src, size_t len) {
+    size_t i = 0;
+
+#define BINOP_AVX2_LOOP(expr)                                               \
+    for (; i + 32 <= len; i += 32) {                                        \
+        __m256i d = _mm256_loadu_si256((const __m256i*) (dst + i));         \
+        __m256i s = _mm256_loadu_si256((const __m256i*) (src + i));         \
+        (void) d;                                                           \
+        _mm256_storeu_si256((__m256i*) (dst + i), expr);                    \
+    }
+
+    switch (op) {
+    case BITOP_AND: BINOP_AVX2_LOOP(_mm256_and_si256(d, s)); break;
+    case BITOP_OR:  BINOP_AVX2_LOOP(_mm256_or_si256(d, s)); break;
+    case BITOP_XOR: BINOP_AVX2_LOOP(_mm256_xor_si256(d, s)); break;
+    case BITOP_NOT:
+        BINOP_AVX2_LOOP(_mm256_xor_si256(s, _mm256_set1_epi8(-1)));
+        break;
+    }
+#undef BINOP_AVX2_LOOP
+
+    binop_scalar(op, dst + i, src + i, len - i);
+}
+
+#endif /* ifdef BITOPS_X86 */
+
+/** ------------------------------ Dispatch ------------------------------- */
+
+typedef uint64_t (*popcount_fn_t)(const unsigned char*, size_t);
+typedef int64_t (*bitpos_fn_t)(const unsigned char*, size_t, int32_t);
+typedef void (*binop_fn_t)(int32_t, unsigned char*, const unsigned char*,
+        size_t);
+
+static int32_t bitops_kernel = BITOPS_KERNEL_SCALAR;
+static popcount_fn_t popcount_fn = popcount_scalar;
+static bitpos_fn_t bitpos_fn = bitpos_scalar;
+static binop_fn_t binop_fn = binop_scalar;
+
+static const char* const bitops_kernel_names[] = {
+    "scalar", "sse+popcnt", "avx2"
+};
+
+
+int32_t bitops_set_kernel(int32_t kernel) {
+    switch (kernel) {
+    case BITOPS_KERNEL_SCALAR:
+        popcount_fn = popcount_scalar;
+        bitpos_fn = bitpos_scalar;
+        binop_fn = binop_scalar;
+        break;
+#ifdef BITOPS_X86
+    case BITOPS_KERNEL_SSE:
+        if (!__builtin_cpu_supports("popcnt") ||
+                !__builtin_cpu_supports("sse2")) {
+            return -1;
+        }
+        popcount_fn = popcount_popcnt;
+        bitpos_fn = bitpos_sse2;
+        binop_fn = binop_sse2;
+        break;
+    case BITOPS_KERNEL_AVX2:
+        /** The AVX2 popcount finishes its tail with POPCNT */
+        if (!__builtin_cpu_supports("avx2") ||
+                !__builtin_cpu_supports("popcnt")) {
+            return -1;
+        }
+        popcount_fn = popcount_avx2;
+        bitpos_fn = bitpos_avx2;
+        binop_fn = binop_avx2;
+        break;
+#endif /* ifdef BITOPS_X86 */
+    default:
+        return -1;
+    }
+
+    bitops_kernel = kernel;
+    return 0;
+}
+
+const char* bitops_kernel_name() {
+    return bitops_kernel_names[bitops_kernel];
+}
+
+void bitops_init() {
+#ifdef BITOPS_X86
+    __builtin_cpu_init();
+#endif /* ifdef BITOPS_X86 */
+    if (bitops_set_kernel(BITOPS_KERNEL_AVX2) == 0) return;
+    if (bitops_set_kernel(BITOPS_KERNEL_SSE) == 0) return;
+    bitops_set_kernel(BITOPS_KERNEL_SCALAR);
+}
+
+uint64_t bitops_popcount(const unsigned char* p, size_t len) {
+    return popcount_fn(p, len);
+}
+
+int64_t bitops_bitpos(const unsigned char* p, size_t len, int32_t bit) {
+    return bitpos_fn(p, len, bit);
+}
+
+void bitops_binop(int32_t op, unsigned char* dst, const unsigned char* src,
+        size_t len) {
+    binop_fn(op, dst, src, len);
+}
@@ -0,0 +1,38 @@
+#ifndef BITOPS_H
+#define BITOPS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Kernels, see bitops_set_kernel() */
+#define BITOPS_KERNEL_SCALAR 0 // 64 bit SWAR
+#define BITOPS_KERNEL_SSE    1 // POPCNT instruction, SSE2 loops
+#define BITOPS_KERNEL_AVX2   2 // nibble LUT popcount, AVX2 loops
+
+#define BITOP_AND 0
+#define BITOP_OR  1
+#define BITOP_XOR 2
+#define BITOP_NOT 3
+
+
+/** Select the fastest kernel the CPU supports */
+void bitops_init();
+
+/** Force a kernel. Return -1 if the CPU does not support it. */
+int32_t bitops_set_kernel(int32_t);
+
+const char* bitops_kernel_name();
+
+/** Number of set bits */
+uint64_t bitops_popcount(const unsigned char*, size_t);
+
+/**
+ * Index of the first bit equal to `bit` (bit 0 is the most significant bit
+ * of the first byte), or -1.
+ * */
+int64_t bitops_bitpos(const unsigned char*, size_t, int32_t);
+
+/** dst = dst AND|OR|XOR src, or dst = NOT src, over `len` bytes */
+void bitops_binop(int32_t, unsigned char*, const unsigned char*, size_t);
+
+#endif // !BITOPS_H
@@ -0,0 +1,346 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blocked.h"
+#include "dict.h"
+#include "event_loop.h"
+#include "networking.h"
+#include "rax.h"
+#include "server.h"
+#include "t_bitmap.h"
+#include "t_stream.h"
+
+/** clients_timeout_table key: deadline then client id, big endian */
+#define TIMEOUT_KEY_SIZE 16
+
+
+/** Clients blocked on one key, in blocking order */
+struct blocked_list_t {
+    uint32_t          len;
+    uint32_t          cap;
+    struct client_t** clients;
+};
+
+static void free_blocked_list(void* l) {
+    free(((struct blocked_list_t*) l)->clients);
+    free(l);
+}
+
+int32_t blocked_init() {
+    server.blocking_keys = create_dict(free_blocked_list);
+    server.ready_keys = create_dict(NULL);
+    server.clients_timeout_table = create_rax();
+    server.blocked_timer_id = -1;
+    if (server.blocking_keys == NULL || server.ready_keys == NULL ||
+            server.clients_timeout_table == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+void block_client(struct client_t* c, int32_t btype, void* state) {
+    assert(!(c->flags & CLIENT_BLOCKED));
+
+    c->flags |= CLIENT_BLOCKED;
+    c->btype = btype;
+    c->bstate = state;
+    server.blocked_clients++;
+}
+
+/** ------------------------------ Timeouts ------------------------------- */
+
+static void encode_timeout_key(unsigned char* key, int64_t timeout,
+        uint64_t id) {
+    for (int32_t i = 0; i < 8; i++) {
+        key[i] = (uint64_t) timeout >> (56 - 8 * i);
+        key[8 + i] = id >> (56 - 8 * i);
+    }
+}
+
+static int64_t decode_timeout_key(const unsigned char* key) {
+    uint64_t timeout = 0;
+    for (int32_t i = 0; i < 8; i++) timeout = timeout << 8 | key[i];
+    return (int64_t) timeout;
+}
+
+/**
+ * Reply a null array to the clients whose deadline passed. Return the
+ * earliest deadline left, 0 if none.
+ * */
+static int64_t handle_blocked_clients_timeout() {
+    int64_t now = get_monotonic_ms();
+    int64_t next = 0;
+    struct rax_iter_t ri;
+
+    rax_iter_start(&ri, server.clients_timeout_table);
+    while (rax_seek(&ri, "^", NULL, 0)) {
+        int64_t timeout = decode_timeout_key(ri.key);
+        if (timeout > now) {
+            next = timeout;
+            break;
+        }
+        struct client_t* c = ri.value;
+        add_reply_null_array(c);
+        unblock_client(c); // removes the table entry
+    }
+    rax_iter_release(&ri);
+    return next;
+}
+
+/** One time event fires at the earliest deadline */
+static int64_t blocked_timeout_timer(struct event_loop_t* el, int64_t id,
+        void* _) {
+    int64_t next = handle_blocked_clients_timeout();
+    if (next == 0) {
+        server.blocked_timer_id = -1;
+        return TE_NOMORE;
+    }
+
+    int64_t now = get_monotonic_ms();
+    server.blocked_timer_when = next;
+    return next > now ? next - now : 0;
+}
+
+static void arm_timeout_timer(int64_t timeout) {
+    if (server.blocked_timer_id != -1) {
+        if (server.blocked_timer_when <= timeout) return;
+        delete_time_event(server.el, server.blocked_timer_id);
+    }
+
+    int64_t now = get_monotonic_ms();
+    server.blocked_timer_id = create_time_event(server.el,
+            timeout > now ? timeout - now : 0, blocked_timeout_timer, NULL);
+    server.blocked_timer_when = timeout;
+}
+
+/** ------------------------------ Keys ----------------------------------- */
+
+static int32_t add_blocked_client(const char* key, size_t len,
+        struct client_t* c) {
+    struct dict_entry_t* e = dict_find(server.blocking_keys, key, len);
+    if (e == NULL) {
+        struct blocked_list_t* l = calloc(1, sizeof(struct blocked_list_t));
+        if (l == NULL) return -1;
+        if (dict_add(server.blocking_keys, key, len, l) != DICT_OK) {
+            free(l);
+            return -1;
+        }
+        e = dict_find(server.blocking_keys, key, len);
+    }
+
+    struct blocked_list_t* l = e->val;
+    if (l->len == l->cap) {
+        uint32_t cap = l->cap == 0 ? 4 : l->cap * 2;
+        struct client_t** clients = realloc(l->clients,
+                sizeof(struct client_t*) * cap);
+        if (clients == NULL) return -1;
+        l->clients = clients;
+        l->cap = cap;
+    }
+    l->clients[l->len++] = c;
+    return 0;
+}
+
+static void remove_blocked_client(const char* key, size_t len,
+        struct client_t* c) {
+    struct dict_entry_t* e = dict_find(server.blocking_keys, key, len);
+    if (e == NULL) return;
+
+    struct blocked_list_t* l = e->val;
+    for (uint32_t i = 0; i < l->len; i++) {
+        if (l->clients[i] != c) continue;
+        memmove(l->clients + i, l->clients + i + 1,
+                sizeof(struct client_t*) * (l->len - i - 1));
+        l->len--;
+        break;
+    }
+    if (l->len == 0) dict_delete(server.blocking_keys, key, len);
+}
+
+/** Undo block_for_keys() registrations and free the operation state */
+static void unblock_from_keys(struct client_t* c) {
+    if (c->bkeys != NULL) {
+        struct dict_iter_t it;
+        struct dict_entry_t* e;
+        dict_init_iter(c->bkeys, &it);
+        while ((e = dict_next(&it)) != NULL) {
+            remove_blocked_client(e->key, e->klen, c);
+        }
+        dict_release_iter(&it);
+        free_dict(c->bkeys);
+        c->bkeys = NULL;
+    }
+
+    if (c->btimeout > 0) {
+        unsigned char key[TIMEOUT_KEY_SIZE];
+        encode_timeout_key(key, c->btimeout, c->id);
+        rax_remove(server.clients_timeout_table, key, TIMEOUT_KEY_SIZE,
+                NULL);
+        c->btimeout = 0;
+    }
+
+    switch (c->btype) {
+    case BLOCKED_STREAM:
+        stream_free_blocked_state(c->bstate);
+        break;
+    }
+}
+
+int32_t block_for_keys(struct client_t* c, int32_t btype,
+        const struct resp_arg_t* keys, int32_t nkeys, int64_t timeout,
+        void* state) {
+    block_client(c, btype, state);
+
+    if ((c->bkeys = create_dict(NULL)) == NULL) goto err;
+    for (int32_t i = 0; i < nkeys; i++) {
+        int32_t ret = dict_add(c->bkeys, keys[i].ptr, keys[i].len, NULL);
+        if (ret == DICT_EXISTS) continue;
+        if (ret != DICT_OK) goto err;
+        if (add_blocked_client(keys[i].ptr, keys[i].len, c) == -1) {
+            remove_blocked_client(keys[i].ptr, keys[i].len, c);
+            goto err;
+        }
+    }
+
+    if (timeout > 0) {
+        unsigned char key[TIMEOUT_KEY_SIZE];
+        encode_timeout_key(key, timeout, c->id);
+        if (rax_insert(server.clients_timeout_table, key, TIMEOUT_KEY_SIZE,
+                    c, NULL) == -1) {
+            goto err;
+        }
+        c->btimeout = timeout;
+        arm_timeout_timer(timeout);
+    }
+    return 0;
+
+err:
+    /** The caller still owns `state` */
+    c->btype = BLOCKED_NONE;
+    unblock_from_keys(c);
+    c->flags &= ~CLIENT_BLOCKED;
+    c->bstate = NULL;
+    server.blocked_clients--;
+    return -1;
+}
+
+void signal_key_as_ready(const char* key, size_t len) {
+    if (dict_find(server.blocking_keys, key, len) == NULL) return;
+    dict_add(server.ready_keys, key, len, NULL);
+}
+
+/** Return 1 if the operation served (and replied to) the client */
+static int32_t serve_blocked_client(struct client_t* c, const char* key,
+        size_t len) {
+    switch (c->btype) {
+    case BLOCKED_STREAM:
+        return stream_serve_blocked_client(c, key, len);
+    }
+    return 0;
+}
+
+/**
+ * Serve the clients blocked on each ready key in blocking order. Keys
+ * signaled meanwhile are served on the next round.
+ * */
+static void handle_clients_blocked_on_keys() {
+    while (dict_size(server.ready_keys) > 0) {
+        struct dict_t* ready = server.ready_keys;
+        if ((server.ready_keys = create_dict(NULL)) == NULL) {
+            server.ready_keys = ready;
+            return;
+        }
+
+        struct dict_iter_t it;
+        struct dict_entry_t* e;
+        dict_init_iter(ready, &it);
+        while ((e = dict_next(&it)) != NULL) {
+            /** Serving unblocks clients, which edits the list */
+            struct dict_entry_t* le = dict_find(server.blocking_keys, e->key,
+                    e->klen);
+            while (le != NULL) {
+                struct blocked_list_t* l = le->val;
+                uint32_t served = 0;
+                for (uint32_t i = 0; i < l->len; i++) {
+                    if (serve_blocked_client(l->clients[i], e->key,
+                                e->klen)) {
+                        unblock_client(l->clients[i]);
+                        served = 1;
+                        break;
+                    }
+                }
+                if (!served) break;
+                le = dict_find(server.blocking_keys, e->key, e->klen);
+            }
+        }
+        dict_release_iter(&it);
+        free_dict(ready);
+    }
+}
+
+/** ------------------------------ Unblocking ----------------------------- */
+
+static void unlink_unblocked(struct client_t* c) {
+    if (!(c->flags & CLIENT_UNBLOCKED)) return;
+
+    if (c->unblocked_prev != NULL) {
+        c->unblocked_prev->unblocked_next = c->unblocked_next;
+    } else {
+        server.unblocked_clients = c->unblocked_next;
+    }
+    if (c->unblocked_next != NULL) {
+        c->unblocked_next->unblocked_prev = c->unblocked_prev;
+    }
+    c->unblocked_prev = c->unblocked_next = NULL;
+    c->flags &= ~CLIENT_UNBLOCKED;
+}
+
+void unblock_client(struct client_t* c) {
+    assert(c->flags & CLIENT_BLOCKED);
+
+    unblock_from_keys(c);
+    c->flags &= ~CLIENT_BLOCKED;
+    c->btype = BLOCKED_NONE;
+    c->bstate = NULL;
+    server.blocked_clients--;
+
+    c->flags |= CLIENT_UNBLOCKED;
+    c->unblocked_prev = NULL;
+    c->unblocked_next = server.unblocked_clients;
+    if (c->unblocked_next != NULL) {
+        c->unblocked_next->unblocked_prev = c;
+    }
+    server.unblocked_clients = c;
+}
+
+void blocked_client_freed(struct client_t* c) {
+    unlink_unblocked(c);
+    if (!(c->flags & CLIENT_BLOCKED)) return;
+
+    switch (c->btype) {
+    case BLOCKED_BITOP:
+        bitop_detach_client(c->bstate);
+        break;
+    }
+    unblock_from_keys(c);
+    c->flags &= ~CLIENT_BLOCKED;
+    c->btype = BLOCKED_NONE;
+    c->bstate = NULL;
+    server.blocked_clients--;
+}
+
+void process_unblocked_clients() {
+    handle_clients_blocked_on_keys();
+    while (server.unblocked_clients != NULL) {
+        while (server.unblocked_clients != NULL) {
+            struct client_t* c = server.unblocked_clients;
+            unlink_unblocked(c);
+            if (c->flags & CLIENT_CLOSE_ASAP) continue;
+            process_query_buffer(c);
+        }
+        /** Resumed requests may feed keys other clients wait for */
+        handle_clients_blocked_on_keys();
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef BLOCKED_H
+#define BLOCKED_H
+
+#include <stdint.h>
+
+#include "networking.h"
+#include "resp.h"
+
+/** What a CLIENT_BLOCKED client waits for (client_t.btype) */
+#define BLOCKED_NONE   0
+#define BLOCKED_BITOP  1 // a chunked BITOP, see t_bitmap.c
+#define BLOCKED_STREAM 2 // XREAD / XREADGROUP BLOCK, see t_stream.c
+
+
+/** Set up the tables of clients blocked on keys */
+int32_t blocked_init();
+
+/**
+ * Stop executing the client's requests until unblock_client(). Requests
+ * that arrive in the meantime are kept in the query buffer. `state` belongs
+ * to the operation.
+ * */
+void block_client(struct client_t*, int32_t, void *);
+
+/**
+ * Block until one of the keys is signaled ready and the operation serves
+ * the client, or until the monotonic `timeout` in ms (0 waits forever)
+ * passes and a null reply is sent. Return -1 on allocation failure, the
+ * client is not blocked then.
+ * */
+int32_t block_for_keys(struct client_t*, int32_t, const struct resp_arg_t*,
+        int32_t, int64_t, void*);
+
+/**
+ * The operation completed (and replied): queue the client so that its
+ * buffered requests are executed from the before sleep handle.
+ * */
+void unblock_client(struct client_t*);
+
+/** Detach a client that is being freed from the operation it waits for */
+void blocked_client_freed(struct client_t*);
+
+/** A key that clients may be blocked on received data */
+void signal_key_as_ready(const char*, size_t);
+
+/**
+ * Serve the clients blocked on keys signaled ready, then resume the
+ * clients queued by unblock_client(), until neither is left. Run before
+ * sleeping.
+ * */
+void process_unblocked_clients();
+
+#endif // !BLOCKED_H
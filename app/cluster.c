@@ -0,0 +1,1392 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cluster.h"
+#include "config.h"
+#include "db.h"
+#include "dict.h"
+#include "event_loop.h"
+#include "ip.h"
+#include "log.h"
+#include "migrate.h"
+#include "networking.h"
+#include "rax.h"
+#include "resp.h"
+#include "server.h"
+
+/**
+ * Bus messages, all integers big endian:
+ *
+ * "RCmb" | totlen u32 | version u16 | type u16 | gossip count u16 |
+ * current epoch u64 | config epoch u64 | sender ID | sender slots bitmap |
+ * port u16 | cport u16 | gossip entries
+ *
+ * A gossip entry tells about another node: ID | ip | port u16 | cport u16.
+ * */
+#define CLUSTER_MSG_SIG      "RCmb"
+#define CLUSTER_MSG_VERSION  1
+#define CLUSTER_MSG_HDR_SIZE (14 + 16 + CLUSTER_NAMELEN + CLUSTER_SLOTS / 8 + 4)
+#define CLUSTER_GOSSIP_SIZE  (CLUSTER_NAMELEN + INET6_ADDRSTRLEN + 4)
+#define CLUSTER_GOSSIP_MAX   1024 // entries accepted in one message
+
+#define CLUSTER_MSG_PING 0
+#define CLUSTER_MSG_PONG 1 // reply to PING and MEET
+#define CLUSTER_MSG_MEET 2 // PING that makes an unknown receiver add us
+
+#define CLUSTER_PING_SAMPLES 5 // random nodes looked at for the 1 Hz ping
+#define CLUSTER_NODES_LINE   256
+
+
+static const uint16_t crc16tab[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
+};
+
+static void link_recv_handle(struct event_loop_t*, int32_t, const char*,
+        ssize_t, void*);
+
+static void link_write_handle(struct event_loop_t*, int32_t, void*);
+
+
+static inline int32_t arg_is(const struct resp_arg_t* arg, const char* s) {
+    size_t len = strlen(s);
+    return arg->len == len && strncasecmp(arg->ptr, s, len) == 0;
+}
+
+/** CRC16-CCITT (XMODEM), as Redis Cluster */
+static uint16_t crc16(const char* buf, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc << 8) ^ crc16tab[((crc >> 8) ^ (unsigned char) buf[i]) &
+            0xff];
+    }
+    return crc;
+}
+
+uint32_t key_hash_slot(const char* key, size_t len) {
+    const char* open = memchr(key, '{', len);
+    if (open != NULL) {
+        size_t start = open - key + 1;
+        const char* close = memchr(open + 1, '}', len - start);
+        if (close != NULL && close > open + 1) {
+            return crc16(open + 1, close - open - 1) & (CLUSTER_SLOTS - 1);
+        }
+    }
+    return crc16(key, len) & (CLUSTER_SLOTS - 1);
+}
+
+static unsigned char* put_be(unsigned char* p, uint64_t v, int32_t n) {
+    for (int32_t i = 0; i < n; i++) p[i] = v >> (8 * (n - 1 - i));
+    return p + n;
+}
+
+static uint64_t get_be(const unsigned char* p, int32_t n) {
+    uint64_t v = 0;
+    for (int32_t i = 0; i < n; i++) v = v << 8 | p[i];
+    return v;
+}
+
+/** Unix ms of a monotonic timestamp, 0 stays 0 */
+static int64_t mono_to_unix_ms(int64_t t) {
+    if (t == 0) return 0;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t now = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    return now - (get_monotonic_ms() - t);
+}
+
+/** ------------------------------ Nodes ---------------------------------- */
+
+static void random_node_name(char* name) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char bytes[CLUSTER_NAMELEN / 2];
+
+    FILE* fp = fopen("/dev/urandom", "r");
+    if (fp == NULL || fread(bytes, sizeof bytes, 1, fp) != 1) {
+        for (uint32_t i = 0; i < sizeof bytes; i++) bytes[i] = rand();
+    }
+    if (fp != NULL) fclose(fp);
+
+    for (uint32_t i = 0; i < sizeof bytes; i++) {
+        name[2 * i] = hex[bytes[i] >> 4];
+        name[2 * i + 1] = hex[bytes[i] & 15];
+    }
+}
+
+/** A node with a random ID when `name` is NULL */
+static struct cluster_node_t* create_node(const char* name, uint32_t flags) {
+    struct cluster_node_t* n = calloc(1, sizeof(struct cluster_node_t));
+    if (n == NULL) return NULL;
+
+    if (name != NULL) {
+        memcpy(n->name, name, CLUSTER_NAMELEN);
+    } else {
+        random_node_name(n->name);
+    }
+    n->flags = flags;
+    n->ctime = get_monotonic_ms();
+    return n;
+}
+
+static struct cluster_node_t* lookup_node(const char* name, size_t len) {
+    struct dict_entry_t* e = dict_find(server.cluster->nodes, name, len);
+    return e != NULL ? e->val : NULL;
+}
+
+static int32_t add_node(struct cluster_node_t* n) {
+    if (dict_add(server.cluster->nodes, n->name, CLUSTER_NAMELEN, n) !=
+            DICT_OK) {
+        free(n);
+        return -1;
+    }
+    return 0;
+}
+
+static inline int32_t node_has_slot(const struct cluster_node_t* n,
+        uint32_t slot) {
+    return n->slots[slot >> 3] >> (slot & 7) & 1;
+}
+
+/** Give the slot to `n`, or nobody when NULL */
+static void assign_slot(uint32_t slot, struct cluster_node_t* n) {
+    struct cluster_state_t* cs = server.cluster;
+    struct cluster_node_t* old = cs->slots[slot];
+
+    if (old != NULL && node_has_slot(old, slot)) {
+        old->slots[slot >> 3] &= ~(1 << (slot & 7));
+        old->numslots--;
+    }
+    cs->slots[slot] = n;
+    if (n != NULL && !node_has_slot(n, slot)) {
+        n->slots[slot >> 3] |= 1 << (slot & 7);
+        n->numslots++;
+    }
+}
+
+static void free_link(struct cluster_link_t*);
+
+static void del_node(struct cluster_node_t* n) {
+    struct cluster_state_t* cs = server.cluster;
+
+    for (uint32_t j = 0; j < CLUSTER_SLOTS; j++) {
+        if (cs->slots[j] == n) assign_slot(j, NULL);
+        if (cs->importing_slots_from[j] == n) {
+            cs->importing_slots_from[j] = NULL;
+        }
+        if (cs->migrating_slots_to[j] == n) cs->migrating_slots_to[j] = NULL;
+    }
+    if (n->link != NULL) free_link(n->link);
+    if (n->inbound_link != NULL) free_link(n->inbound_link);
+    dict_delete(cs->nodes, n->name, CLUSTER_NAMELEN);
+    free(n);
+}
+
+/** A handshake node learned its ID */
+static int32_t rename_node(struct cluster_node_t* n, const char* name) {
+    struct dict_entry_t* e = dict_unlink(server.cluster->nodes, n->name,
+            CLUSTER_NAMELEN);
+    if (e != NULL) dict_free_unlinked(e);
+
+    log_notice("[cluster] Renamed node %.40s to %.40s", n->name, name);
+    memcpy(n->name, name, CLUSTER_NAMELEN);
+    return dict_add(server.cluster->nodes, n->name, CLUSTER_NAMELEN, n) ==
+        DICT_OK ? 0 : -1;
+}
+
+/** A snapshot of the nodes, so that the caller can delete some */
+static struct cluster_node_t** nodes_array(uint32_t* n) {
+    struct dict_iter_t it;
+    struct dict_entry_t* e;
+    struct cluster_node_t** nodes = malloc(sizeof(struct cluster_node_t*) *
+            dict_size(server.cluster->nodes));
+    if (nodes == NULL) return NULL;
+
+    *n = 0;
+    dict_init_iter(server.cluster->nodes, &it);
+    while ((e = dict_next(&it)) != NULL) nodes[(*n)++] = e->val;
+    dict_release_iter(&it);
+    return nodes;
+}
+
+/** The cluster is up while every slot has an owner */
+static void update_state() {
+    struct cluster_state_t* cs = server.cluster;
+    int32_t state = CLUSTER_OK;
+
+    for (uint32_t j = 0; j < CLUSTER_SLOTS; j++) {
+        if (cs->slots[j] == NULL) {
+            state = CLUSTER_FAIL;
+            break;
+        }
+    }
+
+    struct dict_iter_t it;
+    struct dict_entry_t* e;
+    cs->size = 0;
+    dict_init_iter(cs->nodes, &it);
+    while ((e = dict_next(&it)) != NULL) {
+        cs->size += ((struct cluster_node_t*) e->val)->numslots > 0;
+    }
+    dict_release_iter(&it);
+
+    if (state != cs->state) {
+        log_notice("[cluster] Cluster state changed: %s",
+                state == CLUSTER_OK ? "ok" : "fail");
+        cs->state = state;
+    }
+}
+
+/** Take a config epoch greater than every other node's */
+static void bump_config_epoch() {
+    struct cluster_state_t* cs = server.cluster;
+    cs->current_epoch++;
+    cs->myself->config_epoch = cs->current_epoch;
+    log_notice("[cluster] New config epoch set to %lu",
+            (unsigned long) cs->myself->config_epoch);
+}
+
+/** ------------------------------ Links ---------------------------------- */
+
+static struct cluster_link_t* create_link(int32_t fd, int32_t inbound) {
+    struct cluster_link_t* link = calloc(1, sizeof(struct cluster_link_t));
+    if (link == NULL) return NULL;
+
+    link->fd = fd;
+    link->inbound = inbound;
+    link->connected = inbound;
+    link->ctime = get_monotonic_ms();
+    return link;
+}
+
+static void free_link(struct cluster_link_t* link) {
+    unregister_event(server.el, link->fd, E_RECV | E_WRITEABLE);
+    close(link->fd);
+    if (link->node != NULL) {
+        if (link->node->link == link) link->node->link = NULL;
+        if (link->node->inbound_link == link) link->node->inbound_link = NULL;
+    }
+    free(link->sndbuf);
+    free(link->rcvbuf);
+    free(link);
+}
+
+static int32_t grow_buf(unsigned char** buf, size_t* cap, size_t need) {
+    if (need <= *cap) return 0;
+
+    size_t cap2 = *cap == 0 ? CLUSTER_MSG_HDR_SIZE : *cap;
+    while (cap2 < need) cap2 *= 2;
+    unsigned char* b = realloc(*buf, cap2);
+    if (b == NULL) return -1;
+    *buf = b;
+    *cap = cap2;
+    return 0;
+}
+
+/** Write what the socket takes. Return -1 if the link was freed. */
+static int32_t link_flush(struct cluster_link_t* link) {
+    while (link->snd_len > 0) {
+        ssize_t n = send(link->fd, link->sndbuf, link->snd_len,
+                MSG_NOSIGNAL);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n == -1) {
+            log_verbose("[cluster] Bus write error: %s", strerror(errno));
+            free_link(link);
+            return -1;
+        }
+        memmove(link->sndbuf, link->sndbuf + n, link->snd_len - n);
+        link->snd_len -= n;
+    }
+
+    if (link->snd_len > 0 && !link->write_handler) {
+        if (register_event(server.el, link->fd, E_WRITEABLE,
+                    link_write_handle, link) != OK) {
+            free_link(link);
+            return -1;
+        }
+        link->write_handler = 1;
+    } else if (link->snd_len == 0 && link->write_handler) {
+        unregister_event(server.el, link->fd, E_WRITEABLE);
+        link->write_handler = 0;
+    }
+    return 0;
+}
+
+/** Queue a message, sent once connected. Return -1 if the link was freed. */
+static int32_t link_send(struct cluster_link_t* link,
+        const unsigned char* msg, size_t len) {
+    if (grow_buf(&link->sndbuf, &link->snd_cap, link->snd_len + len) == -1) {
+        free_link(link);
+        return -1;
+    }
+    memcpy(link->sndbuf + link->snd_len, msg, len);
+    link->snd_len += len;
+    server.cluster->stat_messages_sent++;
+    return link->connected ? link_flush(link) : 0;
+}
+
+/** Connection completed (outbound), or the socket takes more bytes */
+static void link_write_handle(struct event_loop_t* el, int32_t fd,
+        void* data) {
+    struct cluster_link_t* link = data;
+
+    if (!link->connected) {
+        int32_t err = 0;
+        socklen_t len = sizeof err;
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+            err = errno;
+        }
+        if (err != 0) {
+            log_verbose("[cluster] Connecting to node %.40s failed: %s",
+                    link->node->name, strerror(err));
+            free_link(link);
+            return;
+        }
+        link->connected = 1;
+        if (register_reader(el, fd, link_recv_handle, link) != OK) {
+            free_link(link);
+            return;
+        }
+    }
+    link_flush(link);
+}
+
+static struct cluster_link_t* connect_node(struct cluster_node_t* n) {
+    struct sockaddr_in sa = { 0 };
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(n->cport);
+    if (inet_pton(AF_INET, n->ip, &sa.sin_addr) != 1) return NULL;
+
+    int32_t fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            0);
+    if (fd == -1) return NULL;
+    if (connect(fd, (struct sockaddr*) &sa, sizeof sa) == -1 &&
+            errno != EINPROGRESS) {
+        close(fd);
+        return NULL;
+    }
+    set_tcp_nodelay(fd);
+
+    struct cluster_link_t* link = create_link(fd, 0);
+    if (link == NULL) {
+        close(fd);
+        return NULL;
+    }
+    link->node = n;
+    n->link = link;
+
+    /** Writable once connected, link_write_handle() takes it from there */
+    if (register_event(server.el, fd, E_WRITEABLE, link_write_handle, link)
+            != OK) {
+        free_link(link);
+        return NULL;
+    }
+    link->write_handler = 1;
+    return link;
+}
+
+/** ------------------------------ Messages ------------------------------- */
+
+/**
+ * Header and gossip about max(3, nodes / 10) random nodes that `to` might
+ * not know. Return NULL out of memory.
+ * */
+static unsigned char* build_message(int32_t type,
+        const struct cluster_node_t* to, size_t* len) {
+    struct cluster_state_t* cs = server.cluster;
+    struct cluster_node_t* myself = cs->myself;
+    uint32_t n = 0;
+    struct cluster_node_t** nodes = nodes_array(&n);
+    if (nodes == NULL) return NULL;
+
+    uint32_t ncand = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        struct cluster_node_t* node = nodes[i];
+        if (node == myself || node == to || node->ip[0] == '\0' ||
+                (node->flags & CLUSTER_NODE_HANDSHAKE)) {
+            continue;
+        }
+        nodes[ncand++] = node;
+    }
+    uint32_t wanted = n / 10 < 3 ? 3 : n / 10;
+    if (wanted > ncand) wanted = ncand;
+    for (uint32_t i = 0; i < wanted; i++) {
+        uint32_t j = i + rand() % (ncand - i);
+        struct cluster_node_t* tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+    }
+
+    *len = CLUSTER_MSG_HDR_SIZE + wanted * CLUSTER_GOSSIP_SIZE;
+    unsigned char* buf = calloc(1, *len);
+    if (buf == NULL) {
+        free(nodes);
+        return NULL;
+    }
+
+    unsigned char* p = buf;
+    memcpy(p, CLUSTER_MSG_SIG, 4);
+    p = put_be(p + 4, *len, 4);
+    p = put_be(p, CLUSTER_MSG_VERSION, 2);
+    p = put_be(p, type, 2);
+    p = put_be(p, wanted, 2);
+    p = put_be(p, cs->current_epoch, 8);
+    p = put_be(p, myself->config_epoch, 8);
+    memcpy(p, myself->name, CLUSTER_NAMELEN);
+    p += CLUSTER_NAMELEN;
+    memcpy(p, myself->slots, sizeof myself->slots);
+    p += sizeof myself->slots;
+    p = put_be(p, myself->port, 2);
+    p = put_be(p, myself->cport, 2);
+
+    for (uint32_t i = 0; i < wanted; i++) {
+        memcpy(p, nodes[i]->name, CLUSTER_NAMELEN);
+        p += CLUSTER_NAMELEN;
+        memcpy(p, nodes[i]->ip, INET6_ADDRSTRLEN);
+        p += INET6_ADDRSTRLEN;
+        p = put_be(p, nodes[i]->port, 2);
+        p = put_be(p, nodes[i]->cport, 2);
+    }
+    free(nodes);
+    return buf;
+}
+
+/** Return -1 if the link was freed */
+static int32_t send_message(struct cluster_link_t* link, int32_t type) {
+    size_t len;
+    unsigned char* buf = build_message(type, link->node, &len);
+    if (buf == NULL) return 0;
+
+    if (type != CLUSTER_MSG_PONG && link->node != NULL &&
+            link->node->ping_sent == 0) {
+        link->node->ping_sent = get_monotonic_ms();
+    }
+    int32_t ret = link_send(link, buf, len);
+    free(buf);
+    return ret;
+}
+
+/** Spread a slot change right away instead of waiting for the pings */
+static void broadcast_pong() {
+    uint32_t n = 0;
+    struct cluster_node_t** nodes = nodes_array(&n);
+    if (nodes == NULL) return;
+
+    for (uint32_t i = 0; i < n; i++) {
+        struct cluster_link_t* link = nodes[i]->link;
+        if (link != NULL && link->connected &&
+                !(nodes[i]->flags & CLUSTER_NODE_HANDSHAKE)) {
+            send_message(link, CLUSTER_MSG_PONG);
+        }
+    }
+    free(nodes);
+}
+
+/**
+ * Slots the sender claims with a greater config epoch than their owner's
+ * are now the sender's. Keys left in a slot this node lost are deleted.
+ * */
+static void update_slots_from(struct cluster_node_t* sender,
+        const unsigned char* slots) {
+    struct cluster_state_t* cs = server.cluster;
+    int32_t changed = 0;
+
+    for (uint32_t j = 0; j < CLUSTER_SLOTS; j++) {
+        if (slots[j >> 3] == 0) {
+            j |= 7;
+            continue;
+        }
+        if (!(slots[j >> 3] >> (j & 7) & 1)) continue;
+
+        struct cluster_node_t* owner = cs->slots[j];
+        if (owner == sender || cs->importing_slots_from[j] != NULL) continue;
+        if (owner != NULL && owner->config_epoch >= sender->config_epoch) {
+            continue;
+        }
+
+        if (owner == cs->myself) {
+            cs->migrating_slots_to[j] = NULL;
+            uint64_t deleted = db_del_keys_in_slot(server.db, j);
+            if (deleted > 0) {
+                log_warning("[cluster] Lost hash slot %u to %.40s, deleted "
+                        "%lu keys", j, sender->name, (unsigned long) deleted);
+                server.dirty += deleted;
+            }
+        }
+        assign_slot(j, sender);
+        changed = 1;
+    }
+    if (changed) update_state();
+}
+
+/**
+ * Two nodes with the same config epoch would keep each other's slot
+ * claims forever: the one with the smaller ID takes a new epoch.
+ * */
+static void handle_epoch_collision(struct cluster_node_t* sender) {
+    struct cluster_node_t* myself = server.cluster->myself;
+
+    if (sender->config_epoch != myself->config_epoch ||
+            memcmp(sender->name, myself->name, CLUSTER_NAMELEN) <= 0) {
+        return;
+    }
+    bump_config_epoch();
+}
+
+/** Add the nodes we hear of for the first time */
+static void process_gossip(const unsigned char* p, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++, p += CLUSTER_GOSSIP_SIZE) {
+        const char* name = (const char*) p;
+        const char* ip = (const char*) p + CLUSTER_NAMELEN;
+        const unsigned char* ports = p + CLUSTER_NAMELEN + INET6_ADDRSTRLEN;
+
+        if (ip[0] == '\0' || memchr(ip, '\0', INET6_ADDRSTRLEN) == NULL ||
+                lookup_node(name, CLUSTER_NAMELEN) != NULL) {
+            continue;
+        }
+
+        struct cluster_node_t* n = create_node(name, 0);
+        if (n == NULL) return;
+        memcpy(n->ip, ip, INET6_ADDRSTRLEN);
+        n->port = get_be(ports, 2);
+        n->cport = get_be(ports + 2, 2);
+        if (add_node(n) == 0) {
+            log_notice("[cluster] Learned about node %.40s at %s:%u",
+                    n->name, n->ip, n->port);
+        }
+    }
+}
+
+static void socket_ip(int32_t fd, int32_t peer, char* ip) {
+    struct sockaddr_storage sa;
+    socklen_t len = sizeof sa;
+
+    if ((peer ? getpeername(fd, (struct sockaddr*) &sa, &len) :
+                getsockname(fd, (struct sockaddr*) &sa, &len)) == -1) {
+        return;
+    }
+    inet_ntop(sa.ss_family, get_in_addr((struct sockaddr*) &sa), ip,
+            INET6_ADDRSTRLEN);
+}
+
+/** Return -1 if the link was freed */
+static int32_t process_message(struct cluster_link_t* link,
+        const unsigned char* msg, uint32_t len) {
+    struct cluster_state_t* cs = server.cluster;
+    struct cluster_node_t* myself = cs->myself;
+
+    cs->stat_messages_received++;
+    if (get_be(msg + 8, 2) != CLUSTER_MSG_VERSION) return 0;
+
+    uint32_t type = get_be(msg + 10, 2);
+    uint32_t count = get_be(msg + 12, 2);
+    if (len != CLUSTER_MSG_HDR_SIZE + count * CLUSTER_GOSSIP_SIZE) {
+        free_link(link);
+        return -1;
+    }
+    uint64_t current_epoch = get_be(msg + 14, 8);
+    uint64_t config_epoch = get_be(msg + 22, 8);
+    const char* name = (const char*) msg + 30;
+    const unsigned char* slots = msg + 30 + CLUSTER_NAMELEN;
+    const unsigned char* ports = slots + CLUSTER_SLOTS / 8;
+    uint32_t port = get_be(ports, 2);
+    uint32_t cport = get_be(ports + 2, 2);
+    int64_t now = get_monotonic_ms();
+
+    struct cluster_node_t* sender = lookup_node(name, CLUSTER_NAMELEN);
+    if (sender == myself) return 0;
+
+    /** Our address is the one peers reach us at */
+    if (link->inbound && myself->ip[0] == '\0') {
+        socket_ip(link->fd, 0, myself->ip);
+    }
+
+    if (type == CLUSTER_MSG_MEET && sender == NULL) {
+        if ((sender = create_node(name, 0)) == NULL) return 0;
+        socket_ip(link->fd, 1, sender->ip);
+        sender->port = port;
+        sender->cport = cport;
+        if (add_node(sender) == -1) return 0;
+        log_notice("[cluster] Met node %.40s at %s:%u", sender->name,
+                sender->ip, port);
+    }
+
+    if (link->inbound && sender != NULL && link->node != sender) {
+        if (sender->inbound_link != NULL) free_link(sender->inbound_link);
+        link->node = sender;
+        sender->inbound_link = link;
+    }
+
+    if (type == CLUSTER_MSG_PONG && !link->inbound) {
+        struct cluster_node_t* n = link->node;
+        if (n->flags & CLUSTER_NODE_HANDSHAKE) {
+            /** Known under its ID already: the handshake was redundant */
+            if (sender != NULL) {
+                del_node(n);
+                return -1;
+            }
+            if (rename_node(n, name) == -1) {
+                del_node(n);
+                return -1;
+            }
+            n->flags &= ~(CLUSTER_NODE_HANDSHAKE | CLUSTER_NODE_MEET);
+            sender = n;
+        } else if (memcmp(n->name, name, CLUSTER_NAMELEN) != 0) {
+            log_warning("[cluster] Node at %s:%u answers as %.40s instead of "
+                    "%.40s", n->ip, n->port, name, n->name);
+            free_link(link);
+            return -1;
+        }
+        n->pong_received = now;
+        n->ping_sent = 0;
+        if (n->flags & CLUSTER_NODE_PFAIL) {
+            n->flags &= ~CLUSTER_NODE_PFAIL;
+            log_notice("[cluster] Node %.40s is reachable again", n->name);
+        }
+    }
+
+    if (sender != NULL && !(sender->flags & CLUSTER_NODE_HANDSHAKE)) {
+        if (current_epoch > cs->current_epoch) {
+            cs->current_epoch = current_epoch;
+        }
+        if (config_epoch > sender->config_epoch) {
+            sender->config_epoch = config_epoch;
+        }
+        sender->port = port;
+        sender->cport = cport;
+        update_slots_from(sender, slots);
+        handle_epoch_collision(sender);
+        process_gossip(msg + CLUSTER_MSG_HDR_SIZE, count);
+    }
+
+    if (type == CLUSTER_MSG_PING || type == CLUSTER_MSG_MEET) {
+        return send_message(link, CLUSTER_MSG_PONG);
+    }
+    return 0;
+}
+
+static void link_recv_handle(struct event_loop_t* el, int32_t fd,
+        const char* buf, ssize_t len, void* data) {
+    struct cluster_link_t* link = data;
+
+    if (len <= 0) {
+        if (link->node != NULL) {
+            log_verbose("[cluster] Bus link to node %.40s closed",
+                    link->node->name);
+        }
+        free_link(link);
+        return;
+    }
+    if (grow_buf(&link->rcvbuf, &link->rcv_cap, link->rcv_len + len) == -1) {
+        free_link(link);
+        return;
+    }
+    memcpy(link->rcvbuf + link->rcv_len, buf, len);
+    link->rcv_len += len;
+
+    size_t off = 0;
+    while (link->rcv_len - off >= 8) {
+        const unsigned char* msg = link->rcvbuf + off;
+        uint64_t totlen = get_be(msg + 4, 4);
+        if (memcmp(msg, CLUSTER_MSG_SIG, 4) != 0 ||
+                totlen < CLUSTER_MSG_HDR_SIZE || totlen >
+                CLUSTER_MSG_HDR_SIZE + CLUSTER_GOSSIP_MAX *
+                CLUSTER_GOSSIP_SIZE) {
+            log_warning("[cluster] Bad message on the cluster bus");
+            free_link(link);
+            return;
+        }
+        if (link->rcv_len - off < totlen) break;
+        if (process_message(link, msg, totlen) == -1) return;
+        off += totlen;
+    }
+    memmove(link->rcvbuf, link->rcvbuf + off, link->rcv_len - off);
+    link->rcv_len -= off;
+}
+
+static void cluster_accept_handle(struct event_loop_t* el, int32_t bus_fd,
+        int32_t fd, void* _) {
+    if (fd < 0) {
+        log_warning("[cluster] Bus accept error: %s", strerror(-fd));
+        return;
+    }
+    set_tcp_nodelay(fd);
+
+    struct cluster_link_t* link = create_link(fd, 1);
+    if (link == NULL) {
+        close(fd);
+        return;
+    }
+    if (register_reader(el, fd, link_recv_handle, link) != OK) {
+        free_link(link);
+    }
+}
+
+/** ------------------------------ Setup and cron ------------------------- */
+
+int32_t cluster_init(struct event_loop_t* el) {
+    srand(time(NULL) ^ getpid());
+
+    struct cluster_state_t* cs = calloc(1, sizeof(struct cluster_state_t));
+    if (cs == NULL) return -1;
+    cs->state = CLUSTER_FAIL;
+    cs->bus_fd = -1;
+    if ((cs->nodes = create_dict(NULL)) == NULL) goto err;
+    server.cluster = cs;
+
+    uint32_t cport = config.cluster_port != 0 ? config.cluster_port :
+        config.port + CLUSTER_PORT_INCR;
+    if (cport > 65535) {
+        log_warning("[cluster_init] Cluster bus port %u is out of range, set "
+                "--cluster-port", cport);
+        goto err;
+    }
+
+    struct cluster_node_t* myself = create_node(NULL, CLUSTER_NODE_MYSELF);
+    if (myself == NULL || add_node(myself) == -1) goto err;
+    myself->port = config.port;
+    myself->cport = cport;
+    cs->myself = myself;
+
+    if ((cs->bus_fd = setup(cport)) == -1 ||
+            register_acceptor(el, cs->bus_fd, cluster_accept_handle, NULL) !=
+            OK) {
+        goto err;
+    }
+    log_notice("[cluster_init] Node %.40s, cluster bus on port %u",
+            myself->name, cport);
+    return 0;
+
+err:
+    if (cs->bus_fd != -1) close(cs->bus_fd);
+    if (cs->myself != NULL) free(cs->myself);
+    if (cs->nodes != NULL) free_dict(cs->nodes);
+    free(cs);
+    server.cluster = NULL;
+    return -1;
+}
+
+void cluster_cron() {
+    struct cluster_state_t* cs = server.cluster;
+    int64_t now = get_monotonic_ms();
+    int64_t timeout = config.cluster_node_timeout;
+    int64_t handshake_timeout = timeout > 1000 ? timeout : 1000;
+    uint32_t n = 0;
+    struct cluster_node_t** nodes = nodes_array(&n);
+    if (nodes == NULL) return;
+
+    for (uint32_t i = 0; i < n; i++) {
+        struct cluster_node_t* node = nodes[i];
+        if (node == cs->myself) continue;
+
+        if ((node->flags & CLUSTER_NODE_HANDSHAKE) &&
+                now - node->ctime > handshake_timeout) {
+            log_notice("[cluster] Handshake with %s:%u timed out", node->ip,
+                    node->port);
+            del_node(node);
+            nodes[i] = NULL;
+            continue;
+        }
+        if (node->link == NULL && node->ip[0] != '\0' &&
+                connect_node(node) != NULL) {
+            send_message(node->link, (node->flags & CLUSTER_NODE_MEET) ?
+                    CLUSTER_MSG_MEET : CLUSTER_MSG_PING);
+        }
+    }
+
+    /** Once a second ping the node heard of least recently of a few */
+    if (cs->cronloops++ % SERVER_CRON_HZ == 0 && n > 0) {
+        struct cluster_node_t* best = NULL;
+        for (uint32_t k = 0; k < CLUSTER_PING_SAMPLES; k++) {
+            struct cluster_node_t* node = nodes[rand() % n];
+            if (node == NULL || node == cs->myself || node->link == NULL ||
+                    node->ping_sent != 0 ||
+                    (node->flags & CLUSTER_NODE_HANDSHAKE)) {
+                continue;
+            }
+            if (best == NULL || node->pong_received < best->pong_received) {
+                best = node;
+            }
+        }
+        if (best != NULL) send_message(best->link, CLUSTER_MSG_PING);
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        struct cluster_node_t* node = nodes[i];
+        if (node == NULL || node == cs->myself ||
+                (node->flags & CLUSTER_NODE_HANDSHAKE)) {
+            continue;
+        }
+
+        /** A link with no pong for half the timeout is likely stuck */
+        if (node->link != NULL && node->ping_sent != 0 &&
+                now - node->link->ctime > timeout &&
+                now - node->ping_sent > timeout / 2) {
+            free_link(node->link);
+        }
+        if (node->link != NULL && node->link->connected &&
+                node->ping_sent == 0 &&
+                now - node->pong_received > timeout / 2) {
+            send_message(node->link, CLUSTER_MSG_PING);
+        }
+        if (node->ping_sent != 0 && now - node->ping_sent > timeout &&
+                !(node->flags & CLUSTER_NODE_PFAIL)) {
+            node->flags |= CLUSTER_NODE_PFAIL;
+            log_notice("[cluster] Node %.40s is possibly failing",
+                    node->name);
+        }
+    }
+    free(nodes);
+    update_state();
+}
+
+/** ------------------------------ Redirection ---------------------------- */
+
+int32_t cluster_redirect(struct client_t* c, struct command_t* cmd) {
+    struct cluster_state_t* cs = server.cluster;
+    struct resp_arg_t* argv = c->req.argv;
+    struct keys_result_t keys;
+    int32_t redirected = 1;
+
+    int32_t n = get_keys_from_command(cmd, argv, c->req.argc, &keys);
+    if (n == -1) {
+        add_reply_error(c, "out of memory");
+        goto out;
+    }
+
+    int32_t slot = -1;
+    int32_t missing = 0;
+    for (int32_t i = 0; i < n; i++) {
+        struct resp_arg_t* key = &argv[keys.keys[i]];
+        int32_t s = key_hash_slot(key->ptr, key->len);
+        if (slot != -1 && s != slot) {
+            add_reply_error(c, "-CROSSSLOT Keys in request don't hash to the "
+                    "same slot");
+            goto out;
+        }
+        slot = s;
+        missing += dict_find(server.db->dict, key->ptr, key->len) == NULL;
+    }
+    if (n == 0) {
+        redirected = 0;
+        goto out;
+    }
+
+    struct cluster_node_t* node = cs->slots[slot];
+    if (node == NULL) {
+        add_reply_error_format(c, "-CLUSTERDOWN Hash slot not served");
+        goto out;
+    }
+    if (cs->state != CLUSTER_OK) {
+        add_reply_error(c, "-CLUSTERDOWN The cluster is down");
+        goto out;
+    }
+
+    /**
+     * Keys not here anymore are on the target already. MIGRATE itself
+     * runs here and skips them.
+     * */
+    if (node == cs->myself && cs->migrating_slots_to[slot] != NULL &&
+            missing > 0 && cmd->proc != migrate_command) {
+        if (missing < n) goto tryagain;
+        node = cs->migrating_slots_to[slot];
+        add_reply_error_format(c, "-ASK %d %s:%u", slot, node->ip,
+                node->port);
+        goto out;
+    }
+    if (node != cs->myself && cs->importing_slots_from[slot] != NULL &&
+            ((c->flags & CLIENT_ASKING) || (cmd->flags & CMD_ASKING))) {
+        if (n > 1 && missing > 0) goto tryagain;
+        redirected = 0;
+        goto out;
+    }
+    if (node != cs->myself) {
+        add_reply_error_format(c, "-MOVED %d %s:%u", slot, node->ip,
+                node->port);
+        goto out;
+    }
+    redirected = 0;
+    goto out;
+
+tryagain:
+    add_reply_error(c, "-TRYAGAIN Multiple keys request during rehashing of "
+            "slot");
+out:
+    free_keys_result(&keys);
+    return redirected;
+}
+
+/** ------------------------------ Commands ------------------------------- */
+
+void asking_command(struct client_t* c) {
+    if (server.cluster == NULL) {
+        add_reply_error(c, "This instance has cluster support disabled");
+        return;
+    }
+    c->flags |= CLIENT_ASKING;
+    add_reply_status(c, "OK");
+}
+
+static int32_t parse_slot(struct client_t* c, const struct resp_arg_t* a) {
+    int64_t slot;
+    if (!resp_string2ll(a->ptr, a->len, &slot) || slot < 0 ||
+            slot >= CLUSTER_SLOTS) {
+        add_reply_error(c, "Invalid or out of range slot");
+        return -1;
+    }
+    return slot;
+}
+
+static struct cluster_node_t* lookup_node_or_reply(struct client_t* c,
+        const struct resp_arg_t* a) {
+    struct cluster_node_t* n = lookup_node(a->ptr, a->len);
+    if (n == NULL) {
+        add_reply_error_format(c, "I don't know about node %.*s",
+                (int) (a->len > 64 ? 64 : a->len), a->ptr);
+    }
+    return n;
+}
+
+/** "start-end" or "slot" of the runs of slots of `n` */
+static void write_node_slots(FILE* f, const struct cluster_node_t* n) {
+    for (uint32_t j = 0; j < CLUSTER_SLOTS; j++) {
+        if (!node_has_slot(n, j)) continue;
+
+        uint32_t start = j;
+        while (j + 1 < CLUSTER_SLOTS && node_has_slot(n, j + 1)) j++;
+        if (start == j) {
+            fprintf(f, " %u", j);
+        } else {
+            fprintf(f, " %u-%u", start, j);
+        }
+    }
+}
+
+static void write_node_line(FILE* f, const struct cluster_node_t* n) {
+    struct cluster_state_t* cs = server.cluster;
+    char flags[64] = "";
+
+    if (n->flags & CLUSTER_NODE_MYSELF) strcat(flags, "myself,");
+    if (n->flags & CLUSTER_NODE_HANDSHAKE) {
+        strcat(flags, "handshake,");
+    } else {
+        strcat(flags, "master,");
+    }
+    if (n->flags & CLUSTER_NODE_PFAIL) strcat(flags, "fail?,");
+    flags[strlen(flags) - 1] = '\0';
+
+    int32_t connected = (n->flags & CLUSTER_NODE_MYSELF) ||
+        (n->link != NULL && n->link->connected);
+    fprintf(f, "%.40s %s:%u@%u %s - %ld %ld %lu %s", n->name, n->ip, n->port,
+            n->cport, flags, (long) mono_to_unix_ms(n->ping_sent),
+            (long) mono_to_unix_ms(n->pong_received),
+            (unsigned long) n->config_epoch,
+            connected ? "connected" : "disconnected");
+    write_node_slots(f, n);
+
+    if (n->flags & CLUSTER_NODE_MYSELF) {
+        for (uint32_t j = 0; j < CLUSTER_SLOTS; j++) {
+            if (cs->migrating_slots_to[j] != NULL) {
+                fprintf(f, " [%u->-%.40s]", j, cs->migrating_slots_to[j]->name);
+            }
+            if (cs->importing_slots_from[j] != NULL) {
+                fprintf(f, " [%u-<-%.40s]", j,
+                        cs->importing_slots_from[j]->name);
+            }
+        }
+    }
+    fputs("\n", f);
+}
+
+static void cluster_nodes(struct client_t* c) {
+    char* text = NULL;
+    size_t len = 0;
+    FILE* f = open_memstream(&text, &len);
+    if (f == NULL) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+
+    struct dict_iter_t it;
+    struct dict_entry_t* e;
+    dict_init_iter(server.cluster->nodes, &it);
+    while ((e = dict_next(&it)) != NULL) write_node_line(f, e->val);
+    dict_release_iter(&it);
+
+    fclose(f);
+    add_reply_bulk(c, text, len);
+    free(text);
+}
+
+static void cluster_info(struct client_t* c) {
+    struct cluster_state_t* cs = server.cluster;
+    uint32_t assigned = 0, pfail = 0;
+
+    for (uint32_t j = 0; j < CLUSTER_SLOTS; j++) {
+        if (cs->slots[j] == NULL) continue;
+        assigned++;
+        pfail += (cs->slots[j]->flags & CLUSTER_NODE_PFAIL) != 0;
+    }
+
+    char* text = NULL;
+    size_t len = 0;
+    FILE* f = open_memstream(&text, &len);
+    if (f == NULL) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+    fprintf(f, "cluster_state:%s\r\n"
+            "cluster_slots_assigned:%u\r\n"
+            "cluster_slots_ok:%u\r\n"
+            "cluster_slots_pfail:%u\r\n"
+            "cluster_slots_fail:0\r\n"
+            "cluster_known_nodes:%lu\r\n"
+            "cluster_size:%u\r\n"
+            "cluster_current_epoch:%lu\r\n"
+            "cluster_my_epoch:%lu\r\n"
+            "cluster_stats_messages_sent:%lu\r\n"
+            "cluster_stats_messages_received:%lu\r\n",
+            cs->state == CLUSTER_OK ? "ok" : "fail", assigned,
+            assigned - pfail, pfail, (unsigned long) dict_size(cs->nodes),
+            cs->size, (unsigned long) cs->current_epoch,
+            (unsigned long) cs->myself->config_epoch,
+            (unsigned long) cs->stat_messages_sent,
+            (unsigned long) cs->stat_messages_received);
+    fclose(f);
+    add_reply_bulk(c, text, len);
+    free(text);
+}
+
+/** [[start, end, [ip, port, id]], ...] for each run of slots */
+static void cluster_slots(struct client_t* c) {
+    struct cluster_state_t* cs = server.cluster;
+
+    for (int32_t pass = 0; pass < 2; pass++) {
+        int64_t ranges = 0;
+        for (uint32_t j = 0; j < CLUSTER_SLOTS; j++) {
+            struct cluster_node_t* n = cs->slots[j];
+            if (n == NULL) continue;
+
+            uint32_t start = j;
+            while (j + 1 < CLUSTER_SLOTS && cs->slots[j + 1] == n) j++;
+            ranges++;
+            if (pass == 0) continue;
+
+            add_reply_array_len(c, 3);
+            add_reply_long_long(c, start);
+            add_reply_long_long(c, j);
+            add_reply_array_len(c, 3);
+            add_reply_bulk(c, n->ip, strlen(n->ip));
+            add_reply_long_long(c, n->port);
+            add_reply_bulk(c, n->name, CLUSTER_NAMELEN);
+        }
+        if (pass == 0) add_reply_array_len(c, ranges);
+    }
+}
+
+static void cluster_getkeysinslot(struct client_t* c, uint32_t slot,
+        int64_t count) {
+    unsigned char prefix[2] = { slot >> 8, slot };
+    struct rax_iter_t ri;
+    uint64_t n = db_count_keys_in_slot(server.db, slot);
+
+    if ((uint64_t) count < n) n = count;
+    add_reply_array_len(c, n);
+    rax_iter_start(&ri, server.db->slots_to_keys);
+    int32_t more = rax_seek(&ri, ">=", prefix, sizeof prefix);
+    for (uint64_t i = 0; i < n && more; i++, more = rax_next(&ri)) {
+        add_reply_bulk(c, (const char*) ri.key + 2, ri.key_len - 2);
+    }
+    rax_iter_release(&ri);
+}
+
+/**
+ * ADDSLOTS / DELSLOTS slot ... and ADDSLOTSRANGE / DELSLOTSRANGE start end
+ * ... on this node. Nothing changes unless every slot is valid.
+ * */
+static void cluster_update_slots(struct client_t* c, int32_t add,
+        int32_t range) {
+    struct cluster_state_t* cs = server.cluster;
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+
+    if (range && (argc - 2) % 2 != 0) {
+        add_reply_error(c, "wrong number of arguments for the RANGE "
+                "subcommand");
+        return;
+    }
+    unsigned char* seen = calloc(CLUSTER_SLOTS, 1);
+    if (seen == NULL) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+
+    for (int32_t i = 2; i < argc; i += range ? 2 : 1) {
+        int32_t start = parse_slot(c, &argv[i]);
+        int32_t end = start;
+        if (start == -1 || (range && (end = parse_slot(c, &argv[i + 1])) ==
+                    -1)) {
+            goto out;
+        }
+        if (start > end) {
+            add_reply_error_format(c, "start slot number %d is greater than "
+                    "end slot number %d", start, end);
+            goto out;
+        }
+        for (int32_t j = start; j <= end; j++) {
+            if (add && cs->slots[j] != NULL) {
+                add_reply_error_format(c, "Slot %d is already busy", j);
+                goto out;
+            }
+            if (!add && cs->slots[j] == NULL) {
+                add_reply_error_format(c, "Slot %d is already unassigned", j);
+                goto out;
+            }
+            if (seen[j]++) {
+                add_reply_error_format(c, "Slot %d specified multiple times",
+                        j);
+                goto out;
+            }
+        }
+    }
+
+    for (uint32_t j = 0; j < CLUSTER_SLOTS; j++) {
+        if (!seen[j]) continue;
+        if (add && cs->importing_slots_from[j] == cs->myself) {
+            cs->importing_slots_from[j] = NULL;
+        }
+        assign_slot(j, add ? cs->myself : NULL);
+    }
+    update_state();
+    add_reply_status(c, "OK");
+
+out:
+    free(seen);
+}
+
+/** SETSLOT slot MIGRATING node | IMPORTING node | STABLE | NODE node */
+static void cluster_setslot(struct client_t* c) {
+    struct cluster_state_t* cs = server.cluster;
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    struct cluster_node_t* n = NULL;
+
+    int32_t slot = parse_slot(c, &argv[2]);
+    if (slot == -1) return;
+
+    if (arg_is(&argv[3], "stable") && argc == 4) {
+        cs->migrating_slots_to[slot] = NULL;
+        cs->importing_slots_from[slot] = NULL;
+        add_reply_status(c, "OK");
+        return;
+    }
+    if (argc != 5) {
+        add_reply_error(c, "syntax error");
+        return;
+    }
+    if ((n = lookup_node_or_reply(c, &argv[4])) == NULL) return;
+
+    if (arg_is(&argv[3], "migrating")) {
+        if (cs->slots[slot] != cs->myself) {
+            add_reply_error_format(c, "I'm not the owner of hash slot %d",
+                    slot);
+            return;
+        }
+        if (n == cs->myself) {
+            add_reply_error(c, "I can't migrate to myself");
+            return;
+        }
+        cs->migrating_slots_to[slot] = n;
+    } else if (arg_is(&argv[3], "importing")) {
+        if (cs->slots[slot] == cs->myself) {
+            add_reply_error_format(c, "I'm already the owner of hash slot %d",
+                    slot);
+            return;
+        }
+        if (n == cs->myself) {
+            add_reply_error(c, "I can't import from myself");
+            return;
+        }
+        cs->importing_slots_from[slot] = n;
+    } else if (arg_is(&argv[3], "node")) {
+        uint64_t keys = db_count_keys_in_slot(server.db, slot);
+        if (cs->slots[slot] == cs->myself && n != cs->myself && keys > 0) {
+            add_reply_error_format(c, "Can't assign hashslot %d to a "
+                    "different node while I still hold keys for this hash "
+                    "slot.", slot);
+            return;
+        }
+        if (keys == 0) cs->migrating_slots_to[slot] = NULL;
+
+        /**
+         * The importing node ends the migration with a new epoch, so
+         * that its claim of the slot beats the source's everywhere.
+         * */
+        int32_t bump = n == cs->myself &&
+            cs->importing_slots_from[slot] != NULL;
+        if (n == cs->myself) cs->importing_slots_from[slot] = NULL;
+        assign_slot(slot, n);
+        if (bump) bump_config_epoch();
+        update_state();
+        broadcast_pong();
+    } else {
+        add_reply_error(c, "Invalid CLUSTER SETSLOT action or number of "
+                "arguments");
+        return;
+    }
+    add_reply_status(c, "OK");
+}
+
+/** MEET ip port [cport] */
+static void cluster_meet(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    char ip[INET6_ADDRSTRLEN];
+    struct in_addr addr;
+    int64_t port, cport;
+
+    if (argv[2].len >= sizeof ip) goto invalid;
+    memcpy(ip, argv[2].ptr, argv[2].len);
+    ip[argv[2].len] = '\0';
+    if (inet_pton(AF_INET, ip, &addr) != 1 ||
+            !resp_string2ll(argv[3].ptr, argv[3].len, &port) || port <= 0 ||
+            port > 65535) {
+        goto invalid;
+    }
+    cport = port + CLUSTER_PORT_INCR;
+    if (c->req.argc == 5 && (!resp_string2ll(argv[4].ptr, argv[4].len,
+                    &cport) || cport <= 0)) {
+        goto invalid;
+    }
+    if (cport > 65535) goto invalid;
+
+    /** Already meeting it */
+    struct dict_iter_t it;
+    struct dict_entry_t* e;
+    int32_t found = 0;
+    dict_init_iter(server.cluster->nodes, &it);
+    while ((e = dict_next(&it)) != NULL) {
+        struct cluster_node_t* n = e->val;
+        found |= (n->flags & CLUSTER_NODE_HANDSHAKE) &&
+            strcmp(n->ip, ip) == 0 && n->port == port && n->cport == cport;
+    }
+    dict_release_iter(&it);
+
+    if (!found) {
+        struct cluster_node_t* n = create_node(NULL, CLUSTER_NODE_HANDSHAKE |
+                CLUSTER_NODE_MEET);
+        if (n == NULL || add_node(n) == -1) {
+            add_reply_error(c, "out of memory");
+            return;
+        }
+        memcpy(n->ip, ip, sizeof ip);
+        n->port = port;
+        n->cport = cport;
+    }
+    add_reply_status(c, "OK");
+    return;
+
+invalid:
+    add_reply_error_format(c, "Invalid node address specified: %.*s:%.*s",
+            (int) (argv[2].len > 64 ? 64 : argv[2].len), argv[2].ptr,
+            (int) (argv[3].len > 16 ? 16 : argv[3].len), argv[3].ptr);
+}
+
+/**
+ * CLUSTER MYID | NODES | INFO | SLOTS | KEYSLOT key | COUNTKEYSINSLOT slot
+ *       | GETKEYSINSLOT slot count | MEET ip port [cport]
+ *       | ADDSLOTS slot ... | ADDSLOTSRANGE start end ... | DELSLOTS ...
+ *       | DELSLOTSRANGE ... | SETSLOT ... | BUMPEPOCH
+ * */
+void cluster_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    struct resp_arg_t* sub = &argv[1];
+
+    if (server.cluster == NULL) {
+        add_reply_error(c, "This instance has cluster support disabled");
+        return;
+    }
+
+    if (arg_is(sub, "myid") && argc == 2) {
+        add_reply_bulk(c, server.cluster->myself->name, CLUSTER_NAMELEN);
+    } else if (arg_is(sub, "nodes") && argc == 2) {
+        cluster_nodes(c);
+    } else if (arg_is(sub, "info") && argc == 2) {
+        cluster_info(c);
+    } else if (arg_is(sub, "slots") && argc == 2) {
+        cluster_slots(c);
+    } else if (arg_is(sub, "keyslot") && argc == 3) {
+        add_reply_long_long(c, key_hash_slot(argv[2].ptr, argv[2].len));
+    } else if (arg_is(sub, "countkeysinslot") && argc == 3) {
+        int32_t slot = parse_slot(c, &argv[2]);
+        if (slot == -1) return;
+        add_reply_long_long(c, db_count_keys_in_slot(server.db, slot));
+    } else if (arg_is(sub, "getkeysinslot") && argc == 4) {
+        int64_t count;
+        int32_t slot = parse_slot(c, &argv[2]);
+        if (slot == -1) return;
+        if (!resp_string2ll(argv[3].ptr, argv[3].len, &count) || count < 0) {
+            add_reply_error(c, "Invalid number of keys");
+            return;
+        }
+        cluster_getkeysinslot(c, slot, count);
+    } else if (arg_is(sub, "meet") && (argc == 4 || argc == 5)) {
+        cluster_meet(c);
+    } else if (arg_is(sub, "addslots") && argc >= 3) {
+        cluster_update_slots(c, 1, 0);
+    } else if (arg_is(sub, "addslotsrange") && argc >= 4) {
+        cluster_update_slots(c, 1, 1);
+    } else if (arg_is(sub, "delslots") && argc >= 3) {
+        cluster_update_slots(c, 0, 0);
+    } else if (arg_is(sub, "delslotsrange") && argc >= 4) {
+        cluster_update_slots(c, 0, 1);
+    } else if (arg_is(sub, "setslot") && argc >= 4) {
+        cluster_setslot(c);
+    } else if (arg_is(sub, "bumpepoch") && argc == 2) {
+        bump_config_epoch();
+        add_reply_status(c, "BUMPED");
+    } else {
+        add_reply_error_format(c, "unknown subcommand or wrong number of "
+                "arguments for '%.*s'", (int) (sub->len > 64 ? 64 : sub->len),
+                sub->ptr);
+    }
+}
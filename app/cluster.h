@@ -0,0 +1,109 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "dict.h"
+#include "event_loop.h"
+#include "networking.h"
+
+#define CLUSTER_SLOTS   16384
+#define CLUSTER_NAMELEN 40 // hex characters of a node ID
+
+#define CLUSTER_OK   0
+#define CLUSTER_FAIL 1 // some slot has no owner
+
+/** cluster_node_t.flags */
+#define CLUSTER_NODE_MYSELF    (1 << 0)
+#define CLUSTER_NODE_PFAIL     (1 << 1) // no pong within cluster-node-timeout
+#define CLUSTER_NODE_HANDSHAKE (1 << 2) // met by address, ID not known yet
+#define CLUSTER_NODE_MEET      (1 << 3) // greet with MEET instead of PING
+
+
+struct command_t;
+
+/**
+ * A cluster bus connection. Each node gets an outbound link from us and
+ * an inbound link from its own cron. Messages are framed from `rcvbuf`,
+ * `sndbuf` holds what the socket did not take yet.
+ * */
+struct cluster_link_t {
+    int32_t                fd;
+    int32_t                connected; // outbound connect() completed
+    int32_t                inbound;
+    int32_t                write_handler; // E_WRITEABLE is registered
+    int64_t                ctime;     // monotonic ms
+    struct cluster_node_t* node;      // NULL until an inbound link is named
+    unsigned char*         sndbuf;
+    size_t                 snd_len;
+    size_t                 snd_cap;
+    unsigned char*         rcvbuf;
+    size_t                 rcv_len;
+    size_t                 rcv_cap;
+};
+
+struct cluster_node_t {
+    char                   name[CLUSTER_NAMELEN];
+    uint32_t               flags;
+    uint64_t               config_epoch; // the slot claims of the higher wins
+    unsigned char          slots[CLUSTER_SLOTS / 8];
+    uint32_t               numslots;
+    char                   ip[INET6_ADDRSTRLEN]; // empty until known
+    uint32_t               port;
+    uint32_t               cport;
+    int64_t                ctime;         // monotonic ms, as all times below
+    int64_t                ping_sent;     // 0 when no ping is outstanding
+    int64_t                pong_received;
+    struct cluster_link_t* link;          // outbound
+    struct cluster_link_t* inbound_link;
+};
+
+/**
+ * This node's view of the cluster. A slot is served by `slots[slot]`,
+ * while it moves the source points `migrating_slots_to` at the target and
+ * the target points `importing_slots_from` at the source.
+ * */
+struct cluster_state_t {
+    struct cluster_node_t* myself;
+    uint64_t               current_epoch;
+    int32_t                state; // CLUSTER_OK / CLUSTER_FAIL
+    uint32_t               size;  // nodes serving at least one slot
+    int32_t                bus_fd;
+    struct dict_t*         nodes; // name -> cluster_node_t
+    struct cluster_node_t* slots[CLUSTER_SLOTS];
+    struct cluster_node_t* migrating_slots_to[CLUSTER_SLOTS];
+    struct cluster_node_t* importing_slots_from[CLUSTER_SLOTS];
+    uint64_t               stat_messages_sent;
+    uint64_t               stat_messages_received;
+    uint64_t               cronloops;
+};
+
+
+/**
+ * Hash slot of a key: CRC16 of the key, or of the part between the first
+ * "{" and the next "}" when that is not empty, modulo 16384.
+ * */
+uint32_t key_hash_slot(const char*, size_t);
+
+/**
+ * Create this node with a random ID and listen on the cluster bus port
+ * (cluster-port, or port + 10000) with the server's event loop.
+ * */
+int32_t cluster_init(struct event_loop_t*);
+
+/** Reconnect links, ping, detect failures. Runs SERVER_CRON_HZ a second. */
+void cluster_cron();
+
+/**
+ * Check that this node serves the keys of the request. Return 1 after
+ * replying -MOVED, -ASK, -CROSSSLOT, -TRYAGAIN or -CLUSTERDOWN instead.
+ * */
+int32_t cluster_redirect(struct client_t*, struct command_t*);
+
+void cluster_command(struct client_t*);
+
+void asking_command(struct client_t*);
+
+#endif // !CLUSTER_H
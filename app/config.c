@@ -1,15 +1,317 @@
 #include <errno.h>
 #include <netdb.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "config.h"
+#include "log.h"
 
 
-int32_t setup() {
+static const char* const loglevel_names[] = {
+    "debug", "verbose", "notice", "warning", NULL
+};
+
+/** Indexed by EL_BACKEND_* */
+static const char* const io_backend_names[] = {
+    "poll", "epoll", "io_uring", NULL
+};
+
+/** Indexed by CLIENT_TYPE_* */
+static const char* const client_type_names[] = {
+    "normal", "replica", "pubsub", NULL
+};
+
+struct config_t config = {
+    .port          = DEFAULT_PORT,
+    .loglevel      = LOG_LEVEL,
+    .maxclients    = DEFAULT_MAXCLIENTS,
+    .tcp_backlog   = DEFAULT_TCP_BACKLOG,
+    .tcp_nodelay   = 1,
+    .tcp_keepalive = DEFAULT_TCP_KEEPALIVE,
+    .io_backend    = DEFAULT_IO_BACKEND,
+    .client_query_buffer_limit = DEFAULT_CLIENT_QUERY_BUFFER_LIMIT,
+    .maxmemory_clients = DEFAULT_MAXMEMORY_CLIENTS,
+    .client_obuf_limits = {
+        [CLIENT_TYPE_NORMAL]  = { 0, 0, 0 },
+        [CLIENT_TYPE_REPLICA] = { 256ULL << 20, 64ULL << 20, 60 },
+        [CLIENT_TYPE_PUBSUB]  = { 32ULL << 20, 8ULL << 20, 60 },
+    },
+    .hll_sparse_max_bytes = DEFAULT_HLL_SPARSE_MAX_BYTES,
+    .stream_node_max_bytes = DEFAULT_STREAM_NODE_MAX_BYTES,
+    .stream_node_max_entries = DEFAULT_STREAM_NODE_MAX_ENTRIES,
+    .cluster_node_timeout = DEFAULT_CLUSTER_NODE_TIMEOUT,
+    .tracking_table_max_keys = DEFAULT_TRACKING_TABLE_MAX_KEYS,
+    .active_defrag_ignore_bytes = DEFAULT_ACTIVE_DEFRAG_IGNORE_BYTES,
+    .active_defrag_threshold_lower = DEFAULT_ACTIVE_DEFRAG_THRESHOLD_LOWER,
+    .active_defrag_threshold_upper = DEFAULT_ACTIVE_DEFRAG_THRESHOLD_UPPER,
+    .active_defrag_cycle_min = DEFAULT_ACTIVE_DEFRAG_CYCLE_MIN,
+    .active_defrag_cycle_max = DEFAULT_ACTIVE_DEFRAG_CYCLE_MAX,
+    .hotkeys_sample_ratio = DEFAULT_HOTKEYS_SAMPLE_RATIO,
+    .bigkeys_scan_interval = DEFAULT_BIGKEYS_SCAN_INTERVAL,
+};
+
+static struct config_option_t config_options[] = {
+    { "port",          CONFIG_UINT, &config.port,          1, 65535 },
+    { "unixsocket",    CONFIG_STRING, &config.unixsocket,  0, 0 },
+    { "unixsocketperm", CONFIG_OCTAL, &config.unixsocketperm, 0, 0777 },
+    { "loglevel",      CONFIG_ENUM, &config.loglevel,      0, 0, 
+        loglevel_names },
+    { "maxclients",    CONFIG_UINT, &config.maxclients,    1, UINT32_MAX },
+    { "tcp-backlog",   CONFIG_UINT, &config.tcp_backlog,   1, INT32_MAX },
+    { "tcp-nodelay",   CONFIG_BOOL, &config.tcp_nodelay,   0, 1 },
+    { "tcp-keepalive", CONFIG_UINT, &config.tcp_keepalive, 0, INT32_MAX },
+    { "io-backend",    CONFIG_ENUM, &config.io_backend,    0, 0,
+        io_backend_names },
+    { "client-query-buffer-limit", CONFIG_MEMORY,
+        &config.client_query_buffer_limit, 1024 * 1024, UINT64_MAX },
+    { "maxmemory-clients", CONFIG_MEMORY, &config.maxmemory_clients, 0,
+        UINT64_MAX },
+    { "client-output-buffer-limit", CONFIG_OBUF_LIMIT,
+        config.client_obuf_limits, 0, 0, client_type_names },
+    { "hll-sparse-max-bytes", CONFIG_UINT, &config.hll_sparse_max_bytes, 0,
+        16384 },
+    { "stream-node-max-bytes", CONFIG_UINT, &config.stream_node_max_bytes,
+        0, INT32_MAX },
+    { "stream-node-max-entries", CONFIG_UINT,
+        &config.stream_node_max_entries, 0, INT32_MAX },
+    { "cluster-enabled", CONFIG_BOOL, &config.cluster_enabled, 0, 1 },
+    { "cluster-port",  CONFIG_UINT, &config.cluster_port,  0, 65535 },
+    { "cluster-node-timeout", CONFIG_UINT, &config.cluster_node_timeout,
+        100, INT32_MAX },
+    { "tracking-table-max-keys", CONFIG_UINT,
+        &config.tracking_table_max_keys, 0, INT32_MAX },
+    { "activedefrag",  CONFIG_BOOL, &config.activedefrag,  0, 1 },
+    { "active-defrag-ignore-bytes", CONFIG_MEMORY,
+        &config.active_defrag_ignore_bytes, 0, UINT64_MAX },
+    { "active-defrag-threshold-lower", CONFIG_UINT,
+        &config.active_defrag_threshold_lower, 0, 1000 },
+    { "active-defrag-threshold-upper", CONFIG_UINT,
+        &config.active_defrag_threshold_upper, 0, 1000 },
+    { "active-defrag-cycle-min", CONFIG_UINT,
+        &config.active_defrag_cycle_min, 1, 99 },
+    { "active-defrag-cycle-max", CONFIG_UINT,
+        &config.active_defrag_cycle_max, 1, 99 },
+    { "hotkeys-sample-ratio", CONFIG_UINT, &config.hotkeys_sample_ratio,
+        0, 1 << 20 },
+    { "bigkeys-scan-interval", CONFIG_UINT, &config.bigkeys_scan_interval,
+        0, INT32_MAX },
+};
+
+
+static struct config_option_t* find_config_option(const char* name) {
+    for (uint32_t i = 0; i < sizeof config_options / sizeof config_options[0];
+            i++) {
+        if (strcasecmp(config_options[i].name, name) == 0) {
+            return &config_options[i];
+        }
+    }
+    return NULL;
+}
+
+/** "100", "64kb", "1g", ... Return -1 on a malformed value or overflow. */
+static int32_t parse_memory(const char* value, uint64_t* bytes) {
+    char* end = NULL;
+
+    errno = 0;
+    unsigned long long v = strtoull(value, &end, 10);
+    if (errno != 0 || end == value || *value == '-') return -1;
+
+    uint64_t mul = 1;
+    if (strcasecmp(end, "k") == 0) mul = 1000;
+    else if (strcasecmp(end, "kb") == 0) mul = 1024;
+    else if (strcasecmp(end, "m") == 0) mul = 1000 * 1000;
+    else if (strcasecmp(end, "mb") == 0) mul = 1024 * 1024;
+    else if (strcasecmp(end, "g") == 0) mul = 1000ULL * 1000 * 1000;
+    else if (strcasecmp(end, "gb") == 0) mul = 1024ULL * 1024 * 1024;
+    else if (*end != '\0') return -1;
+
+    if (v > UINT64_MAX / mul) return -1;
+    *bytes = v * mul;
+    return 0;
+}
+
+static int32_t set_obuf_limit(struct config_option_t* opt, const char* value) {
+    char class[16];
+    char hard[32], soft[32];
+    uint32_t seconds;
+    char extra;
+    struct client_buffer_limit_t limit;
+
+    if (sscanf(value, "%15s %31s %31s %u %c", class, hard, soft, &seconds,
+                &extra) != 4 || parse_memory(hard, &limit.hard) == -1 ||
+            parse_memory(soft, &limit.soft) == -1) {
+        log_warning("[load_config] --%s expects \"<class> <hard> <soft> "
+                "<soft seconds>\"", opt->name);
+        return -1;
+    }
+    limit.soft_seconds = seconds;
+
+    for (uint32_t i = 0; opt->enum_names[i] != NULL; i++) {
+        if (strcasecmp(class, opt->enum_names[i]) == 0) {
+            ((struct client_buffer_limit_t*) opt->value)[i] = limit;
+            return 0;
+        }
+    }
+    log_warning("[load_config] invalid client class '%s' for --%s", class,
+            opt->name);
+    return -1;
+}
+
+static int32_t set_config_option(struct config_option_t* opt, 
+        const char* value) {
+    char* end = NULL;
+
+    switch (opt->type) {
+    case CONFIG_UINT: {
+        errno = 0;
+        unsigned long long v = strtoull(value, &end, 10);
+        if (errno != 0 || *value == '\0' || *end != '\0' || v < opt->min || 
+                v > opt->max) {
+            log_warning("[load_config] --%s expects an integer in [%lu, %lu]",
+                    opt->name, (unsigned long) opt->min, 
+                    (unsigned long) opt->max);
+            return -1;
+        }
+        *(uint32_t*) opt->value = v;
+        return 0;
+    }
+    case CONFIG_BOOL:
+        if (strcasecmp(value, "yes") == 0) {
+            *(uint32_t*) opt->value = 1;
+        } else if (strcasecmp(value, "no") == 0) {
+            *(uint32_t*) opt->value = 0;
+        } else {
+            log_warning("[load_config] --%s expects yes or no", opt->name);
+            return -1;
+        }
+        return 0;
+    case CONFIG_ENUM:
+        for (uint32_t i = 0; opt->enum_names[i] != NULL; i++) {
+            if (strcasecmp(value, opt->enum_names[i]) == 0) {
+                *(uint32_t*) opt->value = i;
+                return 0;
+            }
+        }
+        log_warning("[load_config] invalid value '%s' for --%s", value,
+                opt->name);
+        return -1;
+    case CONFIG_MEMORY: {
+        uint64_t v;
+        if (parse_memory(value, &v) == -1 || v < opt->min || v > opt->max) {
+            log_warning("[load_config] --%s expects a size in [%lu, %lu] "
+                    "bytes, e.g. 64mb", opt->name, (unsigned long) opt->min,
+                    (unsigned long) opt->max);
+            return -1;
+        }
+        *(uint64_t*) opt->value = v;
+        return 0;
+    }
+    case CONFIG_OBUF_LIMIT:
+        return set_obuf_limit(opt, value);
+    case CONFIG_STRING:
+        *(const char**) opt->value = *value != '\0' ? value : NULL;
+        return 0;
+    case CONFIG_OCTAL: {
+        errno = 0;
+        unsigned long v = strtoul(value, &end, 8);
+        if (errno != 0 || *value == '\0' || *end != '\0' || v < opt->min ||
+                v > opt->max) {
+            log_warning("[load_config] --%s expects an octal mode in "
+                    "[%lo, %lo]", opt->name, (unsigned long) opt->min,
+                    (unsigned long) opt->max);
+            return -1;
+        }
+        *(uint32_t*) opt->value = v;
+        return 0;
+    }
+    default:
+        return -1;
+    }
+}
+
+int32_t load_config(int32_t argc, char** argv) {
+    struct config_option_t* opt = NULL;
+
+    for (int32_t i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0 || 
+                (opt = find_config_option(argv[i] + 2)) == NULL) {
+            log_warning("[load_config] unknown option %s", argv[i]);
+            return -1;
+        }
+        if (i + 1 == argc) {
+            log_warning("[load_config] missing value for %s", argv[i]);
+            return -1;
+        }
+        if (set_config_option(opt, argv[++i]) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int32_t adjust_open_files_limit() {
+    struct rlimit limit;
+    rlim_t need = (rlim_t) config.maxclients + CONFIG_MIN_RESERVED_FDS;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        log_warning("[adjust_open_files_limit] getrlimit error: %s",
+                strerror(errno));
+        return -1;
+    }
+
+    if (limit.rlim_cur >= need) return 0;
+
+    rlim_t old = limit.rlim_cur;
+    limit.rlim_cur = limit.rlim_max == RLIM_INFINITY || limit.rlim_max >= need
+        ? need : limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        limit.rlim_cur = old;
+    }
+
+    if (limit.rlim_cur >= need) {
+        log_notice("[adjust_open_files_limit] max open files raised to %lu",
+                (unsigned long) limit.rlim_cur);
+        return 0;
+    }
+
+    if (limit.rlim_cur <= CONFIG_MIN_RESERVED_FDS) {
+        log_warning("[adjust_open_files_limit] max open files %lu is too low "
+                "to serve any client", (unsigned long) limit.rlim_cur);
+        return -1;
+    }
+
+    config.maxclients = limit.rlim_cur - CONFIG_MIN_RESERVED_FDS;
+    log_warning("[adjust_open_files_limit] max open files is %lu, maxclients "
+            "lowered to %u", (unsigned long) limit.rlim_cur, config.maxclients);
+
+    return 0;
+}
+
+/** The kernel silently truncates the listen backlog to somaxconn */
+static void check_somaxconn() {
+    FILE* fp = fopen("/proc/sys/net/core/somaxconn", "r");
+    if (fp == NULL) return;
+
+    uint32_t somaxconn = 0;
+    if (fscanf(fp, "%u", &somaxconn) == 1 && somaxconn < config.tcp_backlog) {
+        log_warning("[setup] tcp-backlog %u cannot be enforced because "
+                "/proc/sys/net/core/somaxconn is set to the lower value of %u",
+                config.tcp_backlog, somaxconn);
+    }
+    fclose(fp);
+}
+
+int32_t setup(uint32_t port) {
     /** Server Configuration */
+    char service[8];
     int32_t server_fd = -1;
     int32_t rcode = -1;
     int32_t reuse_port = 1;
@@ -23,22 +325,25 @@ int32_t setup() {
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE;
 
-    if ((rcode = getaddrinfo(NULL, PORT, &hints, &server_opts)) != 0)
+    snprintf(service, sizeof service, "%u", port);
+    if ((rcode = getaddrinfo(NULL, service, &hints, &server_opts)) != 0)
     {
-        printf("getaddrinfo error: %s\n", gai_strerror(rcode));
+        log_warning("[setup] getaddrinfo error: %s", gai_strerror(rcode));
         return -1;
     }
 
     for (server_info = server_opts; server_info; server_info = server_info->ai_next)
     {
-        if ((server_fd = socket(server_info->ai_family, server_info->ai_socktype, server_info->ai_protocol)) == -1)
+        if ((server_fd = socket(server_info->ai_family, 
+                        server_info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        server_info->ai_protocol)) == -1)
         {
-            printf("socket error: %s\n", strerror(errno));
+            log_warning("[setup] socket error: %s", strerror(errno));
             continue;
         }
         if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse_port, sizeof(int)) == -1)
         {
-            printf("setsockopt error %s:\n", strerror(errno));
+            log_warning("[setup] setsockopt error: %s", strerror(errno));
 
             freeaddrinfo(server_opts);
 
@@ -47,7 +352,7 @@ int32_t setup() {
         if (bind(server_fd, server_info->ai_addr, server_info->ai_addrlen) == -1)
         {
             close(server_fd);
-            printf("bind error %s:\n", strerror(errno));
+            log_warning("[setup] bind error: %s", strerror(errno));
             continue;
         }
         break;
@@ -57,15 +362,55 @@ int32_t setup() {
 
     if (!server_info)
     {
-        printf("Failed to bind\n");
+        log_warning("[setup] Failed to bind");
         return -1;
     }
 
-    if (listen(server_fd, BACKLOG) == -1)
+    if (listen(server_fd, config.tcp_backlog) == -1)
     {
-        printf("listen error: %s\n", strerror(errno));
+        log_warning("[setup] listen error: %s", strerror(errno));
+        close(server_fd);
         return -1;
     }
 
+    check_somaxconn();
+
     return server_fd;
 }
+
+int32_t setup_unix(const char* path, uint32_t perm) {
+    struct sockaddr_un sa = { 0 };
+    int32_t fd = -1;
+
+    if (strlen(path) >= sizeof sa.sun_path) {
+        log_warning("[setup_unix] Unix socket path %s is too long", path);
+        return -1;
+    }
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))
+            == -1) {
+        log_warning("[setup_unix] socket error: %s", strerror(errno));
+        return -1;
+    }
+    /** A previous run that did not exit cleanly leaves the file behind */
+    unlink(path);
+    if (bind(fd, (struct sockaddr*) &sa, sizeof sa) == -1) {
+        log_warning("[setup_unix] bind %s error: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (perm != 0 && chmod(path, perm) == -1) {
+        log_warning("[setup_unix] chmod %s error: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, config.tcp_backlog) == -1) {
+        log_warning("[setup_unix] listen error: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
@@ -3,11 +3,129 @@
 
 #include <stdint.h>
 
-#define BACKLOG 10
-#define PORT "6379"
+#include "event_loop.h"
+#include "log.h"
 
+#define DEFAULT_PORT 6379
 
-int32_t setup();
+#define LOG_FILE  NULL      // NULL logs to stdout
+#define LOG_LEVEL LL_NOTICE
+
+#define DEFAULT_MAXCLIENTS    10000
+#define DEFAULT_TCP_BACKLOG   511
+#define DEFAULT_TCP_KEEPALIVE 300 // seconds, 0 disables
+#define DEFAULT_IO_BACKEND    EL_BACKEND_EPOLL
+#define DEFAULT_CLIENT_QUERY_BUFFER_LIMIT (1024ULL * 1024 * 1024)
+#define DEFAULT_MAXMEMORY_CLIENTS 0 // bytes, 0 disables client eviction
+#define DEFAULT_HLL_SPARSE_MAX_BYTES 3000
+#define DEFAULT_STREAM_NODE_MAX_BYTES   4096
+#define DEFAULT_STREAM_NODE_MAX_ENTRIES 100
+#define DEFAULT_CLUSTER_NODE_TIMEOUT 15000 // ms
+#define DEFAULT_TRACKING_TABLE_MAX_KEYS 1000000
+#define DEFAULT_ACTIVE_DEFRAG_IGNORE_BYTES    (100ULL << 20)
+#define DEFAULT_ACTIVE_DEFRAG_THRESHOLD_LOWER 10  // percent over allocated
+#define DEFAULT_ACTIVE_DEFRAG_THRESHOLD_UPPER 100
+#define DEFAULT_ACTIVE_DEFRAG_CYCLE_MIN       1   // percent of CPU
+#define DEFAULT_ACTIVE_DEFRAG_CYCLE_MAX       25
+#define DEFAULT_HOTKEYS_SAMPLE_RATIO     8  // 1 command in 8 feeds the sketch
+#define DEFAULT_BIGKEYS_SCAN_INTERVAL    60 // seconds between two scans
+#define CLUSTER_PORT_INCR 10000 // bus port = port + this unless configured
+
+/** fds kept for listeners, log file, ... on top of maxclients */
+#define CONFIG_MIN_RESERVED_FDS 32
+/** Event loop is pre-sized to maxclients plus this many fds */
+#define CONFIG_FDSET_INCR (CONFIG_MIN_RESERVED_FDS + 96)
+
+#define CONFIG_UINT 0
+#define CONFIG_BOOL 1 // yes / no, stored as uint32_t
+#define CONFIG_ENUM 2 // one of `enum_names`, stored as its index
+#define CONFIG_MEMORY 3 // bytes with an optional k, kb, m, mb, g, gb suffix,
+                        // stored as uint64_t
+#define CONFIG_OBUF_LIMIT 4 // "<class> <hard> <soft> <soft seconds>"
+#define CONFIG_STRING 5 // stored as const char*, "" is NULL
+#define CONFIG_OCTAL 6  // file mode digits, stored as uint32_t
+
+/** Output buffer limit classes, see get_client_type() */
+#define CLIENT_TYPE_NORMAL  0
+#define CLIENT_TYPE_REPLICA 1
+#define CLIENT_TYPE_PUBSUB  2
+#define CLIENT_TYPE_COUNT   3
+
+
+/**
+ * A client whose pending replies reach `hard` bytes, or stay above `soft`
+ * bytes for more than `soft_seconds`, is disconnected. 0 disables a limit.
+ * */
+struct client_buffer_limit_t {
+    uint64_t hard;
+    uint64_t soft;
+    uint32_t soft_seconds;
+};
+
+
+struct config_t {
+    uint32_t port;
+    const char* unixsocket;  // NULL does not listen on a Unix socket
+    uint32_t unixsocketperm; // 0 keeps the mode the umask gives
+    uint32_t loglevel;
+    uint32_t maxclients;
+    uint32_t tcp_backlog;
+    uint32_t tcp_nodelay;
+    uint32_t tcp_keepalive;
+    uint32_t io_backend;    // EL_BACKEND_*, falls back when unavailable
+    uint64_t client_query_buffer_limit;
+    uint64_t maxmemory_clients; // evict the biggest clients above this
+    struct client_buffer_limit_t client_obuf_limits[CLIENT_TYPE_COUNT];
+    uint32_t hll_sparse_max_bytes; // sparse HLLs above this become dense
+    uint32_t stream_node_max_bytes;   // per stream block, 0 is unlimited
+    uint32_t stream_node_max_entries; // per stream block, 0 is unlimited
+    uint32_t cluster_enabled;
+    uint32_t cluster_port; // 0 is port + CLUSTER_PORT_INCR
+    uint32_t cluster_node_timeout; // ms without a pong before PFAIL
+    uint32_t tracking_table_max_keys; // keys evicted above it, 0 unlimited
+    uint32_t activedefrag;
+    uint64_t active_defrag_ignore_bytes; // RSS overhead tolerated anyway
+    uint32_t active_defrag_threshold_lower; // start a cycle above, percent
+    uint32_t active_defrag_threshold_upper; // use cycle_max above, percent
+    uint32_t active_defrag_cycle_min; // CPU percent
+    uint32_t active_defrag_cycle_max;
+    uint32_t hotkeys_sample_ratio; // 0 disables hot key detection
+    uint32_t bigkeys_scan_interval; // seconds, 0 disables the scan
+};
+
+/**
+ * One `--name value` command line option. `value` points into the global
+ * `config` and is parsed according to `type` within [min, max].
+ * */
+struct config_option_t {
+    const char* name;
+    int32_t     type;
+    void*       value;
+    uint64_t    min;
+    uint64_t    max;
+    const char* const* enum_names;
+};
+
+extern struct config_t config;
+
+
+/** Parse `--name value` pairs from the command line into `config` */
+int32_t load_config(int32_t, char**);
+
+/**
+ * Make sure RLIMIT_NOFILE can hold maxclients + CONFIG_MIN_RESERVED_FDS, 
+ * raising the soft limit when possible and lowering maxclients otherwise.
+ * */
+int32_t adjust_open_files_limit();
+
+/** Listen on the TCP `port` of every IPv4 interface, return the fd or -1 */
+int32_t setup(uint32_t);
+
+/**
+ * Listen on a Unix socket at `path`, replacing a stale socket file, with
+ * the file mode `perm` unless 0. Return the fd or -1.
+ * */
+int32_t setup_unix(const char*, uint32_t);
 
 
 #endif // !CONFIG_H
@@ -0,0 +1,267 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "cluster.h"
+#include "config.h"
+#include "db.h"
+#include "dict.h"
+#include "multi.h"
+#include "networking.h"
+#include "object.h"
+#include "rax.h"
+#include "server.h"
+#include "tracking.h"
+
+
+#define SLOT_KEY_STATIC 256
+
+
+struct db_t* create_db() {
+    struct db_t* db = calloc(1, sizeof(struct db_t));
+    if (db == NULL) return NULL;
+
+    db->dict = create_dict(decr_ref_count_void);
+    if (db->dict == NULL) goto err;
+    if (config.cluster_enabled) {
+        db->slots_to_keys = create_rax();
+        db->slot_counts = calloc(CLUSTER_SLOTS, sizeof(uint64_t));
+        if (db->slots_to_keys == NULL || db->slot_counts == NULL) goto err;
+    }
+    return db;
+
+err:
+    free_db(db);
+    return NULL;
+}
+
+void free_db(struct db_t* db) {
+    if (db == NULL) return;
+
+    if (db->dict != NULL) free_dict(db->dict);
+    if (db->slots_to_keys != NULL) free_rax(db->slots_to_keys, NULL);
+    free(db->slot_counts);
+    free(db);
+}
+
+/**
+ * Add (`add` 1) or remove the key from slots_to_keys. A failed insert
+ * leaves the key out of the index: it is still served, but missed by
+ * GETKEYSINSLOT and slot migration.
+ * */
+static void slot_index_update(struct db_t* db, const char* key, size_t len,
+        int32_t add) {
+    unsigned char tmp[SLOT_KEY_STATIC];
+    unsigned char* skey = len + 2 <= sizeof tmp ? tmp : malloc(len + 2);
+    if (skey == NULL) return;
+
+    uint32_t slot = key_hash_slot(key, len);
+    skey[0] = slot >> 8;
+    skey[1] = slot;
+    memcpy(skey + 2, key, len);
+    if (add) {
+        if (rax_insert(db->slots_to_keys, skey, len + 2, NULL, NULL) == 1) {
+            db->slot_counts[slot]++;
+        }
+    } else if (rax_remove(db->slots_to_keys, skey, len + 2, NULL)) {
+        db->slot_counts[slot]--;
+    }
+    if (skey != tmp) free(skey);
+}
+
+struct robj_t* lookup_key_write(struct db_t* db, const char* key,
+        size_t len) {
+    struct dict_entry_t* e = dict_find(db->dict, key, len);
+    if (e == NULL) return NULL;
+
+    struct robj_t* o = e->val;
+    if (o->refcount != OBJ_SHARED_REFCOUNT) o->lru = get_lru_clock();
+    return o;
+}
+
+struct robj_t* lookup_key_read(struct db_t* db, const char* key,
+        size_t len) {
+    struct robj_t* o = lookup_key_write(db, key, len);
+    if (o == NULL) {
+        db->stat_keyspace_misses++;
+    } else {
+        db->stat_keyspace_hits++;
+    }
+    return o;
+}
+
+int32_t check_type(struct client_t* c, const struct robj_t* o,
+        uint32_t type) {
+    if (o != NULL && o->type != type) {
+        add_reply_error(c, WRONGTYPE_ERR);
+        return 1;
+    }
+    return 0;
+}
+
+int32_t set_key(struct db_t* db, const char* key, size_t len,
+        struct robj_t* val) {
+    struct dict_entry_t* e = dict_add_or_find(db->dict, key, len, val);
+    if (e == NULL) {
+        decr_ref_count(val);
+        return DICT_ERR;
+    }
+
+    if (e->val != val) {
+        decr_ref_count(e->val);
+        e->val = val;
+    } else if (db->slots_to_keys != NULL) {
+        slot_index_update(db, key, len, 1);
+    }
+    return DICT_OK;
+}
+
+int32_t db_delete(struct db_t* db, const char* key, size_t len) {
+    if (dict_delete(db->dict, key, len) != DICT_OK) return 0;
+    if (db->slots_to_keys != NULL) slot_index_update(db, key, len, 0);
+    return 1;
+}
+
+struct robj_t* db_unshare_string_value(struct db_t* db, const char* key,
+        size_t len, struct robj_t* o) {
+    if (o->encoding == OBJ_ENCODING_RAW && o->refcount == 1) return o;
+
+    char tmp[OBJ_LONG_STR_SIZE];
+    size_t slen;
+    const char* s = obj_string_ptr(o, tmp, &slen);
+    struct robj_t* no = create_raw_string_object(s, slen);
+    if (no == NULL || set_key(db, key, len, no) != DICT_OK) return NULL;
+    return no;
+}
+
+void empty_db(struct db_t* db) {
+    struct dict_t* d = create_dict(decr_ref_count_void);
+    if (d == NULL) return;
+
+    if (db->slots_to_keys != NULL) {
+        struct rax_t* rt = create_rax();
+        if (rt == NULL) {
+            free_dict(d);
+            return;
+        }
+        free_rax(db->slots_to_keys, NULL);
+        db->slots_to_keys = rt;
+        memset(db->slot_counts, 0, CLUSTER_SLOTS * sizeof(uint64_t));
+    }
+    free_dict(db->dict);
+    db->dict = d;
+}
+
+void signal_modified_key(const char* key, size_t len) {
+    touch_watched_key(key, len);
+    tracking_invalidate_key(server.current_client, key, len);
+}
+
+void signal_flushed_db() {
+    touch_all_watched_keys();
+    tracking_invalidate_all();
+}
+
+uint64_t db_count_keys_in_slot(struct db_t* db, uint32_t slot) {
+    return db->slot_counts != NULL ? db->slot_counts[slot] : 0;
+}
+
+uint64_t db_del_keys_in_slot(struct db_t* db, uint32_t slot) {
+    unsigned char prefix[2] = { slot >> 8, slot };
+    struct rax_iter_t ri;
+    uint64_t deleted = 0;
+
+    if (db->slots_to_keys == NULL) return 0;
+
+    /** Seeking again after each delete keeps the iterator valid */
+    rax_iter_start(&ri, db->slots_to_keys);
+    while (db->slot_counts[slot] > 0 &&
+            rax_seek(&ri, ">=", prefix, sizeof prefix) &&
+            ri.key_len >= 2 && memcmp(ri.key, prefix, 2) == 0) {
+        signal_modified_key((const char*) ri.key + 2, ri.key_len - 2);
+        if (db_delete(db, (const char*) ri.key + 2, ri.key_len - 2)) {
+            deleted++;
+        } else if (rax_remove(db->slots_to_keys, ri.key, ri.key_len, NULL)) {
+            db->slot_counts[slot]--;
+        }
+    }
+    rax_iter_release(&ri);
+    return deleted;
+}
+
+/** ------------------------------ Commands ------------------------------- */
+
+void del_command(struct client_t* c) {
+    int64_t deleted = 0;
+    for (int32_t i = 1; i < c->req.argc; i++) {
+        struct resp_arg_t* key = &c->req.argv[i];
+        if (db_delete(server.db, key->ptr, key->len)) {
+            signal_modified_key(key->ptr, key->len);
+            deleted++;
+        }
+    }
+    server.dirty += deleted;
+    add_reply_long_long(c, deleted);
+}
+
+void exists_command(struct client_t* c) {
+    int64_t count = 0;
+    for (int32_t i = 1; i < c->req.argc; i++) {
+        count += lookup_key_read(server.db, c->req.argv[i].ptr,
+                c->req.argv[i].len) != NULL;
+    }
+    add_reply_long_long(c, count);
+}
+
+void dbsize_command(struct client_t* c) {
+    add_reply_long_long(c, db_size(server.db));
+}
+
+void flushall_command(struct client_t* c) {
+    server.dirty += db_size(server.db);
+    empty_db(server.db);
+    signal_flushed_db();
+    add_reply(c, "+OK\r\n", 5);
+}
+
+/** OBJECT ENCODING|REFCOUNT|IDLETIME key */
+void object_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+
+    if (c->req.argc != 3) {
+        add_reply_error(c, "syntax error, try OBJECT ENCODING|REFCOUNT|"
+                "IDLETIME key");
+        return;
+    }
+
+    /** Inspecting a key must not count as an access */
+    struct dict_entry_t* e = dict_find(server.db->dict, argv[2].ptr,
+            argv[2].len);
+    if (e == NULL) {
+        add_reply_null(c);
+        return;
+    }
+    struct robj_t* o = e->val;
+
+    if (argv[1].len == 8 && strncasecmp(argv[1].ptr, "encoding", 8) == 0) {
+        const char* name = obj_encoding_name(o->encoding);
+        add_reply_bulk(c, name, strlen(name));
+    } else if (argv[1].len == 8 &&
+            strncasecmp(argv[1].ptr, "refcount", 8) == 0) {
+        add_reply_long_long(c, o->refcount);
+    } else if (argv[1].len == 8 &&
+            strncasecmp(argv[1].ptr, "idletime", 8) == 0) {
+        add_reply_long_long(c, o->refcount == OBJ_SHARED_REFCOUNT ? 0 :
+                (get_lru_clock() - o->lru) & OBJ_LRU_CLOCK_MAX);
+    } else {
+        add_reply_error(c, "syntax error, try OBJECT ENCODING|REFCOUNT|"
+                "IDLETIME key");
+    }
+}
+
+void type_command(struct client_t* c) {
+    struct robj_t* o = lookup_key_read(server.db, c->req.argv[1].ptr,
+            c->req.argv[1].len);
+    add_reply_status(c, o == NULL ? "none" : obj_type_name(o->type));
+}
@@ -0,0 +1,95 @@
+#ifndef DB_H
+#define DB_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "dict.h"
+#include "networking.h"
+#include "object.h"
+#include "rax.h"
+
+#define WRONGTYPE_ERR \
+    "-WRONGTYPE Operation against a key holding the wrong kind of value"
+
+
+/**
+ * The keyspace, key -> robj_t. The dict owns one reference to each value.
+ * In cluster mode `slots_to_keys` also indexes the keys by hash slot, as
+ * the 2 byte big endian slot followed by the key.
+ * */
+struct db_t {
+    struct dict_t* dict;
+    struct rax_t*  slots_to_keys; // NULL unless cluster-enabled
+    uint64_t*      slot_counts;   // keys per slot, NULL with the above
+    uint64_t       stat_keyspace_hits;
+    uint64_t       stat_keyspace_misses;
+};
+
+
+struct db_t* create_db();
+
+void free_db(struct db_t*);
+
+/** Return the value and touch its LRU, or NULL. Counts hits / misses. */
+struct robj_t* lookup_key_read(struct db_t*, const char*, size_t);
+
+/** Like lookup_key_read() without touching the stats */
+struct robj_t* lookup_key_write(struct db_t*, const char*, size_t);
+
+/** Return 1 after replying WRONGTYPE when `o` exists with another type */
+int32_t check_type(struct client_t*, const struct robj_t*, uint32_t);
+
+/**
+ * Add or overwrite the key. The db takes over the caller's reference to the
+ * value. Return DICT_OK or DICT_ERR.
+ * */
+int32_t set_key(struct db_t*, const char*, size_t, struct robj_t*);
+
+/** Return 1 if the key existed */
+int32_t db_delete(struct db_t*, const char*, size_t);
+
+static inline uint64_t db_size(const struct db_t* db) {
+    return dict_size(db->dict);
+}
+
+/**
+ * Return a value of the key that can be modified in place: `o` itself when
+ * it is a RAW string nobody else references, or a RAW copy that replaces
+ * it. Return NULL on allocation failure.
+ * */
+struct robj_t* db_unshare_string_value(struct db_t*, const char*, size_t,
+        struct robj_t*);
+
+void empty_db(struct db_t*);
+
+/**
+ * The key was modified, by the command being executed or by an operation
+ * completing later: fail the transactions watching it and invalidate it
+ * in the caches of the tracking clients. Called wherever a key is written
+ * or deleted, never for keys only read or found missing.
+ * */
+void signal_modified_key(const char*, size_t);
+
+/** Every key is gone, e.g. FLUSHALL */
+void signal_flushed_db();
+
+/** Keys in a hash slot, cluster mode only */
+uint64_t db_count_keys_in_slot(struct db_t*, uint32_t);
+
+/** Delete every key of a hash slot, return how many there were */
+uint64_t db_del_keys_in_slot(struct db_t*, uint32_t);
+
+void del_command(struct client_t*);
+
+void exists_command(struct client_t*);
+
+void dbsize_command(struct client_t*);
+
+void flushall_command(struct client_t*);
+
+void object_command(struct client_t*);
+
+void type_command(struct client_t*);
+
+#endif // !DB_H
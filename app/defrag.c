@@ -0,0 +1,426 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "db.h"
+#include "defrag.h"
+#include "dict.h"
+#include "event_loop.h"
+#include "log.h"
+#include "object.h"
+#include "rax.h"
+#include "server.h"
+#include "stream.h"
+#include "util.h"
+
+/** Buckets scanned between two looks at the clock */
+#define DEFRAG_SCAN_BATCH 16
+
+#define DEFRAG_CENSUS 0 // counting the live bytes of every page
+#define DEFRAG_MOVE   1 // moving allocations out of the sparse pages
+
+
+/**
+ * Live bytes of the keyspace per memory page, open addressing on the page
+ * number (0 marks an empty slot, page 0 is never mapped).
+ * */
+struct page_table_t {
+    uint64_t* pages;
+    uint32_t* live;
+    uint64_t  size; // power of two, 0 until the first page
+    uint64_t  used;
+    uint64_t  total_live;
+};
+
+/**
+ * The cycle in progress, server.active_defrag_running is its CPU share. A
+ * cycle scans the keyspace twice: the census fills `pages`, then the
+ * allocations of the pages below the average are offered a move.
+ * */
+struct defrag_cycle_t {
+    int32_t             phase;
+    uint64_t            cursor;     // of the keyspace dict_scan()
+    int64_t             start_ms;
+    int64_t             checked_ms; // last fragmentation measurement
+    size_t              start_rss;
+    uint32_t            start_frag; // percent
+    uint64_t            start_hits;
+    uint64_t            start_misses;
+    int64_t             backoff_ms; // after an unproductive cycle, else 0
+    uint32_t            page_shift;
+    uint32_t            avg_live;   // per page, once the census is done
+    struct page_table_t pages;
+};
+
+static struct defrag_cycle_t cycle;
+
+/**
+ * Chunks malloc gave that were no better than what they would replace.
+ * Keeping them until the step ends makes malloc hand out other free chunks
+ * instead of the same one over and over.
+ * */
+static void*    held[DEFRAG_HELD_MAX];
+static uint32_t nheld;
+
+
+static int64_t get_monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** RSS over allocated bytes, in percent above 100 */
+static uint32_t fragmentation_pct(size_t allocated, size_t rss) {
+    if (allocated == 0 || rss <= allocated) return 0;
+    return (rss - allocated) * 100 / allocated;
+}
+
+/** ------------------------------ Pages ---------------------------------- */
+
+static inline uint64_t page_of(const void* p) {
+    return (uintptr_t) p >> cycle.page_shift;
+}
+
+static inline uint64_t page_slot(const struct page_table_t* t,
+        uint64_t page) {
+    uint64_t i = (page * 0x9e3779b97f4a7c15ULL) & (t->size - 1);
+    while (t->pages[i] != 0 && t->pages[i] != page) {
+        i = (i + 1) & (t->size - 1);
+    }
+    return i;
+}
+
+static uint32_t page_live(const struct page_table_t* t, uint64_t page) {
+    if (t->size == 0) return 0;
+    uint64_t i = page_slot(t, page);
+    return t->pages[i] == page ? t->live[i] : 0;
+}
+
+static int32_t page_table_grow(struct page_table_t* t) {
+    struct page_table_t g = { 0 };
+    g.size = t->size == 0 ? 1024 : t->size * 2;
+    g.pages = calloc(g.size, sizeof(uint64_t));
+    g.live = malloc(g.size * sizeof(uint32_t));
+    if (g.pages == NULL || g.live == NULL) {
+        free(g.pages);
+        free(g.live);
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < t->size; i++) {
+        if (t->pages[i] == 0) continue;
+        uint64_t j = page_slot(&g, t->pages[i]);
+        g.pages[j] = t->pages[i];
+        g.live[j] = t->live[i];
+    }
+    g.used = t->used;
+    g.total_live = t->total_live;
+    free(t->pages);
+    free(t->live);
+    *t = g;
+    return 0;
+}
+
+/** Add (or with a negative `delta` remove) live bytes to a page */
+static void page_add(struct page_table_t* t, uint64_t page, int64_t delta) {
+    if (t->used * 2 >= t->size && page_table_grow(t) == -1) return;
+
+    uint64_t i = page_slot(t, page);
+    if (t->pages[i] == 0) {
+        t->pages[i] = page;
+        t->live[i] = 0;
+        t->used++;
+    }
+    /** Allocated after the census, the page was not counted */
+    if (delta < 0 && t->live[i] < (uint64_t) -delta) {
+        delta = -(int64_t) t->live[i];
+    }
+    t->live[i] += delta;
+    t->total_live += delta;
+}
+
+static void page_table_free(struct page_table_t* t) {
+    free(t->pages);
+    free(t->live);
+    memset(t, 0, sizeof(struct page_table_t));
+}
+
+/** ------------------------------ Moving --------------------------------- */
+
+/** Census: count the allocation where it is, never move it */
+static void* census_alloc(void* ptr) {
+    page_add(&cycle.pages, page_of(ptr), malloc_usable_size(ptr));
+    return NULL;
+}
+
+static void hold(void* p) {
+    if (nheld < DEFRAG_HELD_MAX) {
+        held[nheld++] = p;
+    } else {
+        free(p);
+    }
+}
+
+static void release_held() {
+    for (uint32_t i = 0; i < nheld; i++) free(held[i]);
+    nheld = 0;
+}
+
+/**
+ * glibc malloc cannot tell how used the memory around an allocation is,
+ * so the census stands in for the slab utilization an arena allocator
+ * would report. An allocation of a page below the average moves when
+ * malloc has a chunk on a page more used than its own: live data drifts
+ * into the dense pages, the sparse ones empty, and malloc_trim() gives
+ * them back when the cycle ends. Return the new address, NULL if the
+ * allocation stays.
+ * */
+static void* defrag_alloc(void* ptr) {
+    size_t size = malloc_usable_size(ptr);
+    uint64_t from = page_of(ptr);
+    uint32_t from_live = page_live(&cycle.pages, from);
+
+    if (size >= DEFRAG_MAX_ALLOC || from_live >= cycle.avg_live) {
+        server.stat_active_defrag_misses++;
+        return NULL;
+    }
+
+    void* p = malloc(size);
+    if (p == NULL) return NULL;
+    uint64_t to = page_of(p);
+    uint32_t to_live = page_live(&cycle.pages, to);
+    if (to == from || to_live < from_live ||
+            (to_live == from_live && (uintptr_t) p > (uintptr_t) ptr)) {
+        hold(p);
+        server.stat_active_defrag_misses++;
+        return NULL;
+    }
+
+    memcpy(p, ptr, size);
+    free(ptr);
+    page_add(&cycle.pages, from, -(int64_t) size);
+    page_add(&cycle.pages, to, size);
+    server.stat_active_defrag_hits++;
+    return p;
+}
+
+/** Consumer groups stay, their PELs share entries between two trees */
+static void defrag_stream(struct robj_t* o, rax_defrag_alloc_t offer) {
+    struct stream_t* moved = offer(o->ptr);
+    if (moved != NULL) o->ptr = moved;
+    struct stream_t* s = o->ptr;
+
+    struct rax_t* rt = offer(s->rax);
+    if (rt != NULL) s->rax = rt;
+    rax_defrag(s->rax, offer, offer);
+
+    /** The tail block may have moved, it is looked up on the next append */
+    s->tail = NULL;
+}
+
+/**
+ * Offer the allocations of the object to `offer` and return its new
+ * address, NULL if it stays. Objects others reference (shared integers,
+ * the sources of a running BITOP) are left alone.
+ * */
+static struct robj_t* defrag_object(struct robj_t* o,
+        rax_defrag_alloc_t offer) {
+    if (o->refcount != 1) return NULL;
+
+    struct robj_t* moved = NULL;
+    switch (o->encoding) {
+    case OBJ_ENCODING_EMBSTR: {
+        size_t off = (char*) o->ptr - (char*) o;
+        if ((moved = offer(o)) != NULL) {
+            moved->ptr = (char*) moved + off;
+        }
+        return moved;
+    }
+    case OBJ_ENCODING_RAW: {
+        void* p = offer(o->ptr);
+        if (p != NULL) o->ptr = p;
+        break;
+    }
+    case OBJ_ENCODING_STREAM:
+        defrag_stream(o, offer);
+        break;
+    }
+    return offer(o);
+}
+
+static void census_callback(void* _, struct dict_entry_t* e) {
+    defrag_object(e->val, census_alloc);
+}
+
+static void defrag_callback(void* _, struct dict_entry_t* e) {
+    struct robj_t* o = defrag_object(e->val, defrag_alloc);
+    if (o != NULL) e->val = o;
+}
+
+/** ------------------------------ Cycle ---------------------------------- */
+
+/** Share of the CPU for a fragmentation between the thresholds */
+static uint32_t cycle_cpu_pct(uint32_t frag) {
+    uint32_t lower = config.active_defrag_threshold_lower;
+    uint32_t upper = config.active_defrag_threshold_upper;
+    uint32_t min = config.active_defrag_cycle_min;
+    uint32_t max = config.active_defrag_cycle_max;
+
+    if (frag >= upper || upper <= lower) return max;
+    if (max <= min) return min;
+    return min + (uint64_t) (frag - lower) * (max - min) / (upper - lower);
+}
+
+/**
+ * Measure the fragmentation. Return the CPU share a cycle should use, 0
+ * when it is low enough to leave alone.
+ * */
+static uint32_t check_fragmentation(uint32_t* frag, size_t* rss) {
+    size_t allocated = get_allocated_memory();
+    *rss = get_rss_memory();
+    *frag = fragmentation_pct(allocated, *rss);
+
+    if (*frag <= config.active_defrag_threshold_lower ||
+            *rss - allocated < config.active_defrag_ignore_bytes) {
+        return 0;
+    }
+    return cycle_cpu_pct(*frag);
+}
+
+static void start_cycle(uint32_t cpu_pct, uint32_t frag, size_t rss,
+        int64_t now) {
+    cycle.phase = DEFRAG_CENSUS;
+    cycle.cursor = 0;
+    cycle.start_ms = now;
+    cycle.checked_ms = now;
+    cycle.start_rss = rss;
+    cycle.start_frag = frag;
+    cycle.start_hits = server.stat_active_defrag_hits;
+    cycle.start_misses = server.stat_active_defrag_misses;
+    server.active_defrag_running = cpu_pct;
+
+    log_verbose("[active_defrag_cron] starting, fragmentation %u%% over "
+            "%lu bytes of RSS, %u%% CPU", frag, (unsigned long) rss,
+            cpu_pct);
+}
+
+/**
+ * Give the pages emptied back and account for them. A cycle that did not
+ * pay for itself delays the next one, see DEFRAG_MIN_HIT_PCT.
+ * */
+static void end_cycle(int64_t now) {
+    page_table_free(&cycle.pages);
+    malloc_trim(0);
+
+    size_t rss = get_rss_memory();
+    size_t reclaimed = cycle.start_rss > rss ? cycle.start_rss - rss : 0;
+    uint64_t hits = server.stat_active_defrag_hits - cycle.start_hits;
+    uint64_t misses = server.stat_active_defrag_misses - cycle.start_misses;
+    server.stat_active_defrag_reclaimed += reclaimed;
+    server.active_defrag_running = 0;
+
+    if (hits * 100 < (hits + misses) * DEFRAG_MIN_HIT_PCT ||
+            reclaimed * 100 < cycle.start_rss * DEFRAG_MIN_RECLAIMED_PCT) {
+        cycle.backoff_ms = cycle.backoff_ms == 0 ? 2 * DEFRAG_CHECK_MS :
+            cycle.backoff_ms * 2;
+        if (cycle.backoff_ms > DEFRAG_BACKOFF_MAX_MS) {
+            cycle.backoff_ms = DEFRAG_BACKOFF_MAX_MS;
+        }
+    } else {
+        cycle.backoff_ms = 0;
+    }
+    cycle.checked_ms = now;
+
+    log_verbose("[active_defrag_cron] cycle done in %ld ms: %lu allocations "
+            "moved, %lu refused, fragmentation %u%% -> %u%%, %lu bytes "
+            "reclaimed, next check in %ld ms", (long) (now - cycle.start_ms),
+            (unsigned long) hits, (unsigned long) misses, cycle.start_frag,
+            fragmentation_pct(get_allocated_memory(), rss),
+            (unsigned long) reclaimed,
+            (long) (cycle.backoff_ms > 0 ? cycle.backoff_ms :
+                DEFRAG_CHECK_MS));
+}
+
+/**
+ * Scan the keyspace until the phase is done or `end_us` passes. Return 1
+ * once the cycle is done.
+ * */
+static int32_t defrag_step(int64_t end_us) {
+    struct dict_t* d = server.db->dict;
+    uint32_t buckets = 0;
+    int32_t census = cycle.phase == DEFRAG_CENSUS;
+
+    /** Entries are relinked, which an iterator would not expect */
+    if (d->pause_rehash > 0) return 0;
+
+    do {
+        cycle.cursor = census ?
+            dict_scan(d, cycle.cursor, census_callback, NULL, census_alloc) :
+            dict_scan(d, cycle.cursor, defrag_callback, NULL, defrag_alloc);
+        if (cycle.cursor == 0) break;
+    } while (++buckets % DEFRAG_SCAN_BATCH != 0 ||
+            get_monotonic_us() < end_us);
+    release_held();
+
+    if (cycle.cursor != 0) return 0;
+    if (!census || cycle.pages.used == 0) return 1;
+
+    cycle.phase = DEFRAG_MOVE;
+    cycle.avg_live = cycle.pages.total_live / cycle.pages.used;
+    return 0;
+}
+
+static int64_t active_defrag_cron(struct event_loop_t* el, int64_t id,
+        void* _) {
+    int64_t now = get_monotonic_ms();
+    uint32_t frag;
+    size_t rss;
+
+    if (!config.activedefrag) {
+        if (server.active_defrag_running) end_cycle(now);
+        cycle.backoff_ms = 0;
+        return DEFRAG_INTERVAL_MS;
+    }
+
+    if (!server.active_defrag_running) {
+        int64_t wait_ms = cycle.backoff_ms > 0 ? cycle.backoff_ms :
+            DEFRAG_CHECK_MS;
+        if (now - cycle.checked_ms < wait_ms) return DEFRAG_INTERVAL_MS;
+        cycle.checked_ms = now;
+        uint32_t cpu_pct = check_fragmentation(&frag, &rss);
+        if (cpu_pct == 0) return DEFRAG_INTERVAL_MS;
+        start_cycle(cpu_pct, frag, rss, now);
+    } else if (now - cycle.checked_ms >= DEFRAG_CHECK_MS) {
+        /** Follow the fragmentation with the CPU share, never below min */
+        cycle.checked_ms = now;
+        uint32_t cpu_pct = check_fragmentation(&frag, &rss);
+        server.active_defrag_running = cpu_pct > 0 ? cpu_pct :
+            config.active_defrag_cycle_min;
+    }
+
+    int64_t budget_us = (int64_t) DEFRAG_INTERVAL_MS * 1000 *
+        server.active_defrag_running / 100;
+    if (defrag_step(get_monotonic_us() + budget_us)) {
+        end_cycle(get_monotonic_ms());
+    }
+    return DEFRAG_INTERVAL_MS;
+}
+
+int32_t active_defrag_init(struct event_loop_t* el) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    cycle.page_shift = 12;
+    while (page_size > 0 && (1L << cycle.page_shift) < page_size) {
+        cycle.page_shift++;
+    }
+
+    if (create_time_event(el, DEFRAG_INTERVAL_MS, active_defrag_cron,
+                NULL) == -1) {
+        log_warning("[active_defrag_init] time event creation error");
+        return -1;
+    }
+    return 0;
+}
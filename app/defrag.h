@@ -0,0 +1,33 @@
+#ifndef DEFRAG_H
+#define DEFRAG_H
+
+#include <stdint.h>
+
+#include "event_loop.h"
+
+#define DEFRAG_INTERVAL_MS 100  // timer period, the CPU budget is a share
+#define DEFRAG_CHECK_MS    1000 // fragmentation is measured this often
+#define DEFRAG_MAX_ALLOC   (64 * 1024) // bigger allocations are not moved
+#define DEFRAG_HELD_MAX    1024  // refused chunks kept until a step ends
+
+/**
+ * A cycle that moved under DEFRAG_MIN_HIT_PCT of the allocations it offered
+ * or gave back under DEFRAG_MIN_RECLAIMED_PCT of the RSS delays the next
+ * one, twice as long each time up to DEFRAG_BACKOFF_MAX_MS.
+ * */
+#define DEFRAG_MIN_HIT_PCT       10
+#define DEFRAG_MIN_RECLAIMED_PCT 1
+#define DEFRAG_BACKOFF_MAX_MS    (64 * DEFRAG_CHECK_MS)
+
+
+/**
+ * Start the timer of active defragmentation. While activedefrag is on and
+ * the RSS exceeds the allocated bytes by active-defrag-threshold-lower
+ * percent and active-defrag-ignore-bytes, a cycle scans the keyspace and
+ * moves keys, values and stream nodes, using between active-defrag-cycle-min
+ * and active-defrag-cycle-max percent of the CPU. Cycles that barely help
+ * back off.
+ * */
+int32_t active_defrag_init(struct event_loop_t*);
+
+#endif // !DEFRAG_H
@@ -0,0 +1,359 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include "dict.h"
+
+
+static uint64_t hash_seed = 0x9e3779b97f4a7c15ULL;
+
+void dict_init() {
+    uint64_t seed;
+    if (getrandom(&seed, sizeof seed, GRND_NONBLOCK) == sizeof seed) {
+        hash_seed = seed;
+    } else {
+        hash_seed ^= (uint64_t) time(NULL);
+    }
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+/** Multiply-fold over 8 byte words, keyed by a per process seed */
+uint64_t dict_hash(const char* key, size_t len) {
+    const unsigned char* p = (const unsigned char*) key;
+    uint64_t h = hash_seed ^ (len * 0xa0761d6478bd642fULL);
+    uint64_t v;
+
+    while (len >= 8) {
+        memcpy(&v, p, 8);
+        h = mix(h ^ v, 0xe7037ed1a0b428dbULL);
+        p += 8;
+        len -= 8;
+    }
+
+    v = 0;
+    memcpy(&v, p, len);
+    h = mix(h ^ v ^ ((uint64_t) len << 59), 0x8ebc6af09c88c6e3ULL);
+
+    return mix(h, 0x589965cc75374cc3ULL);
+}
+
+struct dict_t* create_dict(dict_val_free_t val_free) {
+    struct dict_t* d = calloc(1, sizeof(struct dict_t));
+    if (d == NULL) return NULL;
+
+    d->rehash_idx = -1;
+    d->val_free = val_free;
+    return d;
+}
+
+static void clear_table(struct dict_t* d, struct dict_table_t* t) {
+    for (uint64_t i = 0; i < t->size && t->used > 0; i++) {
+        struct dict_entry_t* e = t->buckets[i];
+        while (e != NULL) {
+            struct dict_entry_t* next = e->next;
+            if (d->val_free != NULL) d->val_free(e->val);
+            free(e);
+            t->used--;
+            e = next;
+        }
+    }
+    free(t->buckets);
+    memset(t, 0, sizeof(struct dict_table_t));
+}
+
+void free_dict(struct dict_t* d) {
+    if (d == NULL) return;
+
+    clear_table(d, &d->ht[0]);
+    clear_table(d, &d->ht[1]);
+    free(d);
+}
+
+static int32_t is_rehashing(const struct dict_t* d) {
+    return d->rehash_idx != -1;
+}
+
+/** Move up to `n` non-empty buckets from ht[0] to ht[1] */
+static void rehash(struct dict_t* d, int32_t n) {
+    /** Bound the empty buckets visited as well */
+    int32_t empty_visits = n * 10;
+
+    while (n-- > 0 && d->ht[0].used > 0) {
+        while (d->ht[0].buckets[d->rehash_idx] == NULL) {
+            d->rehash_idx++;
+            if (--empty_visits == 0) return;
+        }
+
+        struct dict_entry_t* e = d->ht[0].buckets[d->rehash_idx];
+        while (e != NULL) {
+            struct dict_entry_t* next = e->next;
+            uint64_t idx = e->hash & (d->ht[1].size - 1);
+            e->next = d->ht[1].buckets[idx];
+            d->ht[1].buckets[idx] = e;
+            d->ht[0].used--;
+            d->ht[1].used++;
+            e = next;
+        }
+        d->ht[0].buckets[d->rehash_idx] = NULL;
+        d->rehash_idx++;
+    }
+
+    if (d->ht[0].used == 0) {
+        free(d->ht[0].buckets);
+        d->ht[0] = d->ht[1];
+        memset(&d->ht[1], 0, sizeof(struct dict_table_t));
+        d->rehash_idx = -1;
+    }
+}
+
+static void rehash_step(struct dict_t* d) {
+    if (d->pause_rehash == 0 && is_rehashing(d)) {
+        rehash(d, DICT_REHASH_STEP);
+    }
+}
+
+static int32_t resize(struct dict_t* d, uint64_t want) {
+    uint64_t size = DICT_INITIAL_SIZE;
+    while (size < want) size <<= 1;
+
+    if (is_rehashing(d) || size == d->ht[0].size) return DICT_OK;
+
+    struct dict_entry_t** buckets = calloc(size, sizeof(struct dict_entry_t*));
+    if (buckets == NULL) return DICT_ERR;
+
+    if (d->ht[0].buckets == NULL) {
+        d->ht[0].buckets = buckets;
+        d->ht[0].size = size;
+        return DICT_OK;
+    }
+
+    d->ht[1].buckets = buckets;
+    d->ht[1].size = size;
+    d->ht[1].used = 0;
+    d->rehash_idx = 0;
+    return DICT_OK;
+}
+
+static struct dict_entry_t* find(struct dict_t* d, const char* key,
+        size_t len, uint64_t hash) {
+    for (int32_t t = 0; t <= 1; t++) {
+        if (d->ht[t].size == 0) continue;
+
+        struct dict_entry_t* e = d->ht[t].buckets[hash & (d->ht[t].size - 1)];
+        for (; e != NULL; e = e->next) {
+            if (e->hash == hash && e->klen == len &&
+                    memcmp(e->key, key, len) == 0) {
+                return e;
+            }
+        }
+        if (!is_rehashing(d)) break;
+    }
+    return NULL;
+}
+
+struct dict_entry_t* dict_find(struct dict_t* d, const char* key,
+        size_t len) {
+    if (dict_size(d) == 0) return NULL;
+
+    rehash_step(d);
+    return find(d, key, len, dict_hash(key, len));
+}
+
+static struct dict_entry_t* add(struct dict_t* d, const char* key,
+        size_t len, void* val, int32_t* existed) {
+    rehash_step(d);
+
+    uint64_t hash = dict_hash(key, len);
+    struct dict_entry_t* e = find(d, key, len, hash);
+    if (e != NULL) {
+        *existed = 1;
+        return e;
+    }
+    *existed = 0;
+
+    /** Load factor 1 */
+    if (!is_rehashing(d) && d->ht[0].used >= d->ht[0].size) {
+        if (resize(d, d->ht[0].used * 2) == DICT_ERR) return NULL;
+    }
+
+    e = malloc(sizeof(struct dict_entry_t) + len);
+    if (e == NULL) return NULL;
+    e->hash = hash;
+    e->val = val;
+    e->klen = len;
+    memcpy(e->key, key, len);
+
+    struct dict_table_t* t = is_rehashing(d) ? &d->ht[1] : &d->ht[0];
+    uint64_t idx = hash & (t->size - 1);
+    e->next = t->buckets[idx];
+    t->buckets[idx] = e;
+    t->used++;
+
+    return e;
+}
+
+int32_t dict_add(struct dict_t* d, const char* key, size_t len, void* val) {
+    int32_t existed;
+    if (add(d, key, len, val, &existed) == NULL) return DICT_ERR;
+    return existed ? DICT_EXISTS : DICT_OK;
+}
+
+struct dict_entry_t* dict_add_or_find(struct dict_t* d, const char* key,
+        size_t len, void* val) {
+    int32_t existed;
+    return add(d, key, len, val, &existed);
+}
+
+struct dict_entry_t* dict_unlink(struct dict_t* d, const char* key,
+        size_t len) {
+    if (dict_size(d) == 0) return NULL;
+
+    rehash_step(d);
+
+    uint64_t hash = dict_hash(key, len);
+    for (int32_t t = 0; t <= 1; t++) {
+        if (d->ht[t].size == 0) continue;
+
+        struct dict_entry_t** link =
+            &d->ht[t].buckets[hash & (d->ht[t].size - 1)];
+        for (; *link != NULL; link = &(*link)->next) {
+            struct dict_entry_t* e = *link;
+            if (e->hash == hash && e->klen == len &&
+                    memcmp(e->key, key, len) == 0) {
+                *link = e->next;
+                d->ht[t].used--;
+
+                /** Give memory back once the table is mostly empty */
+                if (!is_rehashing(d) && d->pause_rehash == 0 &&
+                        d->ht[0].size > DICT_INITIAL_SIZE &&
+                        d->ht[0].used * 8 < d->ht[0].size) {
+                    resize(d, d->ht[0].used * 2);
+                }
+                return e;
+            }
+        }
+        if (!is_rehashing(d)) break;
+    }
+    return NULL;
+}
+
+void dict_free_unlinked(struct dict_entry_t* e) {
+    free(e);
+}
+
+int32_t dict_delete(struct dict_t* d, const char* key, size_t len) {
+    struct dict_entry_t* e = dict_unlink(d, key, len);
+    if (e == NULL) return DICT_MISSING;
+
+    if (d->val_free != NULL) d->val_free(e->val);
+    free(e);
+    return DICT_OK;
+}
+
+void dict_init_iter(struct dict_t* d, struct dict_iter_t* it) {
+    memset(it, 0, sizeof(struct dict_iter_t));
+    it->d = d;
+    it->idx = -1;
+    d->pause_rehash++;
+}
+
+struct dict_entry_t* dict_next(struct dict_iter_t* it) {
+    struct dict_t* d = it->d;
+
+    while (1) {
+        if (it->next != NULL) {
+            it->entry = it->next;
+            it->next = it->entry->next;
+            return it->entry;
+        }
+
+        struct dict_table_t* t = &d->ht[it->table];
+        it->idx++;
+        if (it->idx >= (int64_t) t->size) {
+            if (it->table == 1 || !is_rehashing(d)) return NULL;
+            it->table = 1;
+            it->idx = -1;
+            continue;
+        }
+        it->next = t->buckets[it->idx];
+    }
+}
+
+void dict_release_iter(struct dict_iter_t* it) {
+    assert(it->d->pause_rehash > 0);
+    it->d->pause_rehash--;
+}
+
+static uint64_t rev(uint64_t v) {
+    uint64_t s = 64;
+    uint64_t mask = ~0ULL;
+    while ((s >>= 1) > 0) {
+        mask ^= mask << s;
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+static void scan_bucket(struct dict_entry_t** link,
+        void (*fn)(void*, struct dict_entry_t*), void* privdata,
+        dict_defrag_alloc_t defrag) {
+    while (*link != NULL) {
+        if (defrag != NULL) {
+            struct dict_entry_t* moved = defrag(*link);
+            if (moved != NULL) *link = moved;
+        }
+        struct dict_entry_t* e = *link;
+        link = &e->next;
+        fn(privdata, e);
+    }
+}
+
+uint64_t dict_scan(struct dict_t* d, uint64_t v,
+        void (*fn)(void*, struct dict_entry_t*), void* privdata,
+        dict_defrag_alloc_t defrag) {
+    if (dict_size(d) == 0) return 0;
+
+    /** `fn` must not rehash buckets from under the scan */
+    d->pause_rehash++;
+
+    if (!is_rehashing(d)) {
+        uint64_t m0 = d->ht[0].size - 1;
+        scan_bucket(&d->ht[0].buckets[v & m0], fn, privdata, defrag);
+
+        /** Increment the bits above the mask, reversed */
+        v |= ~m0;
+        v = rev(v);
+        v++;
+        v = rev(v);
+    } else {
+        struct dict_table_t* t0 = &d->ht[0];
+        struct dict_table_t* t1 = &d->ht[1];
+        if (t0->size > t1->size) {
+            t0 = &d->ht[1];
+            t1 = &d->ht[0];
+        }
+        uint64_t m0 = t0->size - 1;
+        uint64_t m1 = t1->size - 1;
+
+        scan_bucket(&t0->buckets[v & m0], fn, privdata, defrag);
+
+        /** Then the buckets of the larger table this bucket expands to */
+        do {
+            scan_bucket(&t1->buckets[v & m1], fn, privdata, defrag);
+            v |= ~m1;
+            v = rev(v);
+            v++;
+            v = rev(v);
+        } while (v & (m0 ^ m1));
+    }
+
+    d->pause_rehash--;
+    return v;
+}
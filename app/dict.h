@@ -0,0 +1,108 @@
+#ifndef DICT_H
+#define DICT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define DICT_OK      0
+#define DICT_EXISTS  1
+#define DICT_MISSING 2
+#define DICT_ERR    -1
+
+#define DICT_INITIAL_SIZE 4
+#define DICT_REHASH_STEP  1  // buckets moved by every lookup / update
+
+
+typedef void (*dict_val_free_t)(void*);
+
+/** Return the new address of a moved allocation, NULL if it stays */
+typedef void* (*dict_defrag_alloc_t)(void*);
+
+/** Keys are binary safe and copied into the entry */
+struct dict_entry_t {
+    struct dict_entry_t* next;
+    uint64_t             hash;
+    void*                val;
+    uint32_t             klen;
+    char                 key[];
+};
+
+struct dict_table_t {
+    struct dict_entry_t** buckets;
+    uint64_t              size; // power of two, 0 when unused
+    uint64_t              used;
+};
+
+/**
+ * Chained hash table. Growing allocates a second table and moves one bucket
+ * per operation (`rehash_idx` is the next bucket of `ht[0]` to move) so
+ * no single command pays for rehashing a large dictionary.
+ * */
+struct dict_t {
+    struct dict_table_t ht[2];
+    int64_t             rehash_idx;   // -1 when not rehashing
+    int32_t             pause_rehash; // > 0 while iterators are active
+    dict_val_free_t     val_free;     // NULL if the dict does not own values
+};
+
+struct dict_iter_t {
+    struct dict_t*       d;
+    int32_t              table;
+    int64_t              idx;
+    struct dict_entry_t* entry;
+    struct dict_entry_t* next;
+};
+
+
+/** Seed the hash function. Call once before creating any dict. */
+void dict_init();
+
+uint64_t dict_hash(const char*, size_t);
+
+struct dict_t* create_dict(dict_val_free_t);
+
+void free_dict(struct dict_t*);
+
+static inline uint64_t dict_size(const struct dict_t* d) {
+    return d->ht[0].used + d->ht[1].used;
+}
+
+struct dict_entry_t* dict_find(struct dict_t*, const char*, size_t);
+
+/** Return DICT_OK, DICT_EXISTS (nothing changed), or DICT_ERR */
+int32_t dict_add(struct dict_t*, const char*, size_t, void*);
+
+/** Like dict_add() but return the new or existing entry, NULL on error */
+struct dict_entry_t* dict_add_or_find(struct dict_t*, const char*, size_t,
+        void*);
+
+/** Free the entry and its value. Return DICT_OK or DICT_MISSING. */
+int32_t dict_delete(struct dict_t*, const char*, size_t);
+
+/** Remove and return the entry without freeing the value */
+struct dict_entry_t* dict_unlink(struct dict_t*, const char*, size_t);
+
+void dict_free_unlinked(struct dict_entry_t*);
+
+/**
+ * Iteration pauses rehashing, so deleting the entry returned last is safe.
+ * dict_release_iter() must be called once done.
+ * */
+void dict_init_iter(struct dict_t*, struct dict_iter_t*);
+
+struct dict_entry_t* dict_next(struct dict_iter_t*);
+
+void dict_release_iter(struct dict_iter_t*);
+
+/**
+ * Visit the entries of the buckets at `cursor` and return the cursor to
+ * continue from, 0 once done. Starting from 0, every entry present for the
+ * whole scan is visited at least once, even if the dict grows meanwhile.
+ * The cursor increments its reversed bits, so it keeps covering the same
+ * hash ranges whatever the table size. Entries moved by `defrag` (if not
+ * NULL) are relinked before `fn` sees them.
+ * */
+uint64_t dict_scan(struct dict_t*, uint64_t,
+        void (*)(void*, struct dict_entry_t*), void*, dict_defrag_alloc_t);
+
+#endif // !DICT_H
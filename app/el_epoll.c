@@ -0,0 +1,136 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "event_loop.h"
+#include "log.h"
+
+
+/**
+ * epoll(7) backend, level triggered. epoll_wait() output goes to an array
+ * sized like the fd table so one call can report every registered fd.
+ * */
+struct el_epoll_t {
+    int32_t             epfd;
+    struct epoll_event* events;
+};
+
+static uint32_t epoll_events(int16_t event_mask) {
+    uint32_t events = 0;
+    if (event_mask & (E_READABLE | E_ACCEPT | E_RECV)) { events |= EPOLLIN; }
+    if (event_mask & E_WRITEABLE) { events |= EPOLLOUT; }
+    return events;
+}
+
+static int el_epoll_init(struct event_loop_t* el) {
+    struct el_epoll_t* ep = calloc(1, sizeof(struct el_epoll_t));
+    if (ep == NULL) {
+        return ALLOC_ERR;
+    }
+
+    if ((ep->events = calloc(el->fds_cap, sizeof(struct epoll_event)))
+            == NULL) {
+        free(ep);
+        return ALLOC_ERR;
+    }
+
+    if ((ep->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        log_warning("[el_epoll_init] epoll_create1 error: %s",
+                strerror(errno));
+        free(ep->events);
+        free(ep);
+        return POLL_ERR;
+    }
+
+    el->backend_data = ep;
+    return OK;
+}
+
+static void el_epoll_free(struct event_loop_t* el) {
+    struct el_epoll_t* ep = el->backend_data;
+    close(ep->epfd);
+    free(ep->events);
+    free(ep);
+}
+
+static int el_epoll_resize(struct event_loop_t* el, uint32_t fds_cap) {
+    struct el_epoll_t* ep = el->backend_data;
+    struct epoll_event* try = realloc(ep->events,
+            fds_cap * sizeof(struct epoll_event));
+    if (try == NULL) {
+        return ALLOC_ERR;
+    }
+    ep->events = try;
+    return OK;
+}
+
+static int el_epoll_update(struct event_loop_t* el, int32_t fd,
+        int16_t old_mask, int16_t new_mask) {
+    struct el_epoll_t* ep = el->backend_data;
+    uint32_t old_events = epoll_events(old_mask);
+    uint32_t new_events = epoll_events(new_mask);
+
+    if (old_events == new_events) return OK;
+
+    int32_t op = old_events == 0 ? EPOLL_CTL_ADD :
+        new_events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    struct epoll_event ee = { .events = new_events, .data.fd = fd };
+
+    el->stat_syscalls++;
+    if (epoll_ctl(ep->epfd, op, fd, &ee) == -1) {
+        /** Unregistering a fd that is already closed is not an error */
+        if (op == EPOLL_CTL_DEL && (errno == EBADF || errno == ENOENT)) {
+            return OK;
+        }
+        log_warning("[el_epoll_update] epoll_ctl error on fd %d: %s", fd,
+                strerror(errno));
+        return POLL_ERR;
+    }
+
+    return OK;
+}
+
+static int el_epoll_poll(struct event_loop_t* el, int32_t timeout_ms) {
+    struct el_epoll_t* ep = el->backend_data;
+
+    el->stat_syscalls++;
+    int32_t rval = epoll_wait(ep->epfd, ep->events, el->fds_cap, timeout_ms);
+    if (rval == -1) {
+        if (errno == EINTR) { return 0; }
+        log_warning("[el_epoll_poll] epoll_wait error %s", strerror(errno));
+        return -POLL_ERR;
+    }
+
+    for (int32_t i = 0; i < rval; i++) {
+        struct epoll_event* ee = &ep->events[i];
+        int16_t event_mask = 0;
+
+        if (ee->events & EPOLLIN) { event_mask |= E_READABLE; }
+        if (ee->events & EPOLLOUT) { event_mask |= E_WRITEABLE; }
+        if (ee->events & EPOLLERR) { event_mask |= E_WRITEABLE | E_READABLE; }
+        if (ee->events & EPOLLHUP) { event_mask |= E_WRITEABLE | E_READABLE; }
+
+        el->fired_event_arr[i].fd = ee->data.fd;
+        el->fired_event_arr[i].event_mask = event_mask;
+        el->fired_event_arr[i].buf = NULL;
+    }
+
+#ifdef DEBUG
+    log_debug("[el_epoll_poll] OK. Number of active I/O events: %d", rval);
+#endif /* ifdef DEBUG */
+
+    return rval;
+}
+
+const struct el_backend_t el_backend_epoll = {
+    .name   = "epoll",
+    .init   = el_epoll_init,
+    .free   = el_epoll_free,
+    .resize = el_epoll_resize,
+    .update = el_epoll_update,
+    .poll   = el_epoll_poll,
+};
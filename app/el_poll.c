@@ -0,0 +1,116 @@
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "event_loop.h"
+#include "log.h"
+
+
+/**
+ * poll(2) backend. The dense `el->pollfd_arr` prefix of `el->nfds` entries
+ * is the poll() input, `rgstr_event_t.poll_idx` locates a fd in it.
+ * */
+
+static int16_t poll_events(int16_t event_mask) {
+    int16_t events = 0;
+    if (event_mask & (E_READABLE | E_ACCEPT | E_RECV)) { events |= POLLIN; }
+    if (event_mask & E_WRITEABLE) { events |= POLLOUT; }
+    return events;
+}
+
+static int el_poll_init(struct event_loop_t* el) {
+    return OK;
+}
+
+static void el_poll_free(struct event_loop_t* el) {
+}
+
+static int el_poll_update(struct event_loop_t* el, int32_t fd,
+        int16_t old_mask, int16_t new_mask) {
+    struct rgstr_event_t* re = &el->rgstr_event_arr[fd];
+
+    if (old_mask == E_NONE) {
+        re->poll_idx = el->nfds;
+        el->pollfd_arr[re->poll_idx].fd = fd;
+    }
+
+    struct pollfd* pfd = &el->pollfd_arr[re->poll_idx];
+    assert(pfd->fd == fd);
+
+    if (new_mask != E_NONE) {
+        pfd->events = poll_events(new_mask);
+        pfd->revents = 0;
+        return OK;
+    }
+
+    /** Last event gone: move the tail pollfd into the hole */
+    uint32_t last = el->nfds - 1;
+    if (re->poll_idx != last) {
+        *pfd = el->pollfd_arr[last];
+        el->rgstr_event_arr[pfd->fd].poll_idx = re->poll_idx;
+    }
+
+    return OK;
+}
+
+static int el_poll_poll(struct event_loop_t* el, int32_t timeout_ms) {
+    assert(el != NULL);
+
+    int32_t rval = 0;
+    int32_t numevents = 0;
+
+    el->stat_syscalls++;
+    rval = poll(el->pollfd_arr, el->nfds, timeout_ms);
+
+    if (rval == -1) {
+        if (errno == EINTR) { return 0; }
+        log_warning("[el_poll_poll] poll() error %s", strerror(errno));
+        return -POLL_ERR;
+    }
+
+    if (rval == 0) { return 0; }
+
+    int16_t event_mask = 0;
+    uint32_t i = 0;
+    struct pollfd* pfd = NULL;
+    for (i = 0; i < el->nfds && numevents < rval; i++) {
+        event_mask = 0;
+
+        pfd = &el->pollfd_arr[i];
+        assert(pfd != NULL);
+
+        if (pfd->revents & POLLIN) { event_mask |= E_READABLE; }
+        if (pfd->revents & POLLOUT) { event_mask |= E_WRITEABLE; }
+        if (pfd->revents & POLLERR) { event_mask |= E_WRITEABLE | E_READABLE; }
+        if (pfd->revents & POLLHUP) { event_mask |= E_WRITEABLE | E_READABLE; }
+
+        if (event_mask != E_NONE) {
+#ifdef DEBUG
+            log_debug("[el_poll_poll] I/O %d is active (mask = %d)", pfd->fd,
+                    event_mask);
+#endif /* ifdef DEBUG */
+
+            el->fired_event_arr[numevents].fd = pfd->fd;
+            el->fired_event_arr[numevents].event_mask = event_mask;
+            el->fired_event_arr[numevents].buf = NULL;
+
+            numevents++;
+        }
+    }
+
+#ifdef DEBUG
+    log_debug("[el_poll_poll] OK. Number of active I/O events: %d", numevents);
+#endif /* ifdef DEBUG */
+
+    return numevents;
+}
+
+const struct el_backend_t el_backend_poll = {
+    .name   = "poll",
+    .init   = el_poll_init,
+    .free   = el_poll_free,
+    .update = el_poll_update,
+    .poll   = el_poll_poll,
+};
@@ -0,0 +1,594 @@
+#include <assert.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event_loop.h"
+#include "log.h"
+
+#define URING_SQ_ENTRIES 1024
+#define URING_CQ_ENTRIES (URING_SQ_ENTRIES * 8)
+#define URING_BUF_COUNT  512  // provided buffers, power of two
+#define URING_BUF_SIZE   4096
+#define URING_BUF_GROUP  0
+
+/** user_data = op (8 bits) | generation or poll sequence (24 bits) | fd */
+#define UOP_POLL   1
+#define UOP_ACCEPT 2
+#define UOP_RECV   3
+#define UOP_SEND   4
+#define UOP_CANCEL 5
+
+#define URING_UDATA(op, seq, fd) (((uint64_t) (op) << 56) | \
+        ((uint64_t) ((seq) & EL_GEN_MASK) << 32) | (uint32_t) (fd))
+#define URING_UDATA_OP(u)  ((uint32_t) ((u) >> 56))
+#define URING_UDATA_SEQ(u) ((uint32_t) ((u) >> 32) & EL_GEN_MASK)
+#define URING_UDATA_FD(u)  ((int32_t) (uint32_t) (u))
+
+
+/**
+ * io_uring backend, talking to the kernel through raw system calls.
+ *
+ * - E_ACCEPT arms one multishot accept, E_RECV one multishot recv picking
+ * its buffer from a provided buffer ring, so a busy connection costs no
+ * system call at all per read.
+ * - E_READABLE / E_WRITEABLE arm a oneshot poll that is re-armed after it
+ * fires, which keeps the level triggered semantics of the other backends.
+ * - el_send() queues a SENDMSG.
+ *
+ * SQEs are only queued by the hooks. Every loop iteration then submits all
+ * of them and waits for completions with a single io_uring_enter().
+ * Requests that stop (no IORING_CQE_F_MORE) or must be re-armed are put on
+ * `rearm` and armed again right before that call.
+ * */
+
+/** Per fd copy of an el_send() request, kept until the SENDMSG completes */
+struct uring_send_t {
+    struct msghdr msg;
+    struct iovec  iov[EL_SEND_IOV_MAX];
+};
+
+struct uring_fd_t {
+    uint32_t             poll_seq;    // tags the armed poll, bumped on cancel
+    int16_t              poll_armed;  // POLLIN / POLLOUT being polled for
+    uint8_t              accept_armed;
+    uint8_t              recv_armed;
+    uint8_t              recv_done;   // multishot recv ended on EOF / error
+    uint8_t              queued;      // on the rearm list
+    struct uring_send_t* send;
+};
+
+struct el_uring_t {
+    int32_t                   ring_fd;
+
+    void*                     ring_ptr;  // SQ and CQ rings (single mmap)
+    size_t                    ring_sz;
+    struct io_uring_sqe*      sqes;
+    size_t                    sqes_sz;
+
+    uint32_t*                 sq_khead;
+    uint32_t*                 sq_ktail;
+    uint32_t                  sq_mask;
+    uint32_t                  sq_entries;
+    uint32_t                  sq_tail;   // local, published before enter
+
+    uint32_t*                 cq_khead;
+    uint32_t*                 cq_ktail;
+    uint32_t                  cq_mask;
+    struct io_uring_cqe*      cqes;
+
+    struct io_uring_buf_ring* br;
+    size_t                    br_sz;
+    char*                     bufs;
+    uint16_t                  br_tail;
+
+    struct uring_fd_t*        fds;       // fds_cap entries
+    int32_t*                  rearm;     // fds_cap entries
+    uint32_t                  nrearm;
+};
+
+
+static int sys_io_uring_setup(uint32_t entries, struct io_uring_params* p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, uint32_t to_submit,
+        uint32_t min_complete, uint32_t flags, void* arg, size_t argsz) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+            flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, uint32_t opcode, void* arg,
+        uint32_t nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static uint32_t uring_sq_pending(struct el_uring_t* ur) {
+    return ur->sq_tail - __atomic_load_n(ur->sq_khead, __ATOMIC_ACQUIRE);
+}
+
+/** Hand every queued SQE to the kernel without waiting */
+static int uring_flush(struct event_loop_t* el) {
+    struct el_uring_t* ur = el->backend_data;
+
+    __atomic_store_n(ur->sq_ktail, ur->sq_tail, __ATOMIC_RELEASE);
+    el->stat_syscalls++;
+    if (sys_io_uring_enter(ur->ring_fd, uring_sq_pending(ur), 0, 0, NULL, 0)
+            == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        log_warning("[uring_flush] io_uring_enter error: %s",
+                strerror(errno));
+        return POLL_ERR;
+    }
+    return OK;
+}
+
+/** Next free SQE, zeroed. Flushes the queue when it is full. */
+static struct io_uring_sqe* uring_get_sqe(struct event_loop_t* el) {
+    struct el_uring_t* ur = el->backend_data;
+
+    if (uring_sq_pending(ur) == ur->sq_entries) {
+        if (uring_flush(el) != OK || uring_sq_pending(ur) == ur->sq_entries) {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe* sqe = &ur->sqes[ur->sq_tail & ur->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ur->sq_tail++;
+    return sqe;
+}
+
+static int uring_cancel(struct event_loop_t* el, uint64_t user_data) {
+    struct io_uring_sqe* sqe = uring_get_sqe(el);
+    if (sqe == NULL) return POLL_ERR;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = URING_UDATA(UOP_CANCEL, 0, 0);
+    return OK;
+}
+
+static int16_t uring_poll_events(int16_t event_mask) {
+    int16_t events = 0;
+    if (event_mask & E_READABLE) { events |= POLLIN; }
+    if (event_mask & E_WRITEABLE) { events |= POLLOUT; }
+    return events;
+}
+
+static void uring_schedule(struct el_uring_t* ur, int32_t fd) {
+    if (ur->fds[fd].queued) return;
+    ur->fds[fd].queued = 1;
+    ur->rearm[ur->nrearm++] = fd;
+}
+
+/** Arm whatever the registration of `fd` wants but is not armed yet */
+static int uring_arm(struct event_loop_t* el, int32_t fd) {
+    struct el_uring_t* ur = el->backend_data;
+    struct uring_fd_t* fs = &ur->fds[fd];
+    struct rgstr_event_t* re = &el->rgstr_event_arr[fd];
+    struct io_uring_sqe* sqe = NULL;
+
+    int16_t events = uring_poll_events(re->event_mask);
+    if (events != 0 && fs->poll_armed == 0) {
+        if ((sqe = uring_get_sqe(el)) == NULL) return POLL_ERR;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = events;
+        sqe->user_data = URING_UDATA(UOP_POLL, fs->poll_seq, fd);
+        fs->poll_armed = events;
+    }
+
+    if ((re->event_mask & E_ACCEPT) && !fs->accept_armed) {
+        if ((sqe = uring_get_sqe(el)) == NULL) return POLL_ERR;
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = URING_UDATA(UOP_ACCEPT, re->gen, fd);
+        fs->accept_armed = 1;
+    }
+
+    if ((re->event_mask & E_RECV) && !fs->recv_armed && !fs->recv_done) {
+        if ((sqe = uring_get_sqe(el)) == NULL) return POLL_ERR;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUF_GROUP;
+        sqe->user_data = URING_UDATA(UOP_RECV, re->gen, fd);
+        fs->recv_armed = 1;
+    }
+
+    return OK;
+}
+
+static void uring_recycle_buf(struct el_uring_t* ur, uint16_t bid) {
+    struct io_uring_buf* buf = &ur->br->bufs[ur->br_tail &
+        (URING_BUF_COUNT - 1)];
+    buf->addr = (uint64_t) (uintptr_t) (ur->bufs + (size_t) bid *
+            URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    ur->br_tail++;
+    __atomic_store_n(&ur->br->tail, ur->br_tail, __ATOMIC_RELEASE);
+}
+
+static void el_uring_free(struct event_loop_t* el) {
+    struct el_uring_t* ur = el->backend_data;
+    if (ur == NULL) return;
+
+    /** Closing the ring cancels every request still in flight */
+    if (ur->ring_fd >= 0) close(ur->ring_fd);
+    if (ur->br != NULL) munmap(ur->br, ur->br_sz);
+    if (ur->sqes != NULL) munmap(ur->sqes, ur->sqes_sz);
+    if (ur->ring_ptr != NULL) munmap(ur->ring_ptr, ur->ring_sz);
+    if (ur->fds != NULL) {
+        for (uint32_t i = 0; i < el->fds_cap; i++) {
+            free(ur->fds[i].send);
+        }
+    }
+    free(ur->fds);
+    free(ur->rearm);
+    free(ur->bufs);
+    free(ur);
+    el->backend_data = NULL;
+}
+
+static int uring_setup_buffers(struct el_uring_t* ur) {
+    ur->br_sz = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    ur->br = mmap(NULL, ur->br_sz, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ur->br == MAP_FAILED) {
+        ur->br = NULL;
+        return ALLOC_ERR;
+    }
+
+    if ((ur->bufs = malloc((size_t) URING_BUF_COUNT * URING_BUF_SIZE))
+            == NULL) {
+        return ALLOC_ERR;
+    }
+
+    struct io_uring_buf_reg reg = { 0 };
+    reg.ring_addr = (uint64_t) (uintptr_t) ur->br;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BUF_GROUP;
+    if (sys_io_uring_register(ur->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1)
+            == -1) {
+        log_notice("[el_uring_init] provided buffer ring error: %s",
+                strerror(errno));
+        return POLL_ERR;
+    }
+
+    for (uint32_t i = 0; i < URING_BUF_COUNT; i++) {
+        uring_recycle_buf(ur, i);
+    }
+    return OK;
+}
+
+static int el_uring_init(struct event_loop_t* el) {
+    struct el_uring_t* ur = calloc(1, sizeof(struct el_uring_t));
+    if (ur == NULL) {
+        return ALLOC_ERR;
+    }
+    ur->ring_fd = -1;
+    el->backend_data = ur;
+
+    ur->fds = calloc(el->fds_cap, sizeof(struct uring_fd_t));
+    ur->rearm = calloc(el->fds_cap, sizeof(int32_t));
+    if (ur->fds == NULL || ur->rearm == NULL) {
+        el_uring_free(el);
+        return ALLOC_ERR;
+    }
+
+    /**
+     * Completion work runs only inside our own io_uring_enter() (6.1+),
+     * which also guarantees multishot accept / recv and buffer rings.
+     * */
+    struct io_uring_params p = { 0 };
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN |
+        IORING_SETUP_SUBMIT_ALL | IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_CQ_ENTRIES;
+    if ((ur->ring_fd = sys_io_uring_setup(URING_SQ_ENTRIES, &p)) == -1) {
+        log_notice("[el_uring_init] io_uring_setup error: %s",
+                strerror(errno));
+        el_uring_free(el);
+        return POLL_ERR;
+    }
+
+    uint32_t need = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+        IORING_FEAT_EXT_ARG;
+    if ((p.features & need) != need) {
+        log_notice("[el_uring_init] kernel lacks required io_uring features");
+        el_uring_free(el);
+        return POLL_ERR;
+    }
+
+    size_t sq_sz = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    size_t cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ur->ring_sz = sq_sz > cq_sz ? sq_sz : cq_sz;
+    ur->ring_ptr = mmap(NULL, ur->ring_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_SQ_RING);
+    if (ur->ring_ptr == MAP_FAILED) {
+        ur->ring_ptr = NULL;
+        el_uring_free(el);
+        return ALLOC_ERR;
+    }
+
+    ur->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ur->sqes = mmap(NULL, ur->sqes_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_SQES);
+    if (ur->sqes == MAP_FAILED) {
+        ur->sqes = NULL;
+        el_uring_free(el);
+        return ALLOC_ERR;
+    }
+
+    char* ring = ur->ring_ptr;
+    ur->sq_khead = (uint32_t*) (ring + p.sq_off.head);
+    ur->sq_ktail = (uint32_t*) (ring + p.sq_off.tail);
+    ur->sq_mask = *(uint32_t*) (ring + p.sq_off.ring_mask);
+    ur->sq_entries = p.sq_entries;
+    ur->sq_tail = *ur->sq_ktail;
+    ur->cq_khead = (uint32_t*) (ring + p.cq_off.head);
+    ur->cq_ktail = (uint32_t*) (ring + p.cq_off.tail);
+    ur->cq_mask = *(uint32_t*) (ring + p.cq_off.ring_mask);
+    ur->cqes = (struct io_uring_cqe*) (ring + p.cq_off.cqes);
+
+    /** SQE slot i is always published through array slot i */
+    uint32_t* array = (uint32_t*) (ring + p.sq_off.array);
+    for (uint32_t i = 0; i < p.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    if (uring_setup_buffers(ur) != OK) {
+        el_uring_free(el);
+        return POLL_ERR;
+    }
+
+    return OK;
+}
+
+static int el_uring_resize(struct event_loop_t* el, uint32_t fds_cap) {
+    struct el_uring_t* ur = el->backend_data;
+
+    int32_t* rearm = realloc(ur->rearm, fds_cap * sizeof(int32_t));
+    if (rearm == NULL) {
+        return ALLOC_ERR;
+    }
+    ur->rearm = rearm;
+
+    struct uring_fd_t* fds = realloc(ur->fds,
+            fds_cap * sizeof(struct uring_fd_t));
+    if (fds == NULL) {
+        return ALLOC_ERR;
+    }
+    if (fds_cap > el->fds_cap) {
+        memset(fds + el->fds_cap, 0,
+                (fds_cap - el->fds_cap) * sizeof(struct uring_fd_t));
+    }
+    ur->fds = fds;
+
+    return OK;
+}
+
+static int el_uring_update(struct event_loop_t* el, int32_t fd,
+        int16_t old_mask, int16_t new_mask) {
+    struct el_uring_t* ur = el->backend_data;
+    struct uring_fd_t* fs = &ur->fds[fd];
+    struct rgstr_event_t* re = &el->rgstr_event_arr[fd];
+    int rval = OK;
+
+    if (fs->poll_armed != 0 && fs->poll_armed !=
+            uring_poll_events(new_mask)) {
+        rval |= uring_cancel(el, URING_UDATA(UOP_POLL, fs->poll_seq, fd));
+        fs->poll_seq = (fs->poll_seq + 1) & EL_GEN_MASK;
+        fs->poll_armed = 0;
+    }
+    if (fs->accept_armed && !(new_mask & E_ACCEPT)) {
+        rval |= uring_cancel(el, URING_UDATA(UOP_ACCEPT, re->gen, fd));
+        fs->accept_armed = 0;
+    }
+    if (!(new_mask & E_RECV)) {
+        if (fs->recv_armed) {
+            rval |= uring_cancel(el, URING_UDATA(UOP_RECV, re->gen, fd));
+            fs->recv_armed = 0;
+        }
+        fs->recv_done = 0;
+    }
+
+    if (new_mask != E_NONE) {
+        uring_schedule(ur, fd);
+    }
+
+    return rval == OK ? OK : POLL_ERR;
+}
+
+static ssize_t el_uring_send(struct event_loop_t* el, int32_t fd,
+        const struct iovec* iov, int iovcnt) {
+    struct el_uring_t* ur = el->backend_data;
+    struct uring_fd_t* fs = &ur->fds[fd];
+
+    if (fs->send == NULL &&
+            (fs->send = calloc(1, sizeof(struct uring_send_t))) == NULL) {
+        return -ENOMEM;
+    }
+
+    struct io_uring_sqe* sqe = uring_get_sqe(el);
+    if (sqe == NULL) {
+        return -EAGAIN;
+    }
+
+    memcpy(fs->send->iov, iov, iovcnt * sizeof(struct iovec));
+    memset(&fs->send->msg, 0, sizeof(struct msghdr));
+    fs->send->msg.msg_iov = fs->send->iov;
+    fs->send->msg.msg_iovlen = iovcnt;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) &fs->send->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = URING_UDATA(UOP_SEND, 0, fd);
+
+    return EL_SEND_ASYNC;
+}
+
+static void el_uring_recycle(struct event_loop_t* el,
+        struct fired_event_t* fe) {
+    uring_recycle_buf(el->backend_data, fe->buf_id);
+}
+
+/** Turn one CQE into a fired event. Return 1 if `fe` was filled. */
+static int uring_reap(struct event_loop_t* el, struct io_uring_cqe* cqe,
+        struct fired_event_t* fe) {
+    struct el_uring_t* ur = el->backend_data;
+    uint32_t op = URING_UDATA_OP(cqe->user_data);
+    uint32_t seq = URING_UDATA_SEQ(cqe->user_data);
+    int32_t fd = URING_UDATA_FD(cqe->user_data);
+    int32_t more = cqe->flags & IORING_CQE_F_MORE;
+
+    if (op == UOP_CANCEL || fd < 0 || fd >= el->fds_cap) return 0;
+
+    struct uring_fd_t* fs = &ur->fds[fd];
+    struct rgstr_event_t* re = &el->rgstr_event_arr[fd];
+    int32_t current = seq == re->gen;
+
+    fe->fd = fd;
+    fe->gen = seq;
+    fe->res = cqe->res;
+    fe->buf = NULL;
+
+    switch (op) {
+    case UOP_POLL:
+        if (seq != fs->poll_seq) return 0;
+        fs->poll_armed = 0;
+        uring_schedule(ur, fd);
+        if (cqe->res == -ECANCELED) return 0;
+
+        fe->event_mask = 0;
+        if (cqe->res < 0 || (cqe->res & (POLLERR | POLLHUP))) {
+            fe->event_mask |= E_READABLE | E_WRITEABLE;
+        }
+        if (cqe->res > 0 && (cqe->res & POLLIN)) {
+            fe->event_mask |= E_READABLE;
+        }
+        if (cqe->res > 0 && (cqe->res & POLLOUT)) {
+            fe->event_mask |= E_WRITEABLE;
+        }
+        return fe->event_mask != 0;
+    case UOP_ACCEPT:
+        if (!current) {
+            if (cqe->res >= 0) close(cqe->res);
+            return 0;
+        }
+        if (!more) {
+            fs->accept_armed = 0;
+            uring_schedule(ur, fd);
+        }
+        if (cqe->res == -ECANCELED) return 0;
+        fe->event_mask = E_ACCEPT;
+        return 1;
+    case UOP_RECV:
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            fe->buf_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            fe->buf = ur->bufs + (size_t) fe->buf_id * URING_BUF_SIZE;
+        }
+        if (!current) {
+            if (fe->buf != NULL) uring_recycle_buf(ur, fe->buf_id);
+            return 0;
+        }
+        if (!more) {
+            fs->recv_armed = 0;
+            /** Out of buffers only pauses the recv, EOF / errors end it */
+            fs->recv_done = cqe->res == 0 ||
+                (cqe->res < 0 && cqe->res != -ENOBUFS);
+            uring_schedule(ur, fd);
+        }
+        if (cqe->res == -ENOBUFS || cqe->res == -ECANCELED) return 0;
+        fe->event_mask = E_RECV;
+        return 1;
+    case UOP_SEND:
+        fe->event_mask = E_SEND;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int el_uring_poll(struct event_loop_t* el, int32_t timeout_ms) {
+    struct el_uring_t* ur = el->backend_data;
+
+    /** Re-arm whatever stopped since the previous iteration */
+    uint32_t nrearm = ur->nrearm;
+    ur->nrearm = 0;
+    for (uint32_t i = 0; i < nrearm; i++) {
+        int32_t fd = ur->rearm[i];
+        ur->fds[fd].queued = 0;
+        if (uring_arm(el, fd) != OK) {
+            return -POLL_ERR;
+        }
+    }
+
+    /** Completions left over by a previous iteration must not wait */
+    uint32_t head = *ur->cq_khead;
+    if (head != __atomic_load_n(ur->cq_ktail, __ATOMIC_ACQUIRE)) {
+        timeout_ms = 0;
+    }
+
+    struct __kernel_timespec ts = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_nsec = (timeout_ms % 1000) * 1000000L,
+    };
+    struct io_uring_getevents_arg arg = { 0 }; // no sigmask
+    arg.ts = (uint64_t) (uintptr_t) &ts;
+
+    __atomic_store_n(ur->sq_ktail, ur->sq_tail, __ATOMIC_RELEASE);
+    el->stat_syscalls++;
+    if (sys_io_uring_enter(ur->ring_fd, uring_sq_pending(ur),
+                timeout_ms > 0 ? 1 : 0,
+                IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                &arg, sizeof arg) == -1) {
+        if (errno != EINTR && errno != ETIME && errno != EAGAIN &&
+                errno != EBUSY) {
+            log_warning("[el_uring_poll] io_uring_enter error %s",
+                    strerror(errno));
+            return -POLL_ERR;
+        }
+    }
+
+    int32_t numevents = 0;
+    uint32_t tail = __atomic_load_n(ur->cq_ktail, __ATOMIC_ACQUIRE);
+    while (head != tail && numevents < el->fds_cap) {
+        struct io_uring_cqe* cqe = &ur->cqes[head & ur->cq_mask];
+        numevents += uring_reap(el, cqe, &el->fired_event_arr[numevents]);
+        head++;
+    }
+    __atomic_store_n(ur->cq_khead, head, __ATOMIC_RELEASE);
+
+#ifdef DEBUG
+    log_debug("[el_uring_poll] OK. Number of completions: %d", numevents);
+#endif /* ifdef DEBUG */
+
+    return numevents;
+}
+
+const struct el_backend_t el_backend_io_uring = {
+    .name    = "io_uring",
+    .init    = el_uring_init,
+    .free    = el_uring_free,
+    .resize  = el_uring_resize,
+    .update  = el_uring_update,
+    .poll    = el_uring_poll,
+    .send    = el_uring_send,
+    .recycle = el_uring_recycle,
+};
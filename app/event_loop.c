@@ -1,61 +1,103 @@
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/poll.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "event_loop.h"
+#include "log.h"
+
 
+int64_t get_monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Carve the fd-indexed arrays and the dense pollfd array out of one zeroed
+ * allocation. `rgstr_event_t` comes first as it has the strictest alignment.
+ * */
+static void* alloc_fd_table(uint32_t fds_cap, struct rgstr_event_t** rgstr,
+        struct pollfd** pfds, struct fired_event_t** fired) {
+    char* table = calloc(fds_cap, sizeof(struct rgstr_event_t) + 
+            sizeof(struct pollfd) + sizeof(struct fired_event_t));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    *rgstr = (struct rgstr_event_t*) table;
+    *pfds  = (struct pollfd*) (table + fds_cap * sizeof(struct rgstr_event_t));
+    *fired = (struct fired_event_t*) (table + fds_cap * 
+            (sizeof(struct rgstr_event_t) + sizeof(struct pollfd)));
+
+    return table;
+}
 
-struct event_loop_t* create_event_loop(uint32_t fds_cap) {
+static const struct el_backend_t* el_backends[] = {
+    [EL_BACKEND_POLL]     = &el_backend_poll,
+    [EL_BACKEND_EPOLL]    = &el_backend_epoll,
+    [EL_BACKEND_IO_URING] = &el_backend_io_uring,
+};
+
+struct event_loop_t* create_event_loop(uint32_t fds_cap, int32_t backend) {
     struct event_loop_t* el = NULL;
+
+    assert(fds_cap > 0);
+    assert(backend >= EL_BACKEND_POLL && backend <= EL_BACKEND_IO_URING);
     
     if ((el = calloc(1, sizeof(struct event_loop_t))) == NULL) {
 #ifdef DEBUG
-        printf("[create_event_loop] event_loop_t calloc error\n");
+        log_debug("[create_event_loop] event_loop_t calloc error");
 #endif /* ifdef DEBUG */
         return NULL;
     }
 
-    if ((el->rgstr_event_arr = calloc(fds_cap, sizeof(struct rgstr_event_t))) == NULL) {
+    if ((el->fd_table = alloc_fd_table(fds_cap, &el->rgstr_event_arr,
+                    &el->pollfd_arr, &el->fired_event_arr)) == NULL) {
 #ifdef DEBUG
-        printf("[create_event_loop] rgstr_even_t* calloc error\n");
+        log_debug("[create_event_loop] fd table calloc error");
 #endif /* ifdef DEBUG */
         free(el);
         return NULL;
     }
 
-    if ((el->fired_event_arr = calloc(fds_cap, sizeof(struct fired_event_t))) 
-            == NULL) {
-#ifdef DEBUG
-        printf("[create_event_loop] struct fired_event_t* calloc error\n");
-#endif /* ifdef DEBUG */
-        free(el->rgstr_event_arr);
+    if ((el->recv_buf = malloc(EL_RECV_BUF_SIZE)) == NULL) {
+        free(el->fd_table);
         free(el);
         return NULL;
     }
 
     el->fds_cap = fds_cap;
+    el->nfds    = 0;
     el->max_fd  = -1;
     el->stop    = 0;
 
-    if ((el->pollfd_arr = calloc(fds_cap, sizeof(struct pollfd))) == NULL) {
-#ifdef DEBUG
-        printf("[create_event_loop] struct pollfd* calloc error\n");
-#endif /* ifdef DEBUG */
-        free(el->fired_event_arr);
-        free(el->rgstr_event_arr);
+    /** Fall back to the next simpler mechanism until one initializes */
+    for (int32_t b = backend; b >= EL_BACKEND_POLL; b--) {
+        el->backend = el_backends[b];
+        if (el->backend->init(el) == OK) break;
+        log_notice("[create_event_loop] %s backend unavailable",
+                el->backend->name);
+        el->backend = NULL;
+    }
+    if (el->backend == NULL) {
+        free(el->recv_buf);
+        free(el->fd_table);
         free(el);
         return NULL;
     }
 
-    for (uint32_t i = 0; i < fds_cap; i++) {
-        el->rgstr_event_arr[i].event_mask = E_NONE;
-    }
 #ifdef DEBUG
-    printf("[create_event_loop] OK. Handling capacity: %d\n", el->fds_cap);
+    log_debug("[create_event_loop] OK. Handling capacity: %d, backend: %s",
+            el->fds_cap, el->backend->name);
 #endif /* ifdef DEBUG */
 
     return el;
@@ -63,111 +105,122 @@ struct event_loop_t* create_event_loop(uint32_t fds_cap) {
 
 void free_event_loop(struct event_loop_t* el) {
     assert(el != NULL);
-    assert(el->fired_event_arr != NULL);
-    assert(el->pollfd_arr != NULL);
-    assert(el->rgstr_event_arr != NULL);
+    assert(el->fd_table != NULL);
 
-    free(el->fired_event_arr);
-    free(el->pollfd_arr);
-    free(el->rgstr_event_arr);
+    struct time_event_t* te = el->time_event_head;
+    while (te != NULL) {
+        struct time_event_t* next = te->next;
+        free(te);
+        te = next;
+    }
+
+    el->backend->free(el);
+    free(el->recv_buf);
+    free(el->fd_table);
     free(el);
 }
 
-/** TODO: This reallocation need to be done in a better way */
+/**
+ * Move every array into a larger table. Registrations, the dense pollfd
+ * prefix and pending fired events (a handler may register a new fd in the 
+ * middle of process_events()) are all preserved.
+ * */
 static int resize_event_loop(struct event_loop_t* el, uint32_t fds_cap) {
     assert(el != NULL);
 
     if (fds_cap == el->fds_cap) return OK;
-    if (fds_cap <= el->max_fd) return RESIZE_ERR;
-
-    void* try = realloc(el->pollfd_arr, sizeof(struct pollfd) * fds_cap);
-    if (try == NULL) {
-#ifdef DEBUG
-        printf("[resize_event_loop] pollfd* realloc error\n");
-#endif /* ifdef DEBUG */
-        return ALLOC_ERR;
+    if ((int64_t) fds_cap <= el->max_fd || fds_cap < el->nfds) {
+        return RESIZE_ERR;
     }
-    el->pollfd_arr = try;
 
-    try = realloc(el->rgstr_event_arr, sizeof(struct rgstr_event_t) * fds_cap);
-    if (try == NULL) {
-#ifdef DEBUG
-        printf("[resize_event_loop] rgstre_event_t* realloc error\n");
-#endif /* ifdef DEBUG */
-        if ((el->pollfd_arr = realloc(el->pollfd_arr, el->fds_cap * 
-                        sizeof(struct pollfd))) 
-                == NULL) {
-            return CRITICAL_ERR;
-        }
+    if (el->backend->resize != NULL && el->backend->resize(el, fds_cap) != OK) {
         return ALLOC_ERR;
     }
 
-    try = realloc(el->fired_event_arr, sizeof(struct fired_event_t) * fds_cap);
-    if (try == NULL) {
+    struct rgstr_event_t* rgstr = NULL;
+    struct pollfd* pfds = NULL;
+    struct fired_event_t* fired = NULL;
+    void* table = alloc_fd_table(fds_cap, &rgstr, &pfds, &fired);
+    if (table == NULL) {
 #ifdef DEBUG
-        printf("[resize_event_loop] rgstre_event_t* realloc error\n");
+        log_debug("[resize_event_loop] fd table calloc error");
 #endif /* ifdef DEBUG */
-        if ((el->pollfd_arr = realloc(el->pollfd_arr, el->fds_cap * 
-                        sizeof(struct pollfd)))
-                == NULL) {
-            return CRITICAL_ERR;
-        }
-        if ((el->rgstr_event_arr = realloc(el->pollfd_arr, el->fds_cap * 
-                        sizeof(struct pollfd)))
-                == NULL) {
-            return CRITICAL_ERR;
-        }
         return ALLOC_ERR;
     }
 
-    el->fds_cap = fds_cap;
-
-    for (uint32_t i = 0; i < el->max_fd + 1; i++) {
-        el->pollfd_arr[i].fd = 0;
-        el->pollfd_arr[i].events = E_NONE;
-        el->pollfd_arr[i].revents = 0;
+    uint32_t keep = fds_cap < el->fds_cap ? fds_cap : el->fds_cap;
+    memcpy(rgstr, el->rgstr_event_arr, keep * sizeof(struct rgstr_event_t));
+    memcpy(pfds, el->pollfd_arr, el->nfds * sizeof(struct pollfd));
+    memcpy(fired, el->fired_event_arr, keep * sizeof(struct fired_event_t));
 
-        el->rgstr_event_arr[i].event_mask = E_NONE;
-
-        el->fired_event_arr[i].fd = 0;
-        el->fired_event_arr[i].event_mask = E_NONE;
-    }
+    free(el->fd_table);
+    el->fd_table = table;
+    el->rgstr_event_arr = rgstr;
+    el->pollfd_arr = pfds;
+    el->fired_event_arr = fired;
+    el->fds_cap = fds_cap;
 
     return OK;
 }
 
-int register_event(struct event_loop_t* el, int32_t fd, int16_t event_mask, 
-        event_handle_t h, void* client_data) {
+void set_before_sleep_handle(struct event_loop_t* el, 
+        before_sleep_handle_t h) {
     assert(el != NULL);
+    el->before_sleep = h;
+}
 
+/** Grow the fd table if needed and hand the new mask to the backend */
+static struct rgstr_event_t* add_event_mask(struct event_loop_t* el, 
+        int32_t fd, int16_t event_mask, int* rval) {
     // This should only happen when high load happen.
     if (fd >= el->fds_cap) {
-        int32_t factor = fd / el->fds_cap;
-        assert(factor >= 1);
-        int rval = OK;
-        if ((rval = resize_event_loop(el, (factor + 1) * el->fds_cap)) != OK) {
-            return rval;
+        uint64_t fds_cap = el->fds_cap;
+        while (fds_cap <= fd) {
+            fds_cap *= 2;
+        }
+        if ((*rval = resize_event_loop(el, fds_cap)) != OK) {
+            return NULL;
         }
     }
 
     struct rgstr_event_t* re = &el->rgstr_event_arr[fd];
-    struct pollfd* pfd = &el->pollfd_arr[fd];
-    assert(re != NULL && pfd != NULL);
+    assert(re != NULL);
 
+    int16_t old_mask = re->event_mask;
+    int16_t new_mask = old_mask | event_mask;
 
     /** Reflect / Map to concrete polling primitive construct */
-    pfd->fd = fd;
-    if (event_mask & E_READABLE) {
-        pfd->events |= POLLIN;
+    if (new_mask != old_mask && 
+            (*rval = el->backend->update(el, fd, old_mask, new_mask)) != OK) {
+        return NULL;
     }
-    if (event_mask & E_WRITEABLE) {
-        pfd->events |= POLLOUT;
+
+    /** Assignment for abstraction */
+    if (old_mask == E_NONE) {
+        el->nfds++;
     }
-    pfd->revents = 0;
+    re->event_mask = new_mask;
 
+    if (fd > el->max_fd) {
+        el->max_fd = fd;
+    }
+
+    *rval = OK;
+    return re;
+}
+
+int register_event(struct event_loop_t* el, int32_t fd, int16_t event_mask, 
+        event_handle_t h, void* client_data) {
+    assert(el != NULL);
+    assert(fd >= 0);
+    assert((event_mask & ~(E_READABLE | E_WRITEABLE)) == 0);
+
+    int rval = OK;
+    struct rgstr_event_t* re = add_event_mask(el, fd, event_mask, &rval);
+    if (re == NULL) {
+        return rval;
+    }
 
-    /** Assignment for abstraction */
-    re->event_mask |= event_mask;
     if (event_mask & E_READABLE) {
         re->read_event_handle = h;
     }
@@ -176,10 +229,40 @@ int register_event(struct event_loop_t* el, int32_t fd, int16_t event_mask,
     }
     re->client_data = client_data;
 
-    if (fd > el->max_fd) {
-        el->max_fd = fd;
+    return OK;
+}
+
+int register_acceptor(struct event_loop_t* el, int32_t fd, accept_handle_t h,
+        void* client_data) {
+    assert(el != NULL && h != NULL);
+    assert(fd >= 0);
+
+    int rval = OK;
+    struct rgstr_event_t* re = add_event_mask(el, fd, E_ACCEPT, &rval);
+    if (re == NULL) {
+        return rval;
     }
 
+    re->accept_handle = h;
+    re->client_data = client_data;
+
+    return OK;
+}
+
+int register_reader(struct event_loop_t* el, int32_t fd, recv_handle_t h,
+        void* client_data) {
+    assert(el != NULL && h != NULL);
+    assert(fd >= 0);
+
+    int rval = OK;
+    struct rgstr_event_t* re = add_event_mask(el, fd, E_RECV, &rval);
+    if (re == NULL) {
+        return rval;
+    }
+
+    re->recv_handle = h;
+    re->client_data = client_data;
+
     return OK;
 }
 
@@ -187,90 +270,214 @@ int unregister_event(struct event_loop_t* el, int32_t fd,
         int16_t del_event_mask) {
     assert(el != NULL);
 
-    if (fd >= el->fds_cap) return ERANGE;
+    if (fd < 0 || fd >= el->fds_cap) return ERANGE;
 
     struct rgstr_event_t* re = &el->rgstr_event_arr[fd];
-    struct pollfd* pfd = &el->pollfd_arr[fd];
-    assert(re != NULL && pfd != NULL);
+    assert(re != NULL);
 
-    if (re->event_mask == E_NONE) return OK;
+    int16_t old_mask = re->event_mask;
+    int16_t new_mask = old_mask & (~del_event_mask);
 
+    if (new_mask == old_mask) return OK;
 
     /** Reflect / Map to concrete polling primitive construct */
-    int16_t event_mask = re->event_mask & ~del_event_mask;
-    pfd->events = 0;
-    if (event_mask & E_READABLE) { pfd->events |= POLLIN; } 
-    if (event_mask & E_WRITEABLE) { pfd->events |= POLLOUT; }
-    pfd->fd = 0;
+    int rval = el->backend->update(el, fd, old_mask, new_mask);
 
     /** Assignment for abstraction */
-    re->event_mask = re->event_mask & (~del_event_mask);
-
-    if (fd == el->max_fd && re->event_mask == E_NONE) {
-        uint32_t i = 0;
-        for (i = el->max_fd - 1; i >= 0; i--) {
-            if (el->rgstr_event_arr[i].event_mask != E_NONE) {
-                break;
-            }
-        }
-        el->max_fd = i;
+    re->event_mask = new_mask;
+    if ((old_mask & ~new_mask) & (E_ACCEPT | E_RECV)) {
+        /** In flight results of the dropped request become stale */
+        re->gen = (re->gen + 1) & EL_GEN_MASK;
+    }
+    if (new_mask == E_NONE) {
+        el->nfds--;
     }
 
     // TODO: shrink size based on some strategies
-    return OK;
+    return rval;
 }
 
-static int kernel_poll(struct event_loop_t* el) {
+ssize_t el_send(struct event_loop_t* el, int32_t fd, const struct iovec* iov,
+        int iovcnt, send_handle_t h, void* client_data) {
     assert(el != NULL);
 
-    int32_t rval = 0;
-    int32_t numevents = 0;
+    if (fd < 0) return -EBADF;
+    if (iovcnt > EL_SEND_IOV_MAX) iovcnt = EL_SEND_IOV_MAX;
 
-    rval = poll(el->pollfd_arr, el->max_fd + 1, 10000);
+    if (el->backend->send != NULL && h != NULL && fd < el->fds_cap) {
+        struct rgstr_event_t* re = &el->rgstr_event_arr[fd];
+        if (re->send_handle != NULL) return -EBUSY;
 
-    if (rval == -1) { 
-        printf("poll() error %s\n", strerror(errno));
-        return POLL_ERR;
+        ssize_t rval = el->backend->send(el, fd, iov, iovcnt);
+        if (rval == EL_SEND_ASYNC) {
+            re->send_handle = h;
+            re->send_data = client_data;
+        }
+        return rval;
     }
 
-    if (rval == 0) { return 0; }
+    struct msghdr msg = { 0 };
+    msg.msg_iov = (struct iovec*) iov;
+    msg.msg_iovlen = iovcnt;
 
-    int16_t event_mask = 0;
-    uint32_t i = 0;
-    struct pollfd* pfd = NULL;
-    for (i = 0; i <= el->max_fd; i++) { 
-        event_mask = 0;
+    el->stat_syscalls++;
+    ssize_t nsent = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    return nsent == -1 ? -errno : nsent;
+}
 
-        pfd = &el->pollfd_arr[i];
-        assert(pfd != NULL);
+int64_t create_time_event(struct event_loop_t* el, int64_t ms, 
+        time_event_handle_t h, void* client_data) {
+    assert(el != NULL && h != NULL);
 
+    struct time_event_t* te = calloc(1, sizeof(struct time_event_t));
+    if (te == NULL) {
 #ifdef DEBUG
-            printf("[kernel_poll] Checking I/O %d\n", i);
+        log_debug("[create_time_event] time_event_t calloc error");
 #endif /* ifdef DEBUG */
+        return -1;
+    }
 
-        if (pfd->revents & POLLIN) { event_mask = E_READABLE; }
-        if (pfd->revents & POLLOUT) { event_mask = E_WRITEABLE; }
-        if (pfd->revents & POLLERR) { event_mask |= E_WRITEABLE | E_READABLE; }
-        if (pfd->revents & POLLHUP) { event_mask |= E_WRITEABLE | E_READABLE; }
+    te->id = el->time_event_next_id++;
+    te->when_ms = get_monotonic_ms() + ms;
+    te->time_event_handle = h;
+    te->client_data = client_data;
+    te->next = el->time_event_head;
+    el->time_event_head = te;
 
-        if (event_mask != E_NONE) {
-#ifdef DEBUG
-            printf("[kernel_poll] I/O %d is active (mask = %d)\n", pfd->fd, 
-                    event_mask);
-#endif /* ifdef DEBUG */
+    return te->id;
+}
 
-            el->fired_event_arr[numevents].fd = pfd->fd;
-            el->fired_event_arr[numevents].event_mask = event_mask;
+int delete_time_event(struct event_loop_t* el, int64_t id) {
+    assert(el != NULL);
 
-            numevents++;
+    struct time_event_t** link = &el->time_event_head;
+    while (*link != NULL) {
+        if ((*link)->id == id) {
+            struct time_event_t* te = *link;
+            *link = te->next;
+            free(te);
+            return OK;
         }
+        link = &(*link)->next;
     }
 
-#ifdef DEBUG
-    printf("[kernel_poll] OK. Number of active I/O events: %d\n", numevents);
-#endif /* ifdef DEBUG */
+    return ERANGE;
+}
+
+/** Milliseconds until the earliest time event, capped by the default */
+static int32_t time_event_timeout(struct event_loop_t* el) {
+    int64_t timeout = DEFAULT_POLL_TIMEOUT_MS;
+    int64_t now = get_monotonic_ms();
 
-    return numevents;
+    for (struct time_event_t* te = el->time_event_head; te; te = te->next) {
+        if (te->when_ms - now < timeout) {
+            timeout = te->when_ms - now;
+        }
+    }
+
+    return timeout < 0 ? 0 : timeout;
+}
+
+static int process_time_events(struct event_loop_t* el) {
+    int processed = 0;
+    int64_t now = get_monotonic_ms();
+    int64_t max_id = el->time_event_next_id - 1;
+
+    struct time_event_t* te = el->time_event_head;
+    while (te != NULL) {
+        /** Skip timers created by handlers during this pass */
+        if (te->id > max_id || te->when_ms > now) {
+            te = te->next;
+            continue;
+        }
+
+        int64_t id = te->id;
+        int64_t next_ms = te->time_event_handle(el, id, te->client_data);
+        processed++;
+
+        /** The handler may have deleted timers, restart from a known node */
+        struct time_event_t* cur = el->time_event_head;
+        while (cur != NULL && cur->id != id) cur = cur->next;
+        if (cur == NULL) {
+            te = el->time_event_head;
+            continue;
+        }
+
+        if (next_ms == TE_NOMORE) {
+            te = cur->next;
+            delete_time_event(el, id);
+        } else {
+            cur->when_ms = get_monotonic_ms() + next_ms;
+            te = cur->next;
+        }
+    }
+
+    return processed;
+}
+
+/** Readiness backends: accept up to EL_MAX_ACCEPTS_PER_CALL connections */
+static void accept_ready(struct event_loop_t* el, int32_t fd) {
+    for (uint32_t i = 0; i < EL_MAX_ACCEPTS_PER_CALL; i++) {
+        struct rgstr_event_t* re = &el->rgstr_event_arr[fd];
+        if (!(re->event_mask & E_ACCEPT)) return;
+
+        el->stat_syscalls++;
+        int32_t client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | 
+                SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                re->accept_handle(el, fd, -errno, re->client_data);
+            }
+            return;
+        }
+
+        re->accept_handle(el, fd, client_fd, re->client_data);
+    }
+}
+
+/** Readiness backends: one read per readiness, level triggering refires */
+static void recv_ready(struct event_loop_t* el, int32_t fd) {
+    struct rgstr_event_t* re = &el->rgstr_event_arr[fd];
+
+    el->stat_syscalls++;
+    ssize_t nread = read(fd, el->recv_buf, EL_RECV_BUF_SIZE);
+    if (nread == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+        nread = -errno;
+    }
+
+    re->recv_handle(el, fd, el->recv_buf, nread, re->client_data);
+}
+
+/** Completion backends: run the handle unless the result is stale */
+static void dispatch_completion(struct event_loop_t* el, 
+        struct fired_event_t* fe) {
+    struct rgstr_event_t* re = &el->rgstr_event_arr[fe->fd];
+
+    if (fe->event_mask & E_SEND) {
+        send_handle_t h = re->send_handle;
+        re->send_handle = NULL;
+        if (h != NULL) {
+            h(el, fe->fd, fe->res, re->send_data);
+        }
+        return;
+    }
+
+    int16_t want = fe->event_mask & (E_ACCEPT | E_RECV);
+    if (fe->gen != re->gen || !(re->event_mask & want)) {
+        /** The fd was unregistered (maybe reused) after the request */
+        if ((fe->event_mask & E_ACCEPT) && fe->res >= 0) {
+            close(fe->res);
+        }
+        return;
+    }
+
+    if (fe->event_mask & E_ACCEPT) {
+        re->accept_handle(el, fe->fd, fe->res, re->client_data);
+    } else {
+        re->recv_handle(el, fe->fd, fe->buf, fe->res, re->client_data);
+    }
 }
 
 int process_events(struct event_loop_t* el) {
@@ -279,10 +486,11 @@ int process_events(struct event_loop_t* el) {
     uint32_t processed = 0;
     int32_t numevents = 0;
 
-    /** TODO: time event callback */
-    /** TODO: before sleep event callback */
-    numevents = kernel_poll(el);
-    if (numevents == POLL_ERR) { return POLL_ERR; }
+    if (el->before_sleep != NULL) {
+        el->before_sleep(el);
+    }
+    numevents = el->backend->poll(el, time_event_timeout(el));
+    if (numevents < 0) { return numevents; }
     /** TODO: after sleep event callback */
 
     
@@ -292,27 +500,51 @@ int process_events(struct event_loop_t* el) {
     int16_t event_mask = 0;
     struct rgstr_event_t* re = NULL;
     for (uint32_t i = 0; i < numevents; i++) {
-        fd = el->fired_event_arr[i].fd;
+        /** Handlers may grow (move) the fd table, never keep pointers */
+        struct fired_event_t fe = el->fired_event_arr[i];
+        fd = fe.fd;
+        event_mask = fe.event_mask;
+
+        if (event_mask & (E_ACCEPT | E_RECV | E_SEND)) {
+            dispatch_completion(el, &fe);
+            if (fe.buf != NULL && el->backend->recycle != NULL) {
+                el->backend->recycle(el, &fe);
+            }
+            processed++;
+            continue;
+        }
 
         re = &el->rgstr_event_arr[fd];
         assert(re != NULL);
 
-        event_mask = el->fired_event_arr[i].event_mask;
-
         fired = 0;
+
+        if (event_mask & E_READABLE) {
+            if (re->event_mask & E_ACCEPT) {
+                accept_ready(el, fd);
+                fired++;
+            } else if (re->event_mask & E_RECV) {
+                recv_ready(el, fd);
+                fired++;
+            }
+            re = &el->rgstr_event_arr[fd];
+        }
         
         if (re->event_mask & event_mask & E_READABLE) {
 #ifdef DEBUG
-            printf("[process_events] Handle I/O %d event %d\n", fd, event_mask);
+            log_debug("[process_events] Handle I/O %d event %d", fd, event_mask);
 #endif /* ifdef DEBUG */
             re->read_event_handle(el, fd, re->client_data);
             fired++;
+
+            /** The handler may have grown (moved) the fd table */
+            re = &el->rgstr_event_arr[fd];
         }
         if (re->event_mask & event_mask & E_WRITEABLE) {
             if (!fired || re->read_event_handle != re->write_event_handle) {
                 re->write_event_handle(el, fd, re->client_data);
 #ifdef DEBUG
-            printf("[process_events] Handle I/O %d event %d\n", fd, event_mask);
+            log_debug("[process_events] Handle I/O %d event %d", fd, event_mask);
 #endif /* ifdef DEBUG */
                 fired++;
             }
@@ -321,7 +553,7 @@ int process_events(struct event_loop_t* el) {
         processed++;
     }
 
-    /** TODO: check time events */
+    processed += process_time_events(el);
 
     return processed;
 }
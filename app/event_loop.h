@@ -1,16 +1,40 @@
 #ifndef EVENT_LOOP_H
 #define EVENT_LOOP_H
 
+#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <poll.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define E_NONE      0
 #define E_READABLE  1
 #define E_WRITEABLE 2
+#define E_ACCEPT    4  // listening socket, accepted fds go to accept_handle
+#define E_RECV      8  // stream socket, received bytes go to recv_handle
+#define E_SEND      16 // fired only: completion of an asynchronous el_send()
+
+#define EL_BACKEND_POLL     0
+#define EL_BACKEND_EPOLL    1
+#define EL_BACKEND_IO_URING 2
 
 #define DEFAULT_FDS_CAP 64
 
+#define DEFAULT_POLL_TIMEOUT_MS 10000
+
+#define EL_RECV_BUF_SIZE        (16 * 1024)
+#define EL_MAX_ACCEPTS_PER_CALL 1000
+#define EL_SEND_IOV_MAX         16 // el_send() sends at most this many iovecs
+
+/** Registration generations wrap at 24 bits, see el_uring.c */
+#define EL_GEN_MASK 0xffffff
+
+/** el_send() result when the backend completes the send later (E_SEND) */
+#define EL_SEND_ASYNC (-EINPROGRESS)
+
+#define TE_NOMORE -1 // returned by a time event handle to delete itself
+
 #define OK           0
 #define ALLOC_ERR    1
 #define RESIZE_ERR   2
@@ -18,80 +42,209 @@
 #define CRITICAL_ERR 4
 
 
+struct event_loop_t;
+
+typedef void (*before_sleep_handle_t)(struct event_loop_t*);
+
+/**
+ * The three per-fd arrays below live in one allocation (`fd_table`) so that
+ * growing the loop is a single calloc + copy that preserves every live
+ * registration.
+ *
+ * - `rgstr_event_arr` and `fired_event_arr` hold `fds_cap` entries and
+ * `rgstr_event_arr` is indexed by file descriptor.
+ * - `pollfd_arr` is only used by the poll backend and is dense: its first
+ * `nfds` entries are exactly the registered file descriptors, each one
+ * located through `rgstr_event_t.poll_idx`. poll() therefore never scans
+ * holes, and unregistering is a swap with the last entry instead of a
+ * back-scan.
+ * */
 struct event_loop_t {
-    int32_t               stop;
-    int32_t               max_fd;  // Highest file descriptor currently registered
-    uint32_t              fds_cap; // Max number of file descriptors tracked
-    struct pollfd*        pollfd_arr;      // input for OS polling system call 
-    struct rgstr_event_t* rgstr_event_arr; // abstraction input  of OS polling system call
-    struct fired_event_t* fired_event_arr; // abstraction output of OS polling system call
+    int32_t                    stop;
+    int32_t                    max_fd;  // Highest file descriptor ever registered
+    uint32_t                   fds_cap; // Max number of file descriptors tracked
+    uint32_t                   nfds;    // Number of file descriptors registered
+    int64_t                    time_event_next_id;
+    struct time_event_t*       time_event_head;
+    before_sleep_handle_t      before_sleep;    // runs before every poll
+    const struct el_backend_t* backend;
+    void*                      backend_data;    // owned by `backend`
+    uint64_t                   stat_syscalls;   // issued by the loop itself
+    char*                      recv_buf;        // E_RECV on readiness backends
+    void*                      fd_table;        // backing allocation of the arrays
+    struct pollfd*             pollfd_arr;      // input for OS polling system call
+    struct rgstr_event_t*      rgstr_event_arr; // abstraction input  of OS polling system call
+    struct fired_event_t*      fired_event_arr; // abstraction output of OS polling system call
 };
 
-/** 
- * This should accept one more parameter, client data (buffer for read, IP, ...) 
+/**
+ * This should accept one more parameter, client data (buffer for read, IP, ...)
  * */
 typedef void (*event_handle_t)(struct event_loop_t*, int32_t, void *);
 
-/** 
- * An abstract construct for the concept of Event and Polling primitive / 
- * construct, in non-blocking I/O. 
+/** (listening fd, accepted fd or -errno, client data) */
+typedef void (*accept_handle_t)(struct event_loop_t*, int32_t, int32_t,
+        void *);
+
+/**
+ * (fd, received bytes, length, client data). Length 0 is EOF, negative is
+ * -errno. The bytes are only valid until the handle returns.
+ * */
+typedef void (*recv_handle_t)(struct event_loop_t*, int32_t, const char*,
+        ssize_t, void *);
+
+/** (fd, bytes sent or -errno, client data) */
+typedef void (*send_handle_t)(struct event_loop_t*, int32_t, ssize_t, void *);
+
+/**
+ * Return milliseconds until the event should fire again, or TE_NOMORE to
+ * delete it.
+ * */
+typedef int64_t (*time_event_handle_t)(struct event_loop_t*, int64_t, void *);
+
+/**
+ * An abstract construct for the concept of Event and Polling primitive /
+ * construct, in non-blocking I/O.
  *
- * Motive: There are different polling mechanisms available in a given OS. Each 
- * polling mechanism has its own polling primitive construct and polling system 
- * call. 
+ * Motive: There are different polling mechanisms available in a given OS. Each
+ * polling mechanism has its own polling primitive construct and polling system
+ * call.
  *
  * Some polling mechanisms are supported in different OS. Some are not. Some are
- * unique to a specific OS (e.g, Window). 
+ * unique to a specific OS (e.g, Window).
  *
  * How it work ([Un]Register an event):
- * 1. [Un]Mark down what event is being register and what handler will be triggered 
+ * 1. [Un]Mark down what event is being register and what handler will be triggered
  * when this event is fired
- * 2. Map this abstract construct to the polling primitive construct of the 
- * chosen polling mechanism (in this case `struct pollfd`)
- * 3. To locate the abstract construct and the concrete polling primitive 
- * construct of a given I/O, use its file descriptor to directly index the 
- * construct array for both abstracted one and concrete one.
- *  - The potential problem of this is file descriptor might be larger than 
- *  array size despite the actual size of less than file descriptor number.
+ * 2. Map this abstract construct to the polling primitive construct of the
+ * chosen polling mechanism (`el_backend_t.update`)
+ * 3. To locate the abstract construct of a given I/O, use its file descriptor
+ * to directly index the construct array.
+ *  - The file descriptor might be larger than array size. The fd table then
+ *  grows geometrically, see `resize_event_loop()`.
+ *
+ * E_ACCEPT and E_RECV are completion style: the handler receives the result
+ * of the accept / read instead of readiness. Readiness backends perform the
+ * system call in process_events(), the io_uring backend gets the result from
+ * a multishot request.
  * */
 struct rgstr_event_t {
-    int16_t        event_mask;
-    void*          client_data;
-    event_handle_t read_event_handle;  // handle on read
-    event_handle_t write_event_handle; // handle on write 
+    int16_t         event_mask;
+    uint32_t        poll_idx;   // slot in pollfd_arr, valid unless E_NONE
+    uint32_t        gen;        // bumped when E_ACCEPT / E_RECV is dropped
+                                // (wraps at EL_GEN_MASK)
+    void*           client_data;
+    event_handle_t  read_event_handle;  // handle on read
+    event_handle_t  write_event_handle; // handle on write
+    accept_handle_t accept_handle;
+    recv_handle_t   recv_handle;
+    send_handle_t   send_handle; // set by el_send(), outlives unregister
+    void*           send_data;
 };
 
 /**
- * An simple abstraction (more like a mapping) of the result return from a given 
+ * An simple abstraction (more like a mapping) of the result return from a given
  * OS polling system call.
  *
  * How it work:
- * 1. Call the system call for the chosen polling mechanism (in this case poll())
- * 2. Once the system call return, iterate through each system polling primitive 
+ * 1. Call the system call for the chosen polling mechanism (`el_backend_t.poll`)
+ * 2. Once the system call return, iterate through each system polling primitive
  * construct for its I/O to see whether if it has an event triggered.
- *   - If it has an event triggered, extract the file descriptor of its I/O as 
+ *   - If it has an event triggered, extract the file descriptor of its I/O as
  *   well as the events triggered into the abstract construct.
  *   - Add this abstract construct into the result array.
  * 3. Iterate through each abstract result construct from the result array.
- *   - Use file descriptor of a given I/O to obtain the abstract construct 
+ *   - Use file descriptor of a given I/O to obtain the abstract construct
  *   associative with this given I/O.
  *   - Obtain the triggered event and run the associative handler.
- */ 
+ *
+ * Completion backends also carry the result (`res`, `buf`) of E_ACCEPT,
+ * E_RECV and E_SEND, and the registration generation it was issued for so
+ * that results of a closed and reused fd are dropped.
+ */
 struct fired_event_t {
-    int32_t fd;
-    int16_t event_mask;
+    int32_t  fd;
+    int16_t  event_mask;
+    uint16_t buf_id;
+    uint32_t gen;
+    int32_t  res;
+    char*    buf;
+};
+
+/**
+ * A polling mechanism. Every hook receives the loop; `update` is called
+ * with the old and new mask whenever the registered mask of a fd changes,
+ * before `el->nfds` and `rgstr_event_t.gen` are adjusted.
+ * */
+struct el_backend_t {
+    const char* name;
+    int     (*init)(struct event_loop_t*);
+    void    (*free)(struct event_loop_t*);
+    int     (*resize)(struct event_loop_t*, uint32_t);
+    int     (*update)(struct event_loop_t*, int32_t, int16_t, int16_t);
+    /** Fill fired_event_arr, return number of events or -POLL_ERR */
+    int     (*poll)(struct event_loop_t*, int32_t);
+    /** Optional: asynchronous send, see el_send() */
+    ssize_t (*send)(struct event_loop_t*, int32_t, const struct iovec*, int);
+    /** Optional: give a received buffer back after the recv handle ran */
+    void    (*recycle)(struct event_loop_t*, struct fired_event_t*);
+};
+
+extern const struct el_backend_t el_backend_poll;
+extern const struct el_backend_t el_backend_epoll;
+extern const struct el_backend_t el_backend_io_uring;
+
+/**
+ * A timer run by process_events() after the I/O events of an iteration. The
+ * poll timeout is shortened so that the earliest timer fires on time. Timers
+ * are kept in an unsorted list, the loop only ever holds a handful of them.
+ * */
+struct time_event_t {
+    int64_t              id;
+    int64_t              when_ms; // monotonic deadline
+    time_event_handle_t  time_event_handle;
+    void*                client_data;
+    struct time_event_t* next;
 };
 
-struct event_loop_t* create_event_loop(uint32_t);
+/** Monotonic clock in milliseconds */
+int64_t get_monotonic_ms();
+
+/**
+ * Create a loop on the requested backend. When the backend is unavailable
+ * the next simpler one is used (io_uring -> epoll -> poll).
+ * */
+struct event_loop_t* create_event_loop(uint32_t, int32_t);
 
 void free_event_loop(struct event_loop_t*);
 
+void set_before_sleep_handle(struct event_loop_t*, before_sleep_handle_t);
+
 int register_event(struct event_loop_t*, int32_t, int16_t, event_handle_t, void *);
 
+int register_acceptor(struct event_loop_t*, int32_t, accept_handle_t, void *);
+
+int register_reader(struct event_loop_t*, int32_t, recv_handle_t, void *);
+
 int unregister_event(struct event_loop_t*, int32_t, int16_t);
 
-static int kernel_poll(struct event_loop_t*);
+/**
+ * Send `iov` on a non-blocking socket. Return bytes sent or -errno right
+ * away, or EL_SEND_ASYNC when the backend queued the send; `h` then fires
+ * with the result and the buffers must stay untouched (and the fd open)
+ * until it does. Only one asynchronous send per fd may be in flight. With a
+ * NULL `h` the send is always synchronous.
+ * */
+ssize_t el_send(struct event_loop_t*, int32_t, const struct iovec*, int,
+        send_handle_t, void *);
+
+/** Return id of the new time event firing in `ms` milliseconds, or -1 */
+int64_t create_time_event(struct event_loop_t*, int64_t, time_event_handle_t,
+        void *);
+
+int delete_time_event(struct event_loop_t*, int64_t);
 
+/** Return number of processed events, or -POLL_ERR */
 int process_events(struct event_loop_t*);
 
 #endif
@@ -0,0 +1,592 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HLL_X86 1
+#endif
+
+#include "config.h"
+#include "hll.h"
+#include "object.h"
+
+#define HLL_ALPHA_INF 0.721347520444481703680 // constant for 0.5/ln(2)
+
+#define HLL_SPARSE_ZERO_BIT   0x00
+#define HLL_SPARSE_XZERO_BIT  0x40
+#define HLL_SPARSE_VAL_BIT    0x80
+#define HLL_SPARSE_ZERO_MAX_LEN  64
+#define HLL_SPARSE_XZERO_MAX_LEN 16384
+#define HLL_SPARSE_VAL_MAX_VALUE 32
+#define HLL_SPARSE_VAL_MAX_LEN   4
+
+#define HLL_SPARSE_IS_ZERO(p)  ((*(p) & 0xc0) == 0)
+#define HLL_SPARSE_IS_XZERO(p) ((*(p) & 0xc0) == HLL_SPARSE_XZERO_BIT)
+#define HLL_SPARSE_ZERO_LEN(p) ((*(p) & 0x3f) + 1)
+#define HLL_SPARSE_XZERO_LEN(p) ((((*(p) & 0x3f) << 8) | *((p) + 1)) + 1)
+#define HLL_SPARSE_VAL_VALUE(p) (((*(p) >> 2) & 0x1f) + 1)
+#define HLL_SPARSE_VAL_LEN(p)   ((*(p) & 0x3) + 1)
+
+/** Bytes of the run at `p` */
+#define HLL_SPARSE_OPLEN(p) (HLL_SPARSE_IS_XZERO(p) ? 2 : 1)
+
+static const char hll_magic[4] = { 'H', 'Y', 'L', 'L' };
+
+
+/** ------------------------------ Format --------------------------------- */
+
+/** MurmurHash64A, seeded as Redis so that registers match its HLLs */
+static uint64_t murmur_hash64a(const void* key, size_t len, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int32_t r = 47;
+    const uint8_t* data = key;
+    const uint8_t* end = data + (len - (len & 7));
+    uint64_t h = seed ^ (len * m);
+
+    for (; data != end; data += 8) {
+        uint64_t k;
+        memcpy(&k, data, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (len & 7) {
+    case 7: h ^= (uint64_t) data[6] << 48; /* fall through */
+    case 6: h ^= (uint64_t) data[5] << 40; /* fall through */
+    case 5: h ^= (uint64_t) data[4] << 32; /* fall through */
+    case 4: h ^= (uint64_t) data[3] << 24; /* fall through */
+    case 3: h ^= (uint64_t) data[2] << 16; /* fall through */
+    case 2: h ^= (uint64_t) data[1] << 8;  /* fall through */
+    case 1: h ^= (uint64_t) data[0];
+            h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+/**
+ * Register index of the element and the length of the run of zeros (plus
+ * one) in the remaining hash bits, 1 .. HLL_Q + 1.
+ * */
+static uint8_t hll_pat_len(const char* ele, size_t len, uint32_t* index) {
+    uint64_t hash = murmur_hash64a(ele, len, 0xadc83b19ULL);
+    *index = hash & HLL_P_MASK;
+    hash >>= HLL_P;
+    hash |= 1ULL << HLL_Q; // the run ends at bit Q at the latest
+    return __builtin_ctzll(hash) + 1;
+}
+
+static inline uint8_t dense_get(const uint8_t* p, uint32_t index) {
+    uint32_t byte = index * HLL_BITS / 8;
+    uint32_t fb = index * HLL_BITS & 7;
+    uint32_t b0 = p[byte];
+    uint32_t b1 = fb > 8 - HLL_BITS ? p[byte + 1] : 0;
+    return ((b0 >> fb) | (b1 << (8 - fb))) & HLL_REGISTER_MAX;
+}
+
+static inline void dense_set(uint8_t* p, uint32_t index, uint8_t v) {
+    uint32_t byte = index * HLL_BITS / 8;
+    uint32_t fb = index * HLL_BITS & 7;
+
+    p[byte] &= ~(HLL_REGISTER_MAX << fb);
+    p[byte] |= v << fb;
+    if (fb > 8 - HLL_BITS) {
+        p[byte + 1] &= ~(HLL_REGISTER_MAX >> (8 - fb));
+        p[byte + 1] |= v >> (8 - fb);
+    }
+}
+
+static inline struct hll_hdr_t* hll_hdr(struct robj_t* o) {
+    return (struct hll_hdr_t*) ((struct rstr_t*) o->ptr)->buf;
+}
+
+static inline size_t hll_len(struct robj_t* o) {
+    return ((struct rstr_t*) o->ptr)->len;
+}
+
+void hll_invalidate_cache(char* s) {
+    ((struct hll_hdr_t*) s)->card[7] |= 1 << 7;
+}
+
+struct robj_t* create_hll_object() {
+    struct robj_t* o = create_raw_string_object(NULL, HLL_HDR_SIZE + 2);
+    if (o == NULL) return NULL;
+
+    struct hll_hdr_t* hdr = hll_hdr(o);
+    memcpy(hdr->magic, hll_magic, sizeof hll_magic);
+    hdr->encoding = HLL_SPARSE;
+
+    /** One XZERO run covering every register, the cached count is 0 */
+    uint32_t run = HLL_REGISTERS - 1;
+    hdr->registers[0] = HLL_SPARSE_XZERO_BIT | (run >> 8);
+    hdr->registers[1] = run & 0xff;
+    return o;
+}
+
+int32_t is_hll(const char* s, size_t len) {
+    const struct hll_hdr_t* hdr = (const struct hll_hdr_t*) s;
+
+    if (len < HLL_HDR_SIZE || memcmp(hdr->magic, hll_magic, 4) != 0) {
+        return 0;
+    }
+    if (hdr->encoding == HLL_DENSE) return len == HLL_DENSE_SIZE;
+    return hdr->encoding == HLL_SPARSE;
+}
+
+/** ------------------------------ Kernels -------------------------------- */
+
+/** Groups of 4 registers are 3 bytes, 24 bits read little endian */
+static void merge_dense_scalar_from(uint8_t* max, const uint8_t* dense,
+        uint32_t from) {
+    for (uint32_t i = from; i < HLL_REGISTERS; i += 4) {
+        const uint8_t* p = dense + i / 4 * 3;
+        uint32_t v = p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16);
+        for (uint32_t j = 0; j < 4; j++, v >>= HLL_BITS) {
+            uint8_t r = v & HLL_REGISTER_MAX;
+            if (r > max[i + j]) max[i + j] = r;
+        }
+    }
+}
+
+static void merge_dense_scalar(uint8_t* max, const uint8_t* dense) {
+    merge_dense_scalar_from(max, dense, 0);
+}
+
+#ifdef HLL_X86
+
+/**
+ * Spread every 3 byte group into a 32 bit lane (PSHUFB), then move each
+ * six bit register to its own byte with shifts and masks. `x` holds 12
+ * packed bytes per 128 bit lane.
+ * */
+#define HLL_UNPACK_LANES(x, and, or, slli, set1)                            \
+    or(or(and(x, set1(0x3f)), and(slli(x, 2), set1(0x3f00))),              \
+       or(and(slli(x, 4), set1(0x3f0000)), and(slli(x, 6), set1(0x3f000000))))
+
+__attribute__((target("ssse3")))
+static void merge_dense_ssse3(uint8_t* max, const uint8_t* dense) {
+    const __m128i shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+            6, 7, 8, -1, 9, 10, 11, -1);
+    uint32_t i = 0;
+
+    /** 16 bytes are loaded for 12, stop before reading past the end */
+    for (; i / 4 * 3 + 16 <= HLL_DENSE_BYTES; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (dense + i / 4 * 3));
+        x = _mm_shuffle_epi8(x, shuf);
+        __m128i r = HLL_UNPACK_LANES(x, _mm_and_si128, _mm_or_si128,
+                _mm_slli_epi32, _mm_set1_epi32);
+        __m128i m = _mm_loadu_si128((const __m128i*) (max + i));
+        _mm_storeu_si128((__m128i*) (max + i), _mm_max_epu8(m, r));
+    }
+    merge_dense_scalar_from(max, dense, i);
+}
+
+__attribute__((target("avx2")))
+static void merge_dense_avx2(uint8_t* max, const uint8_t* dense) {
+    /** Bytes 0 .. 11 to the low lane, 12 .. 23 to the high lane */
+    const __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    const __m256i shuf = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+            6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1,
+            6, 7, 8, -1, 9, 10, 11, -1);
+    uint32_t i = 0;
+
+    for (; i / 4 * 3 + 32 <= HLL_DENSE_BYTES; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (dense + i / 4 * 3));
+        x = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(x, idx), shuf);
+        __m256i r = HLL_UNPACK_LANES(x, _mm256_and_si256,
+                _mm256_or_si256, _mm256_slli_epi32, _mm256_set1_epi32);
+        __m256i m = _mm256_loadu_si256((const __m256i*) (max + i));
+        _mm256_storeu_si256((__m256i*) (max + i), _mm256_max_epu8(m, r));
+    }
+    merge_dense_scalar_from(max, dense, i);
+}
+
+#endif /* ifdef HLL_X86 */
+
+typedef void (*merge_dense_fn_t)(uint8_t*, const uint8_t*);
+
+static int32_t hll_kernel = HLL_KERNEL_SCALAR;
+static merge_dense_fn_t merge_dense_fn = merge_dense_scalar;
+
+static const char* const hll_kernel_names[] = { "scalar", "ssse3", "avx2" };
+
+
+int32_t hll_set_kernel(int32_t kernel) {
+    switch (kernel) {
+    case HLL_KERNEL_SCALAR:
+        merge_dense_fn = merge_dense_scalar;
+        break;
+#ifdef HLL_X86
+    case HLL_KERNEL_SSSE3:
+        if (!__builtin_cpu_supports("ssse3")) return -1;
+        merge_dense_fn = merge_dense_ssse3;
+        break;
+    case HLL_KERNEL_AVX2:
+        if (!__builtin_cpu_supports("avx2")) return -1;
+        merge_dense_fn = merge_dense_avx2;
+        break;
+#endif /* ifdef HLL_X86 */
+    default:
+        return -1;
+    }
+
+    hll_kernel = kernel;
+    return 0;
+}
+
+const char* hll_kernel_name() {
+    return hll_kernel_names[hll_kernel];
+}
+
+void hll_init() {
+#ifdef HLL_X86
+    __builtin_cpu_init();
+#endif /* ifdef HLL_X86 */
+    if (hll_set_kernel(HLL_KERNEL_AVX2) == 0) return;
+    if (hll_set_kernel(HLL_KERNEL_SSSE3) == 0) return;
+    hll_set_kernel(HLL_KERNEL_SCALAR);
+}
+
+/** ------------------------------ Estimate ------------------------------- */
+
+/** Newton's method: libm is not linked (see spawn_redis_server.sh) */
+static double hll_sqrt(double x) {
+    double y = x > 1 ? x : 1;
+    for (int32_t i = 0; i < 128; i++) {
+        double next = 0.5 * (y + x / y);
+        if (next >= y) break;
+        y = next;
+    }
+    return y;
+}
+
+/** Ertl's estimator, "New cardinality estimation algorithms for HLL" */
+static double hll_tau(double x) {
+    if (x == 0. || x == 1.) return 0.;
+
+    double z_prime;
+    double y = 1.0;
+    double z = 1 - x;
+    do {
+        x = hll_sqrt(x);
+        z_prime = z;
+        y *= 0.5;
+        z -= (1 - x) * (1 - x) * y;
+    } while (z_prime != z);
+    return z / 3;
+}
+
+static double hll_sigma(double x) {
+    if (x == 1.) return __builtin_inf();
+
+    double z_prime;
+    double y = 1;
+    double z = x;
+    do {
+        x *= x;
+        z_prime = z;
+        z += x * y;
+        y += y;
+    } while (z_prime != z);
+    return z;
+}
+
+static uint64_t hll_estimate(const uint32_t* histo) {
+    double m = HLL_REGISTERS;
+    double z = m * hll_tau((m - histo[HLL_Q + 1]) / m);
+
+    for (int32_t j = HLL_Q; j >= 1; j--) {
+        z += histo[j];
+        z *= 0.5;
+    }
+    z += m * hll_sigma(histo[0] / m);
+    return (uint64_t) (HLL_ALPHA_INF * m * m / z + 0.5);
+}
+
+/**
+ * Count registers per value. Four tables let consecutive registers with
+ * the same value increment different counters instead of waiting on each
+ * other's store.
+ * */
+static void hll_histogram(const uint8_t* regs, uint32_t* histo) {
+    uint32_t t[4][HLL_REGISTER_MAX + 1];
+    memset(t, 0, sizeof t);
+
+    for (uint32_t i = 0; i < HLL_REGISTERS; i += 4) {
+        t[0][regs[i] & HLL_REGISTER_MAX]++;
+        t[1][regs[i + 1] & HLL_REGISTER_MAX]++;
+        t[2][regs[i + 2] & HLL_REGISTER_MAX]++;
+        t[3][regs[i + 3] & HLL_REGISTER_MAX]++;
+    }
+    for (uint32_t v = 0; v <= HLL_REGISTER_MAX; v++) {
+        histo[v] = t[0][v] + t[1][v] + t[2][v] + t[3][v];
+    }
+}
+
+uint64_t hll_count_registers(const uint8_t* regs) {
+    uint32_t histo[HLL_REGISTER_MAX + 1];
+    hll_histogram(regs, histo);
+    return hll_estimate(histo);
+}
+
+/** ------------------------------ Sparse --------------------------------- */
+
+/**
+ * Call `fn(arg, index, value, runlen)` for every run. Return -1 unless the
+ * runs cover exactly HLL_REGISTERS registers.
+ * */
+static int32_t sparse_for_each(const uint8_t* p, const uint8_t* end,
+        void (*fn)(void*, uint32_t, uint32_t, uint32_t), void* arg) {
+    uint32_t idx = 0;
+
+    while (p < end) {
+        uint32_t value = 0, runlen;
+        if (HLL_SPARSE_IS_ZERO(p)) {
+            runlen = HLL_SPARSE_ZERO_LEN(p);
+            p++;
+        } else if (HLL_SPARSE_IS_XZERO(p)) {
+            if (p + 1 >= end) return -1;
+            runlen = HLL_SPARSE_XZERO_LEN(p);
+            p += 2;
+        } else {
+            value = HLL_SPARSE_VAL_VALUE(p);
+            runlen = HLL_SPARSE_VAL_LEN(p);
+            p++;
+        }
+        if (runlen > HLL_REGISTERS - idx) return -1;
+        fn(arg, idx, value, runlen);
+        idx += runlen;
+    }
+    return idx == HLL_REGISTERS ? 0 : -1;
+}
+
+static void sparse_histogram_run(void* arg, uint32_t idx, uint32_t value,
+        uint32_t runlen) {
+    (void) idx;
+    ((uint32_t*) arg)[value] += runlen;
+}
+
+static void sparse_merge_run(void* arg, uint32_t idx, uint32_t value,
+        uint32_t runlen) {
+    uint8_t* max = arg;
+    if (value == 0) return;
+    for (uint32_t i = idx; i < idx + runlen; i++) {
+        if (value > max[i]) max[i] = value;
+    }
+}
+
+static void sparse_to_dense_run(void* arg, uint32_t idx, uint32_t value,
+        uint32_t runlen) {
+    if (value == 0) return;
+    for (uint32_t i = idx; i < idx + runlen; i++) dense_set(arg, i, value);
+}
+
+/** Replace the sparse representation of `o` with a dense one */
+static int32_t hll_sparse_to_dense(struct robj_t* o) {
+    const uint8_t* p = hll_hdr(o)->registers;
+    const uint8_t* end = (const uint8_t*) hll_hdr(o) + hll_len(o);
+
+    struct robj_t* d = create_raw_string_object(NULL, HLL_DENSE_SIZE);
+    if (d == NULL) return -1;
+
+    struct hll_hdr_t* hdr = hll_hdr(d);
+    memcpy(hdr, hll_hdr(o), HLL_HDR_SIZE);
+    hdr->encoding = HLL_DENSE;
+    if (sparse_for_each(p, end, sparse_to_dense_run, hdr->registers) == -1) {
+        decr_ref_count(d);
+        return -1;
+    }
+
+    /** Swap the strings, `o` keeps its identity in the keyspace */
+    void* tmp = o->ptr;
+    o->ptr = d->ptr;
+    d->ptr = tmp;
+    decr_ref_count(d);
+    return 0;
+}
+
+static size_t sparse_put_zero(uint8_t* p, uint32_t len) {
+    if (len > HLL_SPARSE_ZERO_MAX_LEN) {
+        p[0] = HLL_SPARSE_XZERO_BIT | ((len - 1) >> 8);
+        p[1] = (len - 1) & 0xff;
+        return 2;
+    }
+    p[0] = HLL_SPARSE_ZERO_BIT | (len - 1);
+    return 1;
+}
+
+static size_t sparse_put_val(uint8_t* p, uint32_t value, uint32_t len) {
+    p[0] = HLL_SPARSE_VAL_BIT | ((value - 1) << 2) | (len - 1);
+    return 1;
+}
+
+/**
+ * Set register `index` to `count` if that is larger. The run containing it
+ * is split into at most three runs (before, the register, after), then
+ * neighbouring VAL runs with the same value are merged back.
+ *
+ * Return 1 if it changed, 0 if not, -1 on error and -2 when the HLL must
+ * become dense first.
+ * */
+static int32_t hll_sparse_set(struct robj_t* o, uint32_t index,
+        uint8_t count) {
+    if (count > HLL_SPARSE_VAL_MAX_VALUE) return -2;
+
+    /** The split grows the string by 3 bytes at most */
+    if (raw_string_reserve(o, hll_len(o) + 3) == -1) return -1;
+
+    uint8_t* start = hll_hdr(o)->registers;
+    uint8_t* end = (uint8_t*) hll_hdr(o) + hll_len(o);
+    uint8_t* p = start;
+    uint8_t* prev = NULL;
+    uint32_t first = 0, span = 0;
+
+    while (p < end) {
+        if (HLL_SPARSE_IS_XZERO(p) && p + 1 >= end) return -1;
+        span = HLL_SPARSE_IS_ZERO(p) ? HLL_SPARSE_ZERO_LEN(p) :
+            HLL_SPARSE_IS_XZERO(p) ? HLL_SPARSE_XZERO_LEN(p) :
+            HLL_SPARSE_VAL_LEN(p);
+        if (index < first + span) break;
+        prev = p;
+        p += HLL_SPARSE_OPLEN(p);
+        first += span;
+    }
+    if (p >= end) return -1;
+
+    int32_t is_val = !HLL_SPARSE_IS_ZERO(p) && !HLL_SPARSE_IS_XZERO(p);
+    uint32_t oldlen = HLL_SPARSE_OPLEN(p);
+    uint32_t last = first + span - 1;
+
+    if (is_val && HLL_SPARSE_VAL_VALUE(p) >= count) return 0;
+
+    uint8_t seq[5];
+    size_t n = 0;
+    if (is_val) {
+        uint32_t value = HLL_SPARSE_VAL_VALUE(p);
+        if (index > first) n += sparse_put_val(seq + n, value, index - first);
+        n += sparse_put_val(seq + n, count, 1);
+        if (index < last) n += sparse_put_val(seq + n, value, last - index);
+    } else {
+        if (index > first) n += sparse_put_zero(seq + n, index - first);
+        n += sparse_put_val(seq + n, count, 1);
+        if (index < last) n += sparse_put_zero(seq + n, last - index);
+    }
+
+    size_t len = hll_len(o);
+    if (n > oldlen && len + n - oldlen > config.hll_sparse_max_bytes) {
+        return -2;
+    }
+    memmove(p + n, p + oldlen, end - (p + oldlen));
+    memcpy(p, seq, n);
+    len = len + n - oldlen;
+    end = (uint8_t*) hll_hdr(o) + len;
+
+    /** Merge equal VAL runs around the change, five runs cover it */
+    uint8_t* scan = prev != NULL ? prev : start;
+    for (int32_t i = 0; i < 5 && scan < end; i++) {
+        uint8_t* next = scan + HLL_SPARSE_OPLEN(scan);
+        if (next < end && (*scan & HLL_SPARSE_VAL_BIT) &&
+                (*next & HLL_SPARSE_VAL_BIT) &&
+                HLL_SPARSE_VAL_VALUE(scan) == HLL_SPARSE_VAL_VALUE(next) &&
+                HLL_SPARSE_VAL_LEN(scan) + HLL_SPARSE_VAL_LEN(next) <=
+                HLL_SPARSE_VAL_MAX_LEN) {
+            sparse_put_val(scan, HLL_SPARSE_VAL_VALUE(scan),
+                    HLL_SPARSE_VAL_LEN(scan) + HLL_SPARSE_VAL_LEN(next));
+            memmove(next, next + 1, end - (next + 1));
+            end--;
+            len--;
+            continue; // the merged run may merge with the following one
+        }
+        scan = next;
+    }
+
+    struct rstr_t* str = o->ptr;
+    str->len = len;
+    str->buf[len] = '\0';
+    return 1;
+}
+
+/** ------------------------------ API ------------------------------------ */
+
+int32_t hll_add(struct robj_t* o, const char* ele, size_t len) {
+    uint32_t index;
+    uint8_t count = hll_pat_len(ele, len, &index);
+    struct hll_hdr_t* hdr = hll_hdr(o);
+
+    if (hdr->encoding == HLL_SPARSE) {
+        int32_t ret = hll_sparse_set(o, index, count);
+        if (ret != -2) return ret;
+        if (hll_sparse_to_dense(o) == -1) return -1;
+        hdr = hll_hdr(o);
+    }
+
+    if (dense_get(hdr->registers, index) >= count) return 0;
+    dense_set(hdr->registers, index, count);
+    return 1;
+}
+
+int32_t hll_merge(uint8_t* max, const char* s, size_t len) {
+    const struct hll_hdr_t* hdr = (const struct hll_hdr_t*) s;
+
+    if (hdr->encoding == HLL_DENSE) {
+        merge_dense_fn(max, hdr->registers);
+        return 0;
+    }
+    return sparse_for_each(hdr->registers, (const uint8_t*) s + len,
+            sparse_merge_run, max);
+}
+
+int32_t hll_count(char* s, size_t len, int32_t update_cache,
+        uint64_t* card) {
+    struct hll_hdr_t* hdr = (struct hll_hdr_t*) s;
+
+    if (!(hdr->card[7] & (1 << 7))) {
+        uint64_t v = 0;
+        for (int32_t i = 7; i >= 0; i--) v = (v << 8) | hdr->card[i];
+        *card = v;
+        return 0;
+    }
+
+    if (hdr->encoding == HLL_DENSE) {
+        uint8_t regs[HLL_REGISTERS];
+        memset(regs, 0, sizeof regs);
+        merge_dense_fn(regs, hdr->registers);
+        *card = hll_count_registers(regs);
+    } else {
+        uint32_t histo[HLL_REGISTER_MAX + 1] = { 0 };
+        if (sparse_for_each(hdr->registers, (const uint8_t*) s + len,
+                    sparse_histogram_run, histo) == -1) {
+            return -1;
+        }
+        *card = hll_estimate(histo);
+    }
+
+    if (update_cache) {
+        for (int32_t i = 0; i < 8; i++) hdr->card[i] = *card >> (i * 8);
+    }
+    return 0;
+}
+
+int32_t hll_store_registers(struct robj_t* o, const uint8_t* regs) {
+    if (hll_hdr(o)->encoding == HLL_SPARSE && hll_sparse_to_dense(o) == -1) {
+        return -1;
+    }
+
+    uint8_t* p = hll_hdr(o)->registers;
+    for (uint32_t i = 0; i < HLL_REGISTERS; i += 4, p += 3) {
+        uint32_t v = regs[i] | (regs[i + 1] << 6) | (regs[i + 2] << 12) |
+            ((uint32_t) regs[i + 3] << 18);
+        p[0] = v;
+        p[1] = v >> 8;
+        p[2] = v >> 16;
+    }
+    hll_invalidate_cache((char*) hll_hdr(o));
+    return 0;
+}
@@ -0,0 +1,104 @@
+#ifndef HLL_H
+#define HLL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "object.h"
+
+/**
+ * HyperLogLog with 2^14 six bit registers, stored in a string value (the
+ * same layout as Redis, so dumps are interchangeable):
+ *
+ * +------+-----+--------+-------------------+-----------
+ * | HYLL | enc | unused | cached card (LE)  | registers
+ * +------+-----+--------+-------------------+-----------
+ *    4      1      3              8
+ *
+ * The top bit of the last cardinality byte marks the cache stale.
+ *
+ * DENSE: 16384 registers packed little endian, 12 KB.
+ *
+ * SPARSE: runs of registers, for sets with few elements.
+ * - ZERO   00xxxxxx           1 .. 64 zero registers
+ * - XZERO  01xxxxxx xxxxxxxx  1 .. 16384 zero registers
+ * - VAL    1vvvvvxx           1 .. 4 registers set to 1 .. 32
+ * A sparse HLL becomes dense when it outgrows hll-sparse-max-bytes or a
+ * register needs a value above 32.
+ * */
+
+#define HLL_P             14
+#define HLL_Q             (64 - HLL_P)
+#define HLL_REGISTERS     (1 << HLL_P)
+#define HLL_P_MASK        (HLL_REGISTERS - 1)
+#define HLL_BITS          6
+#define HLL_REGISTER_MAX  ((1 << HLL_BITS) - 1)
+#define HLL_HDR_SIZE      16
+#define HLL_DENSE_BYTES   ((HLL_REGISTERS * HLL_BITS + 7) / 8)
+#define HLL_DENSE_SIZE    (HLL_HDR_SIZE + HLL_DENSE_BYTES)
+
+#define HLL_DENSE  0
+#define HLL_SPARSE 1
+
+/** Kernels, see hll_set_kernel() */
+#define HLL_KERNEL_SCALAR 0
+#define HLL_KERNEL_SSSE3  1 // PSHUFB unpacking, 16 registers per step
+#define HLL_KERNEL_AVX2   2 // 32 registers per step
+
+
+struct hll_hdr_t {
+    char    magic[4];
+    uint8_t encoding;
+    uint8_t notused[3];
+    uint8_t card[8];
+    uint8_t registers[];
+};
+
+
+/** Select the fastest kernel the CPU supports */
+void hll_init();
+
+/** Force a kernel. Return -1 if the CPU does not support it. */
+int32_t hll_set_kernel(int32_t);
+
+const char* hll_kernel_name();
+
+/** An empty sparse HyperLogLog */
+struct robj_t* create_hll_object();
+
+/** Return 1 if the string has a HyperLogLog header and a sane size */
+int32_t is_hll(const char*, size_t);
+
+/**
+ * Add an element to a RAW, unshared HyperLogLog, promoting it to dense when
+ * needed. Return 1 if a register changed, 0 if not, -1 if the object is
+ * corrupted or memory ran out.
+ * */
+int32_t hll_add(struct robj_t*, const char*, size_t);
+
+/**
+ * Cardinality of one HyperLogLog, from the cache when it is valid. Store the
+ * result in the cache when `update_cache` (the string must be writable).
+ * Return -1 if the object is corrupted.
+ * */
+int32_t hll_count(char*, size_t, int32_t, uint64_t*);
+
+/**
+ * Registers as bytes, max-merged with the HyperLogLog. Return -1 if the
+ * object is corrupted.
+ * */
+int32_t hll_merge(uint8_t*, const char*, size_t);
+
+/** Cardinality estimate of registers stored as bytes */
+uint64_t hll_count_registers(const uint8_t*);
+
+/**
+ * Overwrite a RAW, unshared HyperLogLog with registers stored as bytes,
+ * converting it to dense. Return -1 when memory ran out.
+ * */
+int32_t hll_store_registers(struct robj_t*, const uint8_t*);
+
+/** Mark the cached cardinality stale */
+void hll_invalidate_cache(char*);
+
+#endif // !HLL_H
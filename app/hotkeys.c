@@ -0,0 +1,436 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "config.h"
+#include "db.h"
+#include "dict.h"
+#include "event_loop.h"
+#include "hotkeys.h"
+#include "log.h"
+#include "networking.h"
+#include "object.h"
+#include "resp.h"
+#include "server.h"
+
+
+/** A key with its estimated accesses, or its size for the big keys */
+struct top_key_t {
+    char*    key;
+    uint32_t len;
+    uint32_t type;  // OBJ_*, big keys only
+    uint64_t hash;  // dict_hash() of the key
+    uint64_t score; // sketch estimate or bytes
+};
+
+/** Min-heap on the score: the root is the first one to replace */
+struct top_keys_t {
+    struct top_key_t keys[HOTKEYS_TOP_K > BIGKEYS_TOP_K ?
+        HOTKEYS_TOP_K : BIGKEYS_TOP_K];
+    int32_t          n;
+    int32_t          k;
+};
+
+/**
+ * Count-min sketch: a key increments one counter per row, chosen by its
+ * own bits of the hash, and its estimate is the smallest of them. Only the
+ * counters equal to that minimum are incremented, which keeps collisions
+ * from inflating the estimates of cold keys. 128 KB whatever the keyspace.
+ * */
+struct hotkeys_t {
+    uint32_t          sketch[HOTKEYS_CMS_DEPTH][HOTKEYS_CMS_WIDTH];
+    struct top_keys_t top;
+    uint32_t          countdown; // commands before the next sample
+    uint64_t          rand;      // xorshift state of the countdown
+    int64_t           decayed_ms;
+};
+
+/**
+ * The scan collects into `found` and publishes into `last` once the
+ * cursor comes back to 0, so MEMORY BIGKEYS always shows a complete scan.
+ * */
+struct bigkeys_scan_t {
+    struct top_keys_t found;
+    struct top_keys_t last;  // sorted by decreasing size
+    uint64_t          cursor;
+    int32_t           running;
+    int64_t           next_ms; // start of the next scan
+    uint64_t          keys;    // seen by the scan in progress
+    uint64_t          last_keys;
+};
+
+static struct hotkeys_t hot = { .top.k = HOTKEYS_TOP_K };
+static struct bigkeys_scan_t big = {
+    .found.k = BIGKEYS_TOP_K,
+    .last.k = BIGKEYS_TOP_K,
+};
+
+
+static inline int32_t arg_is(const struct resp_arg_t* arg, const char* s) {
+    size_t len = strlen(s);
+    return arg->len == len && strncasecmp(arg->ptr, s, len) == 0;
+}
+
+/** ------------------------------ Top K ---------------------------------- */
+
+static void top_swap(struct top_keys_t* t, int32_t i, int32_t j) {
+    struct top_key_t tmp = t->keys[i];
+    t->keys[i] = t->keys[j];
+    t->keys[j] = tmp;
+}
+
+static void top_sift_up(struct top_keys_t* t, int32_t i) {
+    while (i > 0 && t->keys[(i - 1) / 2].score > t->keys[i].score) {
+        top_swap(t, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void top_sift_down(struct top_keys_t* t, int32_t i) {
+    for (;;) {
+        int32_t min = i;
+        int32_t l = 2 * i + 1;
+        int32_t r = l + 1;
+        if (l < t->n && t->keys[l].score < t->keys[min].score) min = l;
+        if (r < t->n && t->keys[r].score < t->keys[min].score) min = r;
+        if (min == i) return;
+        top_swap(t, i, min);
+        i = min;
+    }
+}
+
+/**
+ * Add the key if the heap has room or it scores above the root, which it
+ * replaces. The key is copied.
+ * */
+static void top_offer(struct top_keys_t* t, const char* key, size_t len,
+        uint32_t type, uint64_t hash, uint64_t score) {
+    int32_t i;
+    if (t->n < t->k) {
+        i = t->n;
+        t->keys[i].key = NULL;
+    } else if (score > t->keys[0].score) {
+        i = 0;
+    } else {
+        return;
+    }
+
+    char* copy = realloc(t->keys[i].key, len > 0 ? len : 1);
+    if (copy == NULL) return;
+    memcpy(copy, key, len);
+    t->keys[i] = (struct top_key_t) { copy, len, type, hash, score };
+
+    if (i == t->n) {
+        top_sift_up(t, t->n++);
+    } else {
+        top_sift_down(t, 0);
+    }
+}
+
+/** Drop the lowest scored key */
+static void top_pop(struct top_keys_t* t) {
+    free(t->keys[0].key);
+    t->keys[0] = t->keys[--t->n];
+    top_sift_down(t, 0);
+}
+
+static void top_clear(struct top_keys_t* t) {
+    for (int32_t i = 0; i < t->n; i++) free(t->keys[i].key);
+    t->n = 0;
+}
+
+static int compare_score_desc(const void* a, const void* b) {
+    const struct top_key_t* x = a;
+    const struct top_key_t* y = b;
+    return x->score < y->score ? 1 : x->score > y->score ? -1 : 0;
+}
+
+/** ------------------------------ Sketch --------------------------------- */
+
+/**
+ * Increment the key's counters, return its new estimate. Rows take
+ * disjoint bits of the hash: two keys then share all their counters with
+ * a 2^-52 chance, where double hashing on 13 bits only gives 2^-26.
+ * */
+static uint32_t sketch_add(uint64_t hash) {
+    uint32_t* counters[HOTKEYS_CMS_DEPTH];
+    uint32_t min = UINT32_MAX;
+
+    for (uint32_t i = 0; i < HOTKEYS_CMS_DEPTH; i++) {
+        counters[i] = &hot.sketch[i][(hash >> (i * HOTKEYS_CMS_BITS)) &
+            (HOTKEYS_CMS_WIDTH - 1)];
+        if (*counters[i] < min) min = *counters[i];
+    }
+    if (min == UINT32_MAX) return min;
+
+    for (uint32_t i = 0; i < HOTKEYS_CMS_DEPTH; i++) {
+        if (*counters[i] == min) (*counters[i])++;
+    }
+    return min + 1;
+}
+
+/**
+ * Halve every count so that the top follows the recent traffic. Keys down
+ * to 0 are no longer hot and leave the top.
+ * */
+static void sketch_decay() {
+    for (uint32_t i = 0; i < HOTKEYS_CMS_DEPTH; i++) {
+        for (uint32_t j = 0; j < HOTKEYS_CMS_WIDTH; j++) {
+            hot.sketch[i][j] >>= 1;
+        }
+    }
+    /** Halving keeps the heap order, the zeros are at the root */
+    for (int32_t i = 0; i < hot.top.n; i++) hot.top.keys[i].score >>= 1;
+    while (hot.top.n > 0 && hot.top.keys[0].score == 0) top_pop(&hot.top);
+}
+
+static void reset_countdown() {
+    uint32_t ratio = config.hotkeys_sample_ratio;
+
+    hot.rand ^= hot.rand << 13;
+    hot.rand ^= hot.rand >> 7;
+    hot.rand ^= hot.rand << 17;
+    /**
+     * Uniform in [1, 2 * ratio - 1]: one in `ratio` on average, with no
+     * period a client could fall in step with.
+     * */
+    hot.countdown = ratio <= 1 ? 1 : 1 + hot.rand % (2 * ratio - 1);
+}
+
+int32_t hotkeys_sample() {
+    if (config.hotkeys_sample_ratio == 0) return 0;
+    if (hot.countdown > 1) {
+        hot.countdown--;
+        return 0;
+    }
+    reset_countdown();
+    return 1;
+}
+
+void hotkeys_record_key(const char* key, size_t len) {
+    uint64_t hash = dict_hash(key, len);
+    uint32_t estimate = sketch_add(hash);
+    struct top_keys_t* t = &hot.top;
+
+    server.stat_hotkeys_sampled++;
+    /**
+     * Each sample raises the estimate by one, so a key of the heap always
+     * comes back above the root: nothing to look for below it.
+     * */
+    if (t->n == t->k && estimate <= t->keys[0].score) return;
+
+    for (int32_t i = 0; i < t->n; i++) {
+        if (t->keys[i].hash == hash && t->keys[i].len == len &&
+                memcmp(t->keys[i].key, key, len) == 0) {
+            t->keys[i].score = estimate;
+            top_sift_down(t, i);
+            return;
+        }
+    }
+    top_offer(t, key, len, 0, hash, estimate);
+}
+
+/** ------------------------------ Big keys ------------------------------- */
+
+/** Entry, key and value, see obj_memory_usage() for `samples` */
+static size_t key_memory_usage(struct dict_entry_t* e, uint64_t samples) {
+    return malloc_usable_size(e) + obj_memory_usage(e->val, samples);
+}
+
+static void bigkeys_callback(void* _, struct dict_entry_t* e) {
+    struct robj_t* o = e->val;
+    struct top_keys_t* t = &big.found;
+    size_t bytes = key_memory_usage(e, BIGKEYS_SAMPLES);
+
+    big.keys++;
+    if (t->n == t->k && bytes <= t->keys[0].score) return;
+    /** A rehash can show an entry twice */
+    for (int32_t i = 0; i < t->n; i++) {
+        if (t->keys[i].hash == e->hash && t->keys[i].len == e->klen &&
+                memcmp(t->keys[i].key, e->key, e->klen) == 0) {
+            return;
+        }
+    }
+    top_offer(t, e->key, e->klen, o->type, e->hash, bytes);
+}
+
+static void bigkeys_publish(int64_t now) {
+    top_clear(&big.last);
+    big.last = big.found;
+    big.last.k = BIGKEYS_TOP_K;
+    qsort(big.last.keys, big.last.n, sizeof(struct top_key_t),
+            compare_score_desc);
+    big.found.n = 0;
+
+    big.last_keys = big.keys;
+    big.running = 0;
+    big.next_ms = now + (int64_t) config.bigkeys_scan_interval * 1000;
+    server.stat_bigkeys_scans++;
+
+    log_verbose("[bigkeys_scan] %lu keys scanned, biggest %lu bytes",
+            (unsigned long) big.last_keys, (unsigned long)
+            (big.last.n > 0 ? big.last.keys[0].score : 0));
+}
+
+/** One bounded step of the scan, like a SCAN call of the server itself */
+static void bigkeys_scan(int64_t now) {
+    if (config.bigkeys_scan_interval == 0) {
+        if (big.running) top_clear(&big.found);
+        big.running = 0;
+        return;
+    }
+    if (!big.running) {
+        if (now < big.next_ms) return;
+        big.running = 1;
+        big.cursor = 0;
+        big.keys = 0;
+    }
+
+    for (uint32_t i = 0; i < BIGKEYS_SCAN_BUCKETS; i++) {
+        big.cursor = dict_scan(server.db->dict, big.cursor, bigkeys_callback,
+                NULL, NULL);
+        if (big.cursor == 0) {
+            bigkeys_publish(now);
+            return;
+        }
+    }
+}
+
+static int64_t hotkeys_cron(struct event_loop_t* el, int64_t id, void* _) {
+    int64_t now = get_monotonic_ms();
+
+    if (now - hot.decayed_ms >= HOTKEYS_DECAY_MS) {
+        sketch_decay();
+        hot.decayed_ms = now;
+    }
+    bigkeys_scan(now);
+    return HOTKEYS_CRON_MS;
+}
+
+int32_t hotkeys_init(struct event_loop_t* el) {
+    hot.rand = dict_hash((const char*) &el, sizeof(el)) | 1;
+    hot.decayed_ms = get_monotonic_ms();
+    reset_countdown();
+
+    if (create_time_event(el, HOTKEYS_CRON_MS, hotkeys_cron, NULL) == -1) {
+        log_warning("[hotkeys_init] time event creation error");
+        return -1;
+    }
+    return 0;
+}
+
+/** ------------------------------ Commands ------------------------------- */
+
+/** Parse the optional COUNT n at argv[i], return -1 after an error reply */
+static int32_t parse_count(struct client_t* c, int32_t i, int64_t* count) {
+    struct resp_arg_t* argv = c->req.argv;
+
+    if (c->req.argc == i) return 0;
+    if (c->req.argc != i + 2 || !arg_is(&argv[i], "count")) {
+        add_reply_error(c, "syntax error");
+        return -1;
+    }
+    if (!resp_string2ll(argv[i + 1].ptr, argv[i + 1].len, count) ||
+            *count < 0) {
+        add_reply_error(c, "value is not an integer or out of range");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * HOTKEYS [COUNT n]: the hottest keys first, as key / estimated accesses
+ * pairs, scaled by the sampling ratio. HOTKEYS RESET forgets them.
+ * */
+void hotkeys_command(struct client_t* c) {
+    int64_t count = HOTKEYS_TOP_K;
+
+    if (c->req.argc == 2 && arg_is(&c->req.argv[1], "reset")) {
+        memset(hot.sketch, 0, sizeof(hot.sketch));
+        top_clear(&hot.top);
+        add_reply(c, "+OK\r\n", 5);
+        return;
+    }
+    if (parse_count(c, 1, &count) == -1) return;
+
+    struct top_key_t sorted[HOTKEYS_TOP_K];
+    int32_t n = hot.top.n;
+    memcpy(sorted, hot.top.keys, n * sizeof(struct top_key_t));
+    qsort(sorted, n, sizeof(struct top_key_t), compare_score_desc);
+    if (count < n) n = count;
+
+    uint64_t ratio = config.hotkeys_sample_ratio > 0 ?
+        config.hotkeys_sample_ratio : 1;
+    add_reply_array_len(c, 2 * n);
+    for (int32_t i = 0; i < n; i++) {
+        add_reply_bulk(c, sorted[i].key, sorted[i].len);
+        add_reply_long_long(c, sorted[i].score * ratio);
+    }
+}
+
+/** MEMORY USAGE key [SAMPLES n], 0 samples measures everything */
+static void memory_usage(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int64_t samples = MEMORY_USAGE_SAMPLES;
+
+    if (c->req.argc != 3) {
+        if (c->req.argc != 5 || !arg_is(&argv[3], "samples")) {
+            add_reply_error(c, "syntax error");
+            return;
+        }
+        if (!resp_string2ll(argv[4].ptr, argv[4].len, &samples) ||
+                samples < 0) {
+            add_reply_error(c, "value is not an integer or out of range");
+            return;
+        }
+    }
+
+    /** Measuring a key must not count as an access */
+    struct dict_entry_t* e = dict_find(server.db->dict, argv[2].ptr,
+            argv[2].len);
+    if (e == NULL) {
+        add_reply_null(c);
+        return;
+    }
+    add_reply_long_long(c, key_memory_usage(e, samples));
+}
+
+/** MEMORY BIGKEYS [COUNT n]: [key, type, bytes] of the last full scan */
+static void memory_bigkeys(struct client_t* c) {
+    int64_t count = BIGKEYS_TOP_K;
+
+    if (parse_count(c, 2, &count) == -1) return;
+
+    int32_t n = big.last.n < count ? big.last.n : count;
+    add_reply_array_len(c, n);
+    for (int32_t i = 0; i < n; i++) {
+        struct top_key_t* k = &big.last.keys[i];
+        const char* type = obj_type_name(k->type);
+        add_reply_array_len(c, 3);
+        add_reply_bulk(c, k->key, k->len);
+        add_reply_bulk(c, type, strlen(type));
+        add_reply_long_long(c, k->score);
+    }
+}
+
+void memory_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+
+    if (arg_is(&argv[1], "usage") && c->req.argc >= 3) {
+        memory_usage(c);
+    } else if (arg_is(&argv[1], "bigkeys")) {
+        memory_bigkeys(c);
+    } else {
+        add_reply_error(c, "syntax error, try MEMORY USAGE|BIGKEYS");
+    }
+}
+
+int32_t memory_getkeys(const struct resp_arg_t* argv, int32_t argc,
+        struct keys_result_t* r) {
+    if (argc >= 3 && arg_is(&argv[1], "usage")) {
+        return keys_result_add(r, 2);
+    }
+    return 0;
+}
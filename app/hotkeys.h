@@ -0,0 +1,53 @@
+#ifndef HOTKEYS_H
+#define HOTKEYS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "event_loop.h"
+#include "networking.h"
+#include "resp.h"
+
+#define HOTKEYS_CMS_DEPTH 4     // rows of the count-min sketch
+#define HOTKEYS_CMS_BITS  13    // DEPTH * BITS must fit a 64 bit hash
+#define HOTKEYS_CMS_WIDTH (1 << HOTKEYS_CMS_BITS) // counters per row
+#define HOTKEYS_TOP_K     32    // hottest keys kept with their names
+#define HOTKEYS_DECAY_MS  10000 // every counter is halved this often
+#define HOTKEYS_CRON_MS   10
+
+#define BIGKEYS_TOP_K        32
+#define BIGKEYS_SCAN_BUCKETS 1000 // dict buckets scanned per cron call
+#define BIGKEYS_SAMPLES      5    // nodes per tree when sizing a stream
+
+/** Default of MEMORY USAGE ... SAMPLES */
+#define MEMORY_USAGE_SAMPLES 5
+
+
+struct keys_result_t;
+
+/**
+ * Start the timer that decays the sketch and runs the big key scan every
+ * bigkeys-scan-interval seconds.
+ * */
+int32_t hotkeys_init(struct event_loop_t*);
+
+/**
+ * Return 1 for one command in hotkeys-sample-ratio on average, whose keys
+ * go to hotkeys_record_key(). Other commands only pay a countdown.
+ * */
+int32_t hotkeys_sample();
+
+/** Count one access to the key in the sketch, and in the top K if hot */
+void hotkeys_record_key(const char*, size_t);
+
+/** HOTKEYS [COUNT n] | RESET */
+void hotkeys_command(struct client_t*);
+
+/** MEMORY USAGE key [SAMPLES n] | BIGKEYS [COUNT n] */
+void memory_command(struct client_t*);
+
+/** command_getkeys_t of MEMORY: the key of USAGE */
+int32_t memory_getkeys(const struct resp_arg_t*, int32_t,
+        struct keys_result_t*);
+
+#endif // !HOTKEYS_H
@@ -1,4 +1,10 @@
+#include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "ip.h"
 
@@ -9,7 +15,57 @@ void * get_in_addr(struct sockaddr *sa)
      {
          return &(((struct sockaddr_in*)sa)->sin_addr);
      }
+     if (sa->sa_family == AF_UNIX)
+     {
+         return ((struct sockaddr_un*)sa)->sun_path;
+     }
 
      return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
+int32_t format_addr(struct sockaddr *sa, char *buf, size_t size)
+{
+    if (sa->sa_family == AF_UNIX)
+    {
+        const char *path = get_in_addr(sa);
+        size_t len = strnlen(path, sizeof ((struct sockaddr_un*)sa)->sun_path);
+        if (len >= size)
+        {
+            return -1;
+        }
+        memcpy(buf, path, len);
+        buf[len] = '\0';
+        return 0;
+    }
+
+    return inet_ntop(sa->sa_family, get_in_addr(sa), buf, size) != NULL ?
+        0 : -1;
+}
+
+int32_t set_tcp_nodelay(int32_t fd)
+{
+    int32_t yes = 1;
+    return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+}
+
+int32_t set_tcp_keepalive(int32_t fd, int32_t interval)
+{
+    int32_t yes = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof yes) == -1)
+    {
+        return -1;
+    }
+
+    int32_t intvl = interval / 3 > 0 ? interval / 3 : 1;
+    int32_t cnt = 3;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &interval, sizeof interval) 
+            == -1 ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof intvl) == -1 ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof cnt) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
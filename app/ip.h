@@ -1,9 +1,31 @@
 #ifndef IP_H
 #define IP_H
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
 
+/** Longest address string: an IPv6 address or a Unix socket path */
+#define NET_ADDR_STR_LEN 108
+
+
+/** The IPv4 / IPv6 address, or the path of an AF_UNIX address */
 void * get_in_addr(struct sockaddr *);
 
+/**
+ * Format an address into `buf` of NET_ADDR_STR_LEN bytes: the IP, or the
+ * socket path for AF_UNIX. Return 0 or -1.
+ * */
+int32_t format_addr(struct sockaddr *, char *, size_t);
 
-#endif // ! IP_H
+/** Disable Nagle so small replies are not delayed. Return 0 or -1 */
+int32_t set_tcp_nodelay(int32_t);
 
+/** 
+ * Enable SO_KEEPALIVE and probe an idle peer after `interval` seconds, then
+ * every interval / 3 seconds, giving up after 3 failed probes.
+ * */
+int32_t set_tcp_keepalive(int32_t, int32_t);
+
+
+#endif // ! IP_H
@@ -0,0 +1,238 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+
+_Atomic int32_t log_level = LL_NOTICE;
+
+static struct {
+    int32_t                     fd;
+    _Atomic int32_t             running;
+    _Atomic int32_t             stop;
+    pthread_t                   thread;
+    _Atomic(struct log_ring_t*) rings;
+    uint64_t                    dropped_reported;
+    char                        batch[LOG_BATCH_SIZE];
+    uint32_t                    batch_len;
+    time_t                      ts_sec;     // second cached in `ts_str`
+    char                        ts_str[32];
+} logger = { .fd = -1 };
+
+static _Thread_local struct log_ring_t* tl_ring = NULL;
+
+static const char level_char[] = { '.', '-', '*', '#' };
+
+
+static struct log_ring_t* create_log_ring() {
+    struct log_ring_t* ring = calloc(1, sizeof(struct log_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->tid = (int32_t) syscall(SYS_gettid);
+
+    /** Lock-free push onto the registry, rings are never unlinked */
+    struct log_ring_t* first = atomic_load(&logger.rings);
+    do {
+        ring->next = first;
+    } while (!atomic_compare_exchange_weak(&logger.rings, &first, ring));
+
+    return ring;
+}
+
+static void write_fully(const char* buf, uint32_t len) {
+    ssize_t nwritten = 0;
+    while (len > 0) {
+        if ((nwritten = write(logger.fd, buf, len)) == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += nwritten;
+        len -= nwritten;
+    }
+}
+
+static void flush_batch() {
+    if (logger.batch_len == 0) return;
+    write_fully(logger.batch, logger.batch_len);
+    logger.batch_len = 0;
+}
+
+static void append_batch(const char* buf, uint32_t len) {
+    if (logger.batch_len + len > LOG_BATCH_SIZE) {
+        flush_batch();
+    }
+    memcpy(logger.batch + logger.batch_len, buf, len);
+    logger.batch_len += len;
+}
+
+static void append_record(int32_t tid, const struct log_record_t* r) {
+    if (r->ts.tv_sec != logger.ts_sec) {
+        struct tm tm;
+        localtime_r(&r->ts.tv_sec, &tm);
+        strftime(logger.ts_str, sizeof logger.ts_str, "%d %b %Y %H:%M:%S",
+                &tm);
+        logger.ts_sec = r->ts.tv_sec;
+    }
+
+    uint16_t len = r->len;
+    if (len > 0 && r->msg[len - 1] == '\n') len--;
+
+    char line[LOG_MSG_SIZE + 64];
+    int32_t n = snprintf(line, sizeof line, "%d %s.%03ld %c %.*s\n", tid,
+            logger.ts_str, r->ts.tv_nsec / 1000000, level_char[r->level],
+            len, r->msg);
+    if (n > (int32_t) sizeof line) n = sizeof line;
+    append_batch(line, n);
+}
+
+/** Drain every ring once. Return number of records drained */
+static uint32_t drain_rings() {
+    uint32_t drained = 0;
+    uint64_t dropped = 0;
+
+    for (struct log_ring_t* ring = atomic_load(&logger.rings); ring != NULL;
+            ring = ring->next) {
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        for (; tail != head; tail++) {
+            append_record(ring->tid,
+                    &ring->records[tail & (LOG_RING_SIZE - 1)]);
+            drained++;
+        }
+
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+
+    if (dropped != logger.dropped_reported) {
+        char line[96];
+        int32_t n = snprintf(line, sizeof line,
+                "%d # [log] %lu log records dropped (ring buffer full)\n",
+                getpid(), (unsigned long) (dropped - logger.dropped_reported));
+        append_batch(line, n);
+        logger.dropped_reported = dropped;
+    }
+
+    flush_batch();
+
+    return drained;
+}
+
+static void* log_main(void* _) {
+    struct timespec idle = { 0, LOG_IDLE_SLEEP_MS * 1000000L };
+
+    while (!atomic_load(&logger.stop)) {
+        if (drain_rings() == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    drain_rings();
+
+    return NULL;
+}
+
+int32_t log_init(const char* path, int32_t level) {
+    assert(level >= LL_DEBUG && level <= LL_WARNING);
+
+    if (atomic_load(&logger.running)) return 0;
+
+    if (path == NULL) {
+        logger.fd = STDOUT_FILENO;
+    } else if ((logger.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644))
+            == -1) {
+        fprintf(stderr, "[log_init] open %s error: %s\n", path,
+                strerror(errno));
+        return -1;
+    }
+
+    atomic_store(&log_level, level);
+    atomic_store(&logger.stop, 0);
+
+    int32_t rval = -1;
+    if ((rval = pthread_create(&logger.thread, NULL, log_main, NULL)) != 0) {
+        fprintf(stderr, "[log_init] thread creation error (%d)\n", rval);
+        if (logger.fd != STDOUT_FILENO) close(logger.fd);
+        logger.fd = -1;
+        return -1;
+    }
+
+    atomic_store(&logger.running, 1);
+
+    return 0;
+}
+
+void log_shutdown() {
+    if (!atomic_load(&logger.running)) return;
+
+    atomic_store(&logger.stop, 1);
+    pthread_join(logger.thread, NULL);
+    atomic_store(&logger.running, 0);
+
+    if (logger.fd != STDOUT_FILENO) close(logger.fd);
+    logger.fd = -1;
+}
+
+void log_set_level(int32_t level) {
+    assert(level >= LL_DEBUG && level <= LL_WARNING);
+    atomic_store(&log_level, level);
+}
+
+uint64_t log_dropped() {
+    uint64_t dropped = 0;
+    for (struct log_ring_t* ring = atomic_load(&logger.rings); ring != NULL;
+            ring = ring->next) {
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+    return dropped;
+}
+
+void log_write(int32_t level, const char* fmt, ...) {
+    va_list ap;
+
+    /** No log thread (yet): fall back to a direct unbuffered write */
+    if (!atomic_load_explicit(&logger.running, memory_order_acquire)) {
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fputc('\n', stderr);
+        return;
+    }
+
+    if (tl_ring == NULL && (tl_ring = create_log_ring()) == NULL) {
+        return;
+    }
+
+    struct log_ring_t* ring = tl_ring;
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    struct log_record_t* r = &ring->records[head & (LOG_RING_SIZE - 1)];
+    clock_gettime(CLOCK_REALTIME_COARSE, &r->ts);
+    r->level = level;
+
+    va_start(ap, fmt);
+    int32_t n = vsnprintf(r->msg, LOG_MSG_SIZE, fmt, ap);
+    va_end(ap);
+    if (n < 0) n = 0;
+    r->len = n >= LOG_MSG_SIZE ? LOG_MSG_SIZE - 1 : n;
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
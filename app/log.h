@@ -0,0 +1,86 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LL_DEBUG   0
+#define LL_VERBOSE 1
+#define LL_NOTICE  2
+#define LL_WARNING 3
+
+#define LOG_RING_SIZE  512  // records per producer thread, power of two
+#define LOG_MSG_SIZE   224  // max formatted message length (truncated past)
+#define LOG_BATCH_SIZE (64 * 1024)
+#define LOG_IDLE_SLEEP_MS 10
+
+
+/**
+ * One formatted log line waiting to be written out. Producers only format
+ * the message body; the timestamp is kept raw and rendered by the log thread
+ * so that no localtime() / strftime() work happens on the hot path.
+ * */
+struct log_record_t {
+    struct timespec ts;
+    int8_t          level;
+    uint16_t        len;
+    char            msg[LOG_MSG_SIZE];
+};
+
+/**
+ * Single producer / single consumer ring. Each thread that logs lazily owns
+ * exactly one ring (producer), and the background log thread is the only
+ * consumer of every ring.
+ *
+ * How it work:
+ * 1. Producer checks for a free slot (head - tail < LOG_RING_SIZE). If the
+ * ring is full, the record is dropped and `dropped` is bumped instead of
+ * blocking the caller.
+ * 2. Producer formats into the slot and publishes it with a release store of
+ * `head`.
+ * 3. Log thread acquires `head`, copies every published record into its batch
+ * buffer and releases the slots with a store of `tail`.
+ * */
+struct log_ring_t {
+    _Atomic uint32_t    head;    // next slot to fill (written by producer)
+    _Atomic uint32_t    tail;    // next slot to drain (written by log thread)
+    _Atomic uint64_t    dropped; // records lost because the ring was full
+    int32_t             tid;
+    struct log_ring_t*  next;    // registry of all rings, push only
+    struct log_record_t records[LOG_RING_SIZE];
+};
+
+
+/**
+ * Start the background log thread. `path` == NULL logs to stdout. Messages
+ * below `level` are discarded before formatting.
+ * */
+int32_t log_init(const char*, int32_t);
+
+/** Drain every ring, stop the log thread and close the log file */
+void log_shutdown();
+
+void log_set_level(int32_t);
+
+/** Total number of records dropped across all producer threads */
+uint64_t log_dropped();
+
+void log_write(int32_t, const char*, ...)
+    __attribute__((format(printf, 2, 3)));
+
+extern _Atomic int32_t log_level;
+
+/** Level check is inlined so filtered messages never reach vsnprintf */
+#define log_at(level, ...) do { \
+    if ((level) >= atomic_load_explicit(&log_level, memory_order_relaxed)) { \
+        log_write((level), __VA_ARGS__); \
+    } \
+} while (0)
+
+#define log_debug(...)   log_at(LL_DEBUG, __VA_ARGS__)
+#define log_verbose(...) log_at(LL_VERBOSE, __VA_ARGS__)
+#define log_notice(...)  log_at(LL_NOTICE, __VA_ARGS__)
+#define log_warning(...) log_at(LL_WARNING, __VA_ARGS__)
+
+#endif // !LOG_H
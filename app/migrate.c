@@ -0,0 +1,807 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blocked.h"
+#include "cluster.h"
+#include "db.h"
+#include "dict.h"
+#include "event_loop.h"
+#include "ip.h"
+#include "log.h"
+#include "migrate.h"
+#include "networking.h"
+#include "object.h"
+#include "rax.h"
+#include "resp.h"
+#include "server.h"
+#include "stream.h"
+
+#define DUMP_FOOTER_SIZE 10 // version and CRC64
+
+#define MIGRATE_DEFAULT_TIMEOUT 1000 // ms, for timeout <= 0
+#define MIGRATE_REPLY_MAX       256  // longest reply line kept
+
+
+/** Growable output of DUMP, and of the pipeline MIGRATE sends */
+struct dump_buf_t {
+    unsigned char* p;
+    size_t         len;
+    size_t         cap;
+    int32_t        oom;
+};
+
+struct dump_reader_t {
+    const unsigned char* p;
+    const unsigned char* end;
+    int32_t              err;
+};
+
+/** A connection MIGRATE keeps to a target between calls */
+struct migrate_socket_t {
+    int32_t fd;
+    int64_t last_use_time; // monotonic ms
+};
+
+/** Bytes of a reply read and not yet consumed */
+struct migrate_rbuf_t {
+    char   buf[4096];
+    size_t pos;
+    size_t len;
+};
+
+
+static inline int32_t arg_is(const struct resp_arg_t* arg, const char* s) {
+    size_t len = strlen(s);
+    return arg->len == len && strncasecmp(arg->ptr, s, len) == 0;
+}
+
+/** ------------------------------ CRC64 ---------------------------------- */
+
+/** CRC-64/Jones, reflected, as the DUMP payloads of Redis */
+#define CRC64_POLY 0x95ac9329ac4bc9b5ULL
+
+static uint64_t crc64tab[256];
+static int32_t crc64_ready = 0;
+
+static uint64_t crc64(const unsigned char* p, size_t len) {
+    if (!crc64_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint64_t crc = i;
+            for (int32_t k = 0; k < 8; k++) {
+                crc = crc & 1 ? crc >> 1 ^ CRC64_POLY : crc >> 1;
+            }
+            crc64tab[i] = crc;
+        }
+        crc64_ready = 1;
+    }
+
+    uint64_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc64tab[(crc ^ p[i]) & 0xff] ^ crc >> 8;
+    }
+    return crc;
+}
+
+/** ------------------------------ Encoding ------------------------------- */
+
+static void buf_put(struct dump_buf_t* b, const void* p, size_t len) {
+    if (b->oom) return;
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap == 0 ? 64 : b->cap;
+        while (cap < b->len + len) cap *= 2;
+        unsigned char* np = realloc(b->p, cap);
+        if (np == NULL) {
+            b->oom = 1;
+            return;
+        }
+        b->p = np;
+        b->cap = cap;
+    }
+    memcpy(b->p + b->len, p, len);
+    b->len += len;
+}
+
+static void buf_put_varint(struct dump_buf_t* b, uint64_t v) {
+    unsigned char tmp[10];
+    size_t n = 0;
+    while (v >= 0x80) {
+        tmp[n++] = v | 0x80;
+        v >>= 7;
+    }
+    tmp[n++] = v;
+    buf_put(b, tmp, n);
+}
+
+static void buf_put_string(struct dump_buf_t* b, const void* p, size_t len) {
+    buf_put_varint(b, len);
+    buf_put(b, p, len);
+}
+
+static void buf_put_id(struct dump_buf_t* b, const struct stream_id_t* id) {
+    buf_put_varint(b, id->ms);
+    buf_put_varint(b, id->seq);
+}
+
+static uint64_t read_varint(struct dump_reader_t* r) {
+    uint64_t v = 0;
+    for (int32_t shift = 0; shift < 64; shift += 7) {
+        if (r->p == r->end) break;
+        unsigned char byte = *r->p++;
+        v |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return v;
+    }
+    r->err = 1;
+    return 0;
+}
+
+static const char* read_string(struct dump_reader_t* r, size_t* len) {
+    *len = read_varint(r);
+    if (r->err || *len > (size_t) (r->end - r->p)) {
+        r->err = 1;
+        return NULL;
+    }
+    const char* s = (const char*) r->p;
+    r->p += *len;
+    return s;
+}
+
+static void read_id(struct dump_reader_t* r, struct stream_id_t* id) {
+    id->ms = read_varint(r);
+    id->seq = read_varint(r);
+}
+
+/**
+ * Stream: the entries (ID, fields and values), last ID, entries added, then
+ * each group with its last ID, its consumers (name, seen time) and its
+ * pending entries (ID, delivery time and count, consumer name).
+ * */
+static void dump_stream(struct dump_buf_t* b, struct stream_t* s) {
+    struct stream_id_t min = { 0, 0 };
+    struct stream_id_t max = { UINT64_MAX, UINT64_MAX };
+    struct stream_iter_t it;
+    struct stream_id_t id;
+    int64_t nfields;
+
+    buf_put_varint(b, s->length);
+    stream_iter_start(&it, s, &min, &max, 0);
+    while (stream_iter_next(&it, &id, &nfields)) {
+        buf_put_id(b, &id);
+        buf_put_varint(b, nfields);
+        for (int64_t i = 0; i < nfields; i++) {
+            const char *field, *value;
+            size_t flen, vlen;
+            stream_iter_field(&it, &field, &flen, &value, &vlen);
+            buf_put_string(b, field, flen);
+            buf_put_string(b, value, vlen);
+        }
+    }
+    stream_iter_stop(&it);
+    buf_put_id(b, &s->last_id);
+    buf_put_varint(b, s->entries_added);
+
+    buf_put_varint(b, s->cgroups != NULL ? rax_size(s->cgroups) : 0);
+    if (s->cgroups == NULL) return;
+
+    struct rax_iter_t gi;
+    rax_iter_start(&gi, s->cgroups);
+    for (int32_t more = rax_seek(&gi, "^", NULL, 0); more;
+            more = rax_next(&gi)) {
+        struct stream_cg_t* cg = gi.value;
+        struct rax_iter_t ri;
+        buf_put_string(b, gi.key, gi.key_len);
+        buf_put_id(b, &cg->last_id);
+
+        buf_put_varint(b, rax_size(cg->consumers));
+        rax_iter_start(&ri, cg->consumers);
+        for (int32_t m = rax_seek(&ri, "^", NULL, 0); m; m = rax_next(&ri)) {
+            struct stream_consumer_t* consumer = ri.value;
+            buf_put_string(b, consumer->name, consumer->name_len);
+            buf_put_varint(b, consumer->seen_time);
+        }
+        rax_iter_release(&ri);
+
+        buf_put_varint(b, rax_size(cg->pel));
+        rax_iter_start(&ri, cg->pel);
+        for (int32_t m = rax_seek(&ri, "^", NULL, 0); m; m = rax_next(&ri)) {
+            struct stream_nack_t* nack = ri.value;
+            stream_decode_id(ri.key, &id);
+            buf_put_id(b, &id);
+            buf_put_varint(b, nack->delivery_time);
+            buf_put_varint(b, nack->delivery_count);
+            buf_put_string(b, nack->consumer->name,
+                    nack->consumer->name_len);
+        }
+        rax_iter_release(&ri);
+    }
+    rax_iter_release(&gi);
+}
+
+/** Serialize the value with its footer into `b`, check b->oom after */
+static void dump_object(struct dump_buf_t* b, const struct robj_t* o) {
+    unsigned char type = o->type;
+    buf_put(b, &type, 1);
+
+    if (o->type == OBJ_STRING) {
+        char tmp[OBJ_LONG_STR_SIZE];
+        size_t len;
+        const char* s = obj_string_ptr(o, tmp, &len);
+        buf_put_string(b, s, len);
+    } else {
+        dump_stream(b, o->ptr);
+    }
+    if (b->oom) return;
+
+    unsigned char footer[DUMP_FOOTER_SIZE];
+    footer[0] = DUMP_VERSION & 0xff;
+    footer[1] = DUMP_VERSION >> 8;
+    buf_put(b, footer, 2);
+    if (b->oom) return;
+
+    uint64_t crc = crc64(b->p, b->len);
+    for (int32_t i = 0; i < 8; i++) footer[i] = crc >> (8 * i);
+    buf_put(b, footer, 8);
+}
+
+/** ------------------------------ Decoding ------------------------------- */
+
+/** Return 0 with the payload's version or checksum wrong */
+static int32_t verify_payload(const unsigned char* p, size_t len) {
+    if (len < 1 + DUMP_FOOTER_SIZE) return 0;
+
+    const unsigned char* footer = p + len - DUMP_FOOTER_SIZE;
+    uint32_t version = footer[0] | footer[1] << 8;
+    if (version > DUMP_VERSION) return 0;
+
+    uint64_t crc = 0;
+    for (int32_t i = 7; i >= 0; i--) crc = crc << 8 | footer[2 + i];
+    return crc64(p, len - 8) == crc;
+}
+
+static int32_t restore_stream_groups(struct dump_reader_t* r,
+        struct stream_t* s) {
+    uint64_t ngroups = read_varint(r);
+
+    for (uint64_t g = 0; g < ngroups && !r->err; g++) {
+        struct stream_id_t id;
+        size_t len;
+        const char* name = read_string(r, &len);
+        read_id(r, &id);
+        if (r->err) return -1;
+
+        struct stream_cg_t* cg = stream_create_cg(s, name, len, &id);
+        if (cg == NULL) return -1;
+
+        uint64_t nconsumers = read_varint(r);
+        for (uint64_t i = 0; i < nconsumers && !r->err; i++) {
+            int32_t created;
+            name = read_string(r, &len);
+            int64_t seen_time = read_varint(r);
+            if (r->err) return -1;
+
+            struct stream_consumer_t* consumer = stream_create_consumer(cg,
+                    name, len, seen_time, &created);
+            if (consumer == NULL) return -1;
+        }
+
+        uint64_t npending = read_varint(r);
+        for (uint64_t i = 0; i < npending && !r->err; i++) {
+            unsigned char key[STREAM_ID_SIZE];
+            struct stream_nack_t* nack;
+            read_id(r, &id);
+            int64_t delivery_time = read_varint(r);
+            uint64_t delivery_count = read_varint(r);
+            name = read_string(r, &len);
+            if (r->err) return -1;
+
+            struct stream_consumer_t* consumer = stream_lookup_consumer(cg,
+                    name, len);
+            if (consumer == NULL ||
+                    stream_pel_deliver(cg, consumer, &id, delivery_time) ==
+                    -1) {
+                return -1;
+            }
+            stream_encode_id(key, &id);
+            rax_find(cg->pel, key, STREAM_ID_SIZE, (void**) &nack);
+            nack->delivery_count = delivery_count;
+        }
+    }
+    return r->err ? -1 : 0;
+}
+
+static struct robj_t* restore_stream(struct dump_reader_t* r) {
+    struct robj_t* o = create_stream_object();
+    if (o == NULL) return NULL;
+    struct stream_t* s = o->ptr;
+    struct resp_arg_t* argv = NULL;
+    uint64_t argv_cap = 0;
+
+    uint64_t length = read_varint(r);
+    for (uint64_t i = 0; i < length && !r->err; i++) {
+        struct stream_id_t id;
+        read_id(r, &id);
+        uint64_t nfields = read_varint(r);
+        if (r->err || nfields == 0 || nfields > (size_t) (r->end - r->p) ||
+                stream_id_cmp(&id, &s->last_id) <= 0) {
+            goto err;
+        }
+
+        if (nfields * 2 > argv_cap) {
+            struct resp_arg_t* a = realloc(argv,
+                    sizeof(struct resp_arg_t) * nfields * 2);
+            if (a == NULL) goto err;
+            argv = a;
+            argv_cap = nfields * 2;
+        }
+        for (uint64_t k = 0; k < nfields * 2; k++) {
+            argv[k].ptr = read_string(r, &argv[k].len);
+            argv[k].off = 0;
+        }
+        if (r->err || stream_append(s, &id, argv, nfields) == -1) goto err;
+    }
+
+    struct stream_id_t last_id;
+    read_id(r, &last_id);
+    s->entries_added = read_varint(r);
+    if (r->err || stream_id_cmp(&last_id, &s->last_id) < 0) goto err;
+    s->last_id = last_id;
+
+    if (restore_stream_groups(r, s) == -1) goto err;
+    free(argv);
+    return o;
+
+err:
+    free(argv);
+    decr_ref_count(o);
+    return NULL;
+}
+
+/** Return NULL when the value does not decode */
+static struct robj_t* restore_object(const unsigned char* p, size_t len) {
+    struct dump_reader_t r = { p + 1, p + len - DUMP_FOOTER_SIZE, 0 };
+    struct robj_t* o = NULL;
+
+    if (p[0] == OBJ_STRING) {
+        size_t slen;
+        const char* s = read_string(&r, &slen);
+        if (r.err) return NULL;
+        if ((o = create_string_object(s, slen)) == NULL) return NULL;
+        o = try_object_encoding(o);
+    } else if (p[0] == OBJ_STREAM) {
+        o = restore_stream(&r);
+    }
+    if (o != NULL && r.p != r.end) {
+        decr_ref_count(o);
+        return NULL;
+    }
+    return o;
+}
+
+/** ------------------------------ DUMP / RESTORE ------------------------- */
+
+void dump_command(struct client_t* c) {
+    struct resp_arg_t* key = &c->req.argv[1];
+    struct robj_t* o = lookup_key_read(server.db, key->ptr, key->len);
+    struct dump_buf_t b = { 0 };
+
+    if (o == NULL) {
+        add_reply_null(c);
+        return;
+    }
+    dump_object(&b, o);
+    if (b.oom) {
+        add_reply_error(c, "out of memory");
+    } else {
+        add_reply_bulk(c, (const char*) b.p, b.len);
+    }
+    free(b.p);
+}
+
+/**
+ * RESTORE key ttl payload [REPLACE]. Keys do not expire in this server, so
+ * the TTL must be 0.
+ * */
+void restore_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    struct resp_arg_t* key = &argv[1];
+    const unsigned char* payload = (const unsigned char*) argv[3].ptr;
+    int32_t replace = 0;
+    int64_t ttl;
+
+    for (int32_t i = 4; i < argc; i++) {
+        if (arg_is(&argv[i], "replace")) {
+            replace = 1;
+        } else {
+            add_reply_error(c, "syntax error");
+            return;
+        }
+    }
+    if (!resp_string2ll(argv[2].ptr, argv[2].len, &ttl) || ttl < 0) {
+        add_reply_error(c, "Invalid TTL value, must be >= 0");
+        return;
+    }
+    if (ttl != 0) {
+        add_reply_error(c, "Invalid TTL value, keys do not expire");
+        return;
+    }
+    if (!replace && lookup_key_write(server.db, key->ptr, key->len) != NULL) {
+        add_reply_error(c, "-BUSYKEY Target key name already exists.");
+        return;
+    }
+    if (!verify_payload(payload, argv[3].len)) {
+        add_reply_error(c, "DUMP payload version or checksum are wrong");
+        return;
+    }
+
+    struct robj_t* o = restore_object(payload, argv[3].len);
+    if (o == NULL) {
+        add_reply_error(c, "Bad data format");
+        return;
+    }
+    if (set_key(server.db, key->ptr, key->len, o) != DICT_OK) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+    if (o->type == OBJ_STREAM) signal_key_as_ready(key->ptr, key->len);
+    signal_modified_key(key->ptr, key->len);
+    server.dirty++;
+    add_reply_status(c, "OK");
+}
+
+/** ------------------------------ MIGRATE -------------------------------- */
+
+int32_t migrate_getkeys(const struct resp_arg_t* argv, int32_t argc,
+        struct keys_result_t* r) {
+    if (argv[3].len != 0) return keys_result_add(r, 3);
+
+    for (int32_t i = 6; i < argc; i++) {
+        if (!arg_is(&argv[i], "keys")) continue;
+        for (int32_t k = i + 1; k < argc; k++) {
+            if (keys_result_add(r, k) == -1) return -1;
+        }
+        break;
+    }
+    return 0;
+}
+
+static void free_migrate_socket(void* p) {
+    struct migrate_socket_t* ms = p;
+    close(ms->fd);
+    free(ms);
+}
+
+/** Wait up to `timeout` ms for `events`, return 0 on timeout or error */
+static int32_t wait_fd(int32_t fd, int16_t events, int64_t timeout) {
+    struct pollfd pfd = { .fd = fd, .events = events };
+    int32_t n;
+    do {
+        n = poll(&pfd, 1, timeout);
+    } while (n == -1 && errno == EINTR);
+    return n == 1 && (pfd.revents & (events | POLLERR | POLLHUP));
+}
+
+static int32_t connect_target(const char* host, const char* port,
+        int64_t timeout) {
+    struct addrinfo hints = { 0 };
+    struct addrinfo* res;
+    int32_t fd = -1;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) return -1;
+
+    for (struct addrinfo* p = res; p != NULL && fd == -1; p = p->ai_next) {
+        fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK |
+                SOCK_CLOEXEC, p->ai_protocol);
+        if (fd == -1) continue;
+
+        int32_t err = 0;
+        socklen_t len = sizeof err;
+        if ((connect(fd, p->ai_addr, p->ai_addrlen) == -1 &&
+                    (errno != EINPROGRESS ||
+                     !wait_fd(fd, POLLOUT, timeout) ||
+                     getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 ||
+                     err != 0))) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd != -1) set_tcp_nodelay(fd);
+    return fd;
+}
+
+/** The cached connection to host:port, connecting if needed */
+static struct migrate_socket_t* get_migrate_socket(struct client_t* c,
+        const struct resp_arg_t* host, const struct resp_arg_t* port,
+        int64_t timeout) {
+    char name[320];
+    char hoststr[256];
+    char portstr[8];
+
+    if (host->len >= sizeof hoststr || port->len >= sizeof portstr) {
+        add_reply_error(c, "-IOERR error or timeout connecting to the client");
+        return NULL;
+    }
+    memcpy(hoststr, host->ptr, host->len);
+    hoststr[host->len] = '\0';
+    memcpy(portstr, port->ptr, port->len);
+    portstr[port->len] = '\0';
+    int32_t len = snprintf(name, sizeof name, "%s:%s", hoststr, portstr);
+
+    if (server.migrate_cached_sockets == NULL &&
+            (server.migrate_cached_sockets =
+             create_dict(free_migrate_socket)) == NULL) {
+        add_reply_error(c, "out of memory");
+        return NULL;
+    }
+    struct dict_entry_t* e = dict_find(server.migrate_cached_sockets, name,
+            len);
+    if (e != NULL) {
+        struct migrate_socket_t* ms = e->val;
+        ms->last_use_time = get_monotonic_ms();
+        return ms;
+    }
+
+    int32_t fd = connect_target(hoststr, portstr, timeout);
+    if (fd == -1) {
+        add_reply_error(c, "-IOERR error or timeout connecting to the client");
+        return NULL;
+    }
+    struct migrate_socket_t* ms = malloc(sizeof(struct migrate_socket_t));
+    if (ms == NULL) {
+        close(fd);
+        add_reply_error(c, "out of memory");
+        return NULL;
+    }
+    ms->fd = fd;
+    ms->last_use_time = get_monotonic_ms();
+    if (dict_add(server.migrate_cached_sockets, name, len, ms) != DICT_OK) {
+        free_migrate_socket(ms);
+        add_reply_error(c, "out of memory");
+        return NULL;
+    }
+    return ms;
+}
+
+static void close_migrate_socket(const struct resp_arg_t* host,
+        const struct resp_arg_t* port) {
+    char name[320];
+    int32_t len = snprintf(name, sizeof name, "%.*s:%.*s",
+            (int) (host->len > 255 ? 255 : host->len), host->ptr,
+            (int) (port->len > 7 ? 7 : port->len), port->ptr);
+    dict_delete(server.migrate_cached_sockets, name, len);
+}
+
+void migrate_cron() {
+    if (server.migrate_cached_sockets == NULL) return;
+
+    struct dict_iter_t it;
+    struct dict_entry_t* e;
+    int64_t now = get_monotonic_ms();
+    dict_init_iter(server.migrate_cached_sockets, &it);
+    while ((e = dict_next(&it)) != NULL) {
+        struct migrate_socket_t* ms = e->val;
+        if (now - ms->last_use_time > MIGRATE_SOCKET_CACHE_TTL) {
+            dict_delete(server.migrate_cached_sockets, e->key, e->klen);
+        }
+    }
+    dict_release_iter(&it);
+}
+
+static int32_t sync_write(int32_t fd, const unsigned char* p, size_t len,
+        int64_t timeout) {
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!wait_fd(fd, POLLOUT, timeout)) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            continue;
+        }
+        if (n == -1) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/** Read a reply line without its CRLF into `line`, truncated if long */
+static int32_t sync_readline(int32_t fd, struct migrate_rbuf_t* rb,
+        char* line, size_t size, int64_t timeout) {
+    size_t n = 0;
+
+    for (;;) {
+        while (rb->pos < rb->len) {
+            char ch = rb->buf[rb->pos++];
+            if (ch == '\n') {
+                if (n > 0 && line[n - 1] == '\r') n--;
+                line[n] = '\0';
+                return 0;
+            }
+            if (n < size - 1) line[n++] = ch;
+        }
+
+        ssize_t r = recv(fd, rb->buf, sizeof rb->buf, 0);
+        if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!wait_fd(fd, POLLIN, timeout)) return -1;
+            continue;
+        }
+        if (r <= 0) return -1;
+        rb->pos = 0;
+        rb->len = r;
+    }
+}
+
+static void buf_put_bulk(struct dump_buf_t* b, const void* p, size_t len) {
+    char hdr[32];
+    int32_t n = snprintf(hdr, sizeof hdr, "$%zu\r\n", len);
+    buf_put(b, hdr, n);
+    buf_put(b, p, len);
+    buf_put(b, "\r\n", 2);
+}
+
+/**
+ * MIGRATE host port key|"" destination-db timeout [COPY] [REPLACE]
+ * [KEYS key ...]
+ *
+ * Sends a RESTORE (RESTORE-ASKING in cluster mode, which the importing node
+ * accepts) per existing key over a cached connection, pipelined, then
+ * deletes the keys the target took unless COPY. This server has a single
+ * database, so the destination must be 0.
+ * */
+void migrate_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    int32_t copy = 0, replace = 0;
+    int32_t first_key = 3, nkeys = 1;
+    int64_t db, timeout;
+
+    for (int32_t i = 6; i < argc; i++) {
+        if (arg_is(&argv[i], "copy")) {
+            copy = 1;
+        } else if (arg_is(&argv[i], "replace")) {
+            replace = 1;
+        } else if (arg_is(&argv[i], "keys")) {
+            if (argv[3].len != 0) {
+                add_reply_error(c, "When using MIGRATE KEYS option, the key "
+                        "argument must be set to the empty string");
+                return;
+            }
+            first_key = i + 1;
+            nkeys = argc - i - 1;
+            break;
+        } else {
+            add_reply_error(c, "syntax error");
+            return;
+        }
+    }
+    if (!resp_string2ll(argv[4].ptr, argv[4].len, &db) ||
+            !resp_string2ll(argv[5].ptr, argv[5].len, &timeout)) {
+        add_reply_error(c, "value is not an integer or out of range");
+        return;
+    }
+    if (db != 0) {
+        add_reply_error(c, "DB index is out of range");
+        return;
+    }
+    if (timeout <= 0) timeout = MIGRATE_DEFAULT_TIMEOUT;
+
+    /** Keys that do not exist are skipped */
+    struct robj_t** objs = malloc(sizeof(struct robj_t*) * nkeys);
+    struct resp_arg_t** keys = malloc(sizeof(struct resp_arg_t*) * nkeys);
+    int32_t* ok = calloc(nkeys, sizeof(int32_t));
+    struct dump_buf_t cmd = { 0 };
+    struct dump_buf_t payload = { 0 };
+    int32_t n = 0;
+    if (objs == NULL || keys == NULL || ok == NULL) {
+        add_reply_error(c, "out of memory");
+        goto out;
+    }
+    for (int32_t i = 0; i < nkeys; i++) {
+        struct resp_arg_t* key = &argv[first_key + i];
+        struct robj_t* o = lookup_key_write(server.db, key->ptr, key->len);
+        if (o == NULL) continue;
+        objs[n] = o;
+        keys[n++] = key;
+    }
+    if (n == 0) {
+        add_reply_status(c, "NOKEY");
+        goto out;
+    }
+
+    const char* restore = server.cluster != NULL ? "RESTORE-ASKING" :
+        "RESTORE";
+    for (int32_t i = 0; i < n; i++) {
+        char hdr[16];
+        int32_t hlen = snprintf(hdr, sizeof hdr, "*%d\r\n", replace ? 5 : 4);
+        payload.len = 0;
+        dump_object(&payload, objs[i]);
+        if (payload.oom) {
+            cmd.oom = 1;
+            break;
+        }
+        buf_put(&cmd, hdr, hlen);
+        buf_put_bulk(&cmd, restore, strlen(restore));
+        buf_put_bulk(&cmd, keys[i]->ptr, keys[i]->len);
+        buf_put_bulk(&cmd, "0", 1);
+        buf_put_bulk(&cmd, payload.p, payload.len);
+        if (replace) buf_put_bulk(&cmd, "REPLACE", 7);
+    }
+    if (cmd.oom) {
+        add_reply_error(c, "out of memory");
+        goto out;
+    }
+
+    /** A cached socket may have been closed by the target meanwhile */
+    int32_t may_retry = 1;
+    struct migrate_socket_t* ms;
+retry:
+    if ((ms = get_migrate_socket(c, &argv[1], &argv[2], timeout)) == NULL) {
+        goto out;
+    }
+    if (sync_write(ms->fd, cmd.p, cmd.len, timeout) == -1) {
+        close_migrate_socket(&argv[1], &argv[2]);
+        if (may_retry && errno != ETIMEDOUT) {
+            may_retry = 0;
+            goto retry;
+        }
+        add_reply_error(c, "-IOERR error or timeout writing to target "
+                "instance");
+        goto out;
+    }
+
+    struct migrate_rbuf_t rb;
+    char line[MIGRATE_REPLY_MAX];
+    char error[MIGRATE_REPLY_MAX] = "";
+    int32_t io_error = 0;
+    rb.pos = rb.len = 0;
+    for (int32_t i = 0; i < n; i++) {
+        if (sync_readline(ms->fd, &rb, line, sizeof line, timeout) == -1) {
+            io_error = 1;
+            break;
+        }
+        if (line[0] == '-') {
+            if (error[0] == '\0') memcpy(error, line + 1, sizeof error - 1);
+        } else {
+            ok[i] = 1;
+        }
+    }
+
+    /** Whatever the target took is its own now */
+    for (int32_t i = 0; i < n && !copy; i++) {
+        if (!ok[i]) continue;
+        db_delete(server.db, keys[i]->ptr, keys[i]->len);
+        signal_modified_key(keys[i]->ptr, keys[i]->len);
+        server.dirty++;
+    }
+
+    if (io_error) {
+        close_migrate_socket(&argv[1], &argv[2]);
+        add_reply_error(c, "-IOERR error or timeout reading to target "
+                "instance");
+    } else if (error[0] != '\0') {
+        add_reply_error_format(c, "Target instance replied with error: %.*s",
+                128, error);
+    } else {
+        add_reply_status(c, "OK");
+    }
+
+out:
+    free(objs);
+    free(keys);
+    free(ok);
+    free(cmd.p);
+    free(payload.p);
+}
@@ -0,0 +1,36 @@
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "networking.h"
+#include "resp.h"
+
+/**
+ * DUMP payload: type byte | value | version u16 | CRC64 of the rest, both
+ * little endian. Integers in the value are LEB128 varints.
+ * */
+#define DUMP_VERSION 1
+
+/** Idle sockets of MIGRATE are closed after this many ms */
+#define MIGRATE_SOCKET_CACHE_TTL 10000
+
+
+struct keys_result_t;
+
+/** command_getkeys_t of MIGRATE: the key, or the keys after KEYS */
+int32_t migrate_getkeys(const struct resp_arg_t*, int32_t,
+        struct keys_result_t*);
+
+/** Close the MIGRATE sockets idle for too long */
+void migrate_cron();
+
+void dump_command(struct client_t*);
+
+/** RESTORE and RESTORE-ASKING */
+void restore_command(struct client_t*);
+
+void migrate_command(struct client_t*);
+
+#endif // !MIGRATE_H
@@ -0,0 +1,286 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dict.h"
+#include "multi.h"
+#include "networking.h"
+#include "resp.h"
+#include "server.h"
+
+
+/** Clients watching one key, in no particular order */
+struct watch_list_t {
+    uint32_t          len;
+    uint32_t          cap;
+    struct client_t** clients;
+};
+
+static void free_watch_list(void* l) {
+    free(((struct watch_list_t*) l)->clients);
+    free(l);
+}
+
+int32_t multi_init() {
+    server.watched_keys = create_dict(free_watch_list);
+    return server.watched_keys == NULL ? -1 : 0;
+}
+
+/** ------------------------------ Queue ---------------------------------- */
+
+static void free_multi_state(struct multi_state_t* ms) {
+    for (int32_t i = 0; i < ms->count; i++) free(ms->commands[i]);
+    free(ms->commands);
+    free(ms);
+}
+
+/** Copy the request, whose arguments may point into a recycled buffer */
+static struct multi_cmd_t* create_multi_cmd(const struct resp_request_t* req,
+        struct command_t* cmd) {
+    size_t bytes = sizeof(struct multi_cmd_t) +
+        req->argc * sizeof(struct resp_arg_t);
+    for (int32_t i = 0; i < req->argc; i++) bytes += req->argv[i].len;
+
+    struct multi_cmd_t* mc = malloc(bytes);
+    if (mc == NULL) return NULL;
+    mc->cmd = cmd;
+    mc->argc = req->argc;
+
+    char* p = (char*) &mc->argv[req->argc];
+    for (int32_t i = 0; i < req->argc; i++) {
+        memcpy(p, req->argv[i].ptr, req->argv[i].len);
+        mc->argv[i].ptr = p;
+        mc->argv[i].len = req->argv[i].len;
+        mc->argv[i].off = 0;
+        p += req->argv[i].len;
+    }
+    return mc;
+}
+
+void queue_multi_command(struct client_t* c, struct command_t* cmd) {
+    struct multi_state_t* ms = c->mstate;
+
+    if (ms->count == ms->cap) {
+        int32_t cap = ms->cap == 0 ? 8 : ms->cap * 2;
+        struct multi_cmd_t** commands = realloc(ms->commands,
+                sizeof(struct multi_cmd_t*) * cap);
+        if (commands == NULL) goto oom;
+        ms->commands = commands;
+        ms->cap = cap;
+    }
+
+    struct multi_cmd_t* mc = create_multi_cmd(&c->req, cmd);
+    if (mc == NULL) goto oom;
+    ms->commands[ms->count++] = mc;
+    ms->bytes += malloc_usable_size(mc);
+    add_reply(c, "+QUEUED\r\n", 9);
+    return;
+
+oom:
+    flag_transaction(c);
+    add_reply_error(c, "out of memory");
+}
+
+void flag_transaction(struct client_t* c) {
+    if (c->flags & CLIENT_MULTI) c->flags |= CLIENT_DIRTY_EXEC;
+}
+
+void discard_transaction(struct client_t* c) {
+    if (c->mstate != NULL) {
+        free_multi_state(c->mstate);
+        c->mstate = NULL;
+    }
+    c->flags &= ~(CLIENT_MULTI | CLIENT_DIRTY_CAS | CLIENT_DIRTY_EXEC);
+    unwatch_all_keys(c);
+}
+
+size_t multi_state_memory(const struct client_t* c) {
+    if (c->mstate == NULL) return 0;
+    return sizeof(struct multi_state_t) + c->mstate->bytes +
+        (size_t) c->mstate->cap * sizeof(struct multi_cmd_t*);
+}
+
+/** ------------------------------ Watch ---------------------------------- */
+
+static int32_t add_watching_client(const char* key, size_t len,
+        struct client_t* c) {
+    struct dict_entry_t* e = dict_find(server.watched_keys, key, len);
+    if (e == NULL) {
+        struct watch_list_t* l = calloc(1, sizeof(struct watch_list_t));
+        if (l == NULL) return -1;
+        if (dict_add(server.watched_keys, key, len, l) != DICT_OK) {
+            free(l);
+            return -1;
+        }
+        e = dict_find(server.watched_keys, key, len);
+    }
+
+    struct watch_list_t* l = e->val;
+    if (l->len == l->cap) {
+        uint32_t cap = l->cap == 0 ? 4 : l->cap * 2;
+        struct client_t** clients = realloc(l->clients,
+                sizeof(struct client_t*) * cap);
+        if (clients == NULL) return -1;
+        l->clients = clients;
+        l->cap = cap;
+    }
+    l->clients[l->len++] = c;
+    return 0;
+}
+
+static void remove_watching_client(const char* key, size_t len,
+        struct client_t* c) {
+    struct dict_entry_t* e = dict_find(server.watched_keys, key, len);
+    if (e == NULL) return;
+
+    struct watch_list_t* l = e->val;
+    for (uint32_t i = 0; i < l->len; i++) {
+        if (l->clients[i] != c) continue;
+        l->clients[i] = l->clients[--l->len];
+        break;
+    }
+    if (l->len == 0) dict_delete(server.watched_keys, key, len);
+}
+
+/** Return -1 out of memory, the key is not watched then */
+static int32_t watch_key(struct client_t* c, const struct resp_arg_t* key) {
+    if (c->watched_keys == NULL &&
+            (c->watched_keys = create_dict(NULL)) == NULL) {
+        return -1;
+    }
+
+    int32_t ret = dict_add(c->watched_keys, key->ptr, key->len, NULL);
+    if (ret == DICT_EXISTS) return 0;
+    if (ret != DICT_OK) return -1;
+    if (add_watching_client(key->ptr, key->len, c) == -1) {
+        remove_watching_client(key->ptr, key->len, c);
+        dict_delete(c->watched_keys, key->ptr, key->len);
+        return -1;
+    }
+    return 0;
+}
+
+void unwatch_all_keys(struct client_t* c) {
+    if (c->watched_keys == NULL) return;
+
+    struct dict_iter_t it;
+    struct dict_entry_t* e;
+    dict_init_iter(c->watched_keys, &it);
+    while ((e = dict_next(&it)) != NULL) {
+        remove_watching_client(e->key, e->klen, c);
+    }
+    dict_release_iter(&it);
+    free_dict(c->watched_keys);
+    c->watched_keys = NULL;
+}
+
+void touch_watched_key(const char* key, size_t len) {
+    if (dict_size(server.watched_keys) == 0) return;
+
+    struct dict_entry_t* e = dict_find(server.watched_keys, key, len);
+    if (e == NULL) return;
+
+    struct watch_list_t* l = e->val;
+    for (uint32_t i = 0; i < l->len; i++) {
+        l->clients[i]->flags |= CLIENT_DIRTY_CAS;
+    }
+}
+
+void touch_all_watched_keys() {
+    if (dict_size(server.watched_keys) == 0) return;
+
+    struct dict_iter_t it;
+    struct dict_entry_t* e;
+    dict_init_iter(server.watched_keys, &it);
+    while ((e = dict_next(&it)) != NULL) {
+        struct watch_list_t* l = e->val;
+        for (uint32_t i = 0; i < l->len; i++) {
+            l->clients[i]->flags |= CLIENT_DIRTY_CAS;
+        }
+    }
+    dict_release_iter(&it);
+}
+
+/** ------------------------------ Commands ------------------------------- */
+
+void multi_command(struct client_t* c) {
+    if (c->flags & CLIENT_MULTI) {
+        add_reply_error(c, "MULTI calls can not be nested");
+        return;
+    }
+    if ((c->mstate = calloc(1, sizeof(struct multi_state_t))) == NULL) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+    c->flags |= CLIENT_MULTI;
+    add_reply(c, "+OK\r\n", 5);
+}
+
+/**
+ * Run the queued commands back to back, their replies in one array that
+ * leaves with the next write of the client. Nothing else runs in between:
+ * blocking commands answer right away while CLIENT_MULTI is set.
+ * */
+void exec_command(struct client_t* c) {
+    if (!(c->flags & CLIENT_MULTI)) {
+        add_reply_error(c, "EXEC without MULTI");
+        return;
+    }
+    if (c->flags & CLIENT_DIRTY_EXEC) {
+        add_reply_error(c, "-EXECABORT Transaction discarded because of "
+                "previous errors.");
+        discard_transaction(c);
+        return;
+    }
+    if (c->flags & CLIENT_DIRTY_CAS) {
+        add_reply_null_array(c);
+        discard_transaction(c);
+        return;
+    }
+
+    /** Writes of the transaction itself must not fail it */
+    unwatch_all_keys(c);
+
+    struct multi_state_t* ms = c->mstate;
+    struct resp_request_t req = c->req;
+    add_reply_array_len(c, ms->count);
+    for (int32_t i = 0; i < ms->count; i++) {
+        struct multi_cmd_t* mc = ms->commands[i];
+        c->req.argc = mc->argc;
+        c->req.argv = mc->argv;
+        call_command(c, mc->cmd);
+    }
+    c->req = req;
+    discard_transaction(c);
+}
+
+void discard_command(struct client_t* c) {
+    if (!(c->flags & CLIENT_MULTI)) {
+        add_reply_error(c, "DISCARD without MULTI");
+        return;
+    }
+    discard_transaction(c);
+    add_reply(c, "+OK\r\n", 5);
+}
+
+/** WATCH key [key ...]: EXEC fails if one of them is modified first */
+void watch_command(struct client_t* c) {
+    if (c->flags & CLIENT_MULTI) {
+        add_reply_error(c, "WATCH inside MULTI is not allowed");
+        return;
+    }
+    for (int32_t i = 1; i < c->req.argc; i++) {
+        if (watch_key(c, &c->req.argv[i]) == -1) {
+            add_reply_error(c, "out of memory");
+            return;
+        }
+    }
+    add_reply(c, "+OK\r\n", 5);
+}
+
+void unwatch_command(struct client_t* c) {
+    unwatch_all_keys(c);
+    c->flags &= ~CLIENT_DIRTY_CAS;
+    add_reply(c, "+OK\r\n", 5);
+}
@@ -0,0 +1,71 @@
+#ifndef MULTI_H
+#define MULTI_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "networking.h"
+#include "resp.h"
+
+struct command_t;
+
+/**
+ * A command queued after MULTI. The arguments are copied out of the query
+ * buffer, their bytes follow `argv` in the same allocation.
+ * */
+struct multi_cmd_t {
+    struct command_t* cmd;
+    int32_t           argc;
+    struct resp_arg_t argv[];
+};
+
+/** Commands queued by a CLIENT_MULTI client, in order */
+struct multi_state_t {
+    struct multi_cmd_t** commands;
+    int32_t              count;
+    int32_t              cap;
+    size_t               bytes; // of the queued commands
+};
+
+
+/** Set up the table of watched keys */
+int32_t multi_init();
+
+/**
+ * Queue the request of a CLIENT_MULTI client that passed the checks of
+ * process_command() and reply +QUEUED.
+ * */
+void queue_multi_command(struct client_t*, struct command_t*);
+
+/**
+ * A queued command was refused (unknown, wrong arity, redirected...): EXEC
+ * will abort the transaction.
+ * */
+void flag_transaction(struct client_t*);
+
+/** Forget the queued commands and the watched keys, leave MULTI */
+void discard_transaction(struct client_t*);
+
+/** A key was modified: the transactions watching it will fail */
+void touch_watched_key(const char*, size_t);
+
+/** FLUSHALL: every transaction watching a key will fail */
+void touch_all_watched_keys();
+
+/** Stop watching every key, e.g. when the client is freed */
+void unwatch_all_keys(struct client_t*);
+
+/** Heap bytes of the queued commands */
+size_t multi_state_memory(const struct client_t*);
+
+void multi_command(struct client_t*);
+
+void exec_command(struct client_t*);
+
+void discard_command(struct client_t*);
+
+void watch_command(struct client_t*);
+
+void unwatch_command(struct client_t*);
+
+#endif // !MULTI_H
@@ -0,0 +1,959 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "blocked.h"
+#include "config.h"
+#include "ip.h"
+#include "log.h"
+#include "multi.h"
+#include "networking.h"
+#include "pubsub.h"
+#include "rax.h"
+#include "server.h"
+#include "tracking.h"
+
+
+static void client_recv_handle(struct event_loop_t*, int32_t, const char*,
+        ssize_t, void *);
+
+static void write_to_client(struct event_loop_t*, struct client_t*);
+
+static void free_reply_block(struct reply_block_t*);
+
+static void update_client_memory_usage(struct client_t*);
+
+static void unlink_client_memory(struct client_t*);
+
+static inline int32_t arg_is(const struct resp_arg_t* arg, const char* s) {
+    size_t len = strlen(s);
+    return arg->len == len && strncasecmp(arg->ptr, s, len) == 0;
+}
+
+/** clients_index key: the client id, big endian */
+static void encode_client_id(unsigned char* key, uint64_t id) {
+    for (int32_t i = 0; i < 8; i++) {
+        key[i] = id >> (56 - 8 * i);
+    }
+}
+
+
+struct client_t* create_client(struct event_loop_t* el, int32_t fd) {
+    struct client_t* c = malloc(sizeof(struct client_t));
+    if (c == NULL) {
+        log_warning("[create_client] client_t malloc error");
+        return NULL;
+    }
+
+    /** Everything but the reply buffer */
+    memset(c, 0, offsetof(struct client_t, buf));
+    c->id = ++server.next_client_id;
+    c->fd = fd;
+    c->mem_bucket = -1;
+
+    struct sockaddr_storage addr = { 0 };
+    socklen_t addr_size = sizeof addr;
+    if (getpeername(fd, (struct sockaddr *) &addr, &addr_size) == 0) {
+        /** Unix socket peers are unnamed, show the path they connected to */
+        if (addr.ss_family == AF_UNIX) {
+            c->flags |= CLIENT_UNIX_SOCKET;
+            addr_size = sizeof addr;
+            getsockname(fd, (struct sockaddr *) &addr, &addr_size);
+        }
+        format_addr((struct sockaddr *) &addr, c->addr, sizeof c->addr);
+    }
+
+    unsigned char key[8];
+    encode_client_id(key, c->id);
+    if (rax_insert(server.clients_index, key, sizeof key, c, NULL) == -1) {
+        free(c);
+        return NULL;
+    }
+    if (register_reader(el, fd, client_recv_handle, c) != OK) {
+        rax_remove(server.clients_index, key, sizeof key, NULL);
+        free(c);
+        return NULL;
+    }
+    update_client_memory_usage(c);
+
+    return c;
+}
+
+static void unlink_pending_write(struct client_t* c) {
+    if (!(c->flags & CLIENT_PENDING_WRITE)) return;
+
+    if (c->pending_prev != NULL) {
+        c->pending_prev->pending_next = c->pending_next;
+    } else {
+        server.clients_pending_write = c->pending_next;
+    }
+    if (c->pending_next != NULL) {
+        c->pending_next->pending_prev = c->pending_prev;
+    }
+    c->pending_prev = c->pending_next = NULL;
+    c->flags &= ~CLIENT_PENDING_WRITE;
+}
+
+static void unlink_close_queue(struct client_t* c) {
+    if (c->close_prev != NULL) {
+        c->close_prev->close_next = c->close_next;
+    } else if (server.clients_to_close == c) {
+        server.clients_to_close = c->close_next;
+    }
+    if (c->close_next != NULL) {
+        c->close_next->close_prev = c->close_prev;
+    }
+    c->close_prev = c->close_next = NULL;
+}
+
+void free_client(struct event_loop_t* el, struct client_t* c) {
+    assert(c != NULL);
+
+    unlink_close_queue(c);
+    unlink_client_memory(c);
+    unlink_pending_write(c);
+    unregister_event(el, c->fd, E_RECV | E_READABLE | E_WRITEABLE);
+    pubsub_unsubscribe_all(c);
+    if (c->flags & (CLIENT_BLOCKED | CLIENT_UNBLOCKED)) {
+        blocked_client_freed(c);
+    }
+    disable_tracking(c);
+    discard_transaction(c);
+
+    unsigned char key[8];
+    encode_client_id(key, c->id);
+    rax_remove(server.clients_index, key, sizeof key, NULL);
+
+    /**
+     * The kernel still reads the reply buffers, and owns the fd. Shutting
+     * the socket down completes a send stuck on a peer that stopped reading.
+     * */
+    if (c->flags & CLIENT_WRITE_INFLIGHT) {
+        c->flags |= CLIENT_CLOSE_ASAP;
+        shutdown(c->fd, SHUT_RDWR);
+        return;
+    }
+
+    close(c->fd);
+
+    struct reply_block_t* b = c->reply_head;
+    while (b != NULL) {
+        struct reply_block_t* next = b->next;
+        free_reply_block(b);
+        b = next;
+    }
+    resp_free_request(&c->req);
+    free(c->querybuf);
+    free(c);
+
+    server.connected_clients--;
+}
+
+struct client_t* lookup_client_by_id(uint64_t id) {
+    unsigned char key[8];
+    void* c = NULL;
+
+    encode_client_id(key, id);
+    rax_find(server.clients_index, key, sizeof key, &c);
+    return c;
+}
+
+void free_client_async(struct client_t* c) {
+    if (c->flags & CLIENT_CLOSE_ASAP) return;
+
+    c->flags |= CLIENT_CLOSE_ASAP;
+    unlink_pending_write(c);
+    unlink_client_memory(c);
+
+    c->close_prev = NULL;
+    c->close_next = server.clients_to_close;
+    if (c->close_next != NULL) {
+        c->close_next->close_prev = c;
+    }
+    server.clients_to_close = c;
+}
+
+void free_clients_in_async_free_queue(struct event_loop_t* el) {
+    while (server.clients_to_close != NULL) {
+        free_client(el, server.clients_to_close);
+    }
+}
+
+/** ------------------------------ Limits ------------------------------- */
+
+int32_t get_client_type(struct client_t* c) {
+    if (c->flags & CLIENT_REPLICA) return CLIENT_TYPE_REPLICA;
+    if (c->flags & CLIENT_PUBSUB) return CLIENT_TYPE_PUBSUB;
+    return CLIENT_TYPE_NORMAL;
+}
+
+size_t get_client_memory_usage(struct client_t* c) {
+    return sizeof(struct client_t) + c->qb_cap + c->reply_bytes +
+        (size_t) c->req.argv_cap * sizeof(struct resp_arg_t) +
+        multi_state_memory(c);
+}
+
+static int32_t client_mem_bucket(size_t mem) {
+    int32_t log2 = 63 - __builtin_clzll(mem | 1);
+    int32_t b = log2 - CLIENT_MEM_BUCKET_MIN_LOG;
+    if (b < 0) return 0;
+    return b >= CLIENT_MEM_BUCKETS ? CLIENT_MEM_BUCKETS - 1 : b;
+}
+
+static void unlink_client_memory(struct client_t* c) {
+    if (c->mem_bucket == -1) return;
+
+    if (c->mem_prev != NULL) {
+        c->mem_prev->mem_next = c->mem_next;
+    } else {
+        server.client_mem_buckets[c->mem_bucket] = c->mem_next;
+    }
+    if (c->mem_next != NULL) {
+        c->mem_next->mem_prev = c->mem_prev;
+    }
+    c->mem_prev = c->mem_next = NULL;
+    c->mem_bucket = -1;
+
+    server.stat_clients_memory -= c->mem_usage;
+    c->mem_usage = 0;
+}
+
+/** Re-account the client and move it to the bucket of its new size */
+static void update_client_memory_usage(struct client_t* c) {
+    if (c->flags & CLIENT_CLOSE_ASAP) return;
+
+    size_t mem = get_client_memory_usage(c);
+    server.stat_clients_memory += mem - c->mem_usage;
+    c->mem_usage = mem;
+
+    int32_t b = client_mem_bucket(mem);
+    if (b == c->mem_bucket) return;
+
+    if (c->mem_bucket != -1) {
+        if (c->mem_prev != NULL) {
+            c->mem_prev->mem_next = c->mem_next;
+        } else {
+            server.client_mem_buckets[c->mem_bucket] = c->mem_next;
+        }
+        if (c->mem_next != NULL) {
+            c->mem_next->mem_prev = c->mem_prev;
+        }
+    }
+    c->mem_bucket = b;
+    c->mem_prev = NULL;
+    c->mem_next = server.client_mem_buckets[b];
+    if (c->mem_next != NULL) {
+        c->mem_next->mem_prev = c;
+    }
+    server.client_mem_buckets[b] = c;
+}
+
+void evict_clients() {
+    if (config.maxmemory_clients == 0) return;
+
+    int32_t b = CLIENT_MEM_BUCKETS - 1;
+    while (server.stat_clients_memory > config.maxmemory_clients && b >= 0) {
+        struct client_t* c = server.client_mem_buckets[b];
+        if (c == NULL) {
+            b--;
+            continue;
+        }
+
+        log_verbose("[evict_clients] evicting client %lu (%s), %zu bytes, "
+                "clients use %lu bytes", (unsigned long) c->id, c->addr,
+                c->mem_usage, (unsigned long) server.stat_clients_memory);
+        server.stat_evicted_clients++;
+        free_client_async(c);
+    }
+}
+
+/** Return 1 when the pending replies break the limit of the client class */
+static int32_t check_client_output_buffer_limits(struct client_t* c) {
+    struct client_buffer_limit_t* limit =
+        &config.client_obuf_limits[get_client_type(c)];
+    uint64_t used = c->reply_bytes;
+
+    if (limit->hard > 0 && used >= limit->hard) return 1;
+
+    if (limit->soft == 0 || used < limit->soft) {
+        c->obuf_soft_limit_reached_ms = 0;
+        return 0;
+    }
+
+    int64_t now = get_monotonic_ms();
+    if (c->obuf_soft_limit_reached_ms == 0) {
+        c->obuf_soft_limit_reached_ms = now;
+        return 0;
+    }
+    return now - c->obuf_soft_limit_reached_ms >
+        (int64_t) limit->soft_seconds * 1000;
+}
+
+static void after_reply_appended(struct client_t* c) {
+    if (check_client_output_buffer_limits(c)) {
+        log_verbose("[add_reply] client %lu (%s) closed for overcoming of "
+                "output buffer limits, %zu bytes pending",
+                (unsigned long) c->id, c->addr, c->reply_bytes);
+        server.stat_client_outbuf_limit_disconnections++;
+        free_client_async(c);
+        return;
+    }
+    update_client_memory_usage(c);
+}
+
+/** ------------------------------ Replies ------------------------------ */
+
+struct shared_reply_t* create_shared_reply(size_t len) {
+    struct shared_reply_t* sr = malloc(sizeof(struct shared_reply_t) + len);
+    if (sr == NULL) return NULL;
+
+    sr->refcount = 1;
+    sr->len = len;
+    return sr;
+}
+
+void incr_shared_reply(struct shared_reply_t* sr) {
+    sr->refcount++;
+}
+
+void decr_shared_reply(struct shared_reply_t* sr) {
+    assert(sr->refcount > 0);
+    if (--sr->refcount == 0) free(sr);
+}
+
+static inline char* reply_block_data(struct reply_block_t* b) {
+    return b->shared != NULL ? b->shared->buf : b->buf;
+}
+
+static void free_reply_block(struct reply_block_t* b) {
+    if (b->shared != NULL) decr_shared_reply(b->shared);
+    free(b);
+}
+
+static void append_reply_block(struct client_t* c, struct reply_block_t* b) {
+    b->next = NULL;
+    if (c->reply_tail != NULL) {
+        c->reply_tail->next = b;
+    } else {
+        c->reply_head = b;
+    }
+    c->reply_tail = b;
+    c->reply_bytes += b->used;
+}
+
+static void mark_pending_write(struct client_t* c) {
+    if (c->flags & (CLIENT_PENDING_WRITE | CLIENT_CLOSE_ASAP)) return;
+
+    c->flags |= CLIENT_PENDING_WRITE;
+    c->pending_prev = NULL;
+    c->pending_next = server.clients_pending_write;
+    if (c->pending_next != NULL) {
+        c->pending_next->pending_prev = c;
+    }
+    server.clients_pending_write = c;
+}
+
+void add_reply(struct client_t* c, const char* s, size_t len) {
+    if (c->flags & (CLIENT_CLOSE_AFTER_REPLY | CLIENT_CLOSE_ASAP)) return;
+
+    mark_pending_write(c);
+
+    /** Keep ordering: the static buffer only takes data while no block exists */
+    if (c->reply_head == NULL) {
+        size_t n = sizeof c->buf - c->bufpos;
+        if (n > len) n = len;
+        memcpy(c->buf + c->bufpos, s, n);
+        c->bufpos += n;
+        s += n;
+        len -= n;
+    }
+    if (len == 0) return;
+
+    struct reply_block_t* tail = c->reply_tail;
+    if (tail != NULL && tail->used < tail->size) {
+        size_t n = tail->size - tail->used;
+        if (n > len) n = len;
+        memcpy(tail->buf + tail->used, s, n);
+        tail->used += n;
+        c->reply_bytes += n;
+        s += n;
+        len -= n;
+    }
+    if (len == 0) {
+        if (tail != NULL) after_reply_appended(c);
+        return;
+    }
+
+    size_t size = len > PROTO_REPLY_CHUNK_BYTES ? len : PROTO_REPLY_CHUNK_BYTES;
+    struct reply_block_t* b = malloc(sizeof(struct reply_block_t) + size);
+    if (b == NULL) {
+        log_warning("[add_reply] reply block malloc error, closing client %lu",
+                (unsigned long) c->id);
+        c->flags |= CLIENT_CLOSE_AFTER_REPLY;
+        return;
+    }
+    b->shared = NULL;
+    b->size = size;
+    b->used = len;
+    memcpy(b->buf, s, len);
+    append_reply_block(c, b);
+    after_reply_appended(c);
+}
+
+void add_reply_shared(struct client_t* c, struct shared_reply_t* sr) {
+    if (c->flags & (CLIENT_CLOSE_AFTER_REPLY | CLIENT_CLOSE_ASAP)) return;
+
+    struct reply_block_t* b = malloc(sizeof(struct reply_block_t));
+    if (b == NULL) {
+        log_warning("[add_reply_shared] reply block malloc error, closing "
+                "client %lu", (unsigned long) c->id);
+        c->flags |= CLIENT_CLOSE_AFTER_REPLY;
+        return;
+    }
+    mark_pending_write(c);
+
+    incr_shared_reply(sr);
+    b->shared = sr;
+    b->size = 0;
+    b->used = sr->len;
+    append_reply_block(c, b);
+    after_reply_appended(c);
+}
+
+void add_reply_status(struct client_t* c, const char* s) {
+    char buf[128];
+    int32_t n = snprintf(buf, sizeof buf, "+%s\r\n", s);
+    if (n >= (int32_t) sizeof buf) {
+        add_reply(c, "+", 1);
+        add_reply(c, s, strlen(s));
+        add_reply(c, "\r\n", 2);
+        return;
+    }
+    add_reply(c, buf, n);
+}
+
+void add_reply_error(struct client_t* c, const char* s) {
+    if (s[0] == '-') {
+        add_reply_error_format(c, "-%s", s + 1);
+    } else {
+        add_reply_error_format(c, "%s", s);
+    }
+}
+
+void add_reply_error_format(struct client_t* c, const char* fmt, ...) {
+    char buf[256];
+    size_t n = 0;
+
+    if (fmt[0] != '-') {
+        memcpy(buf, "-ERR ", 5);
+        n = 5;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    int32_t m = vsnprintf(buf + n, sizeof buf - n - 2, fmt, ap);
+    va_end(ap);
+    if (m < 0) m = 0;
+    n += (size_t) m < sizeof buf - n - 2 ? (size_t) m : sizeof buf - n - 3;
+
+    /** An error is a single line, whatever the arguments contain */
+    for (size_t i = 0; i < n; i++) {
+        if (buf[i] == '\r' || buf[i] == '\n') buf[i] = ' ';
+    }
+    memcpy(buf + n, "\r\n", 2);
+    add_reply(c, buf, n + 2);
+}
+
+void add_reply_long_long(struct client_t* c, int64_t v) {
+    char buf[32];
+    int32_t n = snprintf(buf, sizeof buf, ":%lld\r\n", (long long) v);
+    add_reply(c, buf, n);
+}
+
+void add_reply_bulk(struct client_t* c, const char* s, size_t len) {
+    char buf[32];
+    int32_t n = snprintf(buf, sizeof buf, "$%zu\r\n", len);
+    add_reply(c, buf, n);
+    add_reply(c, s, len);
+    add_reply(c, "\r\n", 2);
+}
+
+void add_reply_null(struct client_t* c) {
+    add_reply(c, "$-1\r\n", 5);
+}
+
+void add_reply_null_array(struct client_t* c) {
+    add_reply(c, "*-1\r\n", 5);
+}
+
+void add_reply_array_len(struct client_t* c, int64_t len) {
+    char buf[32];
+    int32_t n = snprintf(buf, sizeof buf, "*%lld\r\n", (long long) len);
+    add_reply(c, buf, n);
+}
+
+/** ------------------------------ Writes ------------------------------- */
+
+static int32_t client_has_pending_replies(struct client_t* c) {
+    return c->bufpos > 0 || c->reply_head != NULL;
+}
+
+/** Drop `n` sent bytes from the front of the reply buffers */
+static void consume_replies(struct client_t* c, size_t n) {
+    server.stat_net_output_bytes += n;
+
+    if (c->bufpos > 0) {
+        size_t left = c->bufpos - c->sentlen;
+        if (n < left) {
+            c->sentlen += n;
+            return;
+        }
+        n -= left;
+        c->bufpos = c->sentlen = 0;
+    }
+
+    while (n > 0 && c->reply_head != NULL) {
+        struct reply_block_t* b = c->reply_head;
+        size_t left = b->used - c->sentlen;
+        if (n < left) {
+            c->sentlen += n;
+            return;
+        }
+        n -= left;
+        c->sentlen = 0;
+        c->reply_bytes -= b->used;
+        c->reply_head = b->next;
+        if (c->reply_head == NULL) c->reply_tail = NULL;
+        free_reply_block(b);
+    }
+}
+
+static void client_write_handle(struct event_loop_t* el, int32_t fd,
+        void* client_data) {
+    write_to_client(el, client_data);
+}
+
+/** Handle the result of a send, shared by the synchronous / async paths */
+static void after_write(struct event_loop_t* el, struct client_t* c,
+        ssize_t nwritten, size_t offered) {
+    if (nwritten < 0) {
+        if (nwritten == -EAGAIN || nwritten == -EWOULDBLOCK) {
+            if (!(c->flags & CLIENT_WRITE_HANDLER) && register_event(el,
+                        c->fd, E_WRITEABLE, client_write_handle, c) == OK) {
+                c->flags |= CLIENT_WRITE_HANDLER;
+            }
+            return;
+        }
+        log_verbose("[write_to_client] client %lu write error: %s",
+                (unsigned long) c->id, strerror(-nwritten));
+        free_client(el, c);
+        return;
+    }
+
+    consume_replies(c, nwritten);
+    update_client_memory_usage(c);
+
+    if (client_has_pending_replies(c)) {
+        /** A short write means the socket buffer is full */
+        if ((size_t) nwritten == offered) {
+            write_to_client(el, c);
+        } else if (!(c->flags & CLIENT_WRITE_HANDLER) && register_event(el,
+                    c->fd, E_WRITEABLE, client_write_handle, c) == OK) {
+            c->flags |= CLIENT_WRITE_HANDLER;
+        }
+        return;
+    }
+
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
+        free_client(el, c);
+        return;
+    }
+    if (c->flags & CLIENT_WRITE_HANDLER) {
+        unregister_event(el, c->fd, E_WRITEABLE);
+        c->flags &= ~CLIENT_WRITE_HANDLER;
+    }
+}
+
+static void client_sent_handle(struct event_loop_t* el, int32_t fd,
+        ssize_t nwritten, void* client_data) {
+    struct client_t* c = client_data;
+    c->flags &= ~CLIENT_WRITE_INFLIGHT;
+
+    if (c->flags & CLIENT_CLOSE_ASAP) {
+        free_client(el, c);
+        return;
+    }
+    /** Completions are not a readiness signal, keep sending until short */
+    after_write(el, c, nwritten, nwritten > 0 ? (size_t) nwritten : 0);
+}
+
+static void write_to_client(struct event_loop_t* el, struct client_t* c) {
+    if (c->flags & CLIENT_WRITE_INFLIGHT) return;
+
+    struct iovec iov[EL_SEND_IOV_MAX];
+    int32_t iovcnt = 0;
+    size_t offered = 0;
+    size_t skip = c->sentlen;
+
+    if (c->bufpos > 0) {
+        iov[iovcnt].iov_base = c->buf + skip;
+        iov[iovcnt].iov_len = c->bufpos - skip;
+        offered += iov[iovcnt++].iov_len;
+        skip = 0;
+    }
+    for (struct reply_block_t* b = c->reply_head;
+            b != NULL && iovcnt < EL_SEND_IOV_MAX; b = b->next) {
+        iov[iovcnt].iov_base = reply_block_data(b) + skip;
+        iov[iovcnt].iov_len = b->used - skip;
+        offered += iov[iovcnt++].iov_len;
+        skip = 0;
+    }
+
+    if (iovcnt == 0) {
+        after_write(el, c, 0, 0);
+        return;
+    }
+
+    ssize_t nwritten = el_send(el, c->fd, iov, iovcnt, client_sent_handle, c);
+    if (nwritten == EL_SEND_ASYNC) {
+        c->flags |= CLIENT_WRITE_INFLIGHT;
+        return;
+    }
+    after_write(el, c, nwritten, offered);
+}
+
+void handle_clients_with_pending_writes(struct event_loop_t* el) {
+    while (server.clients_pending_write != NULL) {
+        struct client_t* c = server.clients_pending_write;
+        unlink_pending_write(c);
+        write_to_client(el, c);
+    }
+}
+
+/** ------------------------------ Reads -------------------------------- */
+
+/**
+ * Execute every complete request at the start of the buffer. Return the
+ * number of bytes consumed, the rest is a partial request.
+ * */
+static size_t process_input(struct client_t* c, const char* buf, size_t len) {
+    size_t pos = 0;
+    const char* err = NULL;
+
+    while (pos < len && !(c->flags & (CLIENT_CLOSE_AFTER_REPLY |
+                    CLIENT_CLOSE_ASAP | CLIENT_BLOCKED))) {
+        int64_t nread = resp_parse_request(&c->req, buf + pos, len - pos,
+                &err);
+        if (nread == RESP_INCOMPLETE) break;
+        if (nread == RESP_ERR) {
+            log_verbose("[process_input] client %lu (%s): %s",
+                    (unsigned long) c->id, c->addr, err);
+            add_reply_error(c, err);
+            c->flags |= CLIENT_CLOSE_AFTER_REPLY;
+            return len;
+        }
+
+        pos += nread;
+        if (c->req.argc > 0) {
+            process_command(c);
+        }
+    }
+
+    return pos;
+}
+
+static int32_t append_query(struct client_t* c, const char* buf, size_t len) {
+    if (c->qb_len + len > c->qb_cap) {
+        size_t cap = c->qb_cap == 0 ? PROTO_IOBUF_LEN : c->qb_cap;
+        while (cap < c->qb_len + len) cap *= 2;
+
+        char* try = realloc(c->querybuf, cap);
+        if (try == NULL) return -1;
+        c->querybuf = try;
+        c->qb_cap = cap;
+    }
+
+    memcpy(c->querybuf + c->qb_len, buf, len);
+    c->qb_len += len;
+    return 0;
+}
+
+static void client_recv_handle(struct event_loop_t* el, int32_t fd,
+        const char* buf, ssize_t nread, void* client_data) {
+    struct client_t* c = client_data;
+
+    if (nread < 0) {
+        log_verbose("[client_recv_handle] client %lu read error: %s",
+                (unsigned long) c->id, strerror(-nread));
+        free_client(el, c);
+        return;
+    }
+    if (nread == 0) {
+        log_verbose("[client_recv_handle] (%s) client %lu disconnect",
+                c->addr, (unsigned long) c->id);
+        free_client(el, c);
+        return;
+    }
+
+    server.stat_net_input_bytes += nread;
+
+    /** Waiting to be freed from the before sleep handle */
+    if (c->flags & CLIENT_CLOSE_ASAP) return;
+
+    /** Nothing buffered: parse the received bytes in place */
+    if (c->qb_len == 0) {
+        size_t used = process_input(c, buf, nread);
+        buf += used;
+        nread -= used;
+        if (nread == 0) return;
+    }
+
+    if (c->qb_len + nread > config.client_query_buffer_limit) {
+        log_verbose("[client_recv_handle] client %lu (%s) closed for "
+                "reaching the max query buffer length (%zu bytes)",
+                (unsigned long) c->id, c->addr, c->qb_len + nread);
+        server.stat_client_qbuf_limit_disconnections++;
+        free_client(el, c);
+        return;
+    }
+    if (append_query(c, buf, nread) == -1) {
+        log_warning("[client_recv_handle] query buffer realloc error");
+        free_client(el, c);
+        return;
+    }
+
+    process_query_buffer(c);
+}
+
+void process_query_buffer(struct client_t* c) {
+    size_t used = process_input(c, c->querybuf, c->qb_len);
+    c->qb_len -= used;
+    if (c->qb_len > 0 && used > 0) {
+        memmove(c->querybuf, c->querybuf + used, c->qb_len);
+    }
+
+    /** Give back the room a big request needed */
+    if (c->qb_len == 0 && c->qb_cap > PROTO_IOBUF_LEN) {
+        free(c->querybuf);
+        c->querybuf = NULL;
+        c->qb_cap = 0;
+    }
+    update_client_memory_usage(c);
+}
+
+/** ------------------------------ Commands ------------------------------- */
+
+/** CLIENT TRACKING on|off [REDIRECT id] [PREFIX p ...] [BCAST] ... */
+static void client_tracking(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    uint32_t options = 0;
+    int64_t redirect = 0;
+    struct resp_arg_t* prefixes = NULL;
+    int32_t nprefixes = 0;
+
+    if (!arg_is(&argv[2], "on") && !arg_is(&argv[2], "off")) {
+        add_reply_error(c, "syntax error");
+        return;
+    }
+    if (arg_is(&argv[2], "off")) {
+        if (argc != 3) {
+            add_reply_error(c, "syntax error");
+            return;
+        }
+        disable_tracking(c);
+        add_reply_status(c, "OK");
+        return;
+    }
+
+    for (int32_t i = 3; i < argc; i++) {
+        int32_t more = argc - i - 1;
+        if (arg_is(&argv[i], "redirect") && more >= 1) {
+            i++;
+            if (redirect != 0) {
+                add_reply_error(c, "A client can only redirect to a single "
+                        "other client");
+                goto out;
+            }
+            if (!resp_string2ll(argv[i].ptr, argv[i].len, &redirect) ||
+                    redirect <= 0 ||
+                    lookup_client_by_id(redirect) == NULL) {
+                add_reply_error(c, "The client ID you want redirect to does "
+                        "not exist");
+                goto out;
+            }
+        } else if (arg_is(&argv[i], "prefix") && more >= 1) {
+            /** Arguments are not copied, the prefixes are gathered apart */
+            if (prefixes == NULL && (prefixes = malloc(
+                            sizeof(struct resp_arg_t) * argc)) == NULL) {
+                add_reply_error(c, "out of memory");
+                goto out;
+            }
+            prefixes[nprefixes++] = argv[++i];
+        } else if (arg_is(&argv[i], "bcast")) {
+            options |= CLIENT_TRACKING_BCAST;
+        } else if (arg_is(&argv[i], "optin")) {
+            options |= CLIENT_TRACKING_OPTIN;
+        } else if (arg_is(&argv[i], "optout")) {
+            options |= CLIENT_TRACKING_OPTOUT;
+        } else if (arg_is(&argv[i], "noloop")) {
+            options |= CLIENT_TRACKING_NOLOOP;
+        } else {
+            add_reply_error(c, "syntax error");
+            goto out;
+        }
+    }
+
+    uint32_t mode = CLIENT_TRACKING_BCAST | CLIENT_TRACKING_OPTIN |
+        CLIENT_TRACKING_OPTOUT;
+    if (!(options & CLIENT_TRACKING_BCAST) && nprefixes > 0) {
+        add_reply_error(c, "PREFIX option requires BCAST mode to be "
+                "enabled");
+    } else if ((options & CLIENT_TRACKING_OPTIN) &&
+            (options & CLIENT_TRACKING_OPTOUT)) {
+        add_reply_error(c, "You can't use both OPTIN and OPTOUT");
+    } else if ((options & CLIENT_TRACKING_BCAST) && (options &
+                (CLIENT_TRACKING_OPTIN | CLIENT_TRACKING_OPTOUT))) {
+        add_reply_error(c, "OPTIN and OPTOUT are not compatible with "
+                "BCAST");
+    } else if ((c->flags & CLIENT_TRACKING) &&
+            (c->flags & mode) != (options & mode)) {
+        add_reply_error(c, "You can't switch BCAST, OPTIN or OPTOUT mode "
+                "before disabling tracking for this client, and then "
+                "re-enabling it with a different mode.");
+    } else if (redirect == 0) {
+        /** No RESP3 push messages, invalidations only go through pubsub */
+        add_reply_error(c, "TRACKING needs REDIRECT to a client subscribed "
+                "to " TRACKING_CHANNEL);
+    } else if (!tracking_check_prefixes(c, prefixes, nprefixes)) {
+        if (enable_tracking(c, redirect, options, prefixes, nprefixes) ==
+                -1) {
+            add_reply_error(c, "out of memory");
+        } else {
+            add_reply_status(c, "OK");
+        }
+    }
+
+out:
+    free(prefixes);
+}
+
+/** CLIENT CACHING yes|no, for the next command of an OPTIN / OPTOUT client */
+static void client_caching(struct client_t* c) {
+    struct resp_arg_t* arg = &c->req.argv[2];
+
+    if (!(c->flags & (CLIENT_TRACKING_OPTIN | CLIENT_TRACKING_OPTOUT))) {
+        add_reply_error(c, "CLIENT CACHING can be called only when the "
+                "client is in tracking mode with OPTIN or OPTOUT mode "
+                "enabled");
+        return;
+    }
+    if (arg_is(arg, "yes")) {
+        if (!(c->flags & CLIENT_TRACKING_OPTIN)) {
+            add_reply_error(c, "CLIENT CACHING YES is only valid when "
+                    "tracking is enabled in OPTIN mode.");
+            return;
+        }
+    } else if (arg_is(arg, "no")) {
+        if (!(c->flags & CLIENT_TRACKING_OPTOUT)) {
+            add_reply_error(c, "CLIENT CACHING NO is only valid when "
+                    "tracking is enabled in OPTOUT mode.");
+            return;
+        }
+    } else {
+        add_reply_error(c, "syntax error");
+        return;
+    }
+    c->flags |= CLIENT_TRACKING_CACHING;
+    add_reply_status(c, "OK");
+}
+
+static void client_trackinginfo(struct client_t* c) {
+    static const struct {
+        uint32_t    flag;
+        const char* name;
+    } names[] = {
+        { CLIENT_TRACKING_BCAST,        "bcast" },
+        { CLIENT_TRACKING_OPTIN,        "optin" },
+        { CLIENT_TRACKING_OPTOUT,       "optout" },
+        { CLIENT_TRACKING_NOLOOP,       "noloop" },
+        { CLIENT_TRACKING_BROKEN_REDIR, "broken_redirect" },
+    };
+    size_t nnames = sizeof names / sizeof names[0];
+    const char* caching = NULL;
+    int64_t nflags = 1;
+
+    if (c->flags & CLIENT_TRACKING_CACHING) {
+        caching = (c->flags & CLIENT_TRACKING_OPTIN) ? "caching-yes" :
+            "caching-no";
+        nflags++;
+    }
+    for (size_t i = 0; i < nnames; i++) {
+        nflags += (c->flags & names[i].flag) != 0;
+    }
+
+    add_reply_array_len(c, 6);
+    add_reply_bulk(c, "flags", 5);
+    add_reply_array_len(c, nflags);
+    if (!(c->flags & CLIENT_TRACKING)) {
+        add_reply_bulk(c, "off", 3);
+    } else {
+        add_reply_bulk(c, "on", 2);
+    }
+    for (size_t i = 0; i < nnames; i++) {
+        if (c->flags & names[i].flag) {
+            add_reply_bulk(c, names[i].name, strlen(names[i].name));
+        }
+    }
+    if (caching != NULL) add_reply_bulk(c, caching, strlen(caching));
+
+    add_reply_bulk(c, "redirect", 8);
+    add_reply_long_long(c, (c->flags & CLIENT_TRACKING) ?
+            (int64_t) c->client_tracking_redirection : -1);
+
+    add_reply_bulk(c, "prefixes", 8);
+    if (c->client_tracking_prefixes == NULL) {
+        add_reply_array_len(c, 0);
+        return;
+    }
+    struct rax_iter_t ri;
+    add_reply_array_len(c, rax_size(c->client_tracking_prefixes));
+    rax_iter_start(&ri, c->client_tracking_prefixes);
+    int32_t more = rax_seek(&ri, "^", NULL, 0);
+    for (; more; more = rax_next(&ri)) {
+        add_reply_bulk(c, (const char*) ri.key, ri.key_len);
+    }
+    rax_iter_release(&ri);
+}
+
+void client_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+
+    if (arg_is(&argv[1], "id") && argc == 2) {
+        add_reply_long_long(c, c->id);
+    } else if (arg_is(&argv[1], "getredirect") && argc == 2) {
+        add_reply_long_long(c, (c->flags & CLIENT_TRACKING) ?
+                (int64_t) c->client_tracking_redirection : -1);
+    } else if (arg_is(&argv[1], "trackinginfo") && argc == 2) {
+        client_trackinginfo(c);
+    } else if (arg_is(&argv[1], "tracking") && argc >= 3) {
+        client_tracking(c);
+    } else if (arg_is(&argv[1], "caching") && argc == 3) {
+        client_caching(c);
+    } else {
+        add_reply_error_format(c, "unknown subcommand or wrong number of "
+                "arguments for '%.*s'",
+                (int) (argv[1].len > 64 ? 64 : argv[1].len), argv[1].ptr);
+    }
+}
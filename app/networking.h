@@ -0,0 +1,198 @@
+#ifndef NETWORKING_H
+#define NETWORKING_H
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dict.h"
+#include "event_loop.h"
+#include "ip.h"
+#include "resp.h"
+
+#define PROTO_IOBUF_LEN         (16 * 1024) // initial query buffer size
+#define PROTO_REPLY_CHUNK_BYTES (16 * 1024) // static reply buffer / block size
+
+#define CLIENT_PENDING_WRITE     (1 << 0) // on server.clients_pending_write
+#define CLIENT_CLOSE_AFTER_REPLY (1 << 1) // free once the replies are sent
+#define CLIENT_CLOSE_ASAP        (1 << 2) // free when the in flight send ends
+#define CLIENT_WRITE_INFLIGHT    (1 << 3) // asynchronous el_send() pending
+#define CLIENT_WRITE_HANDLER     (1 << 4) // E_WRITEABLE is registered
+
+
+#define CLIENT_PUBSUB            (1 << 5) // subscribed to a channel / pattern
+#define CLIENT_REPLICA           (1 << 6) // replication link (not yet used)
+#define CLIENT_BLOCKED           (1 << 7) // waiting for an operation, see blocked.h
+#define CLIENT_UNBLOCKED         (1 << 8) // on server.unblocked_clients
+#define CLIENT_ASKING            (1 << 9) // may use an importing slot once
+#define CLIENT_UNIX_SOCKET       (1 << 10) // accepted on the Unix socket
+#define CLIENT_TRACKING          (1 << 11) // CLIENT TRACKING on, see tracking.h
+#define CLIENT_TRACKING_BCAST    (1 << 12) // every key of the prefixes
+#define CLIENT_TRACKING_OPTIN    (1 << 13) // only after CLIENT CACHING yes
+#define CLIENT_TRACKING_OPTOUT   (1 << 14) // unless CLIENT CACHING no
+#define CLIENT_TRACKING_CACHING  (1 << 15) // CLIENT CACHING, next command only
+#define CLIENT_TRACKING_NOLOOP   (1 << 16) // not for keys it modified itself
+#define CLIENT_TRACKING_BROKEN_REDIR (1 << 17) // the redirect client is gone
+#define CLIENT_MULTI             (1 << 18) // queueing commands, see multi.h
+#define CLIENT_DIRTY_CAS         (1 << 19) // a watched key was modified
+#define CLIENT_DIRTY_EXEC        (1 << 20) // a queued command was refused
+
+/**
+ * Clients are bucketed by memory usage in powers of two, starting at 32 KB
+ * (smaller clients all share bucket 0), so the eviction for
+ * maxmemory-clients starts from the biggest clients without a scan.
+ * */
+#define CLIENT_MEM_BUCKET_MIN_LOG 15
+#define CLIENT_MEM_BUCKETS        20
+
+
+/**
+ * An encoded reply linked into many clients' reply lists without copying,
+ * e.g. one PUBLISH message fanned out to every subscriber.
+ * */
+struct shared_reply_t {
+    uint32_t refcount;
+    size_t   len;
+    char     buf[];
+};
+
+/**
+ * Replies that do not fit the static buffer, appended in order. A block
+ * either owns `buf` or references `shared` (`size` 0, nothing appended).
+ * */
+struct reply_block_t {
+    struct reply_block_t*  next;
+    struct shared_reply_t* shared;
+    size_t                 size;
+    size_t                 used;
+    char                   buf[];
+};
+
+/**
+ * One connection. Requests are framed from `querybuf` (or straight from the
+ * received bytes when nothing is buffered) and executed one at a time.
+ * Replies go to `buf` first, then to the `reply` block list, and are sent
+ * from the before sleep handle of the event loop.
+ * */
+struct client_t {
+    uint64_t              id;
+    int32_t               fd;
+    uint32_t              flags;
+    char                  addr[NET_ADDR_STR_LEN]; // IP, or socket path
+
+    char*                 querybuf;
+    size_t                qb_len;
+    size_t                qb_cap;
+    struct resp_request_t req; // arguments of the command being executed
+
+    size_t                bufpos;
+    size_t                sentlen;  // of `buf`, or of the head block once
+                                    // `buf` is empty
+    struct reply_block_t* reply_head;
+    struct reply_block_t* reply_tail;
+    size_t                reply_bytes;
+
+    struct client_t*      pending_prev;
+    struct client_t*      pending_next;
+
+    struct dict_t*        pubsub_channels; // channel -> index in subscribers
+    struct dict_t*        pubsub_patterns; // pattern -> index in subscribers
+
+    int64_t               obuf_soft_limit_reached_ms; // 0 if under the limit
+    size_t                mem_usage;  // as last accounted in the server
+    int32_t               mem_bucket; // -1 when not in a bucket
+    struct client_t*      mem_prev;
+    struct client_t*      mem_next;
+    struct client_t*      close_prev; // server.clients_to_close
+    struct client_t*      close_next;
+
+    int32_t               btype;  // BLOCKED_* while CLIENT_BLOCKED
+    void*                 bstate; // owned by the operation blocking on
+    struct dict_t*        bkeys;    // keys waited for, see block_for_keys()
+    int64_t               btimeout; // monotonic ms, 0 waits forever
+    struct client_t*      unblocked_prev;
+    struct client_t*      unblocked_next;
+
+    uint64_t              client_tracking_redirection; // client id
+    struct rax_t*         client_tracking_prefixes; // BCAST, prefix -> NULL
+
+    struct multi_state_t* mstate;       // while CLIENT_MULTI
+    struct dict_t*        watched_keys; // key -> NULL, NULL if none
+
+    char                  buf[PROTO_REPLY_CHUNK_BYTES];
+};
+
+
+/** Create a client for an accepted socket and start reading from it */
+struct client_t* create_client(struct event_loop_t*, int32_t);
+
+/** Close the connection, deferred while an asynchronous send is in flight */
+void free_client(struct event_loop_t*, struct client_t*);
+
+/**
+ * Stop serving the client and free it from the before sleep handle. For
+ * code that cannot free the client it is working on, e.g. reply appends.
+ * */
+void free_client_async(struct client_t*);
+
+void free_clients_in_async_free_queue(struct event_loop_t*);
+
+/** The connected client with this id, or NULL */
+struct client_t* lookup_client_by_id(uint64_t);
+
+/**
+ * Execute the requests buffered in the query buffer, e.g. those that arrived
+ * while the client was blocked.
+ * */
+void process_query_buffer(struct client_t*);
+
+/** CLIENT_TYPE_* of the output buffer limit that applies */
+int32_t get_client_type(struct client_t*);
+
+/** Query buffer, reply buffers, queued MULTI commands and the structure */
+size_t get_client_memory_usage(struct client_t*);
+
+/** Evict the biggest clients while their total exceeds maxmemory-clients */
+void evict_clients();
+
+void add_reply(struct client_t*, const char*, size_t);
+
+void add_reply_status(struct client_t*, const char*);
+
+/** "-ERR <message>", unless the message has its own code ("-WRONGTYPE ...") */
+void add_reply_error(struct client_t*, const char*);
+
+void add_reply_error_format(struct client_t*, const char*, ...)
+    __attribute__((format(printf, 2, 3)));
+
+void add_reply_long_long(struct client_t*, int64_t);
+
+void add_reply_bulk(struct client_t*, const char*, size_t);
+
+void add_reply_null(struct client_t*);
+
+void add_reply_null_array(struct client_t*);
+
+void add_reply_array_len(struct client_t*, int64_t);
+
+/** Allocate `len` bytes with one reference held by the caller */
+struct shared_reply_t* create_shared_reply(size_t);
+
+void incr_shared_reply(struct shared_reply_t*);
+
+void decr_shared_reply(struct shared_reply_t*);
+
+/** Queue a shared reply, taking a reference instead of copying it */
+void add_reply_shared(struct client_t*, struct shared_reply_t*);
+
+/** Start sending to every client that got replies. Run before sleeping. */
+void handle_clients_with_pending_writes(struct event_loop_t*);
+
+/**
+ * CLIENT ID | GETREDIRECT | TRACKINGINFO | CACHING yes|no |
+ * TRACKING on|off [REDIRECT id] [PREFIX prefix ...] [BCAST] [OPTIN]
+ * [OPTOUT] [NOLOOP]
+ * */
+void client_command(struct client_t*);
+
+#endif // !NETWORKING_H
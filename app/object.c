@@ -0,0 +1,278 @@
+#include <assert.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "object.h"
+#include "resp.h"
+#include "stream.h"
+
+
+struct robj_t shared_integers[OBJ_SHARED_INTEGERS];
+
+static uint32_t lru_clock = 0;
+
+
+void object_init() {
+    for (int64_t i = 0; i < OBJ_SHARED_INTEGERS; i++) {
+        shared_integers[i].type = OBJ_STRING;
+        shared_integers[i].encoding = OBJ_ENCODING_INT;
+        shared_integers[i].lru = 0;
+        shared_integers[i].refcount = OBJ_SHARED_REFCOUNT;
+        shared_integers[i].ptr = (void*) (intptr_t) i;
+    }
+    update_lru_clock();
+}
+
+uint32_t get_lru_clock() {
+    return lru_clock;
+}
+
+void update_lru_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    lru_clock = (uint32_t) ts.tv_sec & OBJ_LRU_CLOCK_MAX;
+}
+
+static struct robj_t* create_object(uint32_t type, uint32_t encoding,
+        void* ptr) {
+    struct robj_t* o = malloc(sizeof(struct robj_t));
+    if (o == NULL) return NULL;
+
+    o->type = type;
+    o->encoding = encoding;
+    o->lru = lru_clock;
+    o->refcount = 1;
+    o->ptr = ptr;
+    return o;
+}
+
+struct robj_t* create_raw_string_object(const char* s, size_t len) {
+    /** calloc() gets big zeroed buffers straight from fresh pages */
+    struct rstr_t* str = s == NULL ?
+        calloc(1, sizeof(struct rstr_t) + len + 1) :
+        malloc(sizeof(struct rstr_t) + len + 1);
+    if (str == NULL) return NULL;
+
+    str->len = len;
+    str->alloc = len;
+    if (s != NULL) memcpy(str->buf, s, len);
+    str->buf[len] = '\0';
+
+    struct robj_t* o = create_object(OBJ_STRING, OBJ_ENCODING_RAW, str);
+    if (o == NULL) free(str);
+    return o;
+}
+
+struct robj_t* create_embstr_string_object(const char* s, size_t len) {
+    assert(len <= OBJ_EMBSTR_SIZE_LIMIT);
+
+    struct robj_t* o = malloc(sizeof(struct robj_t) +
+            sizeof(struct embstr_t) + len + 1);
+    if (o == NULL) return NULL;
+
+    struct embstr_t* str = (struct embstr_t*) (o + 1);
+    str->len = len;
+    memcpy(str->buf, s, len);
+    str->buf[len] = '\0';
+
+    o->type = OBJ_STRING;
+    o->encoding = OBJ_ENCODING_EMBSTR;
+    o->lru = lru_clock;
+    o->refcount = 1;
+    o->ptr = str;
+    return o;
+}
+
+struct robj_t* create_string_object(const char* s, size_t len) {
+    if (len <= OBJ_EMBSTR_SIZE_LIMIT) {
+        return create_embstr_string_object(s, len);
+    }
+    return create_raw_string_object(s, len);
+}
+
+/**
+ * Shared integers carry no per key LRU, which is fine as long as nothing
+ * evicts keys by LRU.
+ * */
+struct robj_t* create_string_object_from_long_long(int64_t v) {
+    if (v >= 0 && v < OBJ_SHARED_INTEGERS) {
+        return &shared_integers[v];
+    }
+    return create_object(OBJ_STRING, OBJ_ENCODING_INT, (void*) (intptr_t) v);
+}
+
+struct robj_t* create_stream_object() {
+    struct stream_t* s = create_stream();
+    if (s == NULL) return NULL;
+
+    struct robj_t* o = create_object(OBJ_STREAM, OBJ_ENCODING_STREAM, s);
+    if (o == NULL) free_stream(s);
+    return o;
+}
+
+struct robj_t* try_object_encoding(struct robj_t* o) {
+    if (o->type != OBJ_STRING || o->encoding == OBJ_ENCODING_INT ||
+            o->refcount > 1) {
+        return o;
+    }
+
+    char tmp[OBJ_LONG_STR_SIZE];
+    size_t len;
+    const char* s = obj_string_ptr(o, tmp, &len);
+    int64_t v;
+
+    if (len < OBJ_LONG_STR_SIZE && resp_string2ll(s, len, &v)) {
+        if (v >= 0 && v < OBJ_SHARED_INTEGERS) {
+            decr_ref_count(o);
+            return &shared_integers[v];
+        }
+        if (o->encoding == OBJ_ENCODING_RAW) {
+            free(o->ptr);
+            o->encoding = OBJ_ENCODING_INT;
+            o->ptr = (void*) (intptr_t) v;
+            return o;
+        }
+        /** EMBSTR: the string shares the allocation, shrink into a new one */
+        struct robj_t* io = create_object(OBJ_STRING, OBJ_ENCODING_INT,
+                (void*) (intptr_t) v);
+        if (io == NULL) return o;
+        decr_ref_count(o);
+        return io;
+    }
+
+    if (o->encoding == OBJ_ENCODING_RAW && len <= OBJ_EMBSTR_SIZE_LIMIT) {
+        struct robj_t* eo = create_embstr_string_object(s, len);
+        if (eo == NULL) return o;
+        decr_ref_count(o);
+        return eo;
+    }
+
+    return o;
+}
+
+int32_t raw_string_reserve(struct robj_t* o, size_t len) {
+    assert(o->encoding == OBJ_ENCODING_RAW);
+
+    struct rstr_t* str = o->ptr;
+    if (len <= str->alloc) return 0;
+
+    size_t alloc = len < 1024 * 1024 ? len * 2 : len + 1024 * 1024;
+    struct rstr_t* try = realloc(str, sizeof(struct rstr_t) + alloc + 1);
+    if (try == NULL) return -1;
+    try->alloc = alloc;
+    o->ptr = try;
+    return 0;
+}
+
+int32_t raw_string_grow_zero(struct robj_t* o, size_t len) {
+    if (len <= ((struct rstr_t*) o->ptr)->len) return 0;
+    if (raw_string_reserve(o, len) == -1) return -1;
+
+    struct rstr_t* str = o->ptr;
+    memset(str->buf + str->len, 0, len - str->len);
+    str->len = len;
+    str->buf[len] = '\0';
+    return 0;
+}
+
+void incr_ref_count(struct robj_t* o) {
+    if (o->refcount != OBJ_SHARED_REFCOUNT) o->refcount++;
+}
+
+void decr_ref_count(struct robj_t* o) {
+    if (o->refcount == OBJ_SHARED_REFCOUNT) return;
+
+    assert(o->refcount > 0);
+    if (--o->refcount > 0) return;
+
+    if (o->encoding == OBJ_ENCODING_RAW) free(o->ptr);
+    if (o->encoding == OBJ_ENCODING_STREAM) free_stream(o->ptr);
+    free(o);
+}
+
+void decr_ref_count_void(void* o) {
+    decr_ref_count(o);
+}
+
+static size_t ll2str(char* dst, int64_t v) {
+    char buf[OBJ_LONG_STR_SIZE];
+    uint64_t u = v < 0 ? -(uint64_t) v : (uint64_t) v;
+    size_t n = 0;
+
+    do {
+        buf[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u > 0);
+    if (v < 0) buf[n++] = '-';
+
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = buf[n - 1 - i];
+    }
+    dst[n] = '\0';
+    return n;
+}
+
+const char* obj_string_ptr(const struct robj_t* o, char* tmp, size_t* len) {
+    switch (o->encoding) {
+    case OBJ_ENCODING_RAW:
+        *len = ((struct rstr_t*) o->ptr)->len;
+        return ((struct rstr_t*) o->ptr)->buf;
+    case OBJ_ENCODING_EMBSTR:
+        *len = ((struct embstr_t*) o->ptr)->len;
+        return ((struct embstr_t*) o->ptr)->buf;
+    default:
+        *len = ll2str(tmp, (int64_t) (intptr_t) o->ptr);
+        return tmp;
+    }
+}
+
+size_t obj_string_len(const struct robj_t* o) {
+    char tmp[OBJ_LONG_STR_SIZE];
+    size_t len;
+    obj_string_ptr(o, tmp, &len);
+    return len;
+}
+
+int32_t get_long_long_from_object(const struct robj_t* o, int64_t* v) {
+    if (o->encoding == OBJ_ENCODING_INT) {
+        *v = (int64_t) (intptr_t) o->ptr;
+        return 1;
+    }
+
+    char tmp[OBJ_LONG_STR_SIZE];
+    size_t len;
+    const char* s = obj_string_ptr(o, tmp, &len);
+    return resp_string2ll(s, len, v);
+}
+
+size_t obj_memory_usage(const struct robj_t* o, uint64_t samples) {
+    if (o->refcount == OBJ_SHARED_REFCOUNT) return 0;
+
+    size_t n = malloc_usable_size((void*) o);
+    if (o->encoding == OBJ_ENCODING_RAW) n += malloc_usable_size(o->ptr);
+    if (o->encoding == OBJ_ENCODING_STREAM) {
+        n += stream_memory_usage(o->ptr, samples);
+    }
+    return n;
+}
+
+const char* obj_encoding_name(uint32_t encoding) {
+    switch (encoding) {
+    case OBJ_ENCODING_RAW:    return "raw";
+    case OBJ_ENCODING_INT:    return "int";
+    case OBJ_ENCODING_EMBSTR: return "embstr";
+    case OBJ_ENCODING_STREAM: return "stream";
+    default:                  return "unknown";
+    }
+}
+
+const char* obj_type_name(uint32_t type) {
+    switch (type) {
+    case OBJ_STRING: return "string";
+    case OBJ_STREAM: return "stream";
+    default:         return "unknown";
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define OBJ_STRING 0
+#define OBJ_STREAM 1
+
+#define OBJ_ENCODING_RAW    0 // ptr -> separately allocated rstr_t
+#define OBJ_ENCODING_INT    1 // the value itself is stored in ptr
+#define OBJ_ENCODING_EMBSTR 2 // ptr -> embstr_t right after the header
+#define OBJ_ENCODING_STREAM 3 // ptr -> stream_t
+
+#define OBJ_LRU_BITS      24
+#define OBJ_LRU_CLOCK_MAX ((1 << OBJ_LRU_BITS) - 1)
+
+/** Header, embstr_t length byte and NUL all fit a 64 byte allocation */
+#define OBJ_EMBSTR_SIZE_LIMIT 44
+
+/** Longest decimal int64_t, "-9223372036854775808" */
+#define OBJ_LONG_STR_SIZE 21
+
+#define OBJ_SHARED_INTEGERS 10000
+#define OBJ_SHARED_REFCOUNT INT32_MAX // never freed, refcount is not updated
+
+
+/** Owned string behind a RAW object */
+struct rstr_t {
+    size_t len;
+    size_t alloc;
+    char   buf[];
+};
+
+/** String stored in the same allocation as its object */
+struct embstr_t {
+    uint8_t len;
+    char    buf[];
+};
+
+/** 16 bytes: type, encoding and a seconds LRU clock share one word */
+struct robj_t {
+    uint32_t type : 4;
+    uint32_t encoding : 4;
+    uint32_t lru : OBJ_LRU_BITS;
+    int32_t  refcount;
+    void*    ptr;
+};
+
+/** Integers 0 .. OBJ_SHARED_INTEGERS - 1 */
+extern struct robj_t shared_integers[OBJ_SHARED_INTEGERS];
+
+
+/** Set up the shared integers */
+void object_init();
+
+/** Seconds clock for the LRU field, refreshed by update_lru_clock() */
+uint32_t get_lru_clock();
+
+void update_lru_clock();
+
+/** EMBSTR up to OBJ_EMBSTR_SIZE_LIMIT bytes, RAW above */
+struct robj_t* create_string_object(const char*, size_t);
+
+/** A NULL string creates `len` zero bytes */
+struct robj_t* create_raw_string_object(const char*, size_t);
+
+struct robj_t* create_embstr_string_object(const char*, size_t);
+
+/** Shared object when in range, INT encoded otherwise */
+struct robj_t* create_string_object_from_long_long(int64_t);
+
+/** An empty stream */
+struct robj_t* create_stream_object();
+
+/**
+ * Return the most compact equivalent of a string object: a shared integer,
+ * INT, or EMBSTR. The argument is released if a new object is returned.
+ * */
+struct robj_t* try_object_encoding(struct robj_t*);
+
+/**
+ * Make room for `len` bytes in a RAW object, growing geometrically so that
+ * repeated appends stay amortized O(1). Return -1 on allocation failure.
+ * */
+int32_t raw_string_reserve(struct robj_t*, size_t);
+
+/** Extend a RAW object to `len` bytes with zeros, see raw_string_reserve() */
+int32_t raw_string_grow_zero(struct robj_t*, size_t);
+
+void incr_ref_count(struct robj_t*);
+
+void decr_ref_count(struct robj_t*);
+
+/** dict_val_free_t for dicts owning objects */
+void decr_ref_count_void(void*);
+
+/**
+ * Bytes of a string object. INT objects are formatted into `tmp`, which
+ * must hold OBJ_LONG_STR_SIZE bytes.
+ * */
+const char* obj_string_ptr(const struct robj_t*, char*, size_t*);
+
+size_t obj_string_len(const struct robj_t*);
+
+/** Return 1 and store the value if the object holds a valid int64_t */
+int32_t get_long_long_from_object(const struct robj_t*, int64_t*);
+
+/**
+ * Heap bytes owned by the object (allocator overhead included). Streams
+ * are estimated from `samples` nodes per tree, 0 counts everything.
+ * */
+size_t obj_memory_usage(const struct robj_t*, uint64_t);
+
+const char* obj_encoding_name(uint32_t);
+
+const char* obj_type_name(uint32_t);
+
+#endif // !OBJECT_H
@@ -0,0 +1,503 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "dict.h"
+#include "log.h"
+#include "networking.h"
+#include "pubsub.h"
+#include "server.h"
+#include "util.h"
+
+
+static void free_target(void* val) {
+    struct pubsub_target_t* t = val;
+    free(t->clients);
+    free(t);
+}
+
+int32_t pubsub_init() {
+    server.pubsub_channels = create_dict(free_target);
+    server.pubsub_patterns = create_dict(free_target);
+    server.pubsub_trie = calloc(1, sizeof(struct pattern_node_t));
+    if (server.pubsub_channels == NULL || server.pubsub_patterns == NULL ||
+            server.pubsub_trie == NULL) {
+        log_warning("[pubsub_init] pubsub dict / trie allocation error");
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t subscription_count(struct client_t* c) {
+    uint64_t n = 0;
+    if (c->pubsub_channels != NULL) n += dict_size(c->pubsub_channels);
+    if (c->pubsub_patterns != NULL) n += dict_size(c->pubsub_patterns);
+    return n;
+}
+
+/** ------------------------------ Pattern trie --------------------------- */
+
+static size_t literal_prefix_len(const char* pattern, size_t len) {
+    size_t i = 0;
+    while (i < len && !is_glob_special(pattern[i])) i++;
+    return i;
+}
+
+static struct pattern_node_t* trie_child(struct pattern_node_t* node,
+        unsigned char label) {
+    if (node->nchildren == 0) return NULL;
+
+    unsigned char* hit = memchr(node->labels, label, node->nchildren);
+    return hit == NULL ? NULL : node->children[hit - node->labels];
+}
+
+static struct pattern_node_t* trie_add_child(struct pattern_node_t* node,
+        unsigned char label) {
+    struct pattern_node_t* child = calloc(1, sizeof(struct pattern_node_t));
+    if (child == NULL) return NULL;
+
+    uint32_t n = node->nchildren + 1;
+    unsigned char* labels = realloc(node->labels, n);
+    if (labels == NULL) {
+        free(child);
+        return NULL;
+    }
+    node->labels = labels;
+    struct pattern_node_t** children = realloc(node->children,
+            n * sizeof(struct pattern_node_t*));
+    if (children == NULL) {
+        free(child);
+        return NULL;
+    }
+    node->children = children;
+
+    node->labels[node->nchildren] = label;
+    node->children[node->nchildren] = child;
+    node->nchildren = n;
+    return child;
+}
+
+static int32_t trie_insert(struct pattern_node_t* root,
+        struct pubsub_target_t* t) {
+    struct pattern_node_t* node = root;
+    for (size_t i = 0; i < t->prefix_len; i++) {
+        unsigned char label = t->name[i];
+        struct pattern_node_t* child = trie_child(node, label);
+        if (child == NULL && (child = trie_add_child(node, label)) == NULL) {
+            return -1;
+        }
+        node = child;
+    }
+
+    if (node->npatterns == node->patterns_cap) {
+        uint32_t cap = node->patterns_cap == 0 ? 1 : node->patterns_cap * 2;
+        struct pubsub_target_t** try = realloc(node->patterns,
+                cap * sizeof(struct pubsub_target_t*));
+        if (try == NULL) return -1;
+        node->patterns = try;
+        node->patterns_cap = cap;
+    }
+    node->patterns[node->npatterns++] = t;
+    return 0;
+}
+
+static void free_trie_node(struct pattern_node_t* node) {
+    free(node->labels);
+    free(node->children);
+    free(node->patterns);
+    free(node);
+}
+
+/** Remove the pattern and prune the nodes left without patterns / children */
+static void trie_remove(struct pattern_node_t* root,
+        struct pubsub_target_t* t) {
+    struct pattern_node_t** path = malloc(
+            (t->prefix_len + 1) * sizeof(struct pattern_node_t*));
+    struct pattern_node_t* node = root;
+
+    for (size_t i = 0; i < t->prefix_len; i++) {
+        if (path != NULL) path[i] = node;
+        node = trie_child(node, (unsigned char) t->name[i]);
+        assert(node != NULL);
+    }
+
+    for (uint32_t i = 0; i < node->npatterns; i++) {
+        if (node->patterns[i] == t) {
+            node->patterns[i] = node->patterns[--node->npatterns];
+            break;
+        }
+    }
+
+    /** Without the path the empty nodes are kept, which is only a leak of
+     * bookkeeping until the same prefix is subscribed again */
+    if (path == NULL) return;
+
+    for (size_t depth = t->prefix_len; depth > 0; depth--) {
+        if (node->npatterns > 0 || node->nchildren > 0) break;
+
+        struct pattern_node_t* parent = path[depth - 1];
+        unsigned char* hit = memchr(parent->labels,
+                (unsigned char) t->name[depth - 1], parent->nchildren);
+        uint32_t idx = hit - parent->labels;
+        uint32_t last = --parent->nchildren;
+        parent->labels[idx] = parent->labels[last];
+        parent->children[idx] = parent->children[last];
+
+        free_trie_node(node);
+        node = parent;
+    }
+    free(path);
+}
+
+/** ------------------------------ Subscriptions -------------------------- */
+
+static struct dict_t** client_dict(struct client_t* c, int32_t pattern) {
+    return pattern ? &c->pubsub_patterns : &c->pubsub_channels;
+}
+
+static struct dict_t* server_dict(int32_t pattern) {
+    return pattern ? server.pubsub_patterns : server.pubsub_channels;
+}
+
+static struct pubsub_target_t* create_target(const char* name, size_t len,
+        int32_t pattern) {
+    struct pubsub_target_t* t = calloc(1,
+            sizeof(struct pubsub_target_t) + len);
+    if (t == NULL) return NULL;
+
+    t->len = len;
+    t->prefix_len = pattern ? literal_prefix_len(name, len) : len;
+    memcpy(t->name, name, len);
+    return t;
+}
+
+static int64_t target_add_client(struct pubsub_target_t* t,
+        struct client_t* c) {
+    if (t->count == t->cap) {
+        uint32_t cap = t->cap == 0 ? 4 : t->cap * 2;
+        struct client_t** try = realloc(t->clients,
+                cap * sizeof(struct client_t*));
+        if (try == NULL) return -1;
+        t->clients = try;
+        t->cap = cap;
+    }
+    t->clients[t->count] = c;
+    return t->count++;
+}
+
+/** Swap the last subscriber into the slot and fix its stored index */
+static void target_remove_client(struct pubsub_target_t* t, uint32_t idx,
+        int32_t pattern) {
+    assert(idx < t->count);
+
+    uint32_t last = --t->count;
+    if (idx == last) return;
+
+    struct client_t* moved = t->clients[last];
+    t->clients[idx] = moved;
+
+    struct dict_entry_t* e = dict_find(*client_dict(moved, pattern), t->name,
+            t->len);
+    assert(e != NULL);
+    e->val = (void*) (uintptr_t) idx;
+}
+
+static void add_reply_subscription(struct client_t* c, const char* kind,
+        const char* name, size_t len) {
+    add_reply_array_len(c, 3);
+    add_reply_bulk(c, kind, strlen(kind));
+    if (name != NULL) {
+        add_reply_bulk(c, name, len);
+    } else {
+        add_reply_null(c);
+    }
+    add_reply_long_long(c, subscription_count(c));
+}
+
+static void subscribe(struct client_t* c, const char* name, size_t len,
+        int32_t pattern) {
+    const char* kind = pattern ? "psubscribe" : "subscribe";
+    struct dict_t** cd = client_dict(c, pattern);
+
+    if (*cd == NULL && (*cd = create_dict(NULL)) == NULL) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+
+    if (dict_find(*cd, name, len) == NULL) {
+        struct dict_t* sd = server_dict(pattern);
+        struct dict_entry_t* e = dict_find(sd, name, len);
+        struct pubsub_target_t* t = e != NULL ? e->val : NULL;
+
+        if (t == NULL) {
+            t = create_target(name, len, pattern);
+            if (t == NULL || dict_add(sd, name, len, t) != DICT_OK) {
+                free(t);
+                add_reply_error(c, "out of memory");
+                return;
+            }
+            if (pattern && trie_insert(server.pubsub_trie, t) == -1) {
+                dict_delete(sd, name, len);
+                add_reply_error(c, "out of memory");
+                return;
+            }
+        }
+
+        int64_t idx = target_add_client(t, c);
+        if (idx == -1 ||
+                dict_add(*cd, name, len, (void*) (uintptr_t) idx) != DICT_OK) {
+            if (idx != -1) target_remove_client(t, idx, pattern);
+            /** Drop the target created above rather than leave it empty */
+            if (t->count == 0) {
+                if (pattern) trie_remove(server.pubsub_trie, t);
+                dict_delete(sd, name, len);
+            }
+            add_reply_error(c, "out of memory");
+            return;
+        }
+        c->flags |= CLIENT_PUBSUB;
+    }
+
+    add_reply_subscription(c, kind, name, len);
+}
+
+/** Return 1 if the client was subscribed */
+static int32_t unsubscribe(struct client_t* c, const char* name, size_t len,
+        int32_t pattern, int32_t notify) {
+    struct dict_t* cd = *client_dict(c, pattern);
+    struct dict_entry_t* ce = cd != NULL ? dict_find(cd, name, len) : NULL;
+    int32_t found = ce != NULL;
+
+    if (found) {
+        struct dict_t* sd = server_dict(pattern);
+        struct dict_entry_t* se = dict_find(sd, name, len);
+        assert(se != NULL);
+        struct pubsub_target_t* t = se->val;
+
+        target_remove_client(t, (uintptr_t) ce->val, pattern);
+        if (t->count == 0) {
+            if (pattern) trie_remove(server.pubsub_trie, t);
+            dict_delete(sd, name, len);
+        }
+    }
+
+    /** `name` may point into the client's dict entry, reply before freeing */
+    if (notify) {
+        add_reply_array_len(c, 3);
+        const char* kind = pattern ? "punsubscribe" : "unsubscribe";
+        add_reply_bulk(c, kind, strlen(kind));
+        add_reply_bulk(c, name, len);
+        add_reply_long_long(c, subscription_count(c) - found);
+    }
+    if (found) dict_delete(cd, name, len);
+
+    if (subscription_count(c) == 0) c->flags &= ~CLIENT_PUBSUB;
+    return found;
+}
+
+static void unsubscribe_all(struct client_t* c, int32_t pattern,
+        int32_t notify) {
+    struct dict_t* cd = *client_dict(c, pattern);
+
+    if (cd == NULL || dict_size(cd) == 0) {
+        if (notify) {
+            add_reply_subscription(c,
+                    pattern ? "punsubscribe" : "unsubscribe", NULL, 0);
+        }
+        return;
+    }
+
+    struct dict_iter_t it;
+    struct dict_entry_t* e;
+    dict_init_iter(cd, &it);
+    while ((e = dict_next(&it)) != NULL) {
+        unsubscribe(c, e->key, e->klen, pattern, notify);
+    }
+    dict_release_iter(&it);
+}
+
+void pubsub_unsubscribe_all(struct client_t* c) {
+    if (c->pubsub_channels != NULL) {
+        unsubscribe_all(c, 0, 0);
+        free_dict(c->pubsub_channels);
+        c->pubsub_channels = NULL;
+    }
+    if (c->pubsub_patterns != NULL) {
+        unsubscribe_all(c, 1, 0);
+        free_dict(c->pubsub_patterns);
+        c->pubsub_patterns = NULL;
+    }
+    c->flags &= ~CLIENT_PUBSUB;
+}
+
+/** ------------------------------ Publishing ----------------------------- */
+
+static size_t encode_bulk(char* dst, const char* s, size_t len) {
+    size_t n = sprintf(dst, "$%zu\r\n", len);
+    memcpy(dst + n, s, len);
+    memcpy(dst + n + len, "\r\n", 2);
+    return n + len + 2;
+}
+
+/** Header + "$<len>\r\n" + payload + "\r\n" for every bulk, 20 digits max */
+static struct shared_reply_t* encode_message(const char* pattern,
+        size_t plen, const char* channel, size_t clen, const char* msg,
+        size_t mlen) {
+    size_t cap = 64 + plen + clen + mlen;
+    struct shared_reply_t* sr = create_shared_reply(cap);
+    if (sr == NULL) return NULL;
+
+    size_t n = 0;
+    if (pattern != NULL) {
+        memcpy(sr->buf, "*4\r\n", 4);
+        n = 4;
+        n += encode_bulk(sr->buf + n, "pmessage", 8);
+        n += encode_bulk(sr->buf + n, pattern, plen);
+    } else {
+        memcpy(sr->buf, "*3\r\n", 4);
+        n = 4;
+        n += encode_bulk(sr->buf + n, "message", 7);
+    }
+    n += encode_bulk(sr->buf + n, channel, clen);
+    n += encode_bulk(sr->buf + n, msg, mlen);
+    assert(n <= cap);
+
+    sr->len = n;
+    return sr;
+}
+
+static uint64_t deliver(struct pubsub_target_t* t, const char* pattern,
+        size_t plen, const char* channel, size_t clen, const char* msg,
+        size_t mlen) {
+    struct shared_reply_t* sr = encode_message(pattern, plen, channel, clen,
+            msg, mlen);
+    if (sr == NULL) {
+        log_warning("[pubsub_publish] message allocation error");
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < t->count; i++) {
+        add_reply_shared(t->clients[i], sr);
+    }
+    decr_shared_reply(sr);
+
+    return t->count;
+}
+
+uint64_t pubsub_publish(const char* channel, size_t clen, const char* msg,
+        size_t mlen) {
+    uint64_t receivers = 0;
+
+    struct dict_entry_t* e = dict_find(server.pubsub_channels, channel, clen);
+    if (e != NULL) {
+        receivers += deliver(e->val, NULL, 0, channel, clen, msg, mlen);
+    }
+
+    /** Patterns at depth i have a literal prefix equal to channel[0, i) */
+    struct pattern_node_t* node = server.pubsub_trie;
+    for (size_t i = 0; node != NULL; i++) {
+        for (uint32_t j = 0; j < node->npatterns; j++) {
+            struct pubsub_target_t* t = node->patterns[j];
+            if (string_match_len(t->name + t->prefix_len,
+                        t->len - t->prefix_len, channel + i, clen - i)) {
+                receivers += deliver(t, t->name, t->len, channel, clen,
+                        msg, mlen);
+            }
+        }
+        if (i == clen) break;
+        node = trie_child(node, (unsigned char) channel[i]);
+    }
+
+    server.stat_pubsub_messages++;
+    return receivers;
+}
+
+/** ------------------------------ Commands ------------------------------- */
+
+void subscribe_command(struct client_t* c) {
+    for (int32_t i = 1; i < c->req.argc; i++) {
+        subscribe(c, c->req.argv[i].ptr, c->req.argv[i].len, 0);
+    }
+}
+
+void psubscribe_command(struct client_t* c) {
+    for (int32_t i = 1; i < c->req.argc; i++) {
+        subscribe(c, c->req.argv[i].ptr, c->req.argv[i].len, 1);
+    }
+}
+
+void unsubscribe_command(struct client_t* c) {
+    if (c->req.argc == 1) {
+        unsubscribe_all(c, 0, 1);
+        return;
+    }
+    for (int32_t i = 1; i < c->req.argc; i++) {
+        unsubscribe(c, c->req.argv[i].ptr, c->req.argv[i].len, 0, 1);
+    }
+}
+
+void punsubscribe_command(struct client_t* c) {
+    if (c->req.argc == 1) {
+        unsubscribe_all(c, 1, 1);
+        return;
+    }
+    for (int32_t i = 1; i < c->req.argc; i++) {
+        unsubscribe(c, c->req.argv[i].ptr, c->req.argv[i].len, 1, 1);
+    }
+}
+
+void publish_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    add_reply_long_long(c, pubsub_publish(argv[1].ptr, argv[1].len,
+                argv[2].ptr, argv[2].len));
+}
+
+/** PUBSUB CHANNELS [pattern] | NUMSUB [channel ...] | NUMPAT */
+void pubsub_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+
+    if (argv[1].len == 8 && strncasecmp(argv[1].ptr, "channels", 8) == 0 &&
+            argc <= 3) {
+        struct dict_iter_t it;
+        struct dict_entry_t* e;
+        uint64_t n = 0;
+
+        /** Count first, the array length goes before the elements */
+        for (int32_t pass = 0; pass < 2; pass++) {
+            if (pass == 1) add_reply_array_len(c, n);
+            dict_init_iter(server.pubsub_channels, &it);
+            while ((e = dict_next(&it)) != NULL) {
+                if (argc == 3 && !string_match_len(argv[2].ptr, argv[2].len,
+                            e->key, e->klen)) {
+                    continue;
+                }
+                if (pass == 0) {
+                    n++;
+                } else {
+                    add_reply_bulk(c, e->key, e->klen);
+                }
+            }
+            dict_release_iter(&it);
+        }
+    } else if (argv[1].len == 6 && strncasecmp(argv[1].ptr, "numsub", 6) == 0) {
+        add_reply_array_len(c, (int64_t) (argc - 2) * 2);
+        for (int32_t i = 2; i < argc; i++) {
+            struct dict_entry_t* e = dict_find(server.pubsub_channels,
+                    argv[i].ptr, argv[i].len);
+            add_reply_bulk(c, argv[i].ptr, argv[i].len);
+            add_reply_long_long(c, e != NULL ?
+                    ((struct pubsub_target_t*) e->val)->count : 0);
+        }
+    } else if (argv[1].len == 6 && strncasecmp(argv[1].ptr, "numpat", 6) == 0 &&
+            argc == 2) {
+        add_reply_long_long(c, dict_size(server.pubsub_patterns));
+    } else {
+        add_reply_error_format(c, "unknown subcommand or wrong number of "
+                "arguments for '%.*s'. Try PUBSUB CHANNELS|NUMSUB|NUMPAT",
+                (int) (argv[1].len > 64 ? 64 : argv[1].len), argv[1].ptr);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef PUBSUB_H
+#define PUBSUB_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "networking.h"
+
+
+/**
+ * A channel or a pattern and its subscribers. Every subscriber keeps the
+ * index of its slot in its own pubsub dict so unsubscribing is a swap with
+ * the last slot.
+ * */
+struct pubsub_target_t {
+    uint32_t          count;
+    uint32_t          cap;
+    struct client_t** clients;
+    size_t            prefix_len; // patterns: literal bytes before any glob
+    size_t            len;
+    char              name[];
+};
+
+/**
+ * Patterns indexed by their literal prefix, one byte per level. PUBLISH
+ * walks the channel name down the trie and only glob matches the patterns
+ * stored along that path.
+ * */
+struct pattern_node_t {
+    uint32_t                 nchildren;
+    uint32_t                 npatterns;
+    uint32_t                 patterns_cap;
+    unsigned char*           labels;   // byte leading to children[i]
+    struct pattern_node_t**  children;
+    struct pubsub_target_t** patterns;
+};
+
+
+int32_t pubsub_init();
+
+/** Drop every subscription of the client without replying */
+void pubsub_unsubscribe_all(struct client_t*);
+
+/** Deliver to subscribers, return the number of clients reached */
+uint64_t pubsub_publish(const char*, size_t, const char*, size_t);
+
+void subscribe_command(struct client_t*);
+
+void unsubscribe_command(struct client_t*);
+
+void psubscribe_command(struct client_t*);
+
+void punsubscribe_command(struct client_t*);
+
+void publish_command(struct client_t*);
+
+void pubsub_command(struct client_t*);
+
+#endif // !PUBSUB_H
@@ -0,0 +1,499 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rax.h"
+
+
+static struct rax_node_t* create_node(const unsigned char* label,
+        size_t len) {
+    struct rax_node_t* n = malloc(sizeof(struct rax_node_t) + len);
+    if (n == NULL) return NULL;
+
+    n->is_key = 0;
+    n->len = len;
+    n->nchildren = 0;
+    n->value = NULL;
+    n->children = NULL;
+    if (label != NULL) memcpy(n->label, label, len);
+    return n;
+}
+
+static void free_node(struct rax_node_t* n) {
+    free(n->children);
+    free(n);
+}
+
+struct rax_t* create_rax() {
+    struct rax_t* rt = malloc(sizeof(struct rax_t));
+    if (rt == NULL) return NULL;
+
+    rt->head = create_node(NULL, 0);
+    if (rt->head == NULL) {
+        free(rt);
+        return NULL;
+    }
+    rt->numele = 0;
+    rt->numnodes = 1;
+    return rt;
+}
+
+/** Recursion depth is bounded by the length of the longest key */
+static void free_subtree(struct rax_node_t* n, void (*free_value)(void*)) {
+    for (uint32_t i = 0; i < n->nchildren; i++) {
+        free_subtree(n->children[i], free_value);
+    }
+    if (n->is_key && free_value != NULL) free_value(n->value);
+    free_node(n);
+}
+
+void free_rax(struct rax_t* rt, void (*free_value)(void*)) {
+    if (rt == NULL) return;
+
+    free_subtree(rt->head, free_value);
+    free(rt);
+}
+
+/**
+ * Child whose label starts with `c`, or NULL. `idx` is set to its index, or
+ * to the index it would be inserted at.
+ * */
+static struct rax_node_t* find_child(struct rax_node_t* n, unsigned char c,
+        uint32_t* idx) {
+    uint32_t lo = 0;
+    uint32_t hi = n->nchildren;
+
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        unsigned char m = n->children[mid]->label[0];
+        if (m == c) {
+            *idx = mid;
+            return n->children[mid];
+        }
+        if (m < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *idx = lo;
+    return NULL;
+}
+
+static int32_t add_child(struct rax_node_t* n, uint32_t idx,
+        struct rax_node_t* child) {
+    struct rax_node_t** children = realloc(n->children,
+            sizeof(struct rax_node_t*) * (n->nchildren + 1));
+    if (children == NULL) return -1;
+
+    memmove(children + idx + 1, children + idx,
+            sizeof(struct rax_node_t*) * (n->nchildren - idx));
+    children[idx] = child;
+    n->children = children;
+    n->nchildren++;
+    return 0;
+}
+
+static void remove_child(struct rax_node_t* n, uint32_t idx) {
+    memmove(n->children + idx, n->children + idx + 1,
+            sizeof(struct rax_node_t*) * (n->nchildren - idx - 1));
+    n->nchildren--;
+    if (n->nchildren == 0) {
+        free(n->children);
+        n->children = NULL;
+    }
+}
+
+static size_t common_prefix(const unsigned char* a, size_t alen,
+        const unsigned char* b, size_t blen) {
+    size_t n = alen < blen ? alen : blen;
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+/**
+ * Split the edge to `parent->children[idx]` after `at` label bytes, putting
+ * a new node in the middle. Return the middle node, NULL on allocation
+ * failure (nothing changed).
+ * */
+static struct rax_node_t* split_child(struct rax_t* rt,
+        struct rax_node_t* parent, uint32_t idx, size_t at) {
+    struct rax_node_t* child = parent->children[idx];
+    struct rax_node_t* mid = create_node(child->label, at);
+    struct rax_node_t* rest = create_node(child->label + at, child->len - at);
+    struct rax_node_t** children = malloc(sizeof(struct rax_node_t*));
+    if (mid == NULL || rest == NULL || children == NULL) {
+        free(mid);
+        free(rest);
+        free(children);
+        return NULL;
+    }
+
+    rest->is_key = child->is_key;
+    rest->value = child->value;
+    rest->nchildren = child->nchildren;
+    rest->children = child->children;
+    free(child);
+
+    children[0] = rest;
+    mid->children = children;
+    mid->nchildren = 1;
+    parent->children[idx] = mid;
+    rt->numnodes++;
+    return mid;
+}
+
+int32_t rax_insert(struct rax_t* rt, const unsigned char* key, size_t len,
+        void* value, void** old) {
+    struct rax_node_t* n = rt->head;
+    size_t pos = 0;
+
+    while (pos < len) {
+        uint32_t idx;
+        struct rax_node_t* child = find_child(n, key[pos], &idx);
+
+        if (child == NULL) {
+            struct rax_node_t* leaf = create_node(key + pos, len - pos);
+            if (leaf == NULL) return -1;
+            if (add_child(n, idx, leaf) == -1) {
+                free(leaf);
+                return -1;
+            }
+            rt->numnodes++;
+            n = leaf;
+            break;
+        }
+
+        size_t l = common_prefix(child->label, child->len, key + pos,
+                len - pos);
+        if (l < child->len) {
+            child = split_child(rt, n, idx, l);
+            if (child == NULL) return -1;
+        }
+        n = child;
+        pos += l;
+    }
+
+    if (n->is_key) {
+        if (old != NULL) *old = n->value;
+        n->value = value;
+        return 0;
+    }
+    n->is_key = 1;
+    n->value = value;
+    rt->numele++;
+    return 1;
+}
+
+int32_t rax_find(struct rax_t* rt, const unsigned char* key, size_t len,
+        void** value) {
+    struct rax_node_t* n = rt->head;
+    size_t pos = 0;
+
+    while (pos < len) {
+        uint32_t idx;
+        n = find_child(n, key[pos], &idx);
+        if (n == NULL || n->len > len - pos ||
+                memcmp(n->label, key + pos, n->len) != 0) {
+            return 0;
+        }
+        pos += n->len;
+    }
+    if (!n->is_key) return 0;
+    if (value != NULL) *value = n->value;
+    return 1;
+}
+
+/**
+ * Replace `parent->children[idx]`, a node with a single child and no key,
+ * by one node with both labels. The tree stays valid (just less compact)
+ * when the allocation fails.
+ * */
+static void merge_child(struct rax_t* rt, struct rax_node_t* parent,
+        uint32_t idx) {
+    struct rax_node_t* n = parent->children[idx];
+    struct rax_node_t* child = n->children[0];
+    struct rax_node_t* m = create_node(NULL, n->len + child->len);
+    if (m == NULL) return;
+
+    memcpy(m->label, n->label, n->len);
+    memcpy(m->label + n->len, child->label, child->len);
+    m->is_key = child->is_key;
+    m->value = child->value;
+    m->nchildren = child->nchildren;
+    m->children = child->children;
+    parent->children[idx] = m;
+    free_node(n);
+    free(child);
+    rt->numnodes--;
+}
+
+int32_t rax_remove(struct rax_t* rt, const unsigned char* key, size_t len,
+        void** old) {
+    struct rax_node_t* parent = NULL;
+    struct rax_node_t* grandparent = NULL;
+    uint32_t idx = 0;
+    uint32_t parent_idx = 0;
+    struct rax_node_t* n = rt->head;
+    size_t pos = 0;
+
+    while (pos < len) {
+        uint32_t i;
+        struct rax_node_t* child = find_child(n, key[pos], &i);
+        if (child == NULL || child->len > len - pos ||
+                memcmp(child->label, key + pos, child->len) != 0) {
+            return 0;
+        }
+        grandparent = parent;
+        parent_idx = idx;
+        parent = n;
+        idx = i;
+        n = child;
+        pos += child->len;
+    }
+    if (!n->is_key) return 0;
+
+    if (old != NULL) *old = n->value;
+    n->is_key = 0;
+    n->value = NULL;
+    rt->numele--;
+    if (parent == NULL) return 1;
+
+    /** Keyless leaves go away, keyless single child chains are merged */
+    if (n->nchildren == 0) {
+        remove_child(parent, idx);
+        free_node(n);
+        rt->numnodes--;
+        if (grandparent != NULL && !parent->is_key &&
+                parent->nchildren == 1) {
+            merge_child(rt, grandparent, parent_idx);
+        }
+    } else if (n->nchildren == 1) {
+        merge_child(rt, parent, idx);
+    }
+    return 1;
+}
+
+static size_t subtree_memory_usage(const struct rax_node_t* n) {
+    size_t bytes = malloc_usable_size((void*) n);
+    if (n->children != NULL) bytes += malloc_usable_size(n->children);
+    for (uint32_t i = 0; i < n->nchildren; i++) {
+        bytes += subtree_memory_usage(n->children[i]);
+    }
+    return bytes;
+}
+
+size_t rax_memory_usage(const struct rax_t* rt) {
+    return malloc_usable_size((void*) rt) + subtree_memory_usage(rt->head);
+}
+
+/** Bytes of at most `*budget` nodes of the subtree, depth first */
+static size_t subtree_sample(const struct rax_node_t* n, uint64_t* budget) {
+    size_t bytes = malloc_usable_size((void*) n);
+    if (n->children != NULL) bytes += malloc_usable_size(n->children);
+    (*budget)--;
+    for (uint32_t i = 0; i < n->nchildren && *budget > 0; i++) {
+        bytes += subtree_sample(n->children[i], budget);
+    }
+    return bytes;
+}
+
+size_t rax_memory_usage_sampled(const struct rax_t* rt, uint64_t samples) {
+    if (samples == 0 || rt->numnodes <= samples) return rax_memory_usage(rt);
+
+    uint64_t budget = samples;
+    size_t bytes = subtree_sample(rt->head, &budget);
+    return malloc_usable_size((void*) rt) + bytes * rt->numnodes / samples;
+}
+
+/** Return the node's address after the move, its parent stores it */
+static struct rax_node_t* defrag_subtree(struct rax_node_t* n,
+        rax_defrag_alloc_t defrag, rax_defrag_alloc_t defrag_value) {
+    struct rax_node_t* moved = defrag(n);
+    if (moved != NULL) n = moved;
+
+    if (n->children != NULL) {
+        struct rax_node_t** children = defrag(n->children);
+        if (children != NULL) n->children = children;
+    }
+    if (n->is_key && n->value != NULL && defrag_value != NULL) {
+        void* value = defrag_value(n->value);
+        if (value != NULL) n->value = value;
+    }
+    for (uint32_t i = 0; i < n->nchildren; i++) {
+        n->children[i] = defrag_subtree(n->children[i], defrag,
+                defrag_value);
+    }
+    return n;
+}
+
+void rax_defrag(struct rax_t* rt, rax_defrag_alloc_t defrag,
+        rax_defrag_alloc_t defrag_value) {
+    rt->head = defrag_subtree(rt->head, defrag, defrag_value);
+}
+
+/** ------------------------------ Iterator ------------------------------- */
+
+void rax_iter_start(struct rax_iter_t* it, struct rax_t* rt) {
+    memset(it, 0, sizeof(struct rax_iter_t));
+    it->rt = rt;
+}
+
+void rax_iter_release(struct rax_iter_t* it) {
+    free(it->key);
+    free(it->tmp);
+    it->key = it->tmp = NULL;
+    it->key_len = it->key_cap = it->tmp_len = it->tmp_cap = 0;
+}
+
+/** Append a label to the key being built in `tmp` */
+static int32_t push_label(struct rax_iter_t* it, const struct rax_node_t* n) {
+    if (it->tmp_len + n->len > it->tmp_cap) {
+        size_t cap = it->tmp_cap * 2;
+        if (cap < it->tmp_len + n->len) cap = it->tmp_len + n->len;
+        if (cap < 32) cap = 32;
+        unsigned char* tmp = realloc(it->tmp, cap);
+        if (tmp == NULL) return -1;
+        it->tmp = tmp;
+        it->tmp_cap = cap;
+    }
+    memcpy(it->tmp + it->tmp_len, n->label, n->len);
+    it->tmp_len += n->len;
+    return 0;
+}
+
+/** Smallest key below `n` (whose label is already pushed), or NULL */
+static struct rax_node_t* subtree_min(struct rax_iter_t* it,
+        struct rax_node_t* n) {
+    /** Only the head can be a keyless leaf */
+    while (!n->is_key) {
+        if (n->nchildren == 0) return NULL;
+        n = n->children[0];
+        if (push_label(it, n) == -1) return NULL;
+    }
+    return n;
+}
+
+static struct rax_node_t* subtree_max(struct rax_iter_t* it,
+        struct rax_node_t* n) {
+    while (n->nchildren > 0) {
+        n = n->children[n->nchildren - 1];
+        if (push_label(it, n) == -1) return NULL;
+    }
+    return n->is_key ? n : NULL;
+}
+
+/**
+ * Smallest key >= (> when `strict`) `key` below `n`, whose path is the
+ * first `depth` bytes of `key`.
+ * */
+static struct rax_node_t* seek_ge(struct rax_iter_t* it, struct rax_node_t* n,
+        const unsigned char* key, size_t len, size_t depth, int32_t strict) {
+    if (depth == len) {
+        if (n->is_key && !strict) return n;
+        if (n->nchildren == 0) return NULL;
+        if (push_label(it, n->children[0]) == -1) return NULL;
+        return subtree_min(it, n->children[0]);
+    }
+
+    uint32_t idx;
+    struct rax_node_t* c = find_child(n, key[depth], &idx);
+    if (c != NULL) {
+        size_t rest = len - depth;
+        int32_t cmp = memcmp(c->label, key + depth,
+                c->len < rest ? c->len : rest);
+        size_t saved = it->tmp_len;
+
+        if (push_label(it, c) == -1) return NULL;
+        /** `key` ends inside the label: everything below is greater */
+        if (cmp > 0 || (cmp == 0 && c->len > rest)) {
+            return subtree_min(it, c);
+        }
+        if (cmp == 0) {
+            struct rax_node_t* r = seek_ge(it, c, key, len, depth + c->len,
+                    strict);
+            if (r != NULL) return r;
+        }
+        it->tmp_len = saved;
+        idx++;
+    }
+
+    if (idx >= n->nchildren) return NULL;
+    if (push_label(it, n->children[idx]) == -1) return NULL;
+    return subtree_min(it, n->children[idx]);
+}
+
+/** Greatest key <= (< when `strict`) `key`, see seek_ge() */
+static struct rax_node_t* seek_le(struct rax_iter_t* it, struct rax_node_t* n,
+        const unsigned char* key, size_t len, size_t depth, int32_t strict) {
+    if (depth == len) return n->is_key && !strict ? n : NULL;
+
+    uint32_t idx;
+    struct rax_node_t* c = find_child(n, key[depth], &idx);
+    if (c != NULL) {
+        size_t rest = len - depth;
+        int32_t cmp = memcmp(c->label, key + depth,
+                c->len < rest ? c->len : rest);
+        size_t saved = it->tmp_len;
+
+        if (push_label(it, c) == -1) return NULL;
+        if (cmp < 0) return subtree_max(it, c);
+        if (cmp == 0 && c->len <= rest) {
+            struct rax_node_t* r = seek_le(it, c, key, len, depth + c->len,
+                    strict);
+            if (r != NULL) return r;
+        }
+        it->tmp_len = saved;
+    }
+
+    if (idx > 0) {
+        if (push_label(it, n->children[idx - 1]) == -1) return NULL;
+        return subtree_max(it, n->children[idx - 1]);
+    }
+    /** The path of `n` is a proper prefix of `key`, so it is smaller */
+    return n->is_key ? n : NULL;
+}
+
+int32_t rax_seek(struct rax_iter_t* it, const char* op,
+        const unsigned char* key, size_t len) {
+    struct rax_node_t* head = it->rt->head;
+    struct rax_node_t* n = NULL;
+
+    it->tmp_len = 0;
+    if (op[0] == '^') {
+        n = subtree_min(it, head);
+    } else if (op[0] == '$') {
+        n = subtree_max(it, head);
+    } else if (op[0] == '>') {
+        n = seek_ge(it, head, key, len, 0, op[1] != '=');
+    } else if (op[0] == '<') {
+        n = seek_le(it, head, key, len, 0, op[1] != '=');
+    } else if (op[0] == '=') {
+        n = seek_ge(it, head, key, len, 0, 0);
+        if (n != NULL && (it->tmp_len != len ||
+                    (len > 0 && memcmp(it->tmp, key, len) != 0))) {
+            n = NULL;
+        }
+    }
+    if (n == NULL) return 0;
+
+    unsigned char* buf = it->key;
+    size_t cap = it->key_cap;
+    it->key = it->tmp;
+    it->key_cap = it->tmp_cap;
+    it->key_len = it->tmp_len;
+    it->tmp = buf;
+    it->tmp_cap = cap;
+    it->value = n->value;
+    return 1;
+}
+
+int32_t rax_next(struct rax_iter_t* it) {
+    return rax_seek(it, ">", it->key, it->key_len);
+}
+
+int32_t rax_prev(struct rax_iter_t* it) {
+    return rax_seek(it, "<", it->key, it->key_len);
+}
@@ -0,0 +1,108 @@
+#ifndef RAX_H
+#define RAX_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Radix tree with path compression: every node is reached through an edge
+ * label of one or more bytes, and siblings are kept sorted by the first
+ * byte of their label, so keys iterate in memcmp() order. Keys are binary
+ * safe; a key can be the prefix of another.
+ *
+ *   "stream" "streams" "string"     (root) -- "str" -- "eam" [v] -- "s" [v]
+ *                                                  \-- "ing" [v]
+ * */
+
+struct rax_node_t {
+    uint32_t            is_key : 1;
+    uint32_t            len : 31;  // label bytes
+    uint32_t            nchildren;
+    void*               value;     // meaningful when is_key
+    struct rax_node_t** children;  // sorted by label[0]
+    unsigned char       label[];
+};
+
+struct rax_t {
+    struct rax_node_t* head; // empty label
+    uint64_t           numele;
+    uint64_t           numnodes;
+};
+
+/**
+ * Position of an iterator. `key` holds a copy of the current key, it stays
+ * valid until the next seek or rax_iter_release().
+ * */
+struct rax_iter_t {
+    struct rax_t*  rt;
+    unsigned char* key;
+    size_t         key_len;
+    size_t         key_cap;
+    void*          value;
+    unsigned char* tmp; // the next key is built here, then swapped in
+    size_t         tmp_len;
+    size_t         tmp_cap;
+};
+
+
+/** Return the new address of a moved allocation, NULL if it stays */
+typedef void* (*rax_defrag_alloc_t)(void*);
+
+
+struct rax_t* create_rax();
+
+/** Free the tree, calling `free_value` (if not NULL) on every value */
+void free_rax(struct rax_t*, void (*)(void*));
+
+static inline uint64_t rax_size(const struct rax_t* rt) {
+    return rt->numele;
+}
+
+/**
+ * Insert or overwrite a key. The previous value is stored in `old` (if not
+ * NULL) on overwrite. Return 1 if the key is new, 0 if it was overwritten,
+ * -1 on allocation failure (the tree is unchanged).
+ * */
+int32_t rax_insert(struct rax_t*, const unsigned char*, size_t, void*,
+        void**);
+
+/** Return 1 and the value in `value` (if not NULL) if the key exists */
+int32_t rax_find(struct rax_t*, const unsigned char*, size_t, void**);
+
+/** Return 1 and the removed value in `old` (if not NULL) if the key existed */
+int32_t rax_remove(struct rax_t*, const unsigned char*, size_t, void**);
+
+/** Heap bytes of the nodes (allocator overhead included), not the values */
+size_t rax_memory_usage(const struct rax_t*);
+
+/**
+ * rax_memory_usage() estimated from the first `samples` nodes of a depth
+ * first walk, 0 walks every node.
+ * */
+size_t rax_memory_usage_sampled(const struct rax_t*, uint64_t);
+
+/**
+ * Offer every node, children array and (with `defrag_value` not NULL)
+ * value to be moved, fixing the references to what moved. The tree itself
+ * stays, its owner offers it. Iterators must be re-seeked afterwards.
+ * */
+void rax_defrag(struct rax_t*, rax_defrag_alloc_t, rax_defrag_alloc_t);
+
+void rax_iter_start(struct rax_iter_t*, struct rax_t*);
+
+void rax_iter_release(struct rax_iter_t*);
+
+/**
+ * Position the iterator on the first key matching `op` against `key`:
+ * "^" first key, "$" last key, ">=", ">", "<=", "<", "=". Return 1 if such
+ * a key exists, 0 if not (or on allocation failure).
+ * */
+int32_t rax_seek(struct rax_iter_t*, const char*, const unsigned char*,
+        size_t);
+
+/** Move to the following / preceding key. Return 0 past the end. */
+int32_t rax_next(struct rax_iter_t*);
+
+int32_t rax_prev(struct rax_iter_t*);
+
+#endif // !RAX_H
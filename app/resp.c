@@ -0,0 +1,392 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESP_X86 1
+#endif
+
+#include "resp.h"
+
+#define SWAR_ONES  0x0101010101010101ULL
+#define SWAR_ZEROS (SWAR_ONES * '0')
+#define SWAR_HIGH  (SWAR_ONES * 0x80)
+
+
+static const char* find_crlf_scalar(const char* p, size_t len) {
+    for (; len >= 2; p++, len--) {
+        if (p[0] == '\r' && p[1] == '\n') return p;
+    }
+    return NULL;
+}
+
+/** Overflow checked digit loop, the reference for every fast path */
+static int32_t string2ll_scalar(const char* s, size_t len, int64_t* v) {
+    const char* p = s;
+    const char* end = s + len;
+    int32_t neg = 0;
+    uint64_t u = 0;
+
+    if (len == 0 || len > 20) return 0;
+    if (len == 1 && p[0] == '0') {
+        *v = 0;
+        return 1;
+    }
+    if (*p == '-') {
+        neg = 1;
+        if (++p == end) return 0;
+    }
+    if (*p < '1' || *p > '9') return 0;
+
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') return 0;
+        uint32_t d = *p - '0';
+        if (u > (UINT64_MAX - d) / 10) return 0;
+        u = u * 10 + d;
+    }
+
+    if (neg) {
+        if (u > (uint64_t) INT64_MAX + 1) return 0;
+        *v = (int64_t) (0 - u);
+    } else {
+        if (u > INT64_MAX) return 0;
+        *v = (int64_t) u;
+    }
+    return 1;
+}
+
+#ifdef RESP_X86
+
+__attribute__((target("sse2")))
+static const char* find_crlf_sse2(const char* p, size_t len) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    /** Compare p[i] with '\r' and p[i + 1] with '\n' for 16 i at once */
+    for (; len >= 17; p += 16, len -= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) p);
+        __m128i b = _mm_loadu_si128((const __m128i*) (p + 1));
+        uint32_t m = _mm_movemask_epi8(_mm_and_si128(
+                    _mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, lf)));
+        if (m != 0) return p + __builtin_ctz(m);
+    }
+
+    return find_crlf_scalar(p, len);
+}
+
+__attribute__((target("avx2")))
+static const char* find_crlf_avx2(const char* p, size_t len) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    for (; len >= 33; p += 32, len -= 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) p);
+        __m256i b = _mm256_loadu_si256((const __m256i*) (p + 1));
+        uint32_t m = _mm256_movemask_epi8(_mm256_and_si256(
+                    _mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, lf)));
+        if (m != 0) return p + __builtin_ctz(m);
+    }
+
+    return find_crlf_sse2(p, len);
+}
+
+#endif /* ifdef RESP_X86 */
+
+/**
+ * SWAR digit kernels. `x` holds 8 characters XOR '0' with the first one in
+ * the lowest byte (little endian load), so digits are the byte values 0-9.
+ * */
+
+/** Number of leading digit bytes in x (8 if all are digits) */
+static inline uint32_t swar_digit_count(uint64_t x) {
+    /** A byte above 9 sets its high bit, no carry crosses bytes */
+    uint64_t nondigit = (((x & ~SWAR_HIGH) + SWAR_ONES * 0x76) | x) &
+        SWAR_HIGH;
+    return nondigit == 0 ? 8 : __builtin_ctzll(nondigit) >> 3;
+}
+
+/** Value of the first n (1-8) digits of x */
+static inline uint64_t swar_digits_value(uint64_t x, uint32_t n) {
+    /** Drop the bytes after the digits, pad with leading zeros */
+    x <<= 8 * (8 - n);
+    x = (x * (10 * 256 + 1)) >> 8;
+    x = ((x & 0x00FF00FF00FF00FFULL) * (100 * 65536 + 1)) >> 16;
+    return ((x & 0x0000FFFF0000FFFFULL) *
+            (10000ULL * 4294967296ULL + 1)) >> 32;
+}
+
+static inline uint64_t swar_load(const char* p, size_t n) {
+    uint64_t w = 0;
+    memcpy(&w, p, n);
+    return w ^ SWAR_ZEROS;
+}
+
+/** Up to 16 digits convert 8 at a time, longer ones take the checked loop */
+static int32_t string2ll_swar(const char* s, size_t len, int64_t* v) {
+    const char* p = s;
+    size_t n = len;
+    int32_t neg = 0;
+
+    if (n > 0 && *p == '-') {
+        neg = 1;
+        p++;
+        n--;
+    }
+    if (n == 0 || n > 16 || (*p == '0' && (n > 1 || neg))) {
+        return string2ll_scalar(s, len, v);
+    }
+
+    size_t hi_len = n > 8 ? n - 8 : n;
+    uint64_t x = swar_load(p, hi_len);
+    if (swar_digit_count(x) < hi_len) return 0;
+    uint64_t u = swar_digits_value(x, hi_len);
+
+    if (n > 8) {
+        x = swar_load(p + hi_len, 8);
+        if (swar_digit_count(x) < 8) return 0;
+        u = u * 100000000ULL + swar_digits_value(x, 8);
+    }
+
+    *v = neg ? -(int64_t) u : (int64_t) u;
+    return 1;
+}
+
+typedef const char* (*find_crlf_fn_t)(const char*, size_t);
+typedef int32_t (*string2ll_fn_t)(const char*, size_t, int64_t*);
+
+static int32_t resp_kernel = RESP_KERNEL_SCALAR;
+static find_crlf_fn_t find_crlf_fn = find_crlf_scalar;
+static string2ll_fn_t string2ll_fn = string2ll_scalar;
+
+static const char* const resp_kernel_names[] = { "scalar", "sse2", "avx2" };
+
+
+int32_t resp_set_kernel(int32_t kernel) {
+    switch (kernel) {
+    case RESP_KERNEL_SCALAR:
+        find_crlf_fn = find_crlf_scalar;
+        string2ll_fn = string2ll_scalar;
+        break;
+#ifdef RESP_X86
+    case RESP_KERNEL_SSE2:
+        if (!__builtin_cpu_supports("sse2")) return -1;
+        find_crlf_fn = find_crlf_sse2;
+        string2ll_fn = string2ll_swar;
+        break;
+    case RESP_KERNEL_AVX2:
+        if (!__builtin_cpu_supports("avx2")) return -1;
+        find_crlf_fn = find_crlf_avx2;
+        string2ll_fn = string2ll_swar;
+        break;
+#endif /* ifdef RESP_X86 */
+    default:
+        return -1;
+    }
+
+    resp_kernel = kernel;
+    return 0;
+}
+
+void resp_init() {
+#ifdef RESP_X86
+    __builtin_cpu_init();
+#endif /* ifdef RESP_X86 */
+    if (resp_set_kernel(RESP_KERNEL_AVX2) == 0) return;
+    if (resp_set_kernel(RESP_KERNEL_SSE2) == 0) return;
+    resp_set_kernel(RESP_KERNEL_SCALAR);
+}
+
+const char* resp_kernel_name() {
+    return resp_kernel_names[resp_kernel];
+}
+
+const char* resp_find_crlf(const char* p, size_t len) {
+    return find_crlf_fn(p, len);
+}
+
+int32_t resp_string2ll(const char* s, size_t len, int64_t* v) {
+    return string2ll_fn(s, len, v);
+}
+
+/**
+ * Parse the `<n>\r\n` after a '*' or '$' prefix. The common case, a short
+ * unsigned number directly followed by CRLF, is decoded from one 8 byte
+ * load without searching for the CRLF first.
+ * */
+static int32_t parse_len(const char* p, size_t len, int64_t* v,
+        size_t* used) {
+    if (resp_kernel != RESP_KERNEL_SCALAR && len >= 8) {
+        uint64_t x = swar_load(p, 8);
+        uint32_t n = swar_digit_count(x);
+        if (n > 0 && n < 7 && p[n] == '\r' && p[n + 1] == '\n' &&
+                (p[0] != '0' || n == 1)) {
+            *v = swar_digits_value(x, n);
+            *used = n + 2;
+            return RESP_OK;
+        }
+    }
+
+    const char* crlf = find_crlf_fn(p, len);
+    if (crlf == NULL) {
+        return len > RESP_INLINE_MAX_SIZE ? RESP_ERR : RESP_INCOMPLETE;
+    }
+    if (!string2ll_fn(p, crlf - p, v)) {
+        return RESP_ERR;
+    }
+    *used = crlf - p + 2;
+    return RESP_OK;
+}
+
+static int32_t reserve_argv(struct resp_request_t* req, int64_t argc) {
+    if (argc <= req->argv_cap) return 0;
+
+    int64_t cap = req->argv_cap == 0 ? 8 : req->argv_cap * 2;
+    while (cap < argc) cap *= 2;
+
+    struct resp_arg_t* try = realloc(req->argv,
+            cap * sizeof(struct resp_arg_t));
+    if (try == NULL) return -1;
+
+    req->argv = try;
+    req->argv_cap = cap;
+    return 0;
+}
+
+static int64_t parse_inline(struct resp_request_t* req, const char* buf,
+        size_t len, const char** err) {
+    const char* nl = memchr(buf, '\n', len);
+    if (nl == NULL) {
+        if (len > RESP_INLINE_MAX_SIZE) {
+            *err = "Protocol error: too big inline request";
+            return RESP_ERR;
+        }
+        return RESP_INCOMPLETE;
+    }
+
+    const char* end = nl > buf && nl[-1] == '\r' ? nl - 1 : nl;
+    const char* p = buf;
+
+    req->argc = 0;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p == end) break;
+
+        const char* word = p;
+        while (p < end && *p != ' ' && *p != '\t') p++;
+
+        if (reserve_argv(req, req->argc + 1) == -1) {
+            *err = "out of memory";
+            return RESP_ERR;
+        }
+        req->argv[req->argc].ptr = word;
+        req->argv[req->argc].len = p - word;
+        req->argc++;
+    }
+
+    return nl - buf + 1;
+}
+
+/**
+ * Resumable: arguments already framed in an earlier call are kept (as
+ * offsets, the caller may have moved the buffer) and parsing continues
+ * after them, so a request arriving in many reads is scanned once.
+ * */
+static int64_t parse_multibulk(struct resp_request_t* req, const char* buf,
+        size_t len, const char** err) {
+    size_t pos = req->parsed;
+    size_t used = 0;
+    int64_t n = 0;
+    int32_t rval = RESP_OK;
+
+    if (req->multibulklen == 0) {
+        rval = parse_len(buf + 1, len - 1, &n, &used);
+        if (rval == RESP_INCOMPLETE) return RESP_INCOMPLETE;
+        if (rval == RESP_ERR) {
+            *err = len - 1 > RESP_INLINE_MAX_SIZE ?
+                "Protocol error: too big mbulk count string" :
+                "Protocol error: invalid multibulk length";
+            return RESP_ERR;
+        }
+        if (n > RESP_MAX_MULTIBULK) {
+            *err = "Protocol error: invalid multibulk length";
+            return RESP_ERR;
+        }
+
+        pos = 1 + used;
+        req->argc = 0;
+        if (n <= 0) {
+            return pos;
+        }
+        /** The count is untrusted, grow with the arguments past 1024 */
+        if (reserve_argv(req, n < 1024 ? n : 1024) == -1) {
+            *err = "out of memory";
+            return RESP_ERR;
+        }
+        req->multibulklen = n;
+        req->parsed = pos;
+    }
+
+    while (req->argc < req->multibulklen) {
+        if (pos == len) return RESP_INCOMPLETE;
+        if (buf[pos] != '$') {
+            *err = "Protocol error: expected '$'";
+            goto error;
+        }
+
+        rval = parse_len(buf + pos + 1, len - pos - 1, &n, &used);
+        if (rval == RESP_INCOMPLETE) return RESP_INCOMPLETE;
+        if (rval == RESP_ERR || n < 0 || n > RESP_MAX_BULK_LEN) {
+            *err = "Protocol error: invalid bulk length";
+            goto error;
+        }
+
+        size_t start = pos + 1 + used;
+        if (len - start < (uint64_t) n + 2) return RESP_INCOMPLETE;
+        if (buf[start + n] != '\r' || buf[start + n + 1] != '\n') {
+            *err = "Protocol error: bulk not terminated by CRLF";
+            goto error;
+        }
+
+        if (reserve_argv(req, req->argc + 1) == -1) {
+            *err = "out of memory";
+            goto error;
+        }
+        req->argv[req->argc].ptr = NULL;
+        req->argv[req->argc].len = n;
+        req->argv[req->argc].off = start;
+        req->argc++;
+
+        pos = start + n + 2;
+        req->parsed = pos;
+    }
+
+    for (int32_t i = 0; i < req->argc; i++) {
+        req->argv[i].ptr = buf + req->argv[i].off;
+    }
+    req->multibulklen = 0;
+    req->parsed = 0;
+    return pos;
+
+error:
+    req->multibulklen = 0;
+    req->parsed = 0;
+    return RESP_ERR;
+}
+
+int64_t resp_parse_request(struct resp_request_t* req, const char* buf,
+        size_t len, const char** err) {
+    assert(req != NULL && err != NULL);
+
+    if (len == 0) return RESP_INCOMPLETE;
+    if (buf[0] == '*' || req->multibulklen > 0) {
+        return parse_multibulk(req, buf, len, err);
+    }
+    return parse_inline(req, buf, len, err);
+}
+
+void resp_free_request(struct resp_request_t* req) {
+    free(req->argv);
+    memset(req, 0, sizeof(struct resp_request_t));
+}
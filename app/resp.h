@@ -0,0 +1,68 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define RESP_OK          1
+#define RESP_INCOMPLETE  0
+#define RESP_ERR        -1
+
+#define RESP_INLINE_MAX_SIZE (64 * 1024)         // inline request / header line
+#define RESP_MAX_MULTIBULK   (1024 * 1024)       // arguments per request
+#define RESP_MAX_BULK_LEN    (512LL * 1024 * 1024)
+
+/** CRLF search and length parsing kernels, see resp_set_kernel() */
+#define RESP_KERNEL_SCALAR 0
+#define RESP_KERNEL_SSE2   1
+#define RESP_KERNEL_AVX2   2
+
+
+/** One argument, pointing into the buffer handed to resp_parse_request() */
+struct resp_arg_t {
+    const char* ptr;
+    size_t      len;
+    size_t      off; // from the start of the request
+};
+
+/** Parsed arguments plus the state of a partially received multibulk */
+struct resp_request_t {
+    int32_t            argc;
+    int32_t            argv_cap;
+    struct resp_arg_t* argv;
+    int64_t            multibulklen; // 0 until the `*<n>` header is parsed
+    size_t             parsed;       // bytes of the request framed so far
+};
+
+
+/** Select the fastest kernel the CPU supports */
+void resp_init();
+
+/** Force a kernel. Return -1 if the CPU does not support it. */
+int32_t resp_set_kernel(int32_t);
+
+const char* resp_kernel_name();
+
+/** Return the first "\r\n" in the buffer (pointing at '\r'), or NULL */
+const char* resp_find_crlf(const char*, size_t);
+
+/**
+ * Strict decimal to int64_t: optional '-', no leading zeros, no spaces,
+ * no overflow. Return 1 on success, 0 otherwise.
+ * */
+int32_t resp_string2ll(const char*, size_t, int64_t*);
+
+/**
+ * Frame one request at the start of the buffer, multibulk (`*<n>\r\n$<len>
+ * \r\n...`) or inline (space separated words ending with '\n'). Arguments
+ * point into the buffer, which must not change while they are in use.
+ *
+ * Return the number of bytes consumed (argc 0 for an empty request),
+ * RESP_INCOMPLETE, or RESP_ERR with `err` set to a static message.
+ * */
+int64_t resp_parse_request(struct resp_request_t*, const char*, size_t,
+        const char**);
+
+void resp_free_request(struct resp_request_t*);
+
+#endif // !RESP_H
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -6,158 +8,708 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "bitops.h"
+#include "blocked.h"
+#include "cluster.h"
 #include "config.h"
+#include "db.h"
+#include "defrag.h"
+#include "dict.h"
 #include "event_loop.h"
+#include "hll.h"
+#include "hotkeys.h"
 #include "ip.h"
+#include "log.h"
+#include "migrate.h"
+#include "multi.h"
+#include "networking.h"
+#include "object.h"
+#include "pubsub.h"
+#include "resp.h"
+#include "server.h"
+#include "t_bitmap.h"
+#include "t_hll.h"
+#include "t_stream.h"
+#include "t_string.h"
 #include "thread_pool.h"
+#include "tracking.h"
+#include "util.h"
 
-#define RECV_BUF_SIZE 256
-
-#define DEBUG
+#define MAXCLIENTS_ERR "-ERR max number of clients reached\r\n"
 
-struct message_t {
-    char buffer[256];
-    char addrress[INET6_ADDRSTRLEN];
-};
+static inline int32_t arg_is(const struct resp_arg_t* arg, const char* s) {
+    size_t len = strlen(s);
+    return arg->len == len && strncasecmp(arg->ptr, s, len) == 0;
+}
 
 int32_t thread_pool_server(int32_t);
 
-void handle_client(int, int);
+void handle_client(int);
 
 int32_t event_loop_server(int32_t);
 
-void client_socket_handle(struct event_loop_t*, int, void *);
-
-void server_socket_handle(struct event_loop_t*, int, void *);
+void server_socket_handle(struct event_loop_t*, int32_t, int32_t, void *);
+
+static int32_t populate_command_table();
+
+static void ping_command(struct client_t*);
+
+static void echo_command(struct client_t*);
+
+static void command_command(struct client_t*);
+
+static void quit_command(struct client_t*);
+
+static void info_command(struct client_t*);
+
+struct server_t server = { .server_fd = -1, .unix_fd = -1 };
+
+/** Arity counts the command name, negative means "at least -arity" */
+struct command_t command_table[] = {
+    { "ping",           ping_command,         -1, CMD_PUBSUB_OK },
+    { "echo",           echo_command,         2, 0 },
+    { "command",        command_command,      -1, 0 },
+    { "quit",           quit_command,         1, CMD_PUBSUB_OK },
+    { "subscribe",      subscribe_command,    -2, CMD_PUBSUB_OK },
+    { "unsubscribe",    unsubscribe_command,  -1, CMD_PUBSUB_OK },
+    { "psubscribe",     psubscribe_command,   -2, CMD_PUBSUB_OK },
+    { "punsubscribe",   punsubscribe_command, -1, CMD_PUBSUB_OK },
+    { "publish",        publish_command,      3, 0 },
+    { "pubsub",         pubsub_command,       -2, 0 },
+    { "info",           info_command,         -1, 0 },
+    { "client",         client_command,       -2, 0 },
+    { "set",            set_command,          -3, CMD_WRITE, 1, 1, 1 },
+    { "get",            get_command,          2, CMD_READONLY, 1, 1, 1 },
+    { "strlen",         strlen_command,       2, CMD_READONLY, 1, 1, 1 },
+    { "append",         append_command,       3, CMD_WRITE, 1, 1, 1 },
+    { "incr",           incr_command,         2, CMD_WRITE, 1, 1, 1 },
+    { "decr",           decr_command,         2, CMD_WRITE, 1, 1, 1 },
+    { "incrby",         incrby_command,       3, CMD_WRITE, 1, 1, 1 },
+    { "decrby",         decrby_command,       3, CMD_WRITE, 1, 1, 1 },
+    { "setbit",         setbit_command,       4, CMD_WRITE, 1, 1, 1 },
+    { "getbit",         getbit_command,       3, CMD_READONLY, 1, 1, 1 },
+    { "bitcount",       bitcount_command,     -2, CMD_READONLY, 1, 1, 1 },
+    { "bitpos",         bitpos_command,       -3, CMD_READONLY, 1, 1, 1 },
+    { "bitop",          bitop_command,        -4, CMD_WRITE, 2, -1, 1 },
+    { "bitfield",       bitfield_command,     -2, CMD_WRITE, 1, 1, 1 },
+    { "pfadd",          pfadd_command,        -2, CMD_WRITE, 1, 1, 1 },
+    { "pfcount",        pfcount_command,      -2, CMD_READONLY, 1, -1, 1 },
+    { "pfmerge",        pfmerge_command,      -2, CMD_WRITE, 1, -1, 1 },
+    { "xadd",           xadd_command,         -5, CMD_WRITE, 1, 1, 1 },
+    { "xlen",           xlen_command,         2, CMD_READONLY, 1, 1, 1 },
+    { "xdel",           xdel_command,         -3, CMD_WRITE, 1, 1, 1 },
+    { "xtrim",          xtrim_command,        -4, CMD_WRITE, 1, 1, 1 },
+    { "xrange",         xrange_command,       -4, CMD_READONLY, 1, 1, 1 },
+    { "xrevrange",      xrevrange_command,    -4, CMD_READONLY, 1, 1, 1 },
+    { "xread",          xread_command,        -4, CMD_READONLY,
+        0, 0, 0, xread_getkeys },
+    { "xreadgroup",     xreadgroup_command,   -7, CMD_WRITE,
+        0, 0, 0, xread_getkeys },
+    { "xgroup",         xgroup_command,       -2, CMD_WRITE, 2, 2, 1 },
+    { "xack",           xack_command,         -4, CMD_WRITE, 1, 1, 1 },
+    { "xpending",       xpending_command,     -3, CMD_READONLY, 1, 1, 1 },
+    { "del",            del_command,          -2, CMD_WRITE, 1, -1, 1 },
+    { "exists",         exists_command,       -2, CMD_READONLY, 1, -1, 1 },
+    { "type",           type_command,         2, CMD_READONLY, 1, 1, 1 },
+    { "dbsize",         dbsize_command,       1, 0 },
+    { "flushall",       flushall_command,     1, CMD_WRITE },
+    { "object",         object_command,       -2, CMD_READONLY, 2, 2, 1 },
+    { "cluster",        cluster_command,      -2, 0 },
+    { "asking",         asking_command,       1, 0 },
+    { "dump",           dump_command,         2, CMD_READONLY, 1, 1, 1 },
+    { "restore",        restore_command,      -4, CMD_WRITE, 1, 1, 1 },
+    { "restore-asking", restore_command,      -4, CMD_WRITE | CMD_ASKING,
+        1, 1, 1 },
+    { "migrate",        migrate_command,      -6, CMD_WRITE,
+        0, 0, 0, migrate_getkeys },
+    { "hotkeys",        hotkeys_command,      -1, 0 },
+    { "multi",          multi_command,        1, 0 },
+    { "exec",           exec_command,         1, 0 },
+    { "discard",        discard_command,      1, 0 },
+    { "watch",          watch_command,        -2, 0, 1, -1, 1 },
+    { "unwatch",        unwatch_command,      1, 0 },
+    { "memory",         memory_command,       -2, CMD_READONLY,
+        0, 0, 0, memory_getkeys },
+};
 
-int main() {
+int main(int argc, char** argv) {
 	setbuf(stdout, NULL);
 	setbuf(stderr, NULL);
 	
+    if (log_init(LOG_FILE, LOG_LEVEL) == -1) {
+        return 1;
+    }
+
+    if (load_config(argc, argv) == -1 || adjust_open_files_limit() == -1) {
+        log_shutdown();
+        return 1;
+    }
+    log_set_level(config.loglevel);
+
+    resp_init();
+    log_verbose("[main] Using the %s RESP parsing kernel", resp_kernel_name());
+    bitops_init();
+    log_verbose("[main] Using the %s bitops kernel", bitops_kernel_name());
+    hll_init();
+    log_verbose("[main] Using the %s HyperLogLog kernel", hll_kernel_name());
+
+    dict_init();
+    object_init();
+    if (populate_command_table() == -1 || pubsub_init() == -1 ||
+            blocked_init() == -1 || tracking_init() == -1 ||
+            multi_init() == -1 ||
+            (server.clients_index = create_rax()) == NULL ||
+            (server.db = create_db()) == NULL) {
+        log_shutdown();
+        return 1;
+    }
+
     int server_fd = -1;
-    if ((server_fd = setup()) == -1) {
+    if ((server_fd = setup(config.port)) == -1) {
+        log_shutdown();
+        return 1;
+    }
+    if (config.unixsocket != NULL && (server.unix_fd =
+                setup_unix(config.unixsocket, config.unixsocketperm)) == -1) {
+        log_shutdown();
         return 1;
     }
 
-    return event_loop_server(server_fd);
-    // return thread_pool_server(server_fd);
+    int rval = event_loop_server(server_fd);
+    // int rval = thread_pool_server(server_fd);
+
+    if (server.unix_fd != -1) unlink(config.unixsocket);
+    log_shutdown();
+
+    return rval;
+}
+
+/**
+ * Resume the clients whose blocking operation completed, send the
+ * invalidations of tracked keys, drop the clients over maxmemory-clients or
+ * killed during this iteration, then flush the replies produced while
+ * handling its events.
+ * */
+static void before_sleep(struct event_loop_t* el) {
+    process_unblocked_clients();
+    tracking_limit_used_slots();
+    tracking_broadcast_invalidations();
+    evict_clients();
+    free_clients_in_async_free_queue(el);
+    handle_clients_with_pending_writes(el);
 }
 
 int event_loop_server(int32_t server_fd) {
-    struct event_loop_t* el = create_event_loop(DEFAULT_FDS_CAP);
+    struct event_loop_t* el = create_event_loop(config.maxclients + 
+            CONFIG_FDSET_INCR, config.io_backend);
     if (el == NULL) {
         return 1;
     }
-    if (register_event(el, server_fd, E_READABLE, server_socket_handle, NULL) 
-            == ERANGE) {
+    if (register_acceptor(el, server_fd, server_socket_handle, NULL) != OK) {
+        return 1;
+    }
+    /** Accepted clients are handled the same whichever listener it was */
+    if (server.unix_fd != -1) {
+        if (register_acceptor(el, server.unix_fd, server_socket_handle,
+                    NULL) != OK) {
+            return 1;
+        }
+        log_notice("[event_loop_server] Listening on Unix socket %s",
+                config.unixsocket);
+    }
+    log_notice("[event_loop_server] Using the %s event loop backend",
+            el->backend->name);
+
+    server.server_fd = server_fd;
+    server.el = el;
+
+    if (config.cluster_enabled && cluster_init(el) == -1) {
+        return 1;
+    }
+
+    if (active_defrag_init(el) == -1) {
+        return 1;
+    }
+
+    if (hotkeys_init(el) == -1) {
+        return 1;
+    }
+
+    if (create_time_event(el, 1, server_cron, NULL) == -1) {
         return 1;
     }
+    set_before_sleep_handle(el, before_sleep);
 
     int rval = POLL_ERR;
     while (!el->stop) {
-        if ((rval = process_events(el)) == POLL_ERR) {
+        if ((rval = process_events(el)) < 0) {
             return 1;
         }
-#ifdef DEBUG
-        // printf("[event_loop_server] Handle %d event\n", rval);
-#endif /* ifdef DEBUG */
     }
 
     return 0;
 }
 
-void client_socket_handle(struct event_loop_t* el, int client_fd, 
-        void *client_data) {
-    struct message_t* msg = (struct message_t*) client_data;
-    if (msg == NULL) {
-        printf("[client_socket_handle] no message allocated for client %d\n",
-                client_fd);
-        unregister_event(el, client_fd, E_READABLE | E_WRITEABLE);
-        close(client_fd);
+static int32_t populate_command_table() {
+    server.commands = create_dict(NULL);
+    if (server.commands == NULL) return -1;
+
+    size_t n = sizeof command_table / sizeof command_table[0];
+    for (size_t i = 0; i < n; i++) {
+        struct command_t* cmd = &command_table[i];
+        if (dict_add(server.commands, cmd->name, strlen(cmd->name), cmd) !=
+                DICT_OK) {
+            log_warning("[populate_command_table] cannot add %s", cmd->name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+#define COMMAND_NAME_MAX 32
+
+static struct command_t* lookup_command(const char* name, size_t len) {
+    char lower[COMMAND_NAME_MAX];
+    if (len > COMMAND_NAME_MAX) return NULL;
+
+    for (size_t i = 0; i < len; i++) {
+        lower[i] = name[i] >= 'A' && name[i] <= 'Z' ? name[i] + 32 : name[i];
+    }
+    struct dict_entry_t* e = dict_find(server.commands, lower, len);
+    return e != NULL ? e->val : NULL;
+}
+
+int32_t keys_result_add(struct keys_result_t* r, int32_t idx) {
+    if (r->n == r->cap) {
+        int32_t cap = r->cap * 2;
+        int32_t* keys = malloc(sizeof(int32_t) * cap);
+        if (keys == NULL) return -1;
+        memcpy(keys, r->keys, sizeof(int32_t) * r->n);
+        if (r->keys != r->buf) free(r->keys);
+        r->keys = keys;
+        r->cap = cap;
+    }
+    r->keys[r->n++] = idx;
+    return 0;
+}
+
+int32_t get_keys_from_command(const struct command_t* cmd,
+        const struct resp_arg_t* argv, int32_t argc,
+        struct keys_result_t* r) {
+    r->keys = r->buf;
+    r->n = 0;
+    r->cap = KEYS_RESULT_STATIC;
+
+    if (cmd->getkeys != NULL) {
+        return cmd->getkeys(argv, argc, r) == -1 ? -1 : r->n;
+    }
+    if (cmd->first_key == 0) return 0;
+
+    int32_t last = cmd->last_key < 0 ? argc + cmd->last_key : cmd->last_key;
+    for (int32_t i = cmd->first_key; i <= last && i < argc;
+            i += cmd->key_step) {
+        if (keys_result_add(r, i) == -1) return -1;
+    }
+    return r->n;
+}
+
+void free_keys_result(struct keys_result_t* r) {
+    if (r->keys != r->buf) free(r->keys);
+    r->keys = r->buf;
+}
+
+/**
+ * The keys of a read only command are remembered for the client's cache.
+ * Writes are signaled by the commands themselves, key by key, see
+ * signal_modified_key().
+ * */
+static void track_command_keys(struct client_t* c, struct command_t* cmd) {
+    struct keys_result_t r;
+
+    if (!(cmd->flags & CMD_READONLY) ||
+            (c->flags & (CLIENT_TRACKING | CLIENT_TRACKING_BCAST)) !=
+            CLIENT_TRACKING) {
         return;
     }
+    if (get_keys_from_command(cmd, c->req.argv, c->req.argc, &r) != -1) {
+        tracking_remember_keys(c, c->req.argv, r.keys, r.n);
+    }
+    free_keys_result(&r);
+}
 
-    int nread = read(client_fd, msg->buffer, RECV_BUF_SIZE * sizeof(char));
-    if (nread == -1) {
-#ifdef DEBUG
-        printf("[client_socket_handle] client %d read error: %s\n", client_fd,
-                strerror(errno));
-#endif /* ifdef DEBUG */
-        unregister_event(el, client_fd, E_READABLE | E_WRITEABLE);
-        free(client_data);
-        close(client_fd);
+/** Feed the keys of the sampled commands to the hot key sketch */
+static void sample_command_keys(struct client_t* c, struct command_t* cmd) {
+    struct keys_result_t r;
+
+    if (cmd->first_key == 0 && cmd->getkeys == NULL) return;
+    if (!hotkeys_sample()) return;
+    if (get_keys_from_command(cmd, c->req.argv, c->req.argc, &r) != -1) {
+        for (int32_t i = 0; i < r.n; i++) {
+            struct resp_arg_t* k = &c->req.argv[r.keys[i]];
+            hotkeys_record_key(k->ptr, k->len);
+        }
+    }
+    free_keys_result(&r);
+}
+
+void call_command(struct client_t* c, struct command_t* cmd) {
+    server.current_client = c;
+    cmd->proc(c);
+    track_command_keys(c, cmd);
+    sample_command_keys(c, cmd);
+    server.current_client = NULL;
+    server.stat_numcommands++;
+}
+
+void process_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+
+    struct command_t* cmd = lookup_command(argv[0].ptr, argv[0].len);
+    if (cmd == NULL) {
+        add_reply_error_format(c, "unknown command '%.*s'", 
+                (int) (argv[0].len > 128 ? 128 : argv[0].len), argv[0].ptr);
+        flag_transaction(c);
+        return;
+    }
+    if ((cmd->arity > 0 && argc != cmd->arity) || argc < -cmd->arity) {
+        add_reply_error_format(c, 
+                "wrong number of arguments for '%s' command", cmd->name);
+        flag_transaction(c);
+        return;
+    }
+    if ((c->flags & CLIENT_PUBSUB) && !(cmd->flags & CMD_PUBSUB_OK)) {
+        add_reply_error_format(c, "Can't execute '%s': only (P)SUBSCRIBE / "
+                "(P)UNSUBSCRIBE / PING / QUIT are allowed in this context",
+                cmd->name);
+        return;
+    }
+    if (server.cluster != NULL && cluster_redirect(c, cmd)) {
+        c->flags &= ~CLIENT_ASKING;
+        flag_transaction(c);
         return;
     }
 
-    if (nread == 0) {
-#ifdef DEBUG
-        printf("[client_socket_handle] (%s) client %d disconnect\n", msg->addrress,
-                client_fd);
-#endif /* ifdef DEBUG */
-        unregister_event(el, client_fd, E_READABLE | E_WRITEABLE);
-        free(client_data);
-        close(client_fd);
+    /** Queued commands are checked now, executed by EXEC */
+    if ((c->flags & CLIENT_MULTI) && cmd->proc != exec_command &&
+            cmd->proc != discard_command && cmd->proc != multi_command &&
+            cmd->proc != watch_command && cmd->proc != quit_command) {
+        queue_multi_command(c, cmd);
+    } else {
+        call_command(c, cmd);
+    }
+    /** ASKING and CLIENT CACHING only hold for the next command */
+    if (cmd->proc != asking_command) c->flags &= ~CLIENT_ASKING;
+    if (cmd->proc != client_command || !arg_is(&argv[1], "caching")) {
+        c->flags &= ~CLIENT_TRACKING_CACHING;
+    }
+}
+
+static void ping_command(struct client_t* c) {
+    if (c->req.argc > 2) {
+        add_reply_error(c, "wrong number of arguments for 'ping' command");
+        return;
+    }
+    /** Subscribed clients only read pushes, PONG is sent as one of them */
+    if (c->flags & CLIENT_PUBSUB) {
+        add_reply_array_len(c, 2);
+        add_reply_bulk(c, "pong", 4);
+        if (c->req.argc == 2) {
+            add_reply_bulk(c, c->req.argv[1].ptr, c->req.argv[1].len);
+        } else {
+            add_reply_bulk(c, "", 0);
+        }
+        return;
+    }
+    if (c->req.argc == 2) {
+        add_reply_bulk(c, c->req.argv[1].ptr, c->req.argv[1].len);
         return;
     }
+    add_reply(c, "+PONG\r\n", 7);
+}
 
-    printf("[client_socket_handle] (%s) client %d data: %s\n", msg->addrress,
-            client_fd, msg->buffer);
+static void echo_command(struct client_t* c) {
+    add_reply_bulk(c, c->req.argv[1].ptr, c->req.argv[1].len);
 }
 
-void server_socket_handle(struct event_loop_t* el, int server_fd, 
-        void *_) {
-    int client_fd = -1;
-    socklen_t addr_size = 0;
-    struct sockaddr_storage client_addr = { 0 };
+/** Enough for clients that ask for the command docs on connect */
+static void command_command(struct client_t* c) {
+    add_reply_array_len(c, 0);
+}
+
+static void quit_command(struct client_t* c) {
+    add_reply_status(c, "OK");
+    c->flags |= CLIENT_CLOSE_AFTER_REPLY;
+}
+
+static void info_clients(FILE* f) {
+    fprintf(f, "# Clients\r\n"
+            "connected_clients:%u\r\n"
+            "maxclients:%u\r\n"
+            "blocked_clients:%u\r\n"
+            "clients_memory:%lu\r\n"
+            "maxmemory_clients:%lu\r\n"
+            "pubsub_channels:%lu\r\n"
+            "pubsub_patterns:%lu\r\n"
+            "tracking_clients:%u\r\n",
+            server.connected_clients, config.maxclients,
+            server.blocked_clients,
+            (unsigned long) server.stat_clients_memory,
+            (unsigned long) config.maxmemory_clients,
+            (unsigned long) dict_size(server.pubsub_channels),
+            (unsigned long) dict_size(server.pubsub_patterns),
+            server.tracking_clients);
+}
+
+static void info_memory(FILE* f) {
+    size_t allocated = get_allocated_memory();
+    size_t rss = get_rss_memory();
+
+    fprintf(f, "# Memory\r\n"
+            "used_memory:%lu\r\n"
+            "used_memory_rss:%lu\r\n"
+            "mem_fragmentation_ratio:%.2f\r\n"
+            "mem_fragmentation_bytes:%ld\r\n"
+            "active_defrag_running:%u\r\n",
+            (unsigned long) allocated, (unsigned long) rss,
+            allocated > 0 ? (double) rss / allocated : 0.0,
+            (long) rss - (long) allocated, server.active_defrag_running);
+}
+
+static void info_keyspace(FILE* f) {
+    fprintf(f, "# Keyspace\r\n");
+    if (db_size(server.db) > 0) {
+        fprintf(f, "db0:keys=%lu\r\n", (unsigned long) db_size(server.db));
+    }
+}
+
+static void info_cluster(FILE* f) {
+    fprintf(f, "# Cluster\r\n"
+            "cluster_enabled:%u\r\n", config.cluster_enabled);
+}
 
-    addr_size = sizeof client_addr;
-    client_fd = accept(server_fd, (struct sockaddr *) &client_addr, 
-            &addr_size);
-    if (client_fd == -1) {
-        printf("[server_socket_handle] accept error: %s", strerror(errno));
+static void info_stats(FILE* f) {
+    fprintf(f, "# Stats\r\n"
+            "total_connections_received:%lu\r\n"
+            "total_accepts:%lu\r\n"
+            "instantaneous_accepts_per_sec:%lu\r\n"
+            "total_commands_processed:%lu\r\n"
+            "instantaneous_ops_per_sec:%lu\r\n"
+            "total_net_input_bytes:%lu\r\n"
+            "total_net_output_bytes:%lu\r\n"
+            "rejected_connections:%lu\r\n"
+            "evicted_clients:%lu\r\n"
+            "client_query_buffer_limit_disconnections:%lu\r\n"
+            "client_output_buffer_limit_disconnections:%lu\r\n"
+            "pubsub_messages:%lu\r\n"
+            "keyspace_hits:%lu\r\n"
+            "keyspace_misses:%lu\r\n"
+            "tracking_total_keys:%lu\r\n"
+            "tracking_total_prefixes:%lu\r\n"
+            "active_defrag_hits:%lu\r\n"
+            "active_defrag_misses:%lu\r\n"
+            "active_defrag_reclaimed_bytes:%lu\r\n"
+            "hotkeys_sampled_keys:%lu\r\n"
+            "bigkeys_scans:%lu\r\n",
+            (unsigned long) server.stat_numconnections,
+            (unsigned long) server.stat_accepted,
+            (unsigned long) get_instantaneous_metric(&server.inst_accepts),
+            (unsigned long) server.stat_numcommands,
+            (unsigned long) get_instantaneous_metric(&server.inst_commands),
+            (unsigned long) server.stat_net_input_bytes,
+            (unsigned long) server.stat_net_output_bytes,
+            (unsigned long) server.stat_rejected_conn,
+            (unsigned long) server.stat_evicted_clients,
+            (unsigned long) server.stat_client_qbuf_limit_disconnections,
+            (unsigned long) server.stat_client_outbuf_limit_disconnections,
+            (unsigned long) server.stat_pubsub_messages,
+            (unsigned long) server.db->stat_keyspace_hits,
+            (unsigned long) server.db->stat_keyspace_misses,
+            (unsigned long) tracking_get_total_keys(),
+            (unsigned long) tracking_get_total_prefixes(),
+            (unsigned long) server.stat_active_defrag_hits,
+            (unsigned long) server.stat_active_defrag_misses,
+            (unsigned long) server.stat_active_defrag_reclaimed,
+            (unsigned long) server.stat_hotkeys_sampled,
+            (unsigned long) server.stat_bigkeys_scans);
+}
+
+/** INFO [section], sections: clients, memory, stats, cluster, keyspace */
+static void info_command(struct client_t* c) {
+    struct info_section_t {
+        const char* name;
+        void (*gen)(FILE*);
+    } sections[] = {
+        { "clients", info_clients },
+        { "memory",  info_memory },
+        { "stats",   info_stats },
+        { "cluster", info_cluster },
+        { "keyspace", info_keyspace },
+    };
+    size_t n = sizeof sections / sizeof sections[0];
+
+    if (c->req.argc > 2) {
+        add_reply_error(c, "syntax error");
         return;
     }
 
-    struct message_t* msg = calloc(1, sizeof(struct message_t));
-    if (msg == NULL) {
-        printf("[server_socket_handle] message_t calloc error\n");
-        close(client_fd);
+    char* text = NULL;
+    size_t len = 0;
+    FILE* f = open_memstream(&text, &len);
+    if (f == NULL) {
+        add_reply_error(c, "out of memory");
         return;
     }
 
-    inet_ntop(
-            client_addr.ss_family,
-            get_in_addr((struct sockaddr *) &client_addr),
-            msg->addrress,
-            sizeof msg->addrress);
+    int32_t all = c->req.argc == 1 || (c->req.argv[1].len == 3 &&
+            strncasecmp(c->req.argv[1].ptr, "all", 3) == 0);
+    int32_t first = 1;
+    for (size_t i = 0; i < n; i++) {
+        if (!all && (c->req.argv[1].len != strlen(sections[i].name) ||
+                    strncasecmp(c->req.argv[1].ptr, sections[i].name,
+                        c->req.argv[1].len) != 0)) {
+            continue;
+        }
+        if (!first) fputs("\r\n", f);
+        sections[i].gen(f);
+        first = 0;
+    }
+    fclose(f);
+
+    add_reply_bulk(c, text, len);
+    free(text);
+}
 
-    if (register_event(el, client_fd, E_READABLE, client_socket_handle, msg) 
-            == ERANGE) {
-        printf("[server_socket_handle] Maximum request handle capacity reached\n");
+/**
+ * Admit one accepted connection: maxclients check, register, TCP options
+ * unless it came from the Unix socket
+ * */
+static void accept_client(struct event_loop_t* el, int32_t client_fd) {
+    /** Refuse before any per client allocation happens */
+    if (server.connected_clients >= config.maxclients) {
+        send(client_fd, MAXCLIENTS_ERR, strlen(MAXCLIENTS_ERR), MSG_NOSIGNAL);
         close(client_fd);
+        server.stat_rejected_conn++;
+        log_verbose("[server_socket_handle] maxclients (%u) reached, "
+                "connection refused", config.maxclients);
+        return;
+    }
+
+    struct client_t* c = create_client(el, client_fd);
+    if (c == NULL) {
+        log_warning("[server_socket_handle] client creation error");
+        close(client_fd);
+        return;
+    }
+
+    if (!(c->flags & CLIENT_UNIX_SOCKET)) {
+        if (config.tcp_nodelay && set_tcp_nodelay(client_fd) == -1) {
+            log_verbose("[server_socket_handle] TCP_NODELAY error: %s",
+                    strerror(errno));
+        }
+        if (config.tcp_keepalive > 0 && 
+                set_tcp_keepalive(client_fd, config.tcp_keepalive) == -1) {
+            log_verbose("[server_socket_handle] keepalive error: %s",
+                    strerror(errno));
+        }
+    }
+
+    server.connected_clients++;
+    server.stat_numconnections++;
+
+    log_verbose("[server_socket_handle] New %s connection from %s",
+            (c->flags & CLIENT_UNIX_SOCKET) ? "Unix socket" : "TCP", c->addr);
+}
+
+/** 
+ * One accepted connection, or -errno. The event loop drains the accept queue
+ * in batches of at most EL_MAX_ACCEPTS_PER_CALL connections so a reconnect
+ * storm cannot starve the clients that are already connected.
+ * */
+void server_socket_handle(struct event_loop_t* el, int32_t server_fd, 
+        int32_t client_fd, void *_) {
+    if (client_fd < 0) {
+        log_warning("[server_socket_handle] accept error: %s", 
+                strerror(-client_fd));
         return;
     }
 
-    printf("[server_socket_handle] New TCP connection from %s\n", msg->addrress);
+    server.stat_accepted++;
+    accept_client(el, client_fd);
+}
+
+static void track_instantaneous_metric(struct inst_metric_t* m, 
+        uint64_t count, int64_t now_ms) {
+    if (m->last_sample_ms > 0 && now_ms > m->last_sample_ms) {
+        m->samples[m->idx] = (count - m->last_sample_count) * 1000 / 
+            (now_ms - m->last_sample_ms);
+        m->idx = (m->idx + 1) % STATS_METRIC_SAMPLES;
+    }
+    m->last_sample_ms = now_ms;
+    m->last_sample_count = count;
+}
+
+uint64_t get_instantaneous_metric(struct inst_metric_t* m) {
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < STATS_METRIC_SAMPLES; i++) {
+        sum += m->samples[i];
+    }
+    return sum / STATS_METRIC_SAMPLES;
+}
+
+int64_t server_cron(struct event_loop_t* el, int64_t id, void* _) {
+    int64_t now = get_monotonic_ms();
+
+    update_lru_clock();
+    if (server.cluster != NULL) cluster_cron();
+    migrate_cron();
+    tracking_limit_used_slots();
+
+    track_instantaneous_metric(&server.inst_accepts, server.stat_accepted, 
+            now);
+    track_instantaneous_metric(&server.inst_commands, server.stat_numcommands,
+            now);
+
+    if (server.cronloops++ % (5 * SERVER_CRON_HZ) == 0) {
+        log_verbose("[server_cron] %u clients connected, %lu rejected, "
+                "%lu %s syscalls", server.connected_clients,
+                (unsigned long) server.stat_rejected_conn,
+                (unsigned long) el->stat_syscalls, el->backend->name);
+        log_verbose("[server_cron] %lu bytes of client memory, %lu clients "
+                "evicted, %lu / %lu closed by query / output buffer limits",
+                (unsigned long) server.stat_clients_memory,
+                (unsigned long) server.stat_evicted_clients,
+                (unsigned long) server.stat_client_qbuf_limit_disconnections,
+                (unsigned long) server.stat_client_outbuf_limit_disconnections);
+        log_verbose("[server_cron] %lu commands (%lu/sec), %lu bytes in, "
+                "%lu bytes out",
+                (unsigned long) server.stat_numcommands,
+                (unsigned long) get_instantaneous_metric(&server.inst_commands),
+                (unsigned long) server.stat_net_input_bytes,
+                (unsigned long) server.stat_net_output_bytes);
+    }
+
+    return 1000 / SERVER_CRON_HZ;
 }
 
 int thread_pool_server(int server_fd) {
     struct thread_pool_t* tp;
     struct thread_work_t* tw;
     if ((tp = create_thread_pool()) == NULL) {
-        printf("thread pool creation error\n");
+        log_warning("[thread_pool_server] thread pool creation error");
         return 1;
     }
 
 
     /** Client Information */
     int client_fd = -1;
-    char address[INET6_ADDRSTRLEN] = { 0 };
+    char address[NET_ADDR_STR_LEN] = { 0 };
     socklen_t addr_size = 0;
     struct sockaddr_storage client_addr = { 0 };
 
@@ -166,28 +718,33 @@ int thread_pool_server(int server_fd) {
         addr_size = sizeof client_addr;
         client_fd = accept(server_fd, (struct sockaddr *) &client_addr, 
                 &addr_size);
+        if (client_fd == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = { .fd = server_fd, .events = POLLIN };
+            poll(&pfd, 1, -1);
+            continue;
+        }
         if (client_fd == -1) {
-            printf("accept error: %s", strerror(errno));
+            log_warning("[thread_pool_server] accept error: %s",
+                    strerror(errno));
             continue;
         }
 
-        inet_ntop(
-                client_addr.ss_family,
-                get_in_addr((struct sockaddr *) &client_addr),
-                address,
+        format_addr((struct sockaddr *) &client_addr, address,
                 sizeof address);
 
-        printf("New TCP connection from %s\n", address);
+        log_verbose("[thread_pool_server] New TCP connection from %s",
+                address);
 
         if (!enqueue_thread_work(tp, handle_client, client_fd)) {
-            printf("Something went wrong when enqueuing thread work\n");
+            log_warning("[thread_pool_server] Something went wrong when "
+                    "enqueuing thread work");
         }
     }
 
     return 0;
 }
 
-void handle_client(int client_fd, int lfd) {
+void handle_client(int client_fd) {
     send(client_fd, "Hello World", strlen("Hello World"), 0);
     close(client_fd);
 }
@@ -0,0 +1,146 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+#include "cluster.h"
+#include "db.h"
+#include "dict.h"
+#include "event_loop.h"
+#include "networking.h"
+#include "rax.h"
+
+#define SERVER_CRON_HZ       10
+#define STATS_METRIC_SAMPLES 16
+
+
+/** Per second rate of a counter, averaged over the last samples */
+struct inst_metric_t {
+    int64_t  last_sample_ms;
+    uint64_t last_sample_count;
+    uint64_t samples[STATS_METRIC_SAMPLES];
+    uint32_t idx;
+};
+
+#define CMD_PUBSUB_OK (1 << 0) // allowed while the client is subscribed
+#define CMD_ASKING    (1 << 1) // served from an importing slot like ASKING
+#define CMD_WRITE     (1 << 2) // may modify its keys
+#define CMD_READONLY  (1 << 3) // only reads its keys, tracked for caching
+
+#define KEYS_RESULT_STATIC 16
+
+
+/** Argument indexes of the keys of a request */
+struct keys_result_t {
+    int32_t* keys; // `buf` unless there are more keys
+    int32_t  n;
+    int32_t  cap;
+    int32_t  buf[KEYS_RESULT_STATIC];
+};
+
+typedef void (*command_proc_t)(struct client_t*);
+
+/** Fill the key indexes of irregular syntax, return -1 out of memory */
+typedef int32_t (*command_getkeys_t)(const struct resp_arg_t*, int32_t,
+        struct keys_result_t*);
+
+/**
+ * The keys are the arguments `first_key`, `first_key + key_step`, ... up
+ * to `last_key`, which counts from the end when negative (-1 is the last
+ * argument). `first_key` 0 means no keys. `getkeys` replaces the three.
+ * */
+struct command_t {
+    const char*       name;
+    command_proc_t    proc;
+    int32_t           arity;
+    uint32_t          flags;
+    int32_t           first_key;
+    int32_t           last_key;
+    int32_t           key_step;
+    command_getkeys_t getkeys;
+};
+
+struct server_t {
+    int32_t              server_fd;
+    int32_t              unix_fd; // -1 unless --unixsocket
+    struct event_loop_t* el;
+    uint64_t             cronloops;
+    uint32_t             connected_clients;
+    uint64_t             stat_numconnections; // connections admitted
+    uint64_t             stat_rejected_conn;  // refused because of maxclients
+    uint64_t             stat_accepted;       // accept() successes
+    struct inst_metric_t inst_accepts;
+    uint64_t             next_client_id;
+    struct rax_t*        clients_index;  // big endian id -> client_t
+    struct client_t*     current_client; // executing a command, or NULL
+    struct client_t*     clients_pending_write; // replies waiting to be sent
+    uint64_t             stat_numcommands;
+    struct inst_metric_t inst_commands;
+    uint64_t             stat_net_input_bytes;
+    uint64_t             stat_net_output_bytes;
+    struct dict_t*       commands;        // lower case name -> command_t
+    struct dict_t*       pubsub_channels; // name -> pubsub_target_t
+    struct dict_t*       pubsub_patterns; // pattern -> pubsub_target_t
+    struct pattern_node_t* pubsub_trie;   // patterns by literal prefix
+    uint64_t             stat_pubsub_messages;
+    struct client_t*     clients_to_close; // freed from the before sleep handle
+    struct client_t*     client_mem_buckets[CLIENT_MEM_BUCKETS];
+    uint64_t             stat_clients_memory; // sum of client mem_usage
+    uint64_t             stat_evicted_clients; // by maxmemory-clients
+    uint64_t             stat_client_qbuf_limit_disconnections;
+    uint64_t             stat_client_outbuf_limit_disconnections;
+    struct db_t*         db;
+    uint64_t             dirty; // keyspace changes since startup
+    uint32_t             blocked_clients;
+    struct client_t*     unblocked_clients; // resumed from before sleep
+    struct dict_t*       blocking_keys; // key -> clients blocked on it
+    struct dict_t*       ready_keys;    // signaled, served before sleeping
+    struct rax_t*        clients_timeout_table; // deadline, id -> client
+    int64_t              blocked_timer_id;   // -1 when not armed
+    int64_t              blocked_timer_when; // monotonic ms
+    struct cluster_state_t* cluster; // NULL unless cluster-enabled
+    struct dict_t*       migrate_cached_sockets; // "host:port" -> socket
+    struct rax_t*        tracking_table; // key -> ids of clients caching it
+    struct rax_t*        tracking_prefix_table; // BCAST prefix -> clients
+    uint32_t             tracking_clients;
+    uint32_t             active_defrag_running; // CPU percent, 0 if idle
+    uint64_t             stat_active_defrag_hits;   // allocations moved
+    uint64_t             stat_active_defrag_misses; // offered, not moved
+    uint64_t             stat_active_defrag_reclaimed; // RSS bytes
+    uint64_t             stat_hotkeys_sampled;  // keys fed to the sketch
+    uint64_t             stat_bigkeys_scans;    // full keyspace scans done
+    struct dict_t*       watched_keys; // key -> clients that WATCH it
+};
+
+extern struct server_t server;
+
+
+uint64_t get_instantaneous_metric(struct inst_metric_t*);
+
+/** Append a key index, return -1 out of memory */
+int32_t keys_result_add(struct keys_result_t*, int32_t);
+
+/**
+ * Fill `r` with the key indexes of the request. Return their count, or -1
+ * out of memory. free_keys_result() must be called either way.
+ * */
+int32_t get_keys_from_command(const struct command_t*,
+        const struct resp_arg_t*, int32_t, struct keys_result_t*);
+
+void free_keys_result(struct keys_result_t*);
+
+/**
+ * Execute the request framed in `c->req`, or queue it while the client is
+ * in MULTI. Replies go to the client.
+ * */
+void process_command(struct client_t*);
+
+/**
+ * Run a command that passed the checks of process_command(), then signal
+ * the keys it touched and count it.
+ * */
+void call_command(struct client_t*, struct command_t*);
+
+int64_t server_cron(struct event_loop_t*, int64_t, void *);
+
+#endif // !SERVER_H
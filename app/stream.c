@@ -0,0 +1,802 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "rax.h"
+#include "resp.h"
+#include "stream.h"
+
+#define STREAM_BLOCK_HDR_SIZE sizeof(struct stream_block_t)
+
+
+/** ------------------------------ IDs ------------------------------------ */
+
+void stream_encode_id(unsigned char* buf, const struct stream_id_t* id) {
+    for (int32_t i = 0; i < 8; i++) {
+        buf[i] = id->ms >> (56 - 8 * i);
+        buf[8 + i] = id->seq >> (56 - 8 * i);
+    }
+}
+
+void stream_decode_id(const unsigned char* buf, struct stream_id_t* id) {
+    id->ms = id->seq = 0;
+    for (int32_t i = 0; i < 8; i++) {
+        id->ms = id->ms << 8 | buf[i];
+        id->seq = id->seq << 8 | buf[8 + i];
+    }
+}
+
+int32_t stream_incr_id(struct stream_id_t* id) {
+    if (id->seq == UINT64_MAX) {
+        if (id->ms == UINT64_MAX) return -1;
+        id->ms++;
+        id->seq = 0;
+        return 0;
+    }
+    id->seq++;
+    return 0;
+}
+
+int32_t stream_decr_id(struct stream_id_t* id) {
+    if (id->seq == 0) {
+        if (id->ms == 0) return -1;
+        id->ms--;
+        id->seq = UINT64_MAX;
+        return 0;
+    }
+    id->seq--;
+    return 0;
+}
+
+/** ------------------------------ Encoding ------------------------------- */
+
+static inline size_t varint_len(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static inline unsigned char* write_varint(unsigned char* p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static inline const unsigned char* read_varint(const unsigned char* p,
+        uint64_t* v) {
+    uint64_t r = 0;
+    uint32_t shift = 0;
+    while (*p & 0x80) {
+        r |= (uint64_t) (*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *v = r | (uint64_t) *p++ << shift;
+    return p;
+}
+
+/** Sequence deltas are negative when the ms part grew */
+static inline uint64_t zigzag(uint64_t delta) {
+    return (delta << 1) ^ (uint64_t) ((int64_t) delta >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t v) {
+    return (v >> 1) ^ -(v & 1);
+}
+
+static inline const unsigned char* skip_string(const unsigned char* p) {
+    uint64_t len;
+    p = read_varint(p, &len);
+    return p + len;
+}
+
+static inline unsigned char* write_string(unsigned char* p,
+        const struct resp_arg_t* a) {
+    p = write_varint(p, a->len);
+    memcpy(p, a->ptr, a->len);
+    return p + a->len;
+}
+
+/** Master field list of a block, return its first field */
+static const unsigned char* master_fields(const struct stream_block_t* b,
+        uint64_t* nfields) {
+    return read_varint(b->data, nfields);
+}
+
+static const unsigned char* skip_fields(const unsigned char* p, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) p = skip_string(p);
+    return p;
+}
+
+/**
+ * Decode the header of the entry at `p`: flags, ID and where its fields
+ * start. Return the end of the entry.
+ * */
+static const unsigned char* decode_entry(const unsigned char* p,
+        const struct stream_id_t* master, uint64_t master_nfields,
+        uint32_t* flags, struct stream_id_t* id, const unsigned char** fields,
+        uint64_t* nfields) {
+    uint64_t ms, seq;
+
+    *flags = *p++;
+    p = read_varint(p, &ms);
+    p = read_varint(p, &seq);
+    id->ms = master->ms + ms;
+    id->seq = master->seq + unzigzag(seq);
+
+    if (*flags & STREAM_ENTRY_SAMEFIELDS) {
+        *nfields = master_nfields;
+        *fields = p;
+        return skip_fields(p, master_nfields);
+    }
+    p = read_varint(p, nfields);
+    *fields = p;
+    return skip_fields(p, *nfields * 2);
+}
+
+/** 1 if the entry's field names are the master fields */
+static int32_t same_fields(const struct stream_block_t* b,
+        const struct resp_arg_t* argv, int64_t n) {
+    uint64_t nfields;
+    const unsigned char* p = master_fields(b, &nfields);
+    if (nfields != (uint64_t) n) return 0;
+
+    for (int64_t i = 0; i < n; i++) {
+        uint64_t len;
+        p = read_varint(p, &len);
+        if (len != argv[2 * i].len || memcmp(p, argv[2 * i].ptr, len) != 0) {
+            return 0;
+        }
+        p += len;
+    }
+    return 1;
+}
+
+/** ------------------------------ Stream --------------------------------- */
+
+struct stream_t* create_stream() {
+    struct stream_t* s = calloc(1, sizeof(struct stream_t));
+    if (s == NULL) return NULL;
+
+    s->rax = create_rax();
+    if (s->rax == NULL) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+static void free_consumer(void* c) {
+    struct stream_consumer_t* consumer = c;
+    free_rax(consumer->pel, NULL);
+    free(consumer);
+}
+
+static void free_cg(void* g) {
+    struct stream_cg_t* cg = g;
+    free_rax(cg->pel, free);
+    free_rax(cg->consumers, free_consumer);
+    free(cg);
+}
+
+void free_stream(struct stream_t* s) {
+    if (s == NULL) return;
+
+    free_rax(s->rax, free);
+    free_rax(s->cgroups, free_cg);
+    free(s);
+}
+
+/** Block the next entry goes to, NULL if the stream is empty */
+static struct stream_block_t* stream_tail(struct stream_t* s) {
+    if (s->tail != NULL || rax_size(s->rax) == 0) return s->tail;
+
+    struct rax_iter_t ri;
+    rax_iter_start(&ri, s->rax);
+    if (rax_seek(&ri, "$", NULL, 0)) {
+        s->tail = ri.value;
+        stream_decode_id(ri.key, &s->tail_id);
+    }
+    rax_iter_release(&ri);
+    return s->tail;
+}
+
+static size_t entry_size(const struct stream_id_t* id,
+        const struct stream_id_t* master, const struct resp_arg_t* argv,
+        int64_t n, int32_t same) {
+    size_t size = 1 + varint_len(id->ms - master->ms) +
+        varint_len(zigzag(id->seq - master->seq));
+
+    if (!same) size += varint_len(n);
+    for (int64_t i = 0; i < n; i++) {
+        if (!same) size += varint_len(argv[2 * i].len) + argv[2 * i].len;
+        size += varint_len(argv[2 * i + 1].len) + argv[2 * i + 1].len;
+    }
+    return size;
+}
+
+static unsigned char* write_entry(unsigned char* p,
+        const struct stream_id_t* id, const struct stream_id_t* master,
+        const struct resp_arg_t* argv, int64_t n, int32_t same) {
+    *p++ = same ? STREAM_ENTRY_SAMEFIELDS : 0;
+    p = write_varint(p, id->ms - master->ms);
+    p = write_varint(p, zigzag(id->seq - master->seq));
+
+    if (same) {
+        for (int64_t i = 0; i < n; i++) p = write_string(p, &argv[2 * i + 1]);
+        return p;
+    }
+    p = write_varint(p, n);
+    for (int64_t i = 0; i < 2 * n; i++) p = write_string(p, &argv[i]);
+    return p;
+}
+
+/** Append to the tail block, return 0 if it is full */
+static int32_t append_to_tail(struct stream_t* s, struct stream_block_t* b,
+        const struct stream_id_t* id, const struct resp_arg_t* argv,
+        int64_t n) {
+    if (config.stream_node_max_entries > 0 &&
+            b->count >= config.stream_node_max_entries) {
+        return 0;
+    }
+
+    int32_t same = same_fields(b, argv, n);
+    size_t size = entry_size(id, &s->tail_id, argv, n, same);
+    size_t need = b->len + size;
+    if (config.stream_node_max_bytes > 0 &&
+            need > config.stream_node_max_bytes) {
+        return 0;
+    }
+
+    if (need > b->alloc) {
+        /** Double up to the block size limit, blocks are rarely that full */
+        size_t alloc = b->alloc * 2;
+        if (config.stream_node_max_bytes > 0 &&
+                alloc > config.stream_node_max_bytes) {
+            alloc = config.stream_node_max_bytes;
+        }
+        if (alloc < need) alloc = need;
+
+        struct stream_block_t* nb = realloc(b, STREAM_BLOCK_HDR_SIZE + alloc);
+        if (nb == NULL) return -1;
+        nb->alloc = alloc;
+        if (nb != b) {
+            unsigned char key[STREAM_ID_SIZE];
+            stream_encode_id(key, &s->tail_id);
+            rax_insert(s->rax, key, STREAM_ID_SIZE, nb, NULL);
+            s->tail = b = nb;
+        }
+    }
+
+    write_entry(b->data + b->len, id, &s->tail_id, argv, n, same);
+    b->len += size;
+    b->count++;
+    return 1;
+}
+
+int32_t stream_append(struct stream_t* s, const struct stream_id_t* id,
+        const struct resp_arg_t* argv, int64_t n) {
+    struct stream_block_t* tail = stream_tail(s);
+
+    if (tail != NULL) {
+        int32_t ret = append_to_tail(s, tail, id, argv, n);
+        if (ret == -1) return -1;
+        if (ret == 1) goto added;
+    }
+
+    /** New block, the entry's fields become the master fields */
+    size_t size = varint_len(n);
+    for (int64_t i = 0; i < n; i++) {
+        size += varint_len(argv[2 * i].len) + argv[2 * i].len;
+    }
+    size_t hdr = size;
+    size += entry_size(id, id, argv, n, 1);
+
+    struct stream_block_t* b = malloc(STREAM_BLOCK_HDR_SIZE + size);
+    if (b == NULL) return -1;
+    b->count = 1;
+    b->deleted = 0;
+    b->len = b->alloc = size;
+
+    unsigned char* p = write_varint(b->data, n);
+    for (int64_t i = 0; i < n; i++) p = write_string(p, &argv[2 * i]);
+    write_entry(b->data + hdr, id, id, argv, n, 1);
+
+    unsigned char key[STREAM_ID_SIZE];
+    stream_encode_id(key, id);
+    if (rax_insert(s->rax, key, STREAM_ID_SIZE, b, NULL) == -1) {
+        free(b);
+        return -1;
+    }
+
+    /** The previous tail is complete, give back its spare room */
+    if (tail != NULL && tail->len < tail->alloc) {
+        struct stream_block_t* shrunk = realloc(tail,
+                STREAM_BLOCK_HDR_SIZE + tail->len);
+        if (shrunk != NULL) {
+            shrunk->alloc = shrunk->len;
+            if (shrunk != tail) {
+                stream_encode_id(key, &s->tail_id);
+                rax_insert(s->rax, key, STREAM_ID_SIZE, shrunk, NULL);
+            }
+        }
+    }
+    s->tail = b;
+    s->tail_id = *id;
+
+added:
+    s->length++;
+    s->entries_added++;
+    s->last_id = *id;
+    return 0;
+}
+
+static void remove_block(struct stream_t* s, const struct stream_id_t* master,
+        struct stream_block_t* b) {
+    unsigned char key[STREAM_ID_SIZE];
+    stream_encode_id(key, master);
+    rax_remove(s->rax, key, STREAM_ID_SIZE, NULL);
+    if (s->tail == b) s->tail = NULL;
+    free(b);
+}
+
+int32_t stream_delete(struct stream_t* s, const struct stream_id_t* id) {
+    struct stream_iter_t it;
+    struct stream_id_t found;
+    int64_t nfields;
+    int32_t deleted = 0;
+
+    stream_iter_start(&it, s, id, id, 0);
+    if (stream_iter_next(&it, &found, &nfields)) {
+        stream_iter_remove(&it);
+        deleted = 1;
+    }
+    stream_iter_stop(&it);
+    return deleted;
+}
+
+/** ID of the last entry of a block, deleted or not */
+static void block_last_id(const struct stream_block_t* b,
+        const struct stream_id_t* master, struct stream_id_t* id) {
+    uint64_t mnfields;
+    const unsigned char* p = master_fields(b, &mnfields);
+    p = skip_fields(p, mnfields);
+    const unsigned char* fields;
+    uint64_t nfields;
+    uint32_t flags;
+
+    for (uint32_t i = 0; i < b->count; i++) {
+        p = decode_entry(p, master, mnfields, &flags, id, &fields, &nfields);
+    }
+}
+
+int64_t stream_trim(struct stream_t* s, int32_t by_minid, uint64_t maxlen,
+        const struct stream_id_t* minid, int32_t approx, int64_t limit) {
+    int64_t removed = 0;
+    struct rax_iter_t ri;
+    rax_iter_start(&ri, s->rax);
+
+    while (rax_seek(&ri, "^", NULL, 0)) {
+        struct stream_block_t* b = ri.value;
+        struct stream_id_t master;
+        stream_decode_id(ri.key, &master);
+        uint64_t live = b->count - b->deleted;
+
+        if (!by_minid && s->length <= maxlen) break;
+        if (by_minid && stream_id_cmp(&master, minid) >= 0) break;
+
+        int32_t whole;
+        if (by_minid) {
+            struct stream_id_t last;
+            block_last_id(b, &master, &last);
+            whole = stream_id_cmp(&last, minid) < 0;
+        } else {
+            whole = s->length - live >= maxlen;
+        }
+
+        if (whole) {
+            if (limit > 0 && removed + (int64_t) live > limit) break;
+            s->length -= live;
+            removed += live;
+            remove_block(s, &master, b);
+            continue;
+        }
+        if (approx) break;
+
+        /** Exact: flag the head entries of the first remaining block */
+        uint64_t mnfields;
+        unsigned char* p = (unsigned char*) master_fields(b, &mnfields);
+        p = (unsigned char*) skip_fields(p, mnfields);
+        for (uint32_t i = 0; i < b->count; i++) {
+            const unsigned char* fields;
+            struct stream_id_t id;
+            uint64_t nfields;
+            uint32_t flags;
+            unsigned char* next = (unsigned char*) decode_entry(p, &master,
+                    mnfields, &flags, &id, &fields, &nfields);
+            if (!(flags & STREAM_ENTRY_DELETED)) {
+                if (by_minid ? stream_id_cmp(&id, minid) >= 0 :
+                        s->length <= maxlen) {
+                    break;
+                }
+                *p |= STREAM_ENTRY_DELETED;
+                b->deleted++;
+                s->length--;
+                removed++;
+            }
+            p = next;
+        }
+        break;
+    }
+
+    rax_iter_release(&ri);
+    return removed;
+}
+
+/**
+ * Values of a radix tree, which must be plain allocations, estimated from
+ * the first `samples` of them (0 counts all).
+ * */
+static size_t rax_values_usage(struct rax_t* rt, uint64_t samples) {
+    size_t bytes = 0;
+    uint64_t seen = 0;
+    struct rax_iter_t ri;
+
+    rax_iter_start(&ri, rt);
+    if (rax_seek(&ri, "^", NULL, 0)) {
+        do {
+            bytes += malloc_usable_size(ri.value);
+        } while (++seen != samples && rax_next(&ri));
+    }
+    rax_iter_release(&ri);
+    return seen < rt->numele ? bytes * rt->numele / seen : bytes;
+}
+
+static size_t cg_memory_usage(const struct stream_cg_t* cg,
+        uint64_t samples) {
+    size_t bytes = malloc_usable_size((void*) cg) +
+        rax_memory_usage_sampled(cg->pel, samples) +
+        rax_values_usage(cg->pel, samples) +
+        rax_memory_usage_sampled(cg->consumers, samples) +
+        rax_values_usage(cg->consumers, samples);
+
+    /** The consumer PELs point to the group's entries, only nodes count */
+    size_t pels = 0;
+    uint64_t seen = 0;
+    struct rax_iter_t ri;
+    rax_iter_start(&ri, cg->consumers);
+    if (rax_seek(&ri, "^", NULL, 0)) {
+        do {
+            pels += rax_memory_usage_sampled(
+                    ((struct stream_consumer_t*) ri.value)->pel, samples);
+        } while (++seen != samples && rax_next(&ri));
+    }
+    rax_iter_release(&ri);
+    if (seen < cg->consumers->numele) {
+        pels = pels * cg->consumers->numele / seen;
+    }
+    return bytes + pels;
+}
+
+size_t stream_memory_usage(const struct stream_t* s, uint64_t samples) {
+    size_t bytes = malloc_usable_size((void*) s) +
+        rax_memory_usage_sampled(s->rax, samples) +
+        rax_values_usage(s->rax, samples);
+    if (s->cgroups == NULL) return bytes;
+
+    bytes += rax_memory_usage(s->cgroups);
+    struct rax_iter_t ri;
+    rax_iter_start(&ri, s->cgroups);
+    if (rax_seek(&ri, "^", NULL, 0)) {
+        do {
+            bytes += cg_memory_usage(ri.value, samples);
+        } while (rax_next(&ri));
+    }
+    rax_iter_release(&ri);
+    return bytes;
+}
+
+/** ------------------------------ Iterator ------------------------------- */
+
+void stream_iter_start(struct stream_iter_t* it, struct stream_t* s,
+        const struct stream_id_t* start, const struct stream_id_t* end,
+        int32_t rev) {
+    memset(it, 0, sizeof(struct stream_iter_t));
+    it->s = s;
+    it->start = *start;
+    it->end = *end;
+    it->rev = rev;
+    rax_iter_start(&it->ri, s->rax);
+
+    /** The block holding the first ID, or the first block after it */
+    unsigned char key[STREAM_ID_SIZE];
+    stream_encode_id(key, rev ? end : start);
+    int32_t found = rax_seek(&it->ri, "<=", key, STREAM_ID_SIZE);
+    if (!found && !rev) found = rax_seek(&it->ri, "^", NULL, 0);
+    if (found) it->block = it->ri.value;
+}
+
+/** Set up the scan of `it->block`, return -1 on allocation failure */
+static int32_t enter_block(struct stream_iter_t* it) {
+    struct stream_block_t* b = it->block;
+
+    stream_decode_id(it->ri.key, &it->master);
+    it->master_fields = master_fields(b, &it->master_nfields);
+    it->p = skip_fields(it->master_fields, it->master_nfields);
+    if (!it->rev) return 0;
+
+    /** Entries only decode forwards, remember where each one starts */
+    uint32_t* offsets = realloc(it->offsets, sizeof(uint32_t) * b->count);
+    if (offsets == NULL) return -1;
+    it->offsets = offsets;
+    it->noffsets = 0;
+
+    const unsigned char* p = it->p;
+    for (uint32_t i = 0; i < b->count; i++) {
+        const unsigned char* fields;
+        struct stream_id_t id;
+        uint64_t nfields;
+        uint32_t flags;
+        offsets[it->noffsets++] = p - b->data;
+        p = decode_entry(p, &it->master, it->master_nfields, &flags, &id,
+                &fields, &nfields);
+    }
+    return 0;
+}
+
+int32_t stream_iter_next(struct stream_iter_t* it, struct stream_id_t* id,
+        int64_t* nfields) {
+    while (it->block != NULL) {
+        if (it->entry == NULL && enter_block(it) == -1) break;
+
+        struct stream_block_t* b = it->block;
+        while (it->rev ? it->noffsets > 0 :
+                it->p < b->data + b->len) {
+            const unsigned char* p = it->rev ?
+                b->data + it->offsets[--it->noffsets] : it->p;
+            const unsigned char* fields;
+            uint64_t n;
+            uint32_t flags;
+            const unsigned char* next = decode_entry(p, &it->master,
+                    it->master_nfields, &flags, id, &fields, &n);
+            it->entry = (unsigned char*) p;
+            if (!it->rev) it->p = next;
+
+            if (flags & STREAM_ENTRY_DELETED) continue;
+            if (!it->rev) {
+                if (stream_id_cmp(id, &it->start) < 0) continue;
+                if (stream_id_cmp(id, &it->end) > 0) goto done;
+            } else {
+                if (stream_id_cmp(id, &it->end) > 0) continue;
+                if (stream_id_cmp(id, &it->start) < 0) goto done;
+            }
+
+            it->same_fields = flags & STREAM_ENTRY_SAMEFIELDS;
+            it->fp = it->master_fields;
+            it->vp = fields;
+            it->fields_left = n;
+            *nfields = n;
+            return 1;
+        }
+
+        /**
+         * Blocks emptied by stream_iter_remove() go away, seeking by key
+         * to the next block still works after the removal.
+         * */
+        if (b->deleted == b->count) remove_block(it->s, &it->master, b);
+
+        /** Next block, entered on the following round */
+        it->entry = NULL;
+        int32_t more = it->rev ? rax_prev(&it->ri) : rax_next(&it->ri);
+        it->block = more ? it->ri.value : NULL;
+        if (it->block == NULL) break;
+
+        /** Blocks past the range end the scan without being decoded */
+        struct stream_id_t master;
+        stream_decode_id(it->ri.key, &master);
+        if (!it->rev && stream_id_cmp(&master, &it->end) > 0) goto done;
+    }
+done:
+    it->block = NULL;
+    return 0;
+}
+
+void stream_iter_field(struct stream_iter_t* it, const char** field,
+        size_t* flen, const char** value, size_t* vlen) {
+    uint64_t len;
+
+    if (it->same_fields) {
+        it->fp = read_varint(it->fp, &len);
+        *field = (const char*) it->fp;
+        *flen = len;
+        it->fp += len;
+    } else {
+        it->vp = read_varint(it->vp, &len);
+        *field = (const char*) it->vp;
+        *flen = len;
+        it->vp += len;
+    }
+    it->vp = read_varint(it->vp, &len);
+    *value = (const char*) it->vp;
+    *vlen = len;
+    it->vp += len;
+    it->fields_left--;
+}
+
+void stream_iter_remove(struct stream_iter_t* it) {
+    it->entry[0] |= STREAM_ENTRY_DELETED;
+    it->block->deleted++;
+    it->s->length--;
+}
+
+void stream_iter_stop(struct stream_iter_t* it) {
+    /** Blocks emptied through stream_iter_remove() go now */
+    if (it->ri.key_len == STREAM_ID_SIZE) {
+        struct stream_block_t* b;
+        if (rax_find(it->s->rax, it->ri.key, STREAM_ID_SIZE, (void**) &b) &&
+                b->deleted == b->count) {
+            struct stream_id_t master;
+            stream_decode_id(it->ri.key, &master);
+            remove_block(it->s, &master, b);
+        }
+    }
+    rax_iter_release(&it->ri);
+    free(it->offsets);
+}
+
+/** ------------------------------ Groups --------------------------------- */
+
+struct stream_cg_t* stream_create_cg(struct stream_t* s, const char* name,
+        size_t len, const struct stream_id_t* id) {
+    if (s->cgroups == NULL && (s->cgroups = create_rax()) == NULL) {
+        return NULL;
+    }
+    if (rax_find(s->cgroups, (const unsigned char*) name, len, NULL)) {
+        return NULL;
+    }
+
+    struct stream_cg_t* cg = malloc(sizeof(struct stream_cg_t));
+    if (cg == NULL) return NULL;
+    cg->last_id = *id;
+    cg->pel = create_rax();
+    cg->consumers = create_rax();
+    if (cg->pel == NULL || cg->consumers == NULL ||
+            rax_insert(s->cgroups, (const unsigned char*) name, len, cg,
+                NULL) == -1) {
+        free_rax(cg->pel, NULL);
+        free_rax(cg->consumers, NULL);
+        free(cg);
+        return NULL;
+    }
+    return cg;
+}
+
+struct stream_cg_t* stream_lookup_cg(struct stream_t* s, const char* name,
+        size_t len) {
+    void* cg;
+    if (s->cgroups == NULL ||
+            !rax_find(s->cgroups, (const unsigned char*) name, len, &cg)) {
+        return NULL;
+    }
+    return cg;
+}
+
+int32_t stream_destroy_cg(struct stream_t* s, const char* name, size_t len) {
+    void* cg;
+    if (s->cgroups == NULL ||
+            !rax_remove(s->cgroups, (const unsigned char*) name, len, &cg)) {
+        return 0;
+    }
+    free_cg(cg);
+    return 1;
+}
+
+struct stream_consumer_t* stream_lookup_consumer(struct stream_cg_t* cg,
+        const char* name, size_t len) {
+    void* consumer;
+    if (!rax_find(cg->consumers, (const unsigned char*) name, len,
+                &consumer)) {
+        return NULL;
+    }
+    return consumer;
+}
+
+struct stream_consumer_t* stream_create_consumer(struct stream_cg_t* cg,
+        const char* name, size_t len, int64_t now, int32_t* created) {
+    struct stream_consumer_t* consumer = stream_lookup_consumer(cg, name,
+            len);
+    *created = 0;
+    if (consumer != NULL) return consumer;
+
+    consumer = malloc(sizeof(struct stream_consumer_t) + len);
+    if (consumer == NULL) return NULL;
+    consumer->seen_time = now;
+    consumer->name_len = len;
+    memcpy(consumer->name, name, len);
+    consumer->pel = create_rax();
+    if (consumer->pel == NULL ||
+            rax_insert(cg->consumers, (const unsigned char*) name, len,
+                consumer, NULL) == -1) {
+        free_rax(consumer->pel, NULL);
+        free(consumer);
+        return NULL;
+    }
+    *created = 1;
+    return consumer;
+}
+
+int64_t stream_delete_consumer(struct stream_cg_t* cg,
+        struct stream_consumer_t* consumer) {
+    int64_t pending = rax_size(consumer->pel);
+    struct rax_iter_t ri;
+
+    rax_iter_start(&ri, consumer->pel);
+    if (rax_seek(&ri, "^", NULL, 0)) {
+        do {
+            rax_remove(cg->pel, ri.key, ri.key_len, NULL);
+            free(ri.value);
+        } while (rax_next(&ri));
+    }
+    rax_iter_release(&ri);
+
+    rax_remove(cg->consumers, (const unsigned char*) consumer->name,
+            consumer->name_len, NULL);
+    free_consumer(consumer);
+    return pending;
+}
+
+int32_t stream_pel_deliver(struct stream_cg_t* cg,
+        struct stream_consumer_t* consumer, const struct stream_id_t* id,
+        int64_t now) {
+    unsigned char key[STREAM_ID_SIZE];
+    struct stream_nack_t* nack;
+    stream_encode_id(key, id);
+
+    if (rax_find(cg->pel, key, STREAM_ID_SIZE, (void**) &nack)) {
+        if (nack->consumer != consumer) {
+            if (rax_insert(consumer->pel, key, STREAM_ID_SIZE, nack,
+                        NULL) == -1) {
+                return -1;
+            }
+            rax_remove(nack->consumer->pel, key, STREAM_ID_SIZE, NULL);
+            nack->consumer = consumer;
+        }
+        nack->delivery_time = now;
+        nack->delivery_count++;
+        return 0;
+    }
+
+    nack = malloc(sizeof(struct stream_nack_t));
+    if (nack == NULL) return -1;
+    nack->delivery_time = now;
+    nack->delivery_count = 1;
+    nack->consumer = consumer;
+    if (rax_insert(cg->pel, key, STREAM_ID_SIZE, nack, NULL) == -1) {
+        free(nack);
+        return -1;
+    }
+    if (rax_insert(consumer->pel, key, STREAM_ID_SIZE, nack, NULL) == -1) {
+        rax_remove(cg->pel, key, STREAM_ID_SIZE, NULL);
+        free(nack);
+        return -1;
+    }
+    return 0;
+}
+
+int32_t stream_pel_ack(struct stream_cg_t* cg, const struct stream_id_t* id) {
+    unsigned char key[STREAM_ID_SIZE];
+    struct stream_nack_t* nack;
+    stream_encode_id(key, id);
+
+    if (!rax_remove(cg->pel, key, STREAM_ID_SIZE, (void**) &nack)) return 0;
+    rax_remove(nack->consumer->pel, key, STREAM_ID_SIZE, NULL);
+    free(nack);
+    return 1;
+}
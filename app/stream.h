@@ -0,0 +1,200 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "rax.h"
+#include "resp.h"
+
+/**
+ * Append only log of entries, each a list of field value pairs under a
+ * 128 bit ID <ms>-<seq> that only grows.
+ *
+ * Entries are packed into blocks of at most stream-node-max-entries entries
+ * and stream-node-max-bytes bytes, indexed by a radix tree on the ID of
+ * their first entry (the block's master ID) stored big endian, so the tree
+ * iterates in ID order and a range read is a seek plus sequential scans.
+ *
+ * Block data, integers are LEB128 varints:
+ *
+ * +-----------------+----------------+-------+-------
+ * | master nfields  | master fields  | entry | entry ...
+ * +-----------------+----------------+-------+-------
+ *
+ * entry: flags | ms - master ms | zigzag(seq - master seq) | fields | values
+ *
+ * Entries with the master fields (STREAM_ENTRY_SAMEFIELDS) store only their
+ * values, the others store nfields then interleaved field value pairs.
+ * Deleted entries are flagged, and a block goes away with its last entry.
+ * */
+
+#define STREAM_ID_SIZE 16 // radix tree key
+
+#define STREAM_ENTRY_DELETED    (1 << 0)
+#define STREAM_ENTRY_SAMEFIELDS (1 << 1)
+
+
+struct stream_id_t {
+    uint64_t ms;
+    uint64_t seq;
+};
+
+struct stream_block_t {
+    uint32_t      count;   // entries, deleted ones included
+    uint32_t      deleted;
+    uint32_t      len;     // bytes of data used
+    uint32_t      alloc;
+    unsigned char data[];
+};
+
+/** A delivered and not yet acknowledged entry */
+struct stream_nack_t {
+    int64_t                   delivery_time; // unix ms
+    uint64_t                  delivery_count;
+    struct stream_consumer_t* consumer;
+};
+
+struct stream_consumer_t {
+    int64_t       seen_time; // unix ms
+    struct rax_t* pel;       // ID -> stream_nack_t, owned by the group
+    size_t        name_len;
+    char          name[];
+};
+
+struct stream_cg_t {
+    struct stream_id_t last_id;   // last entry delivered to the group
+    struct rax_t*      pel;       // ID -> stream_nack_t
+    struct rax_t*      consumers; // name -> stream_consumer_t
+};
+
+struct stream_t {
+    struct rax_t*          rax;      // master ID -> stream_block_t
+    uint64_t               length;   // entries not deleted
+    struct stream_id_t     last_id;  // stays when the entry is deleted
+    uint64_t               entries_added;
+    struct rax_t*          cgroups;  // name -> stream_cg_t, NULL if none
+    struct stream_block_t* tail;     // block appended to, NULL to look up
+    struct stream_id_t     tail_id;
+};
+
+/**
+ * Entries between `start` and `end` (inclusive), in ID order or reversed.
+ * The stream must not be modified while iterating, except through
+ * stream_iter_remove().
+ * */
+struct stream_iter_t {
+    struct stream_t*       s;
+    struct stream_id_t     start;
+    struct stream_id_t     end;
+    int32_t                rev;
+    struct rax_iter_t      ri;
+    struct stream_block_t* block;    // NULL once exhausted
+    struct stream_id_t     master;
+    const unsigned char*   master_fields;
+    uint64_t               master_nfields;
+    const unsigned char*   p;        // next entry (forward)
+    uint32_t*              offsets;  // entries of the block (reverse)
+    uint32_t               noffsets;
+    unsigned char*         entry;    // current entry
+    int32_t                same_fields;
+    const unsigned char*   fp;       // next master field
+    const unsigned char*   vp;       // next value, or field value pair
+    uint64_t               fields_left;
+};
+
+
+static inline int32_t stream_id_cmp(const struct stream_id_t* a,
+        const struct stream_id_t* b) {
+    if (a->ms != b->ms) return a->ms < b->ms ? -1 : 1;
+    if (a->seq != b->seq) return a->seq < b->seq ? -1 : 1;
+    return 0;
+}
+
+/** Big endian, so that memcmp() order is ID order */
+void stream_encode_id(unsigned char*, const struct stream_id_t*);
+
+void stream_decode_id(const unsigned char*, struct stream_id_t*);
+
+/** Return -1 when the ID is already the smallest / greatest */
+int32_t stream_incr_id(struct stream_id_t*);
+
+int32_t stream_decr_id(struct stream_id_t*);
+
+struct stream_t* create_stream();
+
+void free_stream(struct stream_t*);
+
+/**
+ * Append an entry with `n` field value pairs at `argv`. The ID must be
+ * greater than `last_id`. Return -1 on allocation failure.
+ * */
+int32_t stream_append(struct stream_t*, const struct stream_id_t*,
+        const struct resp_arg_t*, int64_t);
+
+/** Return 1 if the entry existed and was deleted */
+int32_t stream_delete(struct stream_t*, const struct stream_id_t*);
+
+/**
+ * Trim to at most `maxlen` entries, or (`by_minid`) drop the entries below
+ * `minid`. `approx` only drops whole blocks, at most `limit` entries (0 is
+ * unlimited). Return the number of entries removed.
+ * */
+int64_t stream_trim(struct stream_t*, int32_t, uint64_t,
+        const struct stream_id_t*, int32_t, int64_t);
+
+/**
+ * Heap bytes of blocks, index and consumer groups. With `samples` not 0,
+ * each tree is estimated from its first `samples` nodes and values.
+ * */
+size_t stream_memory_usage(const struct stream_t*, uint64_t);
+
+void stream_iter_start(struct stream_iter_t*, struct stream_t*,
+        const struct stream_id_t*, const struct stream_id_t*, int32_t);
+
+/** Move to the next entry, return 0 past the end */
+int32_t stream_iter_next(struct stream_iter_t*, struct stream_id_t*,
+        int64_t*);
+
+/** Next field value pair of the current entry */
+void stream_iter_field(struct stream_iter_t*, const char**, size_t*,
+        const char**, size_t*);
+
+/** Delete the current entry, the block stays until the iterator stops */
+void stream_iter_remove(struct stream_iter_t*);
+
+void stream_iter_stop(struct stream_iter_t*);
+
+/** ------------------------------ Groups --------------------------------- */
+
+/** Return the group, NULL if it exists already or memory ran out */
+struct stream_cg_t* stream_create_cg(struct stream_t*, const char*, size_t,
+        const struct stream_id_t*);
+
+struct stream_cg_t* stream_lookup_cg(struct stream_t*, const char*, size_t);
+
+/** Return 1 if the group existed */
+int32_t stream_destroy_cg(struct stream_t*, const char*, size_t);
+
+struct stream_consumer_t* stream_lookup_consumer(struct stream_cg_t*,
+        const char*, size_t);
+
+/** Look the consumer up, creating it if needed. NULL when out of memory. */
+struct stream_consumer_t* stream_create_consumer(struct stream_cg_t*,
+        const char*, size_t, int64_t, int32_t*);
+
+/** Delete the consumer and its pending entries, return how many there were */
+int64_t stream_delete_consumer(struct stream_cg_t*,
+        struct stream_consumer_t*);
+
+/**
+ * Record the delivery of an entry to a consumer, moving it from its
+ * previous owner if pending already. Return -1 on allocation failure.
+ * */
+int32_t stream_pel_deliver(struct stream_cg_t*, struct stream_consumer_t*,
+        const struct stream_id_t*, int64_t);
+
+/** Return 1 if the entry was pending */
+int32_t stream_pel_ack(struct stream_cg_t*, const struct stream_id_t*);
+
+#endif // !STREAM_H
@@ -0,0 +1,755 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "bitops.h"
+#include "blocked.h"
+#include "db.h"
+#include "event_loop.h"
+#include "log.h"
+#include "networking.h"
+#include "object.h"
+#include "resp.h"
+#include "server.h"
+#include "t_bitmap.h"
+
+#define BITFIELD_GET    0
+#define BITFIELD_SET    1
+#define BITFIELD_INCRBY 2
+
+#define BITFIELD_OVERFLOW_WRAP 0
+#define BITFIELD_OVERFLOW_SAT  1
+#define BITFIELD_OVERFLOW_FAIL 2
+
+#define BIT_OFFSET_ERR "bit offset is not an integer or out of range"
+#define BIT_VALUE_ERR  "bit is not an integer or out of range"
+#define INTEGER_ERR    "value is not an integer or out of range"
+#define BITFIELD_TYPE_ERR "Invalid bitfield type. Use something like i16 " \
+    "u8. Note that u64 is not supported but i64 is."
+
+
+/** A BITOP source, bytes stay valid while `o` is referenced */
+struct bitop_src_t {
+    struct robj_t*       o; // NULL for a missing key
+    const unsigned char* ptr;
+    size_t               len;
+    char                 tmp[OBJ_LONG_STR_SIZE]; // INT encoded sources
+};
+
+/**
+ * A BITOP in progress. The sources are referenced, so writes to them in the
+ * meantime copy the value first (see db_unshare_string_value()) and the
+ * result is computed from the keys as they were when the command ran.
+ * */
+struct bitop_job_t {
+    struct client_t*   c; // NULL once the client is freed
+    int32_t            op;
+    char*              dest;
+    size_t             dest_len;
+    struct robj_t*     result; // NULL when every source is empty
+    size_t             len;
+    size_t             pos;    // result bytes computed
+    int32_t            nsrc;
+    struct bitop_src_t srcs[];
+};
+
+struct bitfield_op_t {
+    int32_t  opcode;
+    int32_t  sign;
+    int32_t  bits;
+    int32_t  overflow;
+    uint64_t offset;
+    int64_t  arg; // SET value / INCRBY increment
+};
+
+
+static inline int32_t arg_is(const struct resp_arg_t* arg, const char* s) {
+    size_t len = strlen(s);
+    return arg->len == len && strncasecmp(arg->ptr, s, len) == 0;
+}
+
+/**
+ * Parse a bit offset of a `bits` wide field. BITFIELD also takes "#N", the
+ * N-th field of that width. Return -1 after replying an error.
+ * */
+static int32_t get_bit_offset(struct client_t* c, const struct resp_arg_t* arg,
+        int32_t hash, int32_t bits, uint64_t* offset) {
+    const char* p = arg->ptr;
+    size_t len = arg->len;
+    int32_t usehash = hash && len > 1 && p[0] == '#';
+    int64_t v;
+
+    if (usehash) {
+        p++;
+        len--;
+    }
+    if (!resp_string2ll(p, len, &v) || v < 0 ||
+            (usehash && v > INT64_MAX / bits)) {
+        add_reply_error(c, BIT_OFFSET_ERR);
+        return -1;
+    }
+    if (usehash) v *= bits;
+
+    if (((uint64_t) v + bits - 1) >> 3 >= RESP_MAX_BULK_LEN) {
+        add_reply_error(c, BIT_OFFSET_ERR);
+        return -1;
+    }
+    *offset = v;
+    return 0;
+}
+
+/**
+ * The key's value, unshared and zero extended so that `maxbit` is in
+ * range. Create it when missing. Return NULL after replying an error.
+ * */
+static struct robj_t* lookup_string_for_bit_write(struct client_t* c,
+        const struct resp_arg_t* key, uint64_t maxbit) {
+    size_t len = (maxbit >> 3) + 1;
+    struct robj_t* o = lookup_key_write(server.db, key->ptr, key->len);
+    if (check_type(c, o, OBJ_STRING)) return NULL;
+
+    if (o == NULL) {
+        o = create_raw_string_object(NULL, len);
+        if (o == NULL ||
+                set_key(server.db, key->ptr, key->len, o) != DICT_OK) {
+            add_reply_error(c, "out of memory");
+            return NULL;
+        }
+        return o;
+    }
+
+    o = db_unshare_string_value(server.db, key->ptr, key->len, o);
+    if (o == NULL || raw_string_grow_zero(o, len) == -1) {
+        add_reply_error(c, "out of memory");
+        return NULL;
+    }
+    return o;
+}
+
+static inline unsigned char* raw_string_bytes(struct robj_t* o) {
+    return (unsigned char*) ((struct rstr_t*) o->ptr)->buf;
+}
+
+/** SETBIT key offset 0|1 */
+void setbit_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    uint64_t offset;
+
+    if (get_bit_offset(c, &argv[2], 0, 1, &offset) == -1) return;
+    if (argv[3].len != 1 || (argv[3].ptr[0] != '0' && argv[3].ptr[0] != '1')) {
+        add_reply_error(c, BIT_VALUE_ERR);
+        return;
+    }
+    uint32_t on = argv[3].ptr[0] == '1';
+
+    struct robj_t* o = lookup_string_for_bit_write(c, &argv[1], offset);
+    if (o == NULL) return;
+
+    unsigned char* p = raw_string_bytes(o) + (offset >> 3);
+    uint32_t shift = 7 - (offset & 7);
+    uint32_t old = (*p >> shift) & 1;
+    *p = (*p & ~(1u << shift)) | (on << shift);
+
+    signal_modified_key(argv[1].ptr, argv[1].len);
+    server.dirty++;
+    add_reply_long_long(c, old);
+}
+
+/** GETBIT key offset */
+void getbit_command(struct client_t* c) {
+    uint64_t offset;
+    if (get_bit_offset(c, &c->req.argv[2], 0, 1, &offset) == -1) return;
+
+    struct robj_t* o = lookup_key_read(server.db, c->req.argv[1].ptr,
+            c->req.argv[1].len);
+    if (check_type(c, o, OBJ_STRING)) return;
+    if (o == NULL) {
+        add_reply_long_long(c, 0);
+        return;
+    }
+
+    char tmp[OBJ_LONG_STR_SIZE];
+    size_t len;
+    const unsigned char* p = (const unsigned char*) obj_string_ptr(o, tmp,
+            &len);
+    uint64_t byte = offset >> 3;
+    add_reply_long_long(c,
+            byte < len ? (p[byte] >> (7 - (offset & 7))) & 1 : 0);
+}
+
+/** ------------------------------ Ranges --------------------------------- */
+
+/** BYTE / BIT unit: return 1 for BIT, -1 after replying an error */
+static int32_t get_range_unit(struct client_t* c,
+        const struct resp_arg_t* arg) {
+    if (arg_is(arg, "bit")) return 1;
+    if (arg_is(arg, "byte")) return 0;
+    add_reply_error(c, "syntax error");
+    return -1;
+}
+
+/**
+ * Resolve negative indexes against `total` units and clamp the range.
+ * Return 0 when it is empty.
+ * */
+static int32_t normalize_range(int64_t* start, int64_t* end, int64_t total) {
+    if (*start < 0) *start += total;
+    if (*end < 0) *end += total;
+    if (*start < 0) *start = 0;
+    if (*end < 0) *end = 0;
+    if (*end >= total) *end = total - 1;
+    return total > 0 && *start <= *end;
+}
+
+/** BITCOUNT key [start end [BYTE|BIT]] */
+void bitcount_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    int64_t start = 0, end = -1;
+    int32_t isbit = 0;
+
+    if (argc != 2 && argc != 4 && argc != 5) {
+        add_reply_error(c, "syntax error");
+        return;
+    }
+    if (argc >= 4 && (!resp_string2ll(argv[2].ptr, argv[2].len, &start) ||
+                !resp_string2ll(argv[3].ptr, argv[3].len, &end))) {
+        add_reply_error(c, INTEGER_ERR);
+        return;
+    }
+    if (argc == 5 && (isbit = get_range_unit(c, &argv[4])) == -1) return;
+
+    struct robj_t* o = lookup_key_read(server.db, argv[1].ptr, argv[1].len);
+    if (check_type(c, o, OBJ_STRING)) return;
+    if (o == NULL) {
+        add_reply_long_long(c, 0);
+        return;
+    }
+
+    char tmp[OBJ_LONG_STR_SIZE];
+    size_t len;
+    const unsigned char* p = (const unsigned char*) obj_string_ptr(o, tmp,
+            &len);
+    int64_t total = isbit ? (int64_t) len * 8 : (int64_t) len;
+    if (!normalize_range(&start, &end, total)) {
+        add_reply_long_long(c, 0);
+        return;
+    }
+    if (!isbit) {
+        add_reply_long_long(c, bitops_popcount(p + start, end - start + 1));
+        return;
+    }
+
+    /** Whole bytes, minus the bits before `start` and after `end` */
+    int64_t first = start >> 3, last = end >> 3;
+    unsigned char before = 0xff00 >> (start & 7);
+    unsigned char after = (1u << (7 - (end & 7))) - 1;
+    uint64_t count = bitops_popcount(p + first, last - first + 1);
+    count -= __builtin_popcount(p[first] & before);
+    count -= __builtin_popcount(p[last] & after);
+    add_reply_long_long(c, count);
+}
+
+/** First bit equal to `bit` among the `valid` bits of byte `idx`, or -1 */
+static int64_t bitpos_in_byte(unsigned char byte, unsigned char valid,
+        uint64_t idx, int32_t bit) {
+    uint32_t m = (bit ? byte : (unsigned char) ~byte) & valid;
+    return m == 0 ? -1 : (int64_t) idx * 8 + __builtin_clz(m) - 24;
+}
+
+/** First bit equal to `bit` in bits [sbit, ebit], or -1 */
+static int64_t bitpos_range(const unsigned char* p, uint64_t sbit,
+        uint64_t ebit, int32_t bit) {
+    uint64_t first = sbit >> 3, last = ebit >> 3;
+    unsigned char head = 0xff >> (sbit & 7);
+    unsigned char tail = 0xff << (7 - (ebit & 7));
+
+    if (first == last) return bitpos_in_byte(p[first], head & tail, first, bit);
+
+    int64_t pos = bitpos_in_byte(p[first], head, first, bit);
+    if (pos != -1) return pos;
+    if (last > first + 1) {
+        pos = bitops_bitpos(p + first + 1, last - first - 1, bit);
+        if (pos != -1) return (int64_t) (first + 1) * 8 + pos;
+    }
+    return bitpos_in_byte(p[last], tail, last, bit);
+}
+
+/**
+ * BITPOS key 0|1 [start [end [BYTE|BIT]]]
+ *
+ * Looking for a clear bit without an end, the string counts as padded with
+ * zeros: an all ones range returns the first bit past it.
+ * */
+void bitpos_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    int64_t start = 0, end = -1;
+    int32_t isbit = 0;
+
+    if (argc > 6) {
+        add_reply_error(c, "syntax error");
+        return;
+    }
+    if (argv[2].len != 1 || (argv[2].ptr[0] != '0' && argv[2].ptr[0] != '1')) {
+        add_reply_error(c, "The bit argument must be 1 or 0.");
+        return;
+    }
+    int32_t bit = argv[2].ptr[0] == '1';
+
+    if ((argc >= 4 && !resp_string2ll(argv[3].ptr, argv[3].len, &start)) ||
+            (argc >= 5 && !resp_string2ll(argv[4].ptr, argv[4].len, &end))) {
+        add_reply_error(c, INTEGER_ERR);
+        return;
+    }
+    if (argc == 6 && (isbit = get_range_unit(c, &argv[5])) == -1) return;
+
+    struct robj_t* o = lookup_key_read(server.db, argv[1].ptr, argv[1].len);
+    if (check_type(c, o, OBJ_STRING)) return;
+    if (o == NULL) {
+        add_reply_long_long(c, bit ? -1 : 0);
+        return;
+    }
+
+    char tmp[OBJ_LONG_STR_SIZE];
+    size_t len;
+    const unsigned char* p = (const unsigned char*) obj_string_ptr(o, tmp,
+            &len);
+    int64_t total = isbit ? (int64_t) len * 8 : (int64_t) len;
+    if (!normalize_range(&start, &end, total)) {
+        add_reply_long_long(c, -1);
+        return;
+    }
+
+    uint64_t sbit = isbit ? start : start * 8;
+    uint64_t ebit = isbit ? end : end * 8 + 7;
+    int64_t pos = bitpos_range(p, sbit, ebit, bit);
+    if (pos == -1 && bit == 0 && argc < 5) pos = ebit + 1;
+    add_reply_long_long(c, pos);
+}
+
+/** ------------------------------ BITOP ---------------------------------- */
+
+static void free_bitop_job(struct bitop_job_t* job) {
+    for (int32_t i = 0; i < job->nsrc; i++) {
+        if (job->srcs[i].o != NULL) decr_ref_count(job->srcs[i].o);
+    }
+    if (job->result != NULL) decr_ref_count(job->result);
+    free(job->dest);
+    free(job);
+}
+
+/**
+ * Compute up to `n` more result bytes. Every source is applied to one
+ * destination tile before moving to the next, so the tile stays in L1
+ * instead of streaming the whole destination once per source. Bytes past
+ * the end of a shorter source count as zeros.
+ * */
+static void bitop_process(struct bitop_job_t* job, size_t n) {
+    unsigned char* dst = raw_string_bytes(job->result);
+    size_t end = job->len - job->pos < n ? job->len : job->pos + n;
+
+    for (size_t off = job->pos; off < end; off += BITOP_TILE_BYTES) {
+        size_t tile = end - off < BITOP_TILE_BYTES ? end - off :
+            BITOP_TILE_BYTES;
+
+        for (int32_t i = 0; i < job->nsrc; i++) {
+            struct bitop_src_t* src = &job->srcs[i];
+            size_t avail = src->len <= off ? 0 :
+                (src->len - off < tile ? src->len - off : tile);
+
+            /** The result starts zeroed, see create_raw_string_object() */
+            if (i == 0) {
+                if (job->op == BITOP_NOT) {
+                    bitops_binop(BITOP_NOT, dst + off, src->ptr + off, avail);
+                } else {
+                    memcpy(dst + off, src->ptr + off, avail);
+                }
+                continue;
+            }
+
+            bitops_binop(job->op, dst + off, src->ptr + off, avail);
+            if (job->op == BITOP_AND && avail < tile) {
+                memset(dst + off + avail, 0, tile - avail);
+            }
+        }
+    }
+    job->pos = end;
+}
+
+/**
+ * Store the result, reply and resume the client if it is still there. Only
+ * the destination is signaled modified, the sources were only read. A
+ * chunked job finishes from a timer: the client stands as the modifier.
+ * */
+static void bitop_finish(struct bitop_job_t* job) {
+    int32_t modified = 1;
+    if (job->result != NULL) {
+        set_key(server.db, job->dest, job->dest_len, job->result);
+        job->result = NULL;
+    } else {
+        modified = db_delete(server.db, job->dest, job->dest_len);
+    }
+    if (modified) {
+        struct client_t* current = server.current_client;
+        server.current_client = job->c;
+        signal_modified_key(job->dest, job->dest_len);
+        server.current_client = current;
+    }
+    server.dirty++;
+
+    struct client_t* c = job->c;
+    if (c == NULL) return;
+    add_reply_long_long(c, job->len);
+    if (c->flags & CLIENT_BLOCKED) unblock_client(c);
+}
+
+static int64_t bitop_job_step(struct event_loop_t* el, int64_t id,
+        void* client_data) {
+    struct bitop_job_t* job = client_data;
+
+    bitop_process(job, BITOP_CHUNK_BYTES);
+    if (job->pos < job->len) return 0;
+
+    bitop_finish(job);
+    free_bitop_job(job);
+    return TE_NOMORE;
+}
+
+void bitop_detach_client(void* state) {
+    ((struct bitop_job_t*) state)->c = NULL;
+}
+
+/**
+ * BITOP AND|OR|XOR|NOT destkey key [key ...]
+ *
+ * Results up to BITOP_CHUNK_BYTES are computed right away. Longer ones
+ * block the client and are computed BITOP_CHUNK_BYTES per event loop
+ * iteration, so that other clients are served in between. Inside EXEC
+ * the whole result is computed at once.
+ * */
+void bitop_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t op;
+
+    if (arg_is(&argv[1], "and")) {
+        op = BITOP_AND;
+    } else if (arg_is(&argv[1], "or")) {
+        op = BITOP_OR;
+    } else if (arg_is(&argv[1], "xor")) {
+        op = BITOP_XOR;
+    } else if (arg_is(&argv[1], "not")) {
+        op = BITOP_NOT;
+    } else {
+        add_reply_error(c, "syntax error");
+        return;
+    }
+    if (op == BITOP_NOT && c->req.argc != 4) {
+        add_reply_error(c,
+                "BITOP NOT must be called with a single source key.");
+        return;
+    }
+
+    int32_t nsrc = c->req.argc - 3;
+    struct bitop_job_t* job = calloc(1, sizeof(struct bitop_job_t) +
+            nsrc * sizeof(struct bitop_src_t));
+    if (job == NULL) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+    job->c = c;
+    job->op = op;
+    job->nsrc = nsrc;
+
+    for (int32_t i = 0; i < nsrc; i++) {
+        struct bitop_src_t* src = &job->srcs[i];
+        struct robj_t* o = lookup_key_read(server.db, argv[i + 3].ptr,
+                argv[i + 3].len);
+        if (check_type(c, o, OBJ_STRING)) {
+            free_bitop_job(job);
+            return;
+        }
+        if (o == NULL) {
+            src->ptr = (const unsigned char*) "";
+            continue;
+        }
+        incr_ref_count(o);
+        src->o = o;
+        src->ptr = (const unsigned char*) obj_string_ptr(o, src->tmp,
+                &src->len);
+        if (src->len > job->len) job->len = src->len;
+    }
+
+    /** The arguments may point into a receive buffer that is recycled */
+    job->dest_len = argv[2].len;
+    job->dest = malloc(job->dest_len);
+    if (job->dest == NULL || (job->len > 0 &&
+                (job->result = create_raw_string_object(NULL, job->len)) ==
+                NULL)) {
+        free_bitop_job(job);
+        add_reply_error(c, "out of memory");
+        return;
+    }
+    memcpy(job->dest, argv[2].ptr, job->dest_len);
+
+    /** Only missing or empty sources: there is no result, dest is deleted */
+    if (job->len == 0) {
+        bitop_finish(job);
+        free_bitop_job(job);
+        return;
+    }
+
+    /** A transaction runs in one go, chunking would let others in */
+    if (job->len <= BITOP_CHUNK_BYTES || (c->flags & CLIENT_MULTI)) {
+        bitop_process(job, job->len);
+        bitop_finish(job);
+        free_bitop_job(job);
+        return;
+    }
+
+    if (create_time_event(server.el, 0, bitop_job_step, job) == -1) {
+        free_bitop_job(job);
+        add_reply_error(c, "out of memory");
+        return;
+    }
+    log_verbose("[bitop_command] client %lu: %zu bytes in %zu byte chunks",
+            (unsigned long) c->id, job->len, (size_t) BITOP_CHUNK_BYTES);
+    block_client(c, BLOCKED_BITOP, job);
+}
+
+/** ------------------------------ BITFIELD ------------------------------- */
+
+/** Bits past the end of the string read as zeros */
+static uint64_t get_unsigned_bitfield(const unsigned char* p, size_t len,
+        uint64_t offset, int32_t bits) {
+    uint64_t v = 0;
+    for (int32_t i = 0; i < bits; i++, offset++) {
+        uint64_t byte = offset >> 3;
+        uint32_t bit = byte < len ? (p[byte] >> (7 - (offset & 7))) & 1 : 0;
+        v = (v << 1) | bit;
+    }
+    return v;
+}
+
+static int64_t get_signed_bitfield(const unsigned char* p, size_t len,
+        uint64_t offset, int32_t bits) {
+    uint64_t v = get_unsigned_bitfield(p, len, offset, bits);
+    if (bits < 64 && (v & (1ULL << (bits - 1)))) v |= UINT64_MAX << bits;
+    return (int64_t) v;
+}
+
+static void set_bitfield(unsigned char* p, uint64_t offset, int32_t bits,
+        uint64_t v) {
+    for (int32_t i = bits - 1; i >= 0; i--, offset++) {
+        uint32_t bit = (v >> i) & 1;
+        uint32_t shift = 7 - (offset & 7);
+        p[offset >> 3] = (p[offset >> 3] & ~(1u << shift)) | (bit << shift);
+    }
+}
+
+/**
+ * Check `v + incr` against a `bits` wide unsigned field (bits < 64). Return
+ * 1 on overflow, -1 on underflow, 0 otherwise; on overflow `limit` is the
+ * value to store for WRAP / SAT.
+ * */
+static int32_t unsigned_bitfield_overflow(uint64_t v, int64_t incr,
+        int32_t bits, int32_t overflow, uint64_t* limit) {
+    uint64_t max = (1ULL << bits) - 1;
+    uint64_t wrapped = (v + (uint64_t) incr) & max;
+
+    if (v > max || (incr > 0 && (uint64_t) incr > max - v)) {
+        *limit = overflow == BITFIELD_OVERFLOW_SAT ? max : wrapped;
+        return 1;
+    }
+    if (incr < 0 && -(uint64_t) incr > v) {
+        *limit = overflow == BITFIELD_OVERFLOW_SAT ? 0 : wrapped;
+        return -1;
+    }
+    return 0;
+}
+
+/** Signed counterpart of unsigned_bitfield_overflow(), bits <= 64 */
+static int32_t signed_bitfield_overflow(int64_t v, int64_t incr, int32_t bits,
+        int32_t overflow, int64_t* limit) {
+    int64_t max = bits == 64 ? INT64_MAX : (1LL << (bits - 1)) - 1;
+    int64_t min = -max - 1;
+    uint64_t mask = bits == 64 ? UINT64_MAX : (1ULL << bits) - 1;
+    uint64_t wrapped = ((uint64_t) v + (uint64_t) incr) & mask;
+    int64_t res;
+    int32_t ret = 0;
+
+    if (bits < 64 && (wrapped & (1ULL << (bits - 1)))) wrapped |= ~mask;
+
+    if (__builtin_add_overflow(v, incr, &res)) {
+        ret = incr > 0 ? 1 : -1;
+    } else if (res > max) {
+        ret = 1;
+    } else if (res < min) {
+        ret = -1;
+    }
+    if (ret != 0) {
+        *limit = overflow != BITFIELD_OVERFLOW_SAT ? (int64_t) wrapped :
+            (ret == 1 ? max : min);
+    }
+    return ret;
+}
+
+/** "i<bits>" (1 .. 64) or "u<bits>" (1 .. 63) */
+static int32_t get_bitfield_type(struct client_t* c,
+        const struct resp_arg_t* arg, int32_t* sign, int32_t* bits) {
+    int64_t v;
+    if (arg->len < 2 || (arg->ptr[0] != 'i' && arg->ptr[0] != 'u') ||
+            !resp_string2ll(arg->ptr + 1, arg->len - 1, &v) ||
+            v < 1 || v > (arg->ptr[0] == 'i' ? 64 : 63)) {
+        add_reply_error(c, BITFIELD_TYPE_ERR);
+        return -1;
+    }
+    *sign = arg->ptr[0] == 'i';
+    *bits = v;
+    return 0;
+}
+
+/**
+ * BITFIELD key [GET type offset] [SET type offset value]
+ *     [INCRBY type offset increment] [OVERFLOW WRAP|SAT|FAIL] ...
+ *
+ * Every GET / SET / INCRBY replies one element, SET the previous value,
+ * INCRBY the new one, or a null when OVERFLOW FAIL skipped it.
+ * */
+void bitfield_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    int32_t overflow = BITFIELD_OVERFLOW_WRAP;
+    int32_t nops = 0, writes = 0;
+    uint64_t maxbit = 0;
+
+    struct bitfield_op_t* ops = malloc(argc * sizeof(struct bitfield_op_t));
+    if (ops == NULL) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+
+    for (int32_t j = 2; j < argc; ) {
+        struct resp_arg_t* name = &argv[j];
+        int32_t remaining = argc - j - 1;
+        struct bitfield_op_t* op = &ops[nops];
+
+        if (arg_is(name, "overflow") && remaining >= 1) {
+            if (arg_is(&argv[j + 1], "wrap")) {
+                overflow = BITFIELD_OVERFLOW_WRAP;
+            } else if (arg_is(&argv[j + 1], "sat")) {
+                overflow = BITFIELD_OVERFLOW_SAT;
+            } else if (arg_is(&argv[j + 1], "fail")) {
+                overflow = BITFIELD_OVERFLOW_FAIL;
+            } else {
+                add_reply_error(c, "Invalid OVERFLOW type specified");
+                goto out;
+            }
+            j += 2;
+            continue;
+        }
+
+        if (arg_is(name, "get") && remaining >= 2) {
+            op->opcode = BITFIELD_GET;
+        } else if (arg_is(name, "set") && remaining >= 3) {
+            op->opcode = BITFIELD_SET;
+        } else if (arg_is(name, "incrby") && remaining >= 3) {
+            op->opcode = BITFIELD_INCRBY;
+        } else {
+            add_reply_error(c, "syntax error");
+            goto out;
+        }
+
+        if (get_bitfield_type(c, &argv[j + 1], &op->sign, &op->bits) == -1 ||
+                get_bit_offset(c, &argv[j + 2], 1, op->bits, &op->offset) ==
+                -1) {
+            goto out;
+        }
+        if (op->opcode != BITFIELD_GET) {
+            if (!resp_string2ll(argv[j + 3].ptr, argv[j + 3].len, &op->arg)) {
+                add_reply_error(c, INTEGER_ERR);
+                goto out;
+            }
+            writes++;
+            if (op->offset + op->bits - 1 > maxbit) {
+                maxbit = op->offset + op->bits - 1;
+            }
+        }
+        op->overflow = overflow;
+        j += op->opcode == BITFIELD_GET ? 3 : 4;
+        nops++;
+    }
+
+    char tmp[OBJ_LONG_STR_SIZE];
+    const unsigned char* p = NULL;
+    unsigned char* wp = NULL;
+    size_t len = 0;
+
+    if (writes > 0) {
+        struct robj_t* o = lookup_string_for_bit_write(c, &argv[1], maxbit);
+        if (o == NULL) goto out;
+        p = wp = raw_string_bytes(o);
+        len = ((struct rstr_t*) o->ptr)->len;
+    } else {
+        struct robj_t* o = lookup_key_read(server.db, argv[1].ptr,
+                argv[1].len);
+        if (check_type(c, o, OBJ_STRING)) goto out;
+        if (o != NULL) {
+            p = (const unsigned char*) obj_string_ptr(o, tmp, &len);
+        }
+    }
+
+    int64_t changes = 0;
+    add_reply_array_len(c, nops);
+    for (int32_t i = 0; i < nops; i++) {
+        struct bitfield_op_t* op = &ops[i];
+
+        if (op->opcode == BITFIELD_GET) {
+            if (op->sign) {
+                add_reply_long_long(c,
+                        get_signed_bitfield(p, len, op->offset, op->bits));
+            } else {
+                add_reply_long_long(c, (int64_t)
+                        get_unsigned_bitfield(p, len, op->offset, op->bits));
+            }
+            continue;
+        }
+
+        int32_t incr = op->opcode == BITFIELD_INCRBY;
+        int64_t old, next, reply;
+        int32_t of;
+
+        if (op->sign) {
+            int64_t limit;
+            old = get_signed_bitfield(p, len, op->offset, op->bits);
+            of = signed_bitfield_overflow(incr ? old : op->arg,
+                    incr ? op->arg : 0, op->bits, op->overflow, &limit);
+            next = of ? limit : (incr ? old + op->arg : op->arg);
+        } else {
+            uint64_t limit;
+            old = get_unsigned_bitfield(p, len, op->offset, op->bits);
+            of = unsigned_bitfield_overflow(incr ? (uint64_t) old :
+                    (uint64_t) op->arg, incr ? op->arg : 0, op->bits,
+                    op->overflow, &limit);
+            next = of ? (int64_t) limit : (int64_t) (incr ?
+                    (uint64_t) old + op->arg : (uint64_t) op->arg);
+        }
+        reply = incr ? next : old;
+
+        if (of && op->overflow == BITFIELD_OVERFLOW_FAIL) {
+            add_reply_null(c);
+            continue;
+        }
+        set_bitfield(wp, op->offset, op->bits, (uint64_t) next);
+        changes++;
+        add_reply_long_long(c, reply);
+    }
+    if (changes > 0) {
+        signal_modified_key(argv[1].ptr, argv[1].len);
+        server.dirty += changes;
+    }
+
+out:
+    free(ops);
+}
@@ -0,0 +1,31 @@
+#ifndef T_BITMAP_H
+#define T_BITMAP_H
+
+#include "networking.h"
+
+/** BITOP destination bytes computed while the keys stay in cache */
+#define BITOP_TILE_BYTES  (16 * 1024)
+
+/**
+ * BITOP destination bytes computed per event loop iteration. Longer results
+ * block the client and continue from a time event, see bitop_command().
+ * */
+#define BITOP_CHUNK_BYTES (1024 * 1024)
+
+
+void setbit_command(struct client_t*);
+
+void getbit_command(struct client_t*);
+
+void bitcount_command(struct client_t*);
+
+void bitpos_command(struct client_t*);
+
+void bitop_command(struct client_t*);
+
+void bitfield_command(struct client_t*);
+
+/** The client blocked on a BITOP is gone, the BITOP still completes */
+void bitop_detach_client(void *);
+
+#endif // !T_BITMAP_H
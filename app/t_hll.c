@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "db.h"
+#include "hll.h"
+#include "networking.h"
+#include "object.h"
+#include "server.h"
+#include "t_hll.h"
+
+#define HLL_WRONGTYPE_ERR \
+    "-WRONGTYPE Key is not a valid HyperLogLog string value."
+#define HLL_INVALID_ERR "-INVALIDOBJ Corrupted HLL object detected"
+
+
+/**
+ * Bytes of the HyperLogLog at `o`, or NULL after replying an error when the
+ * value is some other string or type.
+ * */
+static const char* hll_string_or_reply(struct client_t* c, struct robj_t* o,
+        char* tmp, size_t* len) {
+    if (check_type(c, o, OBJ_STRING)) return NULL;
+
+    const char* s = obj_string_ptr(o, tmp, len);
+    if (!is_hll(s, *len)) {
+        add_reply_error(c, HLL_WRONGTYPE_ERR);
+        return NULL;
+    }
+    return s;
+}
+
+/** PFADD key [element ...] */
+void pfadd_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    struct robj_t* o = lookup_key_write(server.db, argv[1].ptr, argv[1].len);
+    int32_t updated = 0;
+
+    if (o == NULL) {
+        o = create_hll_object();
+        if (o == NULL ||
+                set_key(server.db, argv[1].ptr, argv[1].len, o) != DICT_OK) {
+            add_reply_error(c, "out of memory");
+            return;
+        }
+        updated = 1;
+    } else {
+        char tmp[OBJ_LONG_STR_SIZE];
+        size_t len;
+        if (hll_string_or_reply(c, o, tmp, &len) == NULL) return;
+        if (c->req.argc > 2) {
+            o = db_unshare_string_value(server.db, argv[1].ptr, argv[1].len,
+                    o);
+            if (o == NULL) {
+                add_reply_error(c, "out of memory");
+                return;
+            }
+        }
+    }
+
+    for (int32_t i = 2; i < c->req.argc; i++) {
+        int32_t ret = hll_add(o, argv[i].ptr, argv[i].len);
+        if (ret == -1) {
+            add_reply_error(c, HLL_INVALID_ERR);
+            return;
+        }
+        updated |= ret;
+    }
+
+    if (updated) {
+        hll_invalidate_cache(((struct rstr_t*) o->ptr)->buf);
+        signal_modified_key(argv[1].ptr, argv[1].len);
+        server.dirty++;
+    }
+    add_reply_long_long(c, updated);
+}
+
+/**
+ * Max-merge the HyperLogLogs at argv[from ..] into `regs`. Missing keys are
+ * empty sets. Return -1 after replying an error.
+ * */
+static int32_t merge_keys(struct client_t* c, int32_t from, uint8_t* regs) {
+    for (int32_t i = from; i < c->req.argc; i++) {
+        struct robj_t* o = lookup_key_read(server.db, c->req.argv[i].ptr,
+                c->req.argv[i].len);
+        if (o == NULL) continue;
+
+        char tmp[OBJ_LONG_STR_SIZE];
+        size_t len;
+        const char* s = hll_string_or_reply(c, o, tmp, &len);
+        if (s == NULL) return -1;
+        if (hll_merge(regs, s, len) == -1) {
+            add_reply_error(c, HLL_INVALID_ERR);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * PFCOUNT key [key ...]
+ *
+ * One key answers from, or refreshes, the cached cardinality. Several keys
+ * are merged into a temporary register array and counted, uncached.
+ * */
+void pfcount_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    uint64_t card;
+
+    if (c->req.argc > 2) {
+        uint8_t* regs = calloc(1, HLL_REGISTERS);
+        if (regs == NULL) {
+            add_reply_error(c, "out of memory");
+            return;
+        }
+        if (merge_keys(c, 1, regs) == 0) {
+            add_reply_long_long(c, hll_count_registers(regs));
+        }
+        free(regs);
+        return;
+    }
+
+    struct robj_t* o = lookup_key_read(server.db, argv[1].ptr, argv[1].len);
+    if (o == NULL) {
+        add_reply_long_long(c, 0);
+        return;
+    }
+
+    char tmp[OBJ_LONG_STR_SIZE];
+    size_t len;
+    const char* s = hll_string_or_reply(c, o, tmp, &len);
+    if (s == NULL) return;
+
+    /** Values referenced elsewhere are not written, the cache stays stale */
+    int32_t writable = o->encoding == OBJ_ENCODING_RAW && o->refcount == 1;
+    if (hll_count((char*) s, len, writable, &card) == -1) {
+        add_reply_error(c, HLL_INVALID_ERR);
+        return;
+    }
+    add_reply_long_long(c, card);
+}
+
+/** PFMERGE destkey [sourcekey ...], the destination is part of the union */
+void pfmerge_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    uint8_t* regs = calloc(1, HLL_REGISTERS);
+    if (regs == NULL) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+    if (merge_keys(c, 1, regs) == -1) goto out;
+
+    struct robj_t* o = lookup_key_write(server.db, argv[1].ptr, argv[1].len);
+    if (o == NULL) {
+        o = create_hll_object();
+        if (o == NULL ||
+                set_key(server.db, argv[1].ptr, argv[1].len, o) != DICT_OK) {
+            add_reply_error(c, "out of memory");
+            goto out;
+        }
+    } else {
+        o = db_unshare_string_value(server.db, argv[1].ptr, argv[1].len, o);
+    }
+    if (o == NULL || hll_store_registers(o, regs) == -1) {
+        add_reply_error(c, "out of memory");
+        goto out;
+    }
+
+    signal_modified_key(argv[1].ptr, argv[1].len);
+    server.dirty++;
+    add_reply_status(c, "OK");
+out:
+    free(regs);
+}
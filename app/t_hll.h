@@ -0,0 +1,13 @@
+#ifndef T_HLL_H
+#define T_HLL_H
+
+#include "networking.h"
+
+
+void pfadd_command(struct client_t*);
+
+void pfcount_command(struct client_t*);
+
+void pfmerge_command(struct client_t*);
+
+#endif // !T_HLL_H
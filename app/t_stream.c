@@ -0,0 +1,1222 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "blocked.h"
+#include "config.h"
+#include "db.h"
+#include "dict.h"
+#include "event_loop.h"
+#include "networking.h"
+#include "object.h"
+#include "rax.h"
+#include "resp.h"
+#include "server.h"
+#include "stream.h"
+#include "t_stream.h"
+
+#define STREAM_ID_ERR "Invalid stream ID specified as stream command argument"
+#define STREAM_ID_STR_SIZE 42 // "<ms>-<seq>" of two 20 digit numbers
+#define XGROUP_NOKEY_ERR "The XGROUP subcommand requires the key to exist. " \
+    "Note that for CREATE you may want to use the MKSTREAM option to " \
+    "create an empty stream automatically."
+
+#define TRIM_NONE   0
+#define TRIM_MAXLEN 1
+#define TRIM_MINID  2
+
+
+/** MAXLEN|MINID [=|~] threshold [LIMIT count] of XADD and XTRIM */
+struct trim_args_t {
+    int32_t            strategy;
+    int32_t            approx;
+    int64_t            limit; // -1 when not given
+    uint64_t           maxlen;
+    struct stream_id_t minid;
+};
+
+/** State of a client blocked by XREAD / XREADGROUP */
+struct stream_wait_t {
+    uint64_t       count;  // 0 is unlimited
+    int32_t        noack;
+    struct dict_t* ids;    // XREAD: key -> stream_id_t, serve entries after
+    char*          group;  // XREADGROUP, the copied names
+    size_t         group_len;
+    char*          consumer;
+    size_t         consumer_len;
+};
+
+static const struct stream_id_t stream_id_max = { UINT64_MAX, UINT64_MAX };
+
+
+static inline int32_t arg_is(const struct resp_arg_t* arg, const char* s) {
+    size_t len = strlen(s);
+    return arg->len == len && strncasecmp(arg->ptr, s, len) == 0;
+}
+
+/** IDs take the wall clock, the monotonic clock is only for timeouts */
+static int64_t unix_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int32_t parse_u64(const char* s, size_t len, uint64_t* v) {
+    uint64_t r = 0;
+
+    if (len == 0 || len > 20) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') return 0;
+        uint64_t d = s[i] - '0';
+        if (r > (UINT64_MAX - d) / 10) return 0;
+        r = r * 10 + d;
+    }
+    *v = r;
+    return 1;
+}
+
+/**
+ * Parse "<ms>-<seq>", or "<ms>" which gets `missing_seq`. With `seq_auto`
+ * not NULL "<ms>-*" is accepted too and sets it. Return -1 after replying
+ * an error.
+ * */
+static int32_t parse_id(struct client_t* c, const struct resp_arg_t* a,
+        uint64_t missing_seq, struct stream_id_t* id, int32_t* seq_auto) {
+    const char* dash = memchr(a->ptr, '-', a->len);
+    if (seq_auto != NULL) *seq_auto = 0;
+
+    if (dash == NULL) {
+        if (!parse_u64(a->ptr, a->len, &id->ms)) goto err;
+        id->seq = missing_seq;
+        return 0;
+    }
+
+    size_t mslen = dash - a->ptr;
+    size_t seqlen = a->len - mslen - 1;
+    if (!parse_u64(a->ptr, mslen, &id->ms)) goto err;
+    if (seq_auto != NULL && seqlen == 1 && dash[1] == '*') {
+        *seq_auto = 1;
+        id->seq = 0;
+        return 0;
+    }
+    if (!parse_u64(dash + 1, seqlen, &id->seq)) goto err;
+    return 0;
+
+err:
+    add_reply_error(c, STREAM_ID_ERR);
+    return -1;
+}
+
+/** Range bound: "-", "+", an ID, or "(" and an exclusive ID */
+static int32_t parse_range_id(struct client_t* c, const struct resp_arg_t* a,
+        int32_t is_end, struct stream_id_t* id) {
+    if (a->len == 1 && (a->ptr[0] == '-' || a->ptr[0] == '+')) {
+        *id = a->ptr[0] == '-' ? (struct stream_id_t) { 0, 0 } :
+            stream_id_max;
+        return 0;
+    }
+    if (a->len == 0 || a->ptr[0] != '(') {
+        return parse_id(c, a, is_end ? UINT64_MAX : 0, id, NULL);
+    }
+
+    struct resp_arg_t inner = { a->ptr + 1, a->len - 1, 0 };
+    if (parse_id(c, &inner, is_end ? UINT64_MAX : 0, id, NULL) == -1) {
+        return -1;
+    }
+    if ((is_end ? stream_decr_id(id) : stream_incr_id(id)) == -1) {
+        add_reply_error(c, is_end ? "invalid end ID for the interval" :
+                "invalid start ID for the interval");
+        return -1;
+    }
+    return 0;
+}
+
+/** The stream at the key, NULL if missing or after replying WRONGTYPE */
+static struct stream_t* lookup_stream(struct client_t* c,
+        const struct resp_arg_t* key, int32_t write, int32_t* err) {
+    struct robj_t* o = write ?
+        lookup_key_write(server.db, key->ptr, key->len) :
+        lookup_key_read(server.db, key->ptr, key->len);
+    *err = check_type(c, o, OBJ_STREAM);
+    return o == NULL || *err ? NULL : o->ptr;
+}
+
+/** ------------------------------ Replies -------------------------------- */
+
+static void add_reply_stream_id(struct client_t* c,
+        const struct stream_id_t* id) {
+    char buf[STREAM_ID_STR_SIZE];
+    int32_t n = snprintf(buf, sizeof buf, "%llu-%llu",
+            (unsigned long long) id->ms, (unsigned long long) id->seq);
+    add_reply_bulk(c, buf, n);
+}
+
+/** [id, [field, value, ...]] of the iterator's current entry */
+static void add_reply_entry(struct client_t* c, struct stream_iter_t* it,
+        const struct stream_id_t* id, int64_t nfields) {
+    add_reply_array_len(c, 2);
+    add_reply_stream_id(c, id);
+    add_reply_array_len(c, nfields * 2);
+    for (int64_t i = 0; i < nfields; i++) {
+        const char* field;
+        const char* value;
+        size_t flen, vlen;
+        stream_iter_field(it, &field, &flen, &value, &vlen);
+        add_reply_bulk(c, field, flen);
+        add_reply_bulk(c, value, vlen);
+    }
+}
+
+/** Entries of a range, at most `count` (0 is unlimited) */
+static int64_t count_range(struct stream_t* s, const struct stream_id_t* start,
+        const struct stream_id_t* end, uint64_t count, int32_t rev) {
+    struct stream_iter_t it;
+    struct stream_id_t id;
+    int64_t nfields;
+    uint64_t n = 0;
+
+    stream_iter_start(&it, s, start, end, rev);
+    while ((count == 0 || n < count) && stream_iter_next(&it, &id, &nfields)) {
+        n++;
+    }
+    stream_iter_stop(&it);
+    return n;
+}
+
+/**
+ * Reply the first `n` entries of a range, as counted by count_range().
+ * With a group they are delivered to the consumer: the group's last ID
+ * moves past them and, unless `noack`, they become pending.
+ * */
+static void add_reply_range(struct client_t* c, struct stream_t* s,
+        const struct stream_id_t* start, const struct stream_id_t* end,
+        int64_t n, int32_t rev, struct stream_cg_t* cg,
+        struct stream_consumer_t* consumer, int32_t noack) {
+    struct stream_iter_t it;
+    struct stream_id_t id;
+    int64_t nfields;
+    int64_t now = unix_ms();
+
+    add_reply_array_len(c, n);
+    stream_iter_start(&it, s, start, end, rev);
+    for (int64_t i = 0; i < n && stream_iter_next(&it, &id, &nfields); i++) {
+        if (cg != NULL) {
+            if (stream_id_cmp(&id, &cg->last_id) > 0) cg->last_id = id;
+            /** Out of memory the entry is still delivered, just not tracked */
+            if (!noack) stream_pel_deliver(cg, consumer, &id, now);
+        }
+        add_reply_entry(c, &it, &id, nfields);
+    }
+    stream_iter_stop(&it);
+}
+
+/** ------------------------------ Trimming ------------------------------- */
+
+/**
+ * Parse a trim option at argv[*i] and move past it. Return 0 if argv[*i]
+ * is no trim option, 1 if parsed, -1 after replying an error.
+ * */
+static int32_t parse_trim_option(struct client_t* c, int32_t* i,
+        struct trim_args_t* t) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    int32_t j = *i;
+
+    int32_t strategy = arg_is(&argv[j], "maxlen") ? TRIM_MAXLEN :
+        arg_is(&argv[j], "minid") ? TRIM_MINID : TRIM_NONE;
+    if (strategy == TRIM_NONE) return 0;
+    if (t->strategy != TRIM_NONE && t->strategy != strategy) {
+        add_reply_error(c, "syntax error, MAXLEN and MINID options at the "
+                "same time are not compatible");
+        return -1;
+    }
+    t->strategy = strategy;
+
+    j++;
+    if (j < argc && argv[j].len == 1 &&
+            (argv[j].ptr[0] == '~' || argv[j].ptr[0] == '=')) {
+        t->approx = argv[j].ptr[0] == '~';
+        j++;
+    }
+    if (j >= argc) {
+        add_reply_error(c, "syntax error");
+        return -1;
+    }
+
+    if (strategy == TRIM_MAXLEN) {
+        int64_t v;
+        if (!resp_string2ll(argv[j].ptr, argv[j].len, &v) || v < 0) {
+            add_reply_error(c, "The MAXLEN argument must be >= 0.");
+            return -1;
+        }
+        t->maxlen = v;
+    } else if (parse_id(c, &argv[j], 0, &t->minid, NULL) == -1) {
+        return -1;
+    }
+    j++;
+
+    if (j + 1 < argc && arg_is(&argv[j], "limit")) {
+        int64_t v;
+        if (!resp_string2ll(argv[j + 1].ptr, argv[j + 1].len, &v) || v < 0) {
+            add_reply_error(c, "The LIMIT argument must be >= 0.");
+            return -1;
+        }
+        t->limit = v;
+        j += 2;
+    }
+    *i = j;
+    return 1;
+}
+
+static int32_t check_trim_args(struct client_t* c,
+        const struct trim_args_t* t) {
+    if (t->limit != -1 && !t->approx) {
+        add_reply_error(c, "syntax error, LIMIT cannot be used without the "
+                "special ~ option");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * "~" only drops whole blocks, so the stream keeps up to one block more
+ * than asked, and by default at most 100 blocks' worth per call so a
+ * single command never frees an unbounded amount.
+ * */
+static int64_t apply_trim(struct stream_t* s, const struct trim_args_t* t) {
+    int64_t limit = 0;
+    if (t->approx) {
+        limit = t->limit != -1 ? t->limit :
+            config.stream_node_max_entries > 0 ?
+            100 * (int64_t) config.stream_node_max_entries : 10000;
+    }
+    return stream_trim(s, t->strategy == TRIM_MINID, t->maxlen, &t->minid,
+            t->approx, limit);
+}
+
+/** ------------------------------ Commands ------------------------------- */
+
+/** The ID of a new entry after `last`. Return -1 after replying an error. */
+static int32_t next_id(struct client_t* c, const struct stream_id_t* last,
+        int32_t id_auto, int32_t seq_auto, struct stream_id_t* id) {
+    if (id_auto) {
+        uint64_t ms = unix_ms();
+        if (ms > last->ms) {
+            id->ms = ms;
+            id->seq = 0;
+            return 0;
+        }
+        *id = *last;
+        if (stream_incr_id(id) == -1) {
+            add_reply_error(c, "The stream has exhausted the last possible "
+                    "ID, unable to add more items");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (seq_auto) {
+        if (id->ms > last->ms) return 0;
+        if (id->ms == last->ms && last->seq != UINT64_MAX) {
+            id->seq = last->seq + 1;
+            return 0;
+        }
+    } else if (stream_id_cmp(id, last) > 0) {
+        return 0;
+    }
+    add_reply_error(c, "The ID specified in XADD is equal or smaller than "
+            "the target stream top item");
+    return -1;
+}
+
+/**
+ * XADD key [NOMKSTREAM] [MAXLEN|MINID [=|~] threshold [LIMIT count]]
+ *      *|id field value [field value ...]
+ * */
+void xadd_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    struct trim_args_t trim = { .strategy = TRIM_NONE, .limit = -1 };
+    int32_t nomkstream = 0;
+    int32_t i = 2;
+
+    while (i < argc) {
+        if (arg_is(&argv[i], "nomkstream")) {
+            nomkstream = 1;
+            i++;
+            continue;
+        }
+        int32_t ret = parse_trim_option(c, &i, &trim);
+        if (ret == -1) return;
+        if (ret == 0) break;
+    }
+    int32_t nargs = argc - i - 1;
+    if (nargs <= 0 || nargs % 2 != 0) {
+        add_reply_error(c, "wrong number of arguments for 'xadd' command");
+        return;
+    }
+    if (check_trim_args(c, &trim) == -1) return;
+
+    struct stream_id_t id = { 0, 0 };
+    int32_t id_auto = argv[i].len == 1 && argv[i].ptr[0] == '*';
+    int32_t seq_auto = 0;
+    if (!id_auto && parse_id(c, &argv[i], 0, &id, &seq_auto) == -1) return;
+    if (!id_auto && !seq_auto && id.ms == 0 && id.seq == 0) {
+        add_reply_error(c, "The ID specified in XADD must be greater than 0-0");
+        return;
+    }
+
+    int32_t err;
+    struct stream_t* s = lookup_stream(c, &argv[1], 1, &err);
+    if (err) return;
+    if (s == NULL && nomkstream) {
+        add_reply_null(c);
+        return;
+    }
+
+    struct stream_id_t none = { 0, 0 };
+    if (next_id(c, s != NULL ? &s->last_id : &none, id_auto, seq_auto, &id)
+            == -1) {
+        return;
+    }
+
+    if (s == NULL) {
+        struct robj_t* o = create_stream_object();
+        if (o == NULL ||
+                set_key(server.db, argv[1].ptr, argv[1].len, o) != DICT_OK) {
+            add_reply_error(c, "out of memory");
+            return;
+        }
+        s = o->ptr;
+    }
+    if (stream_append(s, &id, &argv[i + 1], nargs / 2) == -1) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+    if (trim.strategy != TRIM_NONE) apply_trim(s, &trim);
+
+    signal_modified_key(argv[1].ptr, argv[1].len);
+    server.dirty++;
+    signal_key_as_ready(argv[1].ptr, argv[1].len);
+    add_reply_stream_id(c, &id);
+}
+
+void xlen_command(struct client_t* c) {
+    int32_t err;
+    struct stream_t* s = lookup_stream(c, &c->req.argv[1], 0, &err);
+    if (err) return;
+    add_reply_long_long(c, s == NULL ? 0 : (int64_t) s->length);
+}
+
+/** XDEL key id [id ...] */
+void xdel_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    struct stream_id_t id;
+
+    /** Nothing is deleted unless every ID is valid */
+    for (int32_t i = 2; i < argc; i++) {
+        if (parse_id(c, &argv[i], 0, &id, NULL) == -1) return;
+    }
+
+    int32_t err;
+    struct stream_t* s = lookup_stream(c, &argv[1], 1, &err);
+    if (err) return;
+
+    int64_t deleted = 0;
+    for (int32_t i = 2; s != NULL && i < argc; i++) {
+        parse_id(c, &argv[i], 0, &id, NULL);
+        deleted += stream_delete(s, &id);
+    }
+    if (deleted > 0) signal_modified_key(argv[1].ptr, argv[1].len);
+    server.dirty += deleted;
+    add_reply_long_long(c, deleted);
+}
+
+/** XTRIM key MAXLEN|MINID [=|~] threshold [LIMIT count] */
+void xtrim_command(struct client_t* c) {
+    struct trim_args_t trim = { .strategy = TRIM_NONE, .limit = -1 };
+    int32_t i = 2;
+
+    int32_t ret = parse_trim_option(c, &i, &trim);
+    if (ret == -1) return;
+    if (ret == 0 || i != c->req.argc) {
+        add_reply_error(c, "syntax error");
+        return;
+    }
+    if (check_trim_args(c, &trim) == -1) return;
+
+    int32_t err;
+    struct stream_t* s = lookup_stream(c, &c->req.argv[1], 1, &err);
+    if (err) return;
+
+    int64_t removed = s == NULL ? 0 : apply_trim(s, &trim);
+    if (removed > 0) {
+        signal_modified_key(c->req.argv[1].ptr, c->req.argv[1].len);
+    }
+    server.dirty += removed;
+    add_reply_long_long(c, removed);
+}
+
+/** XRANGE key start end [COUNT n], XREVRANGE key end start [COUNT n] */
+static void xrange_generic(struct client_t* c, int32_t rev) {
+    struct resp_arg_t* argv = c->req.argv;
+    struct stream_id_t start, end;
+    int64_t count = 0;
+
+    if (parse_range_id(c, &argv[rev ? 3 : 2], 0, &start) == -1 ||
+            parse_range_id(c, &argv[rev ? 2 : 3], 1, &end) == -1) {
+        return;
+    }
+    if (c->req.argc > 4) {
+        if (c->req.argc != 6 || !arg_is(&argv[4], "count")) {
+            add_reply_error(c, "syntax error");
+            return;
+        }
+        if (!resp_string2ll(argv[5].ptr, argv[5].len, &count)) {
+            add_reply_error(c, "value is not an integer or out of range");
+            return;
+        }
+        if (count <= 0) {
+            add_reply_array_len(c, 0);
+            return;
+        }
+    }
+
+    int32_t err;
+    struct stream_t* s = lookup_stream(c, &argv[1], 0, &err);
+    if (err) return;
+    if (s == NULL || stream_id_cmp(&start, &end) > 0) {
+        add_reply_array_len(c, 0);
+        return;
+    }
+
+    int64_t n = count_range(s, &start, &end, count, rev);
+    add_reply_range(c, s, &start, &end, n, rev, NULL, NULL, 0);
+}
+
+void xrange_command(struct client_t* c) {
+    xrange_generic(c, 0);
+}
+
+void xrevrange_command(struct client_t* c) {
+    xrange_generic(c, 1);
+}
+
+/** ------------------------------ XREAD ---------------------------------- */
+
+void stream_free_blocked_state(void* state) {
+    struct stream_wait_t* w = state;
+    if (w == NULL) return;
+
+    if (w->ids != NULL) free_dict(w->ids);
+    free(w->group);
+    free(w->consumer);
+    free(w);
+}
+
+static char* dup_arg(const struct resp_arg_t* a) {
+    char* s = malloc(a->len > 0 ? a->len : 1);
+    if (s != NULL) memcpy(s, a->ptr, a->len);
+    return s;
+}
+
+/** Block on the keys, the IDs being those entries must follow (XREAD) */
+static void block_for_entries(struct client_t* c, struct resp_arg_t* keys,
+        const struct stream_id_t* ids, int32_t nkeys, int64_t timeout,
+        uint64_t count, const struct resp_arg_t* group,
+        const struct resp_arg_t* consumer, int32_t noack) {
+    struct stream_wait_t* w = calloc(1, sizeof(struct stream_wait_t));
+    if (w == NULL) goto oom;
+    w->count = count;
+    w->noack = noack;
+
+    if (group != NULL) {
+        w->group = dup_arg(group);
+        w->group_len = group->len;
+        w->consumer = dup_arg(consumer);
+        w->consumer_len = consumer->len;
+        if (w->group == NULL || w->consumer == NULL) goto oom;
+    } else {
+        if ((w->ids = create_dict(free)) == NULL) goto oom;
+        for (int32_t i = 0; i < nkeys; i++) {
+            struct stream_id_t* id = malloc(sizeof(struct stream_id_t));
+            if (id == NULL) goto oom;
+            *id = ids[i];
+            if (dict_add(w->ids, keys[i].ptr, keys[i].len, id) != DICT_OK) {
+                free(id);
+            }
+        }
+    }
+
+    int64_t deadline = timeout > 0 ? get_monotonic_ms() + timeout : 0;
+    if (block_for_keys(c, BLOCKED_STREAM, keys, nkeys, deadline, w) == 0) {
+        return;
+    }
+
+oom:
+    stream_free_blocked_state(w);
+    add_reply_error(c, "out of memory");
+}
+
+/** Pending entries of the consumer after `after`, at most `count` */
+static int64_t count_history(struct stream_consumer_t* consumer,
+        const struct stream_id_t* after, uint64_t count) {
+    unsigned char key[STREAM_ID_SIZE];
+    struct rax_iter_t ri;
+    uint64_t n = 0;
+
+    stream_encode_id(key, after);
+    rax_iter_start(&ri, consumer->pel);
+    if (rax_seek(&ri, ">", key, STREAM_ID_SIZE)) {
+        do {
+            n++;
+        } while ((count == 0 || n < count) && rax_next(&ri));
+    }
+    rax_iter_release(&ri);
+    return n;
+}
+
+/**
+ * Deliver `n` of the consumer's pending entries again, after `after`.
+ * Entries deleted meanwhile are replied as [id, nil].
+ * */
+static void add_reply_history(struct client_t* c, struct stream_t* s,
+        struct stream_consumer_t* consumer, const struct stream_id_t* after,
+        int64_t n) {
+    unsigned char key[STREAM_ID_SIZE];
+    struct rax_iter_t ri;
+    int64_t now = unix_ms();
+
+    add_reply_array_len(c, n);
+    stream_encode_id(key, after);
+    rax_iter_start(&ri, consumer->pel);
+    int32_t more = rax_seek(&ri, ">", key, STREAM_ID_SIZE);
+    for (int64_t i = 0; i < n && more; i++, more = rax_next(&ri)) {
+        struct stream_nack_t* nack = ri.value;
+        struct stream_id_t id, found;
+        struct stream_iter_t it;
+        int64_t nfields;
+
+        stream_decode_id(ri.key, &id);
+        stream_iter_start(&it, s, &id, &id, 0);
+        if (stream_iter_next(&it, &found, &nfields)) {
+            add_reply_entry(c, &it, &id, nfields);
+            nack->delivery_time = now;
+            nack->delivery_count++;
+        } else {
+            add_reply_array_len(c, 2);
+            add_reply_stream_id(c, &id);
+            add_reply_null_array(c);
+        }
+        stream_iter_stop(&it);
+    }
+    rax_iter_release(&ri);
+}
+
+static void reply_nogroup(struct client_t* c, const char* key, size_t klen,
+        const char* group, size_t glen) {
+    add_reply_error_format(c, "-NOGROUP No such key '%.*s' or consumer "
+            "group '%.*s' in XREADGROUP with GROUP option",
+            (int) (klen > 64 ? 64 : klen), key,
+            (int) (glen > 64 ? 64 : glen), group);
+}
+
+/**
+ * Keys of XREAD and XREADGROUP: the first half of the arguments after
+ * STREAMS. A malformed request has none, the command replies the error.
+ * */
+int32_t xread_getkeys(const struct resp_arg_t* argv, int32_t argc,
+        struct keys_result_t* r) {
+    int32_t streams = 0;
+
+    for (int32_t i = 1; i < argc && streams == 0; i++) {
+        if (arg_is(&argv[i], "streams")) {
+            streams = i + 1;
+        } else if (arg_is(&argv[i], "block") || arg_is(&argv[i], "count")) {
+            i++;
+        } else if (arg_is(&argv[i], "group")) {
+            i += 2;
+        }
+    }
+    if (streams == 0 || (argc - streams) % 2 != 0) return 0;
+
+    int32_t nkeys = (argc - streams) / 2;
+    for (int32_t i = 0; i < nkeys; i++) {
+        if (keys_result_add(r, streams + i) == -1) return -1;
+    }
+    return 0;
+}
+
+/**
+ * XREAD [COUNT n] [BLOCK ms] STREAMS key [key ...] id|$ [id|$ ...]
+ * XREADGROUP GROUP group consumer [COUNT n] [BLOCK ms] [NOACK]
+ *            STREAMS key [key ...] id|> [id|> ...]
+ *
+ * Streams with entries after the ID are replied right away. When none has
+ * any and BLOCK is given, the client waits for the first XADD to one of
+ * the keys (BLOCK 0 waits forever). XREADGROUP with an ID other than ">"
+ * reads the consumer's pending entries again and never blocks.
+ * */
+static void xread_generic(struct client_t* c, int32_t xreadgroup) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    struct resp_arg_t* group = NULL;
+    struct resp_arg_t* consumer_name = NULL;
+    int64_t timeout = -1;
+    uint64_t count = 0;
+    int32_t noack = 0;
+    int32_t streams = 0;
+
+    for (int32_t i = 1; i < argc && streams == 0; i++) {
+        int32_t more = argc - i - 1;
+        if (arg_is(&argv[i], "block") && more >= 1) {
+            if (!resp_string2ll(argv[i + 1].ptr, argv[i + 1].len, &timeout)) {
+                add_reply_error(c, "timeout is not an integer or out of "
+                        "range");
+                return;
+            }
+            if (timeout < 0) {
+                add_reply_error(c, "timeout is negative");
+                return;
+            }
+            i++;
+        } else if (arg_is(&argv[i], "count") && more >= 1) {
+            int64_t v;
+            if (!resp_string2ll(argv[i + 1].ptr, argv[i + 1].len, &v)) {
+                add_reply_error(c, "value is not an integer or out of range");
+                return;
+            }
+            count = v > 0 ? v : 0;
+            i++;
+        } else if (arg_is(&argv[i], "streams") && more >= 1) {
+            streams = i + 1;
+        } else if (xreadgroup && arg_is(&argv[i], "group") && more >= 2) {
+            group = &argv[i + 1];
+            consumer_name = &argv[i + 2];
+            i += 2;
+        } else if (xreadgroup && arg_is(&argv[i], "noack")) {
+            noack = 1;
+        } else {
+            add_reply_error(c, "syntax error");
+            return;
+        }
+    }
+    if (streams == 0) {
+        add_reply_error(c, "syntax error");
+        return;
+    }
+    if (xreadgroup && group == NULL) {
+        add_reply_error(c, "Missing GROUP option for XREADGROUP");
+        return;
+    }
+    if ((argc - streams) % 2 != 0) {
+        add_reply_error_format(c, "Unbalanced '%s' list of streams: for "
+                "each stream key an ID or '%c' must be specified.",
+                xreadgroup ? "xreadgroup" : "xread", xreadgroup ? '>' : '$');
+        return;
+    }
+
+    int32_t nkeys = (argc - streams) / 2;
+    struct resp_arg_t* keys = &argv[streams];
+    struct resp_arg_t* idargs = &argv[streams + nkeys];
+    struct stream_t** ss = calloc(nkeys, sizeof(struct stream_t*));
+    struct stream_id_t* ids = calloc(nkeys, sizeof(struct stream_id_t));
+    struct stream_cg_t** cgs = calloc(nkeys, sizeof(struct stream_cg_t*));
+    struct stream_consumer_t** consumers = calloc(nkeys,
+            sizeof(struct stream_consumer_t*));
+    int64_t* ns = calloc(nkeys, sizeof(int64_t));
+    int32_t* history = calloc(nkeys, sizeof(int32_t));
+    if (ss == NULL || ids == NULL || cgs == NULL || consumers == NULL ||
+            ns == NULL || history == NULL) {
+        add_reply_error(c, "out of memory");
+        goto out;
+    }
+
+    /** Validate everything before replying anything */
+    for (int32_t i = 0; i < nkeys; i++) {
+        int32_t err;
+        ss[i] = lookup_stream(c, &keys[i], 0, &err);
+        if (err) goto out;
+
+        if (xreadgroup) {
+            cgs[i] = ss[i] == NULL ? NULL :
+                stream_lookup_cg(ss[i], group->ptr, group->len);
+            if (cgs[i] == NULL) {
+                reply_nogroup(c, keys[i].ptr, keys[i].len, group->ptr,
+                        group->len);
+                goto out;
+            }
+            if (idargs[i].len == 1 && idargs[i].ptr[0] == '>') {
+                ids[i] = cgs[i]->last_id;
+            } else if (parse_id(c, &idargs[i], 0, &ids[i], NULL) == -1) {
+                goto out;
+            } else {
+                history[i] = 1;
+            }
+        } else if (idargs[i].len == 1 && idargs[i].ptr[0] == '$') {
+            if (ss[i] != NULL) ids[i] = ss[i]->last_id;
+        } else if (parse_id(c, &idargs[i], 0, &ids[i], NULL) == -1) {
+            goto out;
+        }
+    }
+
+    int64_t now = unix_ms();
+    for (int32_t i = 0; i < nkeys && xreadgroup; i++) {
+        int32_t created;
+        consumers[i] = stream_create_consumer(cgs[i], consumer_name->ptr,
+                consumer_name->len, now, &created);
+        if (consumers[i] == NULL) {
+            add_reply_error(c, "out of memory");
+            goto out;
+        }
+        consumers[i]->seen_time = now;
+        if (created) {
+            signal_modified_key(keys[i].ptr, keys[i].len);
+            server.dirty++;
+        }
+    }
+
+    int32_t ready = 0;
+    for (int32_t i = 0; i < nkeys; i++) {
+        if (history[i]) {
+            ns[i] = count_history(consumers[i], &ids[i], count);
+            ready++;
+            continue;
+        }
+        struct stream_id_t start = ids[i];
+        if (ss[i] == NULL || stream_incr_id(&start) == -1) continue;
+        ns[i] = count_range(ss[i], &start, &stream_id_max, count, 0);
+        if (ns[i] > 0) ready++;
+    }
+
+    if (ready == 0) {
+        /** Inside EXEC nothing may wait: answer as without BLOCK */
+        if (timeout >= 0 && !(c->flags & CLIENT_MULTI)) {
+            block_for_entries(c, keys, ids, nkeys, timeout, count, group,
+                    consumer_name, noack);
+        } else {
+            add_reply_null_array(c);
+        }
+        goto out;
+    }
+
+    add_reply_array_len(c, ready);
+    for (int32_t i = 0; i < nkeys; i++) {
+        if (!history[i] && ns[i] == 0) continue;
+
+        add_reply_array_len(c, 2);
+        add_reply_bulk(c, keys[i].ptr, keys[i].len);
+        if (history[i]) {
+            add_reply_history(c, ss[i], consumers[i], &ids[i], ns[i]);
+            continue;
+        }
+        struct stream_id_t start = ids[i];
+        stream_incr_id(&start);
+        add_reply_range(c, ss[i], &start, &stream_id_max, ns[i], 0, cgs[i],
+                consumers[i], noack);
+        if (xreadgroup) {
+            signal_modified_key(keys[i].ptr, keys[i].len);
+            server.dirty++;
+        }
+    }
+
+out:
+    free(ss);
+    free(ids);
+    free(cgs);
+    free(consumers);
+    free(ns);
+    free(history);
+}
+
+void xread_command(struct client_t* c) {
+    xread_generic(c, 0);
+}
+
+void xreadgroup_command(struct client_t* c) {
+    xread_generic(c, 1);
+}
+
+int32_t stream_serve_blocked_client(struct client_t* c, const char* key,
+        size_t len) {
+    struct stream_wait_t* w = c->bstate;
+    struct robj_t* o = lookup_key_write(server.db, key, len);
+    if (o == NULL || o->type != OBJ_STREAM) return 0;
+
+    struct stream_t* s = o->ptr;
+    struct stream_cg_t* cg = NULL;
+    struct stream_consumer_t* consumer = NULL;
+    struct stream_id_t start;
+
+    if (w->group != NULL) {
+        cg = stream_lookup_cg(s, w->group, w->group_len);
+        if (cg == NULL) {
+            reply_nogroup(c, key, len, w->group, w->group_len);
+            return 1;
+        }
+        start = cg->last_id;
+    } else {
+        struct dict_entry_t* e = dict_find(w->ids, key, len);
+        if (e == NULL) return 0;
+        start = *(struct stream_id_t*) e->val;
+    }
+
+    if (stream_incr_id(&start) == -1) return 0;
+    int64_t n = count_range(s, &start, &stream_id_max, w->count, 0);
+    if (n == 0) return 0;
+
+    if (cg != NULL) {
+        int32_t created;
+        int64_t now = unix_ms();
+        consumer = stream_create_consumer(cg, w->consumer, w->consumer_len,
+                now, &created);
+        if (consumer == NULL) {
+            add_reply_error(c, "out of memory");
+            return 1;
+        }
+        consumer->seen_time = now;
+        signal_modified_key(key, len);
+        server.dirty++;
+    }
+
+    add_reply_array_len(c, 1);
+    add_reply_array_len(c, 2);
+    add_reply_bulk(c, key, len);
+    add_reply_range(c, s, &start, &stream_id_max, n, 0, cg, consumer,
+            w->noack);
+    return 1;
+}
+
+/** ------------------------------ Groups --------------------------------- */
+
+/** "$" is the last ID of the stream, a missing sequence is 0 */
+static int32_t parse_group_id(struct client_t* c, const struct resp_arg_t* a,
+        const struct stream_t* s, struct stream_id_t* id) {
+    if (a->len == 1 && a->ptr[0] == '$') {
+        *id = s != NULL ? s->last_id : (struct stream_id_t) { 0, 0 };
+        return 0;
+    }
+    return parse_id(c, a, 0, id, NULL);
+}
+
+/** [ENTRIESREAD n] is accepted for compatibility and ignored */
+static int32_t parse_group_options(struct client_t* c, int32_t from,
+        int32_t* mkstream) {
+    struct resp_arg_t* argv = c->req.argv;
+
+    for (int32_t i = from; i < c->req.argc; i++) {
+        int64_t v;
+        if (mkstream != NULL && arg_is(&argv[i], "mkstream")) {
+            *mkstream = 1;
+        } else if (arg_is(&argv[i], "entriesread") && i + 1 < c->req.argc &&
+                resp_string2ll(argv[i + 1].ptr, argv[i + 1].len, &v)) {
+            i++;
+        } else {
+            add_reply_error(c, "syntax error");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * XGROUP CREATE key group id|$ [MKSTREAM] [ENTRIESREAD n]
+ * XGROUP SETID key group id|$ [ENTRIESREAD n]
+ * XGROUP DESTROY key group
+ * XGROUP CREATECONSUMER key group consumer
+ * XGROUP DELCONSUMER key group consumer
+ * */
+void xgroup_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    struct resp_arg_t* sub = &argv[1];
+
+    int32_t ok = (arg_is(sub, "create") && argc >= 5) ||
+        (arg_is(sub, "setid") && argc >= 5) ||
+        (arg_is(sub, "destroy") && argc == 4) ||
+        (arg_is(sub, "createconsumer") && argc == 5) ||
+        (arg_is(sub, "delconsumer") && argc == 5);
+    if (!ok) {
+        add_reply_error_format(c, "unknown subcommand or wrong number of "
+                "arguments for '%.*s'", (int) (sub->len > 64 ? 64 : sub->len),
+                sub->ptr);
+        return;
+    }
+
+    struct resp_arg_t* key = &argv[2];
+    struct resp_arg_t* name = &argv[3];
+    int32_t err;
+    struct stream_t* s = lookup_stream(c, key, 1, &err);
+    if (err) return;
+
+    if (arg_is(sub, "create")) {
+        int32_t mkstream = 0;
+        struct stream_id_t id;
+        if (parse_group_options(c, 5, &mkstream) == -1 ||
+                parse_group_id(c, &argv[4], s, &id) == -1) {
+            return;
+        }
+        if (s == NULL && !mkstream) {
+            add_reply_error(c, XGROUP_NOKEY_ERR);
+            return;
+        }
+        if (s != NULL && stream_lookup_cg(s, name->ptr, name->len) != NULL) {
+            add_reply_error(c, "-BUSYGROUP Consumer Group name already "
+                    "exists");
+            return;
+        }
+        if (s == NULL) {
+            struct robj_t* o = create_stream_object();
+            if (o == NULL ||
+                    set_key(server.db, key->ptr, key->len, o) != DICT_OK) {
+                add_reply_error(c, "out of memory");
+                return;
+            }
+            s = o->ptr;
+        }
+        if (stream_create_cg(s, name->ptr, name->len, &id) == NULL) {
+            add_reply_error(c, "out of memory");
+            return;
+        }
+        signal_modified_key(key->ptr, key->len);
+        server.dirty++;
+        add_reply_status(c, "OK");
+        return;
+    }
+
+    if (s == NULL) {
+        add_reply_error(c, XGROUP_NOKEY_ERR);
+        return;
+    }
+    if (arg_is(sub, "destroy")) {
+        int32_t destroyed = stream_destroy_cg(s, name->ptr, name->len);
+        if (destroyed) {
+            signal_modified_key(key->ptr, key->len);
+            server.dirty++;
+            /** Clients blocked on the group get a NOGROUP error */
+            signal_key_as_ready(key->ptr, key->len);
+        }
+        add_reply_long_long(c, destroyed);
+        return;
+    }
+
+    struct stream_cg_t* cg = stream_lookup_cg(s, name->ptr, name->len);
+    if (cg == NULL) {
+        add_reply_error_format(c, "-NOGROUP No such consumer group '%.*s' "
+                "for key name '%.*s'", (int) (name->len > 64 ? 64 : name->len),
+                name->ptr, (int) (key->len > 64 ? 64 : key->len), key->ptr);
+        return;
+    }
+
+    if (arg_is(sub, "setid")) {
+        struct stream_id_t id;
+        if (parse_group_options(c, 5, NULL) == -1 ||
+                parse_group_id(c, &argv[4], s, &id) == -1) {
+            return;
+        }
+        cg->last_id = id;
+        signal_modified_key(key->ptr, key->len);
+        server.dirty++;
+        add_reply_status(c, "OK");
+    } else if (arg_is(sub, "createconsumer")) {
+        int32_t created;
+        if (stream_create_consumer(cg, argv[4].ptr, argv[4].len, unix_ms(),
+                    &created) == NULL) {
+            add_reply_error(c, "out of memory");
+            return;
+        }
+        if (created) signal_modified_key(key->ptr, key->len);
+        server.dirty += created;
+        add_reply_long_long(c, created);
+    } else {
+        struct stream_consumer_t* consumer = stream_lookup_consumer(cg,
+                argv[4].ptr, argv[4].len);
+        int64_t pending = 0;
+        if (consumer != NULL) {
+            pending = stream_delete_consumer(cg, consumer);
+            signal_modified_key(key->ptr, key->len);
+            server.dirty++;
+        }
+        add_reply_long_long(c, pending);
+    }
+}
+
+/** XACK key group id [id ...] */
+void xack_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    struct stream_id_t id;
+
+    for (int32_t i = 3; i < argc; i++) {
+        if (parse_id(c, &argv[i], 0, &id, NULL) == -1) return;
+    }
+
+    int32_t err;
+    struct stream_t* s = lookup_stream(c, &argv[1], 1, &err);
+    if (err) return;
+    struct stream_cg_t* cg = s == NULL ? NULL :
+        stream_lookup_cg(s, argv[2].ptr, argv[2].len);
+
+    int64_t acked = 0;
+    for (int32_t i = 3; cg != NULL && i < argc; i++) {
+        parse_id(c, &argv[i], 0, &id, NULL);
+        acked += stream_pel_ack(cg, &id);
+    }
+    if (acked > 0) signal_modified_key(argv[1].ptr, argv[1].len);
+    server.dirty += acked;
+    add_reply_long_long(c, acked);
+}
+
+/** [count, smallest ID, greatest ID, [[consumer, count], ...]] */
+static void xpending_summary(struct client_t* c, struct stream_cg_t* cg) {
+    struct rax_iter_t ri;
+    struct stream_id_t id;
+
+    add_reply_array_len(c, 4);
+    add_reply_long_long(c, rax_size(cg->pel));
+    if (rax_size(cg->pel) == 0) {
+        add_reply_null(c);
+        add_reply_null(c);
+        add_reply_null_array(c);
+        return;
+    }
+
+    rax_iter_start(&ri, cg->pel);
+    rax_seek(&ri, "^", NULL, 0);
+    stream_decode_id(ri.key, &id);
+    add_reply_stream_id(c, &id);
+    rax_seek(&ri, "$", NULL, 0);
+    stream_decode_id(ri.key, &id);
+    add_reply_stream_id(c, &id);
+    rax_iter_release(&ri);
+
+    int64_t n = 0;
+    rax_iter_start(&ri, cg->consumers);
+    for (int32_t more = rax_seek(&ri, "^", NULL, 0); more;
+            more = rax_next(&ri)) {
+        n += rax_size(((struct stream_consumer_t*) ri.value)->pel) > 0;
+    }
+    add_reply_array_len(c, n);
+    for (int32_t more = rax_seek(&ri, "^", NULL, 0); more;
+            more = rax_next(&ri)) {
+        struct stream_consumer_t* consumer = ri.value;
+        if (rax_size(consumer->pel) == 0) continue;
+
+        char buf[OBJ_LONG_STR_SIZE];
+        int32_t len = snprintf(buf, sizeof buf, "%llu",
+                (unsigned long long) rax_size(consumer->pel));
+        add_reply_array_len(c, 2);
+        add_reply_bulk(c, consumer->name, consumer->name_len);
+        add_reply_bulk(c, buf, len);
+    }
+    rax_iter_release(&ri);
+}
+
+/**
+ * Pending entries between `start` and `end` idle for at least `min_idle`
+ * ms, at most `count`. Count them (`c` NULL) or reply them as
+ * [id, consumer, idle ms, deliveries].
+ * */
+static int64_t xpending_range(struct client_t* c, struct rax_t* pel,
+        const struct stream_id_t* start, const struct stream_id_t* end,
+        int64_t count, int64_t min_idle, int64_t now) {
+    unsigned char key[STREAM_ID_SIZE];
+    struct rax_iter_t ri;
+    int64_t n = 0;
+
+    stream_encode_id(key, start);
+    rax_iter_start(&ri, pel);
+    for (int32_t more = rax_seek(&ri, ">=", key, STREAM_ID_SIZE);
+            more && n < count; more = rax_next(&ri)) {
+        struct stream_nack_t* nack = ri.value;
+        struct stream_id_t id;
+        stream_decode_id(ri.key, &id);
+        if (stream_id_cmp(&id, end) > 0) break;
+
+        int64_t idle = now - nack->delivery_time;
+        if (idle < 0) idle = 0;
+        if (idle < min_idle) continue;
+        n++;
+        if (c == NULL) continue;
+
+        add_reply_array_len(c, 4);
+        add_reply_stream_id(c, &id);
+        add_reply_bulk(c, nack->consumer->name, nack->consumer->name_len);
+        add_reply_long_long(c, idle);
+        add_reply_long_long(c, nack->delivery_count);
+    }
+    rax_iter_release(&ri);
+    return n;
+}
+
+/** XPENDING key group [[IDLE min-idle] start end count [consumer]] */
+void xpending_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    int32_t argc = c->req.argc;
+    struct stream_id_t start, end;
+    struct resp_arg_t* consumer_name = NULL;
+    int64_t min_idle = 0;
+    int64_t count = 0;
+    int32_t i = 3;
+
+    if (argc > 3) {
+        if (argc >= 5 && arg_is(&argv[3], "idle")) {
+            if (!resp_string2ll(argv[4].ptr, argv[4].len, &min_idle)) {
+                add_reply_error(c, "value is not an integer or out of range");
+                return;
+            }
+            i = 5;
+        }
+        if (argc - i != 3 && argc - i != 4) {
+            add_reply_error(c, "syntax error");
+            return;
+        }
+        if (parse_range_id(c, &argv[i], 0, &start) == -1 ||
+                parse_range_id(c, &argv[i + 1], 1, &end) == -1) {
+            return;
+        }
+        if (!resp_string2ll(argv[i + 2].ptr, argv[i + 2].len, &count)) {
+            add_reply_error(c, "value is not an integer or out of range");
+            return;
+        }
+        if (argc - i == 4) consumer_name = &argv[i + 3];
+    }
+
+    int32_t err;
+    struct stream_t* s = lookup_stream(c, &argv[1], 0, &err);
+    if (err) return;
+    struct stream_cg_t* cg = s == NULL ? NULL :
+        stream_lookup_cg(s, argv[2].ptr, argv[2].len);
+    if (cg == NULL) {
+        add_reply_error_format(c, "-NOGROUP No such key '%.*s' or consumer "
+                "group '%.*s'", (int) (argv[1].len > 64 ? 64 : argv[1].len),
+                argv[1].ptr, (int) (argv[2].len > 64 ? 64 : argv[2].len),
+                argv[2].ptr);
+        return;
+    }
+
+    if (argc == 3) {
+        xpending_summary(c, cg);
+        return;
+    }
+
+    struct rax_t* pel = cg->pel;
+    if (consumer_name != NULL) {
+        struct stream_consumer_t* consumer = stream_lookup_consumer(cg,
+                consumer_name->ptr, consumer_name->len);
+        if (consumer == NULL) {
+            add_reply_array_len(c, 0);
+            return;
+        }
+        pel = consumer->pel;
+    }
+
+    int64_t now = unix_ms();
+    int64_t n = xpending_range(NULL, pel, &start, &end, count, min_idle, now);
+    add_reply_array_len(c, n);
+    xpending_range(c, pel, &start, &end, n, min_idle, now);
+}
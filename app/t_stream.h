@@ -0,0 +1,47 @@
+#ifndef T_STREAM_H
+#define T_STREAM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "networking.h"
+#include "resp.h"
+
+struct keys_result_t;
+
+
+/**
+ * Serve a client blocked by XREAD / XREADGROUP on a key that got new
+ * entries. Return 1 if it was replied to, 0 to keep it waiting.
+ * */
+int32_t stream_serve_blocked_client(struct client_t*, const char*, size_t);
+
+void stream_free_blocked_state(void*);
+
+void xadd_command(struct client_t*);
+
+void xlen_command(struct client_t*);
+
+void xdel_command(struct client_t*);
+
+void xtrim_command(struct client_t*);
+
+void xrange_command(struct client_t*);
+
+void xrevrange_command(struct client_t*);
+
+/** command_getkeys_t of XREAD and XREADGROUP */
+int32_t xread_getkeys(const struct resp_arg_t*, int32_t,
+        struct keys_result_t*);
+
+void xread_command(struct client_t*);
+
+void xreadgroup_command(struct client_t*);
+
+void xgroup_command(struct client_t*);
+
+void xack_command(struct client_t*);
+
+void xpending_command(struct client_t*);
+
+#endif // !T_STREAM_H
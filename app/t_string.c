@@ -0,0 +1,193 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "db.h"
+#include "networking.h"
+#include "object.h"
+#include "resp.h"
+#include "server.h"
+#include "t_string.h"
+
+#define SET_NX (1 << 0)
+#define SET_XX (1 << 1)
+
+
+void add_reply_bulk_object(struct client_t* c, struct robj_t* o) {
+    char tmp[OBJ_LONG_STR_SIZE];
+    size_t len;
+    const char* s = obj_string_ptr(o, tmp, &len);
+    add_reply_bulk(c, s, len);
+}
+
+/** SET key value [NX|XX] */
+void set_command(struct client_t* c) {
+    struct resp_arg_t* argv = c->req.argv;
+    uint32_t flags = 0;
+
+    for (int32_t i = 3; i < c->req.argc; i++) {
+        if (argv[i].len == 2 && strncasecmp(argv[i].ptr, "nx", 2) == 0 &&
+                !(flags & SET_XX)) {
+            flags |= SET_NX;
+        } else if (argv[i].len == 2 && strncasecmp(argv[i].ptr, "xx", 2) == 0
+                && !(flags & SET_NX)) {
+            flags |= SET_XX;
+        } else {
+            add_reply_error(c, "syntax error");
+            return;
+        }
+    }
+
+    if (flags & (SET_NX | SET_XX)) {
+        int32_t exists = lookup_key_write(server.db, argv[1].ptr,
+                argv[1].len) != NULL;
+        if (((flags & SET_NX) && exists) || ((flags & SET_XX) && !exists)) {
+            add_reply_null(c);
+            return;
+        }
+    }
+
+    struct robj_t* o = create_string_object(argv[2].ptr, argv[2].len);
+    if (o == NULL) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+    o = try_object_encoding(o);
+
+    if (set_key(server.db, argv[1].ptr, argv[1].len, o) != DICT_OK) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+    signal_modified_key(argv[1].ptr, argv[1].len);
+    server.dirty++;
+    add_reply(c, "+OK\r\n", 5);
+}
+
+void get_command(struct client_t* c) {
+    struct robj_t* o = lookup_key_read(server.db, c->req.argv[1].ptr,
+            c->req.argv[1].len);
+    if (check_type(c, o, OBJ_STRING)) return;
+    if (o == NULL) {
+        add_reply_null(c);
+        return;
+    }
+    add_reply_bulk_object(c, o);
+}
+
+void strlen_command(struct client_t* c) {
+    struct robj_t* o = lookup_key_read(server.db, c->req.argv[1].ptr,
+            c->req.argv[1].len);
+    if (check_type(c, o, OBJ_STRING)) return;
+    add_reply_long_long(c, o == NULL ? 0 : (int64_t) obj_string_len(o));
+}
+
+/**
+ * INT encoded values that are not shared are updated in place, so a hot
+ * counter costs no allocation per increment.
+ * */
+static void incr_generic(struct client_t* c, int64_t incr) {
+    struct resp_arg_t* key = &c->req.argv[1];
+    struct robj_t* o = lookup_key_write(server.db, key->ptr, key->len);
+    int64_t v = 0;
+
+    if (check_type(c, o, OBJ_STRING)) return;
+    if (o != NULL && !get_long_long_from_object(o, &v)) {
+        add_reply_error(c, "value is not an integer or out of range");
+        return;
+    }
+    if ((incr < 0 && v < 0 && incr < INT64_MIN - v) ||
+            (incr > 0 && v > 0 && incr > INT64_MAX - v)) {
+        add_reply_error(c, "increment or decrement would overflow");
+        return;
+    }
+    v += incr;
+
+    if (o != NULL && o->encoding == OBJ_ENCODING_INT && o->refcount == 1 &&
+            (v < 0 || v >= OBJ_SHARED_INTEGERS)) {
+        o->ptr = (void*) (intptr_t) v;
+    } else {
+        struct robj_t* no = create_string_object_from_long_long(v);
+        if (no == NULL ||
+                set_key(server.db, key->ptr, key->len, no) != DICT_OK) {
+            add_reply_error(c, "out of memory");
+            return;
+        }
+    }
+    signal_modified_key(key->ptr, key->len);
+    server.dirty++;
+    add_reply_long_long(c, v);
+}
+
+static int32_t get_increment(struct client_t* c, int64_t* incr) {
+    if (!resp_string2ll(c->req.argv[2].ptr, c->req.argv[2].len, incr)) {
+        add_reply_error(c, "value is not an integer or out of range");
+        return -1;
+    }
+    return 0;
+}
+
+void incr_command(struct client_t* c) {
+    incr_generic(c, 1);
+}
+
+void decr_command(struct client_t* c) {
+    incr_generic(c, -1);
+}
+
+void incrby_command(struct client_t* c) {
+    int64_t incr;
+    if (get_increment(c, &incr) == -1) return;
+    incr_generic(c, incr);
+}
+
+void decrby_command(struct client_t* c) {
+    int64_t incr;
+    if (get_increment(c, &incr) == -1) return;
+    if (incr == INT64_MIN) {
+        add_reply_error(c, "decrement would overflow");
+        return;
+    }
+    incr_generic(c, -incr);
+}
+
+void append_command(struct client_t* c) {
+    struct resp_arg_t* key = &c->req.argv[1];
+    struct resp_arg_t* arg = &c->req.argv[2];
+    struct robj_t* o = lookup_key_write(server.db, key->ptr, key->len);
+
+    if (check_type(c, o, OBJ_STRING)) return;
+    if (o == NULL) {
+        o = create_string_object(arg->ptr, arg->len);
+        if (o == NULL ||
+                set_key(server.db, key->ptr, key->len, o) != DICT_OK) {
+            add_reply_error(c, "out of memory");
+            return;
+        }
+        signal_modified_key(key->ptr, key->len);
+        server.dirty++;
+        add_reply_long_long(c, arg->len);
+        return;
+    }
+
+    size_t total = obj_string_len(o) + arg->len;
+    if (total > RESP_MAX_BULK_LEN) {
+        add_reply_error(c, "string exceeds maximum allowed size");
+        return;
+    }
+
+    o = db_unshare_string_value(server.db, key->ptr, key->len, o);
+    if (o == NULL || raw_string_reserve(o, total) == -1) {
+        add_reply_error(c, "out of memory");
+        return;
+    }
+
+    struct rstr_t* str = o->ptr;
+    memcpy(str->buf + str->len, arg->ptr, arg->len);
+    str->len = total;
+    str->buf[total] = '\0';
+
+    signal_modified_key(key->ptr, key->len);
+    server.dirty++;
+    add_reply_long_long(c, total);
+}
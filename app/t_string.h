@@ -0,0 +1,26 @@
+#ifndef T_STRING_H
+#define T_STRING_H
+
+#include "networking.h"
+#include "object.h"
+
+
+void add_reply_bulk_object(struct client_t*, struct robj_t*);
+
+void set_command(struct client_t*);
+
+void get_command(struct client_t*);
+
+void strlen_command(struct client_t*);
+
+void incr_command(struct client_t*);
+
+void decr_command(struct client_t*);
+
+void incrby_command(struct client_t*);
+
+void decrby_command(struct client_t*);
+
+void append_command(struct client_t*);
+
+#endif // !T_STRING_H
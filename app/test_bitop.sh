@@ -0,0 +1,27 @@
+#!/bin/bash
+#
+# BITOP over missing and empty sources replies 0 and deletes the destination.
+# Run against a server listening on localhost 6379.
+
+exec 3<>/dev/tcp/localhost/6379
+printf '*3\r\n$3\r\nSET\r\n$1\r\nd\r\n$1\r\nx\r\n' >&3
+printf '*4\r\n$5\r\nBITOP\r\n$3\r\nAND\r\n$1\r\nd\r\n$5\r\nnokey\r\n' >&3
+printf '*2\r\n$6\r\nEXISTS\r\n$1\r\nd\r\n' >&3
+printf '*3\r\n$3\r\nSET\r\n$1\r\ne\r\n$0\r\n\r\n' >&3
+printf '*4\r\n$5\r\nBITOP\r\n$2\r\nOR\r\n$1\r\nd\r\n$1\r\ne\r\n' >&3
+printf '*5\r\n$5\r\nBITOP\r\n$3\r\nXOR\r\n$1\r\nd\r\n$1\r\ne\r\n$5\r\nnokey\r\n' >&3
+printf '*4\r\n$5\r\nBITOP\r\n$3\r\nNOT\r\n$1\r\nd\r\n$1\r\ne\r\n' >&3
+printf '*1\r\n$4\r\nPING\r\n' >&3
+
+expected=$'+OK\r\n:0\r\n:0\r\n+OK\r\n:0\r\n:0\r\n:0\r\n+PONG\r\n'
+got=$(head -c ${#expected} <&3)
+exec 3<&-
+
+# $(...) drops the final newline
+if [ "$got" == "${expected%$'\n'}" ]; then
+    echo "ok"
+else
+    echo "FAIL: got"
+    printf '%s' "$got" | od -c
+    exit 1
+fi
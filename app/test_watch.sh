@@ -0,0 +1,57 @@
+#!/bin/bash
+#
+# WATCH only fails EXEC when a watched key is written, not when another
+# command reads it or finds it missing. Run against a server listening on
+# localhost 6379, whose keys are flushed.
+
+exec 3<>/dev/tcp/localhost/6379 # watches
+exec 4<>/dev/tcp/localhost/6379 # writes
+
+cmd() {
+    local fd=$1
+    shift
+    printf '*%d\r\n' $# >&$fd
+    for a in "$@"; do printf '$%d\r\n%s\r\n' ${#a} "$a" >&$fd; done
+}
+
+fail=0
+
+expect() {
+    local got
+    got=$(timeout 2 head -c ${#2} <&$1)
+    # $(...) drops the final newline
+    if [ "$got" != "${2%$'\n'}" ]; then
+        echo "FAIL: $3, got"
+        printf '%s' "$got" | od -c
+        fail=1
+    fi
+}
+
+# watched key, write by the other client, expected EXEC reply
+check() {
+    cmd 3 WATCH "$1"
+    expect 3 $'+OK\r\n' "WATCH $1"
+    cmd 4 "${@:2:$#-3}"
+    expect 4 "${@: -2:1}" "${*:2:$#-3}"
+    cmd 3 MULTI
+    cmd 3 PING
+    cmd 3 EXEC
+    expect 3 $'+OK\r\n+QUEUED\r\n'"${@: -1}" "EXEC after ${*:2:$#-3}"
+}
+
+pong=$'*1\r\n+PONG\r\n'
+aborted=$'*-1\r\n'
+
+cmd 4 FLUSHALL; expect 4 $'+OK\r\n' "FLUSHALL"
+cmd 4 SET src x; expect 4 $'+OK\r\n' "SET src"
+cmd 4 PFADD h1 a; expect 4 $':1\r\n' "PFADD h1"
+cmd 4 SET zz 1; expect 4 $'+OK\r\n' "SET zz"
+
+check src BITOP AND dst src $':1\r\n' "$pong"
+check h1 PFMERGE hm h1 $'+OK\r\n' "$pong"
+check xx DEL zz xx $':1\r\n' "$pong"
+check dst BITOP OR dst src $':1\r\n' "$aborted"
+
+exec 3<&- 4<&-
+[ $fail == 0 ] && echo "ok"
+exit $fail
@@ -1,6 +1,5 @@
 #include <assert.h>
 #include <bits/time.h>
-#include <fcntl.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -9,13 +8,14 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "log.h"
 #include "thread_pool.h"
 
 
 struct thread_work_t* create_thread_work(client_handler_t ch, int32_t cfd) {
     struct thread_work_t* tw = calloc(1, sizeof(struct thread_work_t));
     if (tw == NULL) {
-        printf("create_thread_work: calloc error\n");
+        log_warning("create_thread_work: calloc error");
         return NULL;
     }
 
@@ -36,7 +36,7 @@ void destory_thread_work(struct thread_work_t* tw) {
 int32_t enqueue_thread_work(struct thread_pool_t* tp, client_handler_t ch, 
         int32_t cfd) {
     if (tp == NULL) {
-        printf("enqueue_thread_work: NULL thread pool\n");
+        log_warning("enqueue_thread_work: NULL thread pool");
         return 0;
     }
 
@@ -49,12 +49,12 @@ int32_t enqueue_thread_work(struct thread_pool_t* tp, client_handler_t ch,
 
     struct timespec deadline;
     clock_gettime(CLOCK_REALTIME, &deadline);
-    deadline.tv_sec = 60;
+    deadline.tv_sec += 60;
 
     /** Critical Section */
     if ((rval = pthread_mutex_timedlock(&tp->queue_mutex, &deadline)) != 0) {
-        printf("enqueue_thread_work: mutex lock timeout (%d). abort work \
-                enqueue\n", rval);
+        log_warning("enqueue_thread_work: mutex lock timeout (%d). abort work "
+                "enqueue", rval);
         return rval;
     }
 
@@ -71,11 +71,11 @@ int32_t enqueue_thread_work(struct thread_pool_t* tp, client_handler_t ch,
 
     int32_t r = 1;
     if (pthread_cond_broadcast(&tp->enqueue_cond) != 0) {
-        printf("enqueue_thread_work: broadcast error (%d).\n", rval);
+        log_warning("enqueue_thread_work: broadcast error (%d).", rval);
         r = rval;
     }
     if ((rval = pthread_mutex_unlock(&tp->queue_mutex)) != 0) {
-        printf("enqueue_thread_work: mutex unlock error (%d).\n", rval);
+        log_warning("enqueue_thread_work: mutex unlock error (%d).", rval);
         r = rval;
     }
     /** Critical Section */
@@ -83,16 +83,9 @@ int32_t enqueue_thread_work(struct thread_pool_t* tp, client_handler_t ch,
     return r;
 }
 
-struct thread_work_t* dequeue_thread_work(struct thread_pool_t* tp, char* log, 
-        int32_t lfd) {
-    assert(log != NULL);
-
-    pthread_t tid = pthread_self();
-
+struct thread_work_t* dequeue_thread_work(struct thread_pool_t* tp) {
     if (tp == NULL) {
-        sprintf(log, "(thread %lu) dequeue_thread_work: NULL thread_pool\n",
-                tid);
-        write(lfd, log, LOG_MSG_SIZE * sizeof(char));
+        log_warning("dequeue_thread_work: NULL thread_pool");
         return NULL;
     }
 
@@ -121,23 +114,8 @@ void* worker_main(void* args) {
     struct thread_pool_t* tp = args;
     struct thread_work_t* tw = NULL;
 
-    pthread_t tid = pthread_self();
-
-    char logf[LOG_NAME_SIZE];
-    char log[LOG_MSG_SIZE];
-    memset(logf, 0, LOG_NAME_SIZE * sizeof(char));
-    memset(log, 0, LOG_MSG_SIZE * sizeof(char));
-
-    sprintf(logf, "%ld.tlog", tid);
-    int32_t lfd = open(logf, O_RDWR | O_CREAT | O_TRUNC | O_SYNC, 0644);
-    if (lfd == -1) {
-        return NULL;
-    }
-
     if (tp == NULL) {
-        sprintf(log, "(thread %lu) worker_main: receive NULL thread pool", tid);
-        write(lfd, log, LOG_MSG_SIZE);
-        close(lfd);
+        log_warning("worker_main: receive NULL thread pool");
         return NULL;
     }
 
@@ -146,13 +124,11 @@ void* worker_main(void* args) {
 
     while (1) {
         clock_gettime(CLOCK_REALTIME, &deadline);
-        deadline.tv_sec = 60;
+        deadline.tv_sec += 60;
         
         /** Critical Section */
         if ((rval = pthread_mutex_timedlock(&tp->queue_mutex, &deadline)) != 0) {
-            sprintf(log, "(thread %ld) worker_main: mutex lock timeout (%d)",
-                    tid, rval);
-            write(lfd, log, LOG_MSG_SIZE);
+            log_warning("worker_main: mutex lock timeout (%d)", rval);
             continue;
         }
 
@@ -160,10 +136,8 @@ void* worker_main(void* args) {
             assert(tp->queue_size == 0);
             if ((rval = pthread_cond_wait(&tp->enqueue_cond, &tp->queue_mutex)) 
                     != 0) {
-                sprintf(log, "(thread %ld) worker_main: pthread_cond_wait \
-                        error (%d).\n", tid, rval);
-                write(lfd, log, LOG_MSG_SIZE);
-                close(lfd);
+                log_warning("worker_main: pthread_cond_wait error (%d).", rval);
+                log_shutdown();
                 exit(1);
             }
         }
@@ -172,18 +146,16 @@ void* worker_main(void* args) {
             break;
         }
 
-        tw = dequeue_thread_work(tp, log, lfd);
+        tw = dequeue_thread_work(tp);
         if ((rval = pthread_mutex_unlock(&tp->queue_mutex)) != 0) {
-            sprintf(log, "(thread %ld) worker_main: mutex unlock error (%d).\n",
-                    tid, rval);
-            write(lfd, log, LOG_MSG_SIZE);
-            close(lfd);
+            log_warning("worker_main: mutex unlock error (%d).", rval);
+            log_shutdown();
             exit(1);
         }
         /** Critical Section */
 
         if (tw != NULL) {
-            tw->client_handler(tw->client_fd, lfd);
+            tw->client_handler(tw->client_fd);
             destory_thread_work(tw);
         }
     }
@@ -198,19 +170,19 @@ void* worker_main(void* args) {
 struct thread_pool_t* create_thread_pool() {
     struct thread_pool_t* tp = calloc(1, sizeof(struct thread_pool_t));
     if (tp == NULL) {
-        printf("create_thread_pool: calloc error\n");
+        log_warning("create_thread_pool: calloc error");
         return NULL;
     }
 
     int32_t rval = -1;
     if ((rval = pthread_mutex_init(&tp->queue_mutex, NULL)) != 0) {
-        printf("create_thread_pool: mutex init error\n");
+        log_warning("create_thread_pool: mutex init error");
         free(tp);
         return NULL;
     }
     
     if((rval = pthread_cond_init(&tp->enqueue_cond, NULL)) != 0) {
-        printf("create_thread_pool: mutex init error\n");
+        log_warning("create_thread_pool: mutex init error");
         destory_thread_pool(tp);
         return NULL;
     }
@@ -222,12 +194,12 @@ struct thread_pool_t* create_thread_pool() {
     pthread_t tid = 0;
     for (uint8_t i = 0; i < THREAD_LIMIT; i++) {
         if ((rval = pthread_create(&tid, NULL, worker_main, tp)) != 0) {
-            printf("create_thread_pool: thread creation error (%d).\n", rval);
+            log_warning("create_thread_pool: thread creation error (%d).", rval);
             continue;
         }
         tp->active_thread++;
         if ((rval = pthread_detach(tid)) != 0) {
-            printf("create_threa_pool: thread detachment erro (%d).\n", rval);
+            log_warning("create_threa_pool: thread detachment erro (%d).", rval);
         }
     }
 
@@ -236,7 +208,7 @@ struct thread_pool_t* create_thread_pool() {
 
 int32_t destory_thread_pool(struct thread_pool_t* tp) {
     if (tp == NULL) {
-        printf("destory_thread_pool: NULL thread pool\n");
+        log_warning("destory_thread_pool: NULL thread pool");
         return 1;
     }
 
@@ -245,7 +217,7 @@ int32_t destory_thread_pool(struct thread_pool_t* tp) {
     struct thread_work_t* prev = NULL;
 
     if ((rval = pthread_mutex_lock(&tp->queue_mutex)) != 0) {
-        printf("destory_thread_pool: mutex lock error (%d)\n", rval);
+        log_warning("destory_thread_pool: mutex lock error (%d)", rval);
         return 0;
     }
 
@@ -260,23 +232,23 @@ int32_t destory_thread_pool(struct thread_pool_t* tp) {
 
     int32_t r = 1;
     if ((rval = pthread_cond_broadcast(&tp->enqueue_cond)) != 0) {
-        printf("destory_thread_pool: broadcast error (%d)\n", rval);
+        log_warning("destory_thread_pool: broadcast error (%d)", rval);
         return 0;
     }
 
     if ((rval = pthread_mutex_unlock(&tp->queue_mutex)) != 0) {
-        printf("destory_thread_pool: mutex unlock error (%d)\n", rval);
+        log_warning("destory_thread_pool: mutex unlock error (%d)", rval);
         return 0;
     }
 
     /** Wait */
 
     if ((rval = pthread_mutex_destroy(&tp->queue_mutex)) != 0) {
-        printf("destory_thread_pool: mutex destory error (%d)\n", rval);
+        log_warning("destory_thread_pool: mutex destory error (%d)", rval);
         r = 0;
     }
     if ((rval = pthread_cond_destroy(&tp->enqueue_cond)) != 0) {
-        printf("destory_thread_pool: mutex destory error (%d)\n", rval);
+        log_warning("destory_thread_pool: mutex destory error (%d)", rval);
         r = 0;
     }
 
@@ -8,11 +8,8 @@
 
 #define THREAD_LIMIT 4
 
-#define LOG_NAME_SIZE 64
-#define LOG_MSG_SIZE  128
 
-
-typedef void(* client_handler_t)(int32_t, int32_t);
+typedef void(* client_handler_t)(int32_t);
 
 
 struct thread_pool_t {
@@ -40,7 +37,7 @@ void destory_thread_work(struct thread_work_t*);
 int32_t enqueue_thread_work(struct thread_pool_t*, client_handler_t, int32_t);
 
 /** Called by worker thread */
-struct thread_work_t* dequeue_thread_work(struct thread_pool_t*, char*, int32_t);
+struct thread_work_t* dequeue_thread_work(struct thread_pool_t*);
 
 void* worker_main(void*);
 
@@ -0,0 +1,553 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "dict.h"
+#include "log.h"
+#include "networking.h"
+#include "rax.h"
+#include "server.h"
+#include "tracking.h"
+
+/** Client ids are rax keys as 8 big endian bytes, so they sort numerically */
+#define TRACKING_ID_SIZE 8
+
+#define CLIENT_TRACKING_ALL (CLIENT_TRACKING | CLIENT_TRACKING_BCAST | \
+        CLIENT_TRACKING_OPTIN | CLIENT_TRACKING_OPTOUT | \
+        CLIENT_TRACKING_CACHING | CLIENT_TRACKING_NOLOOP | \
+        CLIENT_TRACKING_BROKEN_REDIR)
+
+
+/**
+ * Value of a key in the tracking table: the ids of the clients that may
+ * have it cached, sorted. Ids only grow, so most inserts append.
+ * */
+struct tracking_ids_t {
+    uint32_t n;
+    uint32_t cap;
+    uint64_t ids[];
+};
+
+/** A broadcast prefix: its clients and the keys modified since the flush */
+struct bcast_state_t {
+    struct rax_t* clients; // id -> client_t
+    struct rax_t* keys;    // key -> id of the only modifier, 0 if several
+};
+
+/** Where tracking_limit_used_slots() resumes, NULL starts over */
+static unsigned char* evict_cursor;
+static size_t         evict_cursor_len;
+static size_t         evict_cursor_cap;
+
+
+int32_t tracking_init() {
+    server.tracking_table = create_rax();
+    server.tracking_prefix_table = create_rax();
+    if (server.tracking_table == NULL ||
+            server.tracking_prefix_table == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+static void encode_id(unsigned char* key, uint64_t id) {
+    for (int32_t i = 0; i < TRACKING_ID_SIZE; i++) {
+        key[i] = id >> (56 - 8 * i);
+    }
+}
+
+uint64_t tracking_get_total_keys() {
+    return rax_size(server.tracking_table);
+}
+
+uint64_t tracking_get_total_prefixes() {
+    return rax_size(server.tracking_prefix_table);
+}
+
+/** ------------------------------ Messages ------------------------------- */
+
+/**
+ * The client subscribed to TRACKING_CHANNEL that gets the invalidations of
+ * `c`, or NULL when there is none to send to.
+ * */
+static struct client_t* tracking_target(struct client_t* c) {
+    struct client_t* t = lookup_client_by_id(c->client_tracking_redirection);
+    if (t == NULL) {
+        if (!(c->flags & CLIENT_TRACKING_BROKEN_REDIR)) {
+            log_verbose("[tracking_target] client %lu redirects to client "
+                    "%lu which is gone", (unsigned long) c->id,
+                    (unsigned long) c->client_tracking_redirection);
+            c->flags |= CLIENT_TRACKING_BROKEN_REDIR;
+        }
+        return NULL;
+    }
+    if (t->pubsub_channels == NULL || dict_find(t->pubsub_channels,
+                TRACKING_CHANNEL, TRACKING_CHANNEL_LEN) == NULL) {
+        return NULL;
+    }
+    return t;
+}
+
+/**
+ * Start a message of `n` keys to the target of `c`, the caller adds the
+ * keys as bulks. -1 sends a null array, "everything". Return the target.
+ * */
+static struct client_t* begin_message(struct client_t* c, int64_t n) {
+    struct client_t* t = tracking_target(c);
+    if (t == NULL) return NULL;
+
+    add_reply_array_len(t, 3);
+    add_reply_bulk(t, "message", 7);
+    add_reply_bulk(t, TRACKING_CHANNEL, TRACKING_CHANNEL_LEN);
+    if (n < 0) {
+        add_reply_null_array(t);
+    } else {
+        add_reply_array_len(t, n);
+    }
+    return t;
+}
+
+/** ------------------------------ Enabling ------------------------------- */
+
+static void free_bcast_state(struct bcast_state_t* bs) {
+    free_rax(bs->clients, NULL);
+    free_rax(bs->keys, NULL);
+    free(bs);
+}
+
+static int32_t add_prefix(struct client_t* c, const char* prefix,
+        size_t len) {
+    struct bcast_state_t* bs = NULL;
+    unsigned char id[TRACKING_ID_SIZE];
+
+    if (c->client_tracking_prefixes == NULL &&
+            (c->client_tracking_prefixes = create_rax()) == NULL) {
+        return -1;
+    }
+    if (!rax_find(server.tracking_prefix_table, (const unsigned char*) prefix,
+                len, (void**) &bs)) {
+        bs = malloc(sizeof(struct bcast_state_t));
+        if (bs == NULL) return -1;
+        bs->clients = create_rax();
+        bs->keys = create_rax();
+        if (bs->clients == NULL || bs->keys == NULL ||
+                rax_insert(server.tracking_prefix_table,
+                    (const unsigned char*) prefix, len, bs, NULL) == -1) {
+            if (bs->clients != NULL) free_rax(bs->clients, NULL);
+            if (bs->keys != NULL) free_rax(bs->keys, NULL);
+            free(bs);
+            return -1;
+        }
+    }
+
+    /** The client's own list first, disable_tracking() undoes through it */
+    if (rax_insert(c->client_tracking_prefixes,
+                (const unsigned char*) prefix, len, NULL, NULL) == -1) {
+        return -1;
+    }
+    encode_id(id, c->id);
+    if (rax_insert(bs->clients, id, sizeof id, c, NULL) == -1) {
+        rax_remove(c->client_tracking_prefixes,
+                (const unsigned char*) prefix, len, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+int32_t enable_tracking(struct client_t* c, uint64_t redirect,
+        uint32_t options, const struct resp_arg_t* prefixes,
+        int32_t nprefixes) {
+    if (!(c->flags & CLIENT_TRACKING)) server.tracking_clients++;
+    c->flags &= ~(CLIENT_TRACKING_ALL & ~CLIENT_TRACKING);
+    c->flags |= CLIENT_TRACKING | options;
+    c->client_tracking_redirection = redirect;
+
+    if (!(options & CLIENT_TRACKING_BCAST)) return 0;
+
+    /** No prefix is the empty one, every key matches it */
+    if (nprefixes == 0 && c->client_tracking_prefixes == NULL &&
+            add_prefix(c, "", 0) == -1) {
+        disable_tracking(c);
+        return -1;
+    }
+    for (int32_t i = 0; i < nprefixes; i++) {
+        if (add_prefix(c, prefixes[i].ptr, prefixes[i].len) == -1) {
+            disable_tracking(c);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void disable_tracking(struct client_t* c) {
+    if (!(c->flags & CLIENT_TRACKING)) return;
+
+    if (c->client_tracking_prefixes != NULL) {
+        unsigned char id[TRACKING_ID_SIZE];
+        struct rax_iter_t ri;
+
+        encode_id(id, c->id);
+        rax_iter_start(&ri, c->client_tracking_prefixes);
+        int32_t more = rax_seek(&ri, "^", NULL, 0);
+        for (; more; more = rax_next(&ri)) {
+            struct bcast_state_t* bs;
+            if (!rax_find(server.tracking_prefix_table, ri.key, ri.key_len,
+                        (void**) &bs)) {
+                continue;
+            }
+            rax_remove(bs->clients, id, sizeof id, NULL);
+            if (rax_size(bs->clients) == 0) {
+                rax_remove(server.tracking_prefix_table, ri.key, ri.key_len,
+                        NULL);
+                free_bcast_state(bs);
+            }
+        }
+        rax_iter_release(&ri);
+
+        free_rax(c->client_tracking_prefixes, NULL);
+        c->client_tracking_prefixes = NULL;
+    }
+
+    c->flags &= ~CLIENT_TRACKING_ALL;
+    c->client_tracking_redirection = 0;
+
+    /** Nobody is left to invalidate, forget every key at once */
+    if (--server.tracking_clients == 0 &&
+            rax_size(server.tracking_table) > 0) {
+        struct rax_t* t = create_rax();
+        if (t != NULL) {
+            free_rax(server.tracking_table, free);
+            server.tracking_table = t;
+        }
+    }
+}
+
+/** Prefixes overlap when one starts with the other */
+static int32_t prefixes_overlap(const char* a, size_t alen, const char* b,
+        size_t blen) {
+    size_t n = alen < blen ? alen : blen;
+    return n == 0 || memcmp(a, b, n) == 0;
+}
+
+int32_t tracking_check_prefixes(struct client_t* c,
+        const struct resp_arg_t* prefixes, int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        const struct resp_arg_t* p = &prefixes[i];
+
+        if (c->client_tracking_prefixes != NULL) {
+            struct rax_iter_t ri;
+            int32_t overlap = 0;
+
+            rax_iter_start(&ri, c->client_tracking_prefixes);
+            int32_t more = rax_seek(&ri, "^", NULL, 0);
+            while (more && !(overlap = prefixes_overlap(p->ptr, p->len,
+                            (const char*) ri.key, ri.key_len))) {
+                more = rax_next(&ri);
+            }
+            if (overlap) {
+                add_reply_error_format(c, "Prefix '%.*s' overlaps with an "
+                        "existing prefix '%.*s'. Prefixes for a single "
+                        "client must not overlap.",
+                        (int) (p->len > 64 ? 64 : p->len), p->ptr,
+                        (int) (ri.key_len > 64 ? 64 : ri.key_len),
+                        (const char*) ri.key);
+            }
+            rax_iter_release(&ri);
+            if (overlap) return 1;
+        }
+
+        for (int32_t j = i + 1; j < n; j++) {
+            const struct resp_arg_t* q = &prefixes[j];
+            if (prefixes_overlap(p->ptr, p->len, q->ptr, q->len)) {
+                add_reply_error_format(c, "Prefix '%.*s' overlaps with "
+                        "another provided prefix '%.*s'. Prefixes for a "
+                        "single client must not overlap.",
+                        (int) (p->len > 64 ? 64 : p->len), p->ptr,
+                        (int) (q->len > 64 ? 64 : q->len), q->ptr);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/** ------------------------------ Tracking ------------------------------- */
+
+/** Add the id to the key's entry, creating it, return -1 out of memory */
+static int32_t remember_key(const char* key, size_t len, uint64_t id) {
+    struct tracking_ids_t* ids = NULL;
+
+    if (!rax_find(server.tracking_table, (const unsigned char*) key, len,
+                (void**) &ids)) {
+        ids = malloc(sizeof(struct tracking_ids_t) + 2 * sizeof(uint64_t));
+        if (ids == NULL) return -1;
+        ids->n = 0;
+        ids->cap = 2;
+        if (rax_insert(server.tracking_table, (const unsigned char*) key,
+                    len, ids, NULL) == -1) {
+            free(ids);
+            return -1;
+        }
+    }
+
+    uint32_t lo = ids->n;
+    if (lo > 0 && ids->ids[lo - 1] >= id) {
+        uint32_t hi = lo - 1;
+        lo = 0;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (ids->ids[mid] < id) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (ids->ids[lo] == id) return 0;
+    }
+
+    if (ids->n == ids->cap) {
+        uint32_t cap = ids->cap * 2;
+        struct tracking_ids_t* grown = realloc(ids,
+                sizeof(struct tracking_ids_t) + cap * sizeof(uint64_t));
+        if (grown == NULL) return -1;
+        grown->cap = cap;
+        /** Overwriting an existing key does not allocate */
+        rax_insert(server.tracking_table, (const unsigned char*) key, len,
+                grown, NULL);
+        ids = grown;
+    }
+    memmove(ids->ids + lo + 1, ids->ids + lo,
+            (ids->n - lo) * sizeof(uint64_t));
+    ids->ids[lo] = id;
+    ids->n++;
+    return 0;
+}
+
+void tracking_remember_keys(struct client_t* c,
+        const struct resp_arg_t* argv, const int32_t* keys, int32_t n) {
+    uint32_t caching = c->flags & CLIENT_TRACKING_CACHING;
+    if (((c->flags & CLIENT_TRACKING_OPTIN) && !caching) ||
+            ((c->flags & CLIENT_TRACKING_OPTOUT) && caching)) {
+        return;
+    }
+
+    for (int32_t i = 0; i < n; i++) {
+        const struct resp_arg_t* k = &argv[keys[i]];
+        if (remember_key(k->ptr, k->len, c->id) == -1) {
+            log_warning("[tracking_remember_keys] tracking table "
+                    "allocation error");
+            return;
+        }
+    }
+}
+
+/**
+ * Drop the key from the tracking table and send it to every client that
+ * read it, and still tracks in the default mode. Ids of clients gone since
+ * are skipped here rather than searched for when a client leaves.
+ * */
+static void invalidate_tracked_key(struct client_t* modifier,
+        const char* key, size_t len) {
+    struct tracking_ids_t* ids;
+    if (!rax_remove(server.tracking_table, (const unsigned char*) key, len,
+                (void**) &ids)) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < ids->n; i++) {
+        struct client_t* c = lookup_client_by_id(ids->ids[i]);
+        if (c == NULL || (c->flags & (CLIENT_TRACKING |
+                        CLIENT_TRACKING_BCAST)) != CLIENT_TRACKING) {
+            continue;
+        }
+        if ((c->flags & CLIENT_TRACKING_NOLOOP) && c == modifier) continue;
+
+        struct client_t* t = begin_message(c, 1);
+        if (t != NULL) add_reply_bulk(t, key, len);
+    }
+    free(ids);
+}
+
+/** Queue the key for the clients of every prefix it starts with */
+static void queue_broadcast_key(struct client_t* modifier, const char* key,
+        size_t len) {
+    uint64_t id = modifier != NULL ? modifier->id : 0;
+    struct rax_iter_t ri;
+
+    rax_iter_start(&ri, server.tracking_prefix_table);
+    int32_t more = rax_seek(&ri, "^", NULL, 0);
+    for (; more; more = rax_next(&ri)) {
+        struct bcast_state_t* bs = ri.value;
+        void* old;
+
+        if (ri.key_len > len || (ri.key_len > 0 &&
+                    memcmp(ri.key, key, ri.key_len) != 0)) {
+            continue;
+        }
+        int32_t r = rax_insert(bs->keys, (const unsigned char*) key, len,
+                (void*) (uintptr_t) id, &old);
+        /** Modified by several clients, NOLOOP cannot skip anybody */
+        if (r == 0 && old != (void*) (uintptr_t) id) {
+            rax_insert(bs->keys, (const unsigned char*) key, len, NULL,
+                    NULL);
+        }
+    }
+    rax_iter_release(&ri);
+}
+
+void tracking_invalidate_key(struct client_t* modifier, const char* key,
+        size_t len) {
+    if (server.tracking_clients == 0) return;
+
+    if (rax_size(server.tracking_prefix_table) > 0) {
+        queue_broadcast_key(modifier, key, len);
+    }
+    if (rax_size(server.tracking_table) > 0) {
+        invalidate_tracked_key(modifier, key, len);
+    }
+}
+
+void tracking_invalidate_all() {
+    if (server.tracking_clients == 0) return;
+
+    struct rax_iter_t ri;
+    rax_iter_start(&ri, server.clients_index);
+    int32_t more = rax_seek(&ri, "^", NULL, 0);
+    for (; more; more = rax_next(&ri)) {
+        struct client_t* c = ri.value;
+        if (!(c->flags & CLIENT_TRACKING)) continue;
+        if ((c->flags & CLIENT_TRACKING_NOLOOP) &&
+                c == server.current_client) {
+            continue;
+        }
+        begin_message(c, -1);
+    }
+    rax_iter_release(&ri);
+
+    struct rax_t* t = create_rax();
+    if (t != NULL) {
+        free_rax(server.tracking_table, free);
+        server.tracking_table = t;
+    }
+
+    /** Whatever was queued is covered by the null message */
+    rax_iter_start(&ri, server.tracking_prefix_table);
+    more = rax_seek(&ri, "^", NULL, 0);
+    for (; more; more = rax_next(&ri)) {
+        struct bcast_state_t* bs = ri.value;
+        struct rax_t* keys = create_rax();
+        if (keys == NULL) continue;
+        free_rax(bs->keys, NULL);
+        bs->keys = keys;
+    }
+    rax_iter_release(&ri);
+}
+
+/** ------------------------------ Broadcast ------------------------------ */
+
+/** Send the keys of `bs` to `c`, but those only `c` modified with NOLOOP */
+static void broadcast_to_client(struct client_t* c,
+        struct bcast_state_t* bs) {
+    uint64_t skip = (c->flags & CLIENT_TRACKING_NOLOOP) ? c->id : 0;
+    struct rax_iter_t ri;
+    int64_t n = 0;
+
+    /** Count first, the array length goes before the keys */
+    rax_iter_start(&ri, bs->keys);
+    int32_t more = rax_seek(&ri, "^", NULL, 0);
+    for (; more; more = rax_next(&ri)) {
+        n += skip == 0 || (uint64_t) (uintptr_t) ri.value != skip;
+    }
+
+    struct client_t* t = n > 0 ? begin_message(c, n) : NULL;
+    if (t != NULL) {
+        more = rax_seek(&ri, "^", NULL, 0);
+        for (; more; more = rax_next(&ri)) {
+            if (skip != 0 && (uint64_t) (uintptr_t) ri.value == skip) {
+                continue;
+            }
+            add_reply_bulk(t, (const char*) ri.key, ri.key_len);
+        }
+    }
+    rax_iter_release(&ri);
+}
+
+void tracking_broadcast_invalidations() {
+    struct rax_iter_t ri;
+
+    if (rax_size(server.tracking_prefix_table) == 0) return;
+
+    rax_iter_start(&ri, server.tracking_prefix_table);
+    int32_t more = rax_seek(&ri, "^", NULL, 0);
+    for (; more; more = rax_next(&ri)) {
+        struct bcast_state_t* bs = ri.value;
+        struct rax_iter_t ci;
+
+        if (rax_size(bs->keys) == 0) continue;
+
+        rax_iter_start(&ci, bs->clients);
+        int32_t cmore = rax_seek(&ci, "^", NULL, 0);
+        for (; cmore; cmore = rax_next(&ci)) {
+            broadcast_to_client(ci.value, bs);
+        }
+        rax_iter_release(&ci);
+
+        struct rax_t* keys = create_rax();
+        if (keys == NULL) {
+            log_warning("[tracking_broadcast_invalidations] rax "
+                    "allocation error");
+            continue;
+        }
+        free_rax(bs->keys, NULL);
+        bs->keys = keys;
+    }
+    rax_iter_release(&ri);
+}
+
+/** ------------------------------ Eviction ------------------------------- */
+
+static int32_t save_evict_cursor(const unsigned char* key, size_t len) {
+    if (len > evict_cursor_cap || evict_cursor == NULL) {
+        size_t cap = len < 64 ? 64 : len;
+        unsigned char* buf = realloc(evict_cursor, cap);
+        if (buf == NULL) return -1;
+        evict_cursor = buf;
+        evict_cursor_cap = cap;
+    }
+    memcpy(evict_cursor, key, len);
+    evict_cursor_len = len;
+    return 0;
+}
+
+/**
+ * Keys are evicted round robin from where the last call stopped, so a key
+ * that is read over and over is not evicted more often than the others.
+ * */
+void tracking_limit_used_slots() {
+    uint64_t max = config.tracking_table_max_keys;
+    if (max == 0 || rax_size(server.tracking_table) <= max) return;
+
+    struct rax_iter_t ri;
+    uint32_t evicted = 0;
+
+    rax_iter_start(&ri, server.tracking_table);
+    while (rax_size(server.tracking_table) > max &&
+            evicted < TRACKING_EVICT_MAX_KEYS) {
+        int32_t found = evict_cursor != NULL &&
+            rax_seek(&ri, ">", evict_cursor, evict_cursor_len);
+        if (!found && !rax_seek(&ri, "^", NULL, 0)) break;
+        if (save_evict_cursor(ri.key, ri.key_len) == -1) break;
+
+        invalidate_tracked_key(NULL, (const char*) evict_cursor,
+                evict_cursor_len);
+        evicted++;
+    }
+    rax_iter_release(&ri);
+
+    if (evicted > 0) {
+        log_verbose("[tracking_limit_used_slots] evicted %u keys, %lu "
+                "tracked", evicted,
+                (unsigned long) rax_size(server.tracking_table));
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef TRACKING_H
+#define TRACKING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "networking.h"
+#include "resp.h"
+
+/** Channel the invalidation messages are published on for REDIRECT */
+#define TRACKING_CHANNEL     "__redis__:invalidate"
+#define TRACKING_CHANNEL_LEN (sizeof TRACKING_CHANNEL - 1)
+
+/** Keys evicted from an oversized tracking table per call */
+#define TRACKING_EVICT_MAX_KEYS 1000
+
+
+/** Set up the tracking table and the broadcast prefixes */
+int32_t tracking_init();
+
+/**
+ * Turn tracking on for the client, sending invalidations to the client
+ * `redirect`, with the CLIENT_TRACKING_* `options`. In broadcast mode the
+ * client is registered for every prefix (all keys if there is none).
+ * Return -1 out of memory, tracking is left off then.
+ * */
+int32_t enable_tracking(struct client_t*, uint64_t, uint32_t,
+        const struct resp_arg_t*, int32_t);
+
+/** Turn tracking off and forget the client's broadcast prefixes */
+void disable_tracking(struct client_t*);
+
+/**
+ * Return 1 after replying an error when one of the prefixes would overlap
+ * another one, or one the client already has.
+ * */
+int32_t tracking_check_prefixes(struct client_t*, const struct resp_arg_t*,
+        int32_t);
+
+/**
+ * Remember that the client read the keys of the request it just executed,
+ * unless OPTIN / OPTOUT and CLIENT CACHING say otherwise.
+ * */
+void tracking_remember_keys(struct client_t*, const struct resp_arg_t*,
+        const int32_t*, int32_t);
+
+/**
+ * A key was modified: invalidate it for the clients that read it, and
+ * queue it for the broadcast prefixes it matches. `modifier` (NULL if no
+ * client did it) is skipped by NOLOOP clients.
+ * */
+void tracking_invalidate_key(struct client_t*, const char*, size_t);
+
+/** FLUSHALL: every tracking client drops its whole cache */
+void tracking_invalidate_all();
+
+/**
+ * Send the keys queued for each broadcast prefix to its clients, one
+ * message per client and prefix. Run before sleeping.
+ * */
+void tracking_broadcast_invalidations();
+
+/**
+ * Evict keys from the tracking table while it holds more than
+ * tracking-table-max-keys, invalidating them for the clients that read
+ * them, at most TRACKING_EVICT_MAX_KEYS per call.
+ * */
+void tracking_limit_used_slots();
+
+/** Keys in the tracking table */
+uint64_t tracking_get_total_keys();
+
+/** Broadcast prefixes with at least one client */
+uint64_t tracking_get_total_prefixes();
+
+#endif // !TRACKING_H
@@ -0,0 +1,110 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "util.h"
+
+
+/**
+ * Match one pattern token (not '*') against `c`. Store the token length in
+ * `adv` and return 1 on a match.
+ * */
+static int32_t match_token(const char* p, size_t plen, char c, size_t* adv) {
+    if (p[0] == '?') {
+        *adv = 1;
+        return 1;
+    }
+
+    if (p[0] == '\\' && plen > 1) {
+        *adv = 2;
+        return p[1] == c;
+    }
+
+    if (p[0] != '[') {
+        *adv = 1;
+        return p[0] == c;
+    }
+
+    /** Character class, an unterminated one ends with the pattern */
+    size_t i = 1;
+    int32_t negate = 0;
+    int32_t match = 0;
+    if (i < plen && p[i] == '^') {
+        negate = 1;
+        i++;
+    }
+    while (i < plen && p[i] != ']') {
+        if (p[i] == '\\' && i + 1 < plen) {
+            i++;
+            match |= p[i] == c;
+            i++;
+        } else if (i + 2 < plen && p[i + 1] == '-' && p[i + 2] != ']') {
+            unsigned char lo = p[i], hi = p[i + 2];
+            if (lo > hi) {
+                unsigned char t = lo;
+                lo = hi;
+                hi = t;
+            }
+            match |= (unsigned char) c >= lo && (unsigned char) c <= hi;
+            i += 3;
+        } else {
+            match |= p[i] == c;
+            i++;
+        }
+    }
+    *adv = i < plen ? i + 1 : i;
+
+    return negate ? !match : match;
+}
+
+int32_t string_match_len(const char* p, size_t plen, const char* s,
+        size_t slen) {
+    size_t pi = 0, si = 0;
+    size_t star_p = SIZE_MAX, star_s = 0;
+
+    while (si < slen) {
+        if (pi < plen) {
+            if (p[pi] == '*') {
+                while (pi < plen && p[pi] == '*') pi++;
+                if (pi == plen) return 1;
+                star_p = pi;
+                star_s = si;
+                continue;
+            }
+
+            size_t adv;
+            if (match_token(p + pi, plen - pi, s[si], &adv)) {
+                pi += adv;
+                si++;
+                continue;
+            }
+        }
+
+        /** Let the last '*' absorb one more byte and retry */
+        if (star_p == SIZE_MAX) return 0;
+        pi = star_p;
+        si = ++star_s;
+    }
+
+    while (pi < plen && p[pi] == '*') pi++;
+    return pi == plen;
+}
+
+size_t get_allocated_memory() {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+size_t get_rss_memory() {
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f == NULL) return 0;
+
+    int32_t n = fscanf(f, "%lu %lu", &size, &resident);
+    fclose(f);
+    if (n != 2) return 0;
+    return resident * (size_t) sysconf(_SC_PAGESIZE);
+}
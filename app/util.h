@@ -0,0 +1,26 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/** Return 1 if the byte can start a glob construct ('*', '?', '[', '\\') */
+static inline int32_t is_glob_special(char c) {
+    return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+/**
+ * Glob-style match of the whole string: '*', '?', '[a-z]', '[^abc]' and
+ * '\\' escapes. Backtracks to the last '*' only, so the cost stays
+ * O(pattern * string) whatever the pattern looks like.
+ * */
+int32_t string_match_len(const char*, size_t, const char*, size_t);
+
+/** Bytes handed out by malloc, mmapped chunks included */
+size_t get_allocated_memory();
+
+/** Resident set size of the process in bytes, 0 if unknown */
+size_t get_rss_memory();
+
+#endif // !UTIL_H